@@ -0,0 +1,188 @@
+/**
+ * File: allocstats.c
+ *
+ * Description:
+ *  This file contains the allocation accounting used by malloc_with_check when the assembler is built with
+ *  -DASM_ALLOC_STATS. Call sites are kept in a small open addressing table keyed by file and line; the figures are
+ *  protected by a mutex, as accounting builds are for measuring memory rather than speed.
+ *
+ * Functions:
+ *  alloc_stats_record_alloc() / alloc_stats_record_free(): Account for one allocation or release.
+ *  alloc_stats_print() / alloc_stats_print_json(): Add the allocation figures to the --stats reports.
+ *  alloc_stats_report_leaks(): Lists the allocations that are still live, per call site.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "allocstats.h"
+
+#ifdef ASM_ALLOC_STATS
+#include <pthread.h>
+
+#define SITE_TABLE_SIZE 512
+
+/* Totals for one call site of malloc_with_check */
+typedef struct alloc_site {
+	char *file;
+	int line;
+	long count;
+	long bytes;
+	long live_count;
+	long live_bytes;
+} alloc_site;
+
+static alloc_site sites[SITE_TABLE_SIZE];
+static long total_count = 0, live_bytes = 0, peak_bytes = 0;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Accounts for a new allocation.
+ *
+ * @param size The number of bytes allocated.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
+ *
+ * @return The index of the call site, to be passed to alloc_stats_record_free when the block is released.
+ */
+
+int alloc_stats_record_alloc(long size, char *file, int line) {
+	unsigned int index = line;
+	char *c;
+
+	for (c = file; *c; c++) index = index * 31 + *c;
+	index %= SITE_TABLE_SIZE;
+
+	pthread_mutex_lock(&stats_lock);
+	/* Call sites are a few dozen at most, so the table never fills up */
+	while (sites[index].file != NULL && (sites[index].line != line || strcmp(sites[index].file, file) != 0)) {
+		index = (index + 1) % SITE_TABLE_SIZE;
+	}
+	sites[index].file = file;
+	sites[index].line = line;
+	sites[index].count++;
+	sites[index].bytes += size;
+	sites[index].live_count++;
+	sites[index].live_bytes += size;
+
+	total_count++;
+	live_bytes += size;
+	if (live_bytes > peak_bytes) peak_bytes = live_bytes;
+	pthread_mutex_unlock(&stats_lock);
+	return index;
+}
+
+
+/**
+ * Accounts for the release of an allocation.
+ *
+ * @param size The number of bytes released.
+ * @param site The call site index returned by alloc_stats_record_alloc.
+ */
+
+void alloc_stats_record_free(long size, int site) {
+	pthread_mutex_lock(&stats_lock);
+	sites[site].live_count--;
+	sites[site].live_bytes -= size;
+	live_bytes -= size;
+	pthread_mutex_unlock(&stats_lock);
+}
+
+
+/**
+ * Prints the allocation figures as part of the human-readable --stats table.
+ *
+ * @param out The stream to print to.
+ */
+
+void alloc_stats_print(FILE *out) {
+	int i;
+	char site_name[64];
+
+	fprintf(out, "\n%-20s %12ld\n%-20s %12ld\n%-20s %12ld\n\n", "allocations", total_count,
+	        "live bytes", live_bytes, "peak bytes", peak_bytes);
+	fprintf(out, "%-32s %10s %12s\n", "allocation site", "count", "bytes");
+	for (i = 0; i < SITE_TABLE_SIZE; i++) {
+		if (sites[i].file != NULL) {
+			snprintf(site_name, sizeof(site_name), "%s:%d", sites[i].file, sites[i].line);
+			fprintf(out, "%-32s %10ld %12ld\n", site_name, sites[i].count, sites[i].bytes);
+		}
+	}
+}
+
+
+/**
+ * Prints the allocation figures as a JSON value (an object, or null when accounting is not compiled in).
+ *
+ * @param out The stream to print to.
+ */
+
+void alloc_stats_print_json(FILE *out) {
+	int i;
+	bool first = TRUE;
+
+	fprintf(out, "{\"allocations\": %ld, \"live_bytes\": %ld, \"peak_bytes\": %ld, \"sites\": {",
+	        total_count, live_bytes, peak_bytes);
+	for (i = 0; i < SITE_TABLE_SIZE; i++) {
+		if (sites[i].file != NULL) {
+			fprintf(out, "%s\"%s:%d\": {\"count\": %ld, \"bytes\": %ld}", first ? "" : ", ", sites[i].file,
+			        sites[i].line, sites[i].count, sites[i].bytes);
+			first = FALSE;
+		}
+	}
+	fprintf(out, "}}");
+}
+
+
+/**
+ * Lists the allocations that are still live, per call site.
+ *
+ * @param out The stream to print to.
+ *
+ * @return The number of live allocations.
+ */
+
+long alloc_stats_report_leaks(FILE *out) {
+	int i;
+	long leaked = 0;
+
+	for (i = 0; i < SITE_TABLE_SIZE; i++) {
+		if (sites[i].file != NULL && sites[i].live_count > 0) {
+			fprintf(out, "Leak: %ld allocation(s), %ld bytes from %s:%d\n", sites[i].live_count,
+			        sites[i].live_bytes, sites[i].file, sites[i].line);
+			leaked += sites[i].live_count;
+		}
+	}
+	return leaked;
+}
+
+#else
+
+int alloc_stats_record_alloc(long size, char *file, int line) {
+	(void) size;
+	(void) file;
+	(void) line;
+	return 0;
+}
+
+void alloc_stats_record_free(long size, int site) {
+	(void) size;
+	(void) site;
+}
+
+void alloc_stats_print(FILE *out) {
+	(void) out;
+}
+
+void alloc_stats_print_json(FILE *out) {
+	fprintf(out, "null");
+}
+
+long alloc_stats_report_leaks(FILE *out) {
+	(void) out;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,73 @@
+/**
+ * File: allocstats.h
+ *
+ * Description:
+ *  This header file declares the optional allocation accounting behind malloc_with_check. When the assembler is
+ *  built with -DASM_ALLOC_STATS, every allocation is tagged with the file and line that made it, and the number of
+ *  allocations, live and peak bytes, and per-call-site totals are kept. Without the flag none of this is compiled
+ *  and the functions below report nothing.
+ *
+ * Functions:
+ *  alloc_stats_record_alloc() / alloc_stats_record_free(): Account for one allocation or release.
+ *  alloc_stats_print() / alloc_stats_print_json(): Add the allocation figures to the --stats reports.
+ *  alloc_stats_report_leaks(): Lists the allocations that are still live, per call site.
+ */
+
+#ifndef _ALLOCSTATS_H
+#define _ALLOCSTATS_H
+#include <stdio.h>
+#include "globals.h"
+
+
+/**
+ * Accounts for a new allocation.
+ *
+ * @param size The number of bytes allocated.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
+ *
+ * @return The index of the call site, to be passed to alloc_stats_record_free when the block is released.
+ */
+
+int alloc_stats_record_alloc(long size, char *file, int line);
+
+
+/**
+ * Accounts for the release of an allocation.
+ *
+ * @param size The number of bytes released.
+ * @param site The call site index returned by alloc_stats_record_alloc.
+ */
+
+void alloc_stats_record_free(long size, int site);
+
+
+/**
+ * Prints the allocation figures as part of the human-readable --stats table.
+ *
+ * @param out The stream to print to.
+ */
+
+void alloc_stats_print(FILE *out);
+
+
+/**
+ * Prints the allocation figures as a JSON value (an object, or null when accounting is not compiled in).
+ *
+ * @param out The stream to print to.
+ */
+
+void alloc_stats_print_json(FILE *out);
+
+
+/**
+ * Lists the allocations that are still live, per call site.
+ *
+ * @param out The stream to print to.
+ *
+ * @return The number of live allocations.
+ */
+
+long alloc_stats_report_leaks(FILE *out);
+
+#endif
@@ -0,0 +1,237 @@
+/**
+ * File: arena.c
+ *
+ * Description:
+ *  This file contains the arena allocator declared in arena.h. Blocks come from malloc_with_check and are chained
+ *  newest first; an allocation takes the next aligned bytes of the newest block, and a request that does not fit
+ *  starts a new block. Releasing walks the chain once. Released regular blocks go to a small pool shared by all
+ *  threads, which new blocks are taken from first; the pool is only touched once per block, so one mutex suffices.
+ *
+ * Functions:
+ *  arena_init(): Prepares an empty arena.
+ *  arena_alloc(): Allocates memory from an arena.
+ *  arena_release(): Releases all memory of an arena at once.
+ *  arena_trim(): Frees the blocks kept for reuse by later arenas.
+ *  arena_select(): Makes an arena the calling thread's current arena.
+ *  assembly_alloc(): Allocates memory from the current arena.
+ *  assembly_strdup(): Copies a string into the current arena.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "utils.h"
+#include "arena.h"
+#include "stats.h"
+
+/* Every allocation is rounded up to this, which suits any object type */
+#define ARENA_ALIGNMENT 16
+#define ALIGN_UP(size) (((size) + ARENA_ALIGNMENT - 1) & ~(long) (ARENA_ALIGNMENT - 1))
+
+struct arena_block {
+	struct arena_block *next;
+	long size;
+	long used;
+	/* Keeps data aligned whatever the size of the fields above */
+	union {
+		long double align;
+		char data[1];
+	} payload;
+};
+
+static __thread arena *current_arena = NULL;
+
+/* Released regular blocks, chained through next */
+static arena_block *cached_blocks = NULL;
+static int cached_block_count = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Takes a regular block from the pool of released blocks, or allocates a new one.
+ *
+ * @return The block; its size is ARENA_BLOCK_SIZE.
+ */
+
+static arena_block *get_regular_block(void) {
+	arena_block *block;
+
+	pthread_mutex_lock(&cache_lock);
+	block = cached_blocks;
+	if (block != NULL) {
+		cached_blocks = block->next;
+		cached_block_count--;
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	if (block == NULL) {
+		block = malloc_with_check(offsetof(arena_block, payload) + ARENA_BLOCK_SIZE);
+		block->size = ARENA_BLOCK_SIZE;
+	}
+	return block;
+}
+
+
+/**
+ * Returns a released block to the pool, or frees it if it is oversized or the pool is full.
+ *
+ * @param block The block to release.
+ */
+
+static void put_block(arena_block *block) {
+	if (block->size == ARENA_BLOCK_SIZE) {
+		pthread_mutex_lock(&cache_lock);
+		if (cached_block_count < ARENA_CACHED_BLOCKS) {
+			block->next = cached_blocks;
+			cached_blocks = block;
+			cached_block_count++;
+			block = NULL;
+		}
+		pthread_mutex_unlock(&cache_lock);
+	}
+	if (block != NULL) free_with_check(block);
+}
+
+
+/**
+ * Prepares an empty arena. No memory is taken until the first allocation.
+ *
+ * @param a The arena to initialize.
+ */
+
+void arena_init(arena *a) {
+	a->current = NULL;
+	a->used_bytes = 0;
+}
+
+
+/**
+ * Allocates memory from an arena. The memory is suitably aligned for any object and stays valid until the arena is
+ * released. Exits the program if memory cannot be obtained.
+ *
+ * @param a The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ *
+ * @return Pointer to the allocated memory.
+ */
+
+void *arena_alloc(arena *a, long size) {
+	arena_block *block = a->current;
+	void *ptr;
+
+	size = ALIGN_UP(size > 0 ? size : 1);
+	if (block == NULL || block->size - block->used < size) {
+		if (size > ARENA_BLOCK_SIZE) {
+			block = malloc_with_check(offsetof(arena_block, payload) + size);
+			block->size = size;
+		} else {
+			block = get_regular_block();
+		}
+		block->used = 0;
+		if (a->current != NULL && size > ARENA_BLOCK_SIZE) {
+			/* An oversized block is full at once; keep allocating from the current one */
+			block->next = a->current->next;
+			a->current->next = block;
+		} else {
+			block->next = a->current;
+			a->current = block;
+		}
+	}
+
+	ptr = block->payload.data + block->used;
+	block->used += size;
+	a->used_bytes += size;
+	return ptr;
+}
+
+
+/**
+ * Releases all memory of an arena at once. The arena is empty afterwards and can be reused.
+ * Regular blocks are kept (up to ARENA_CACHED_BLOCKS) for the next arenas rather than freed.
+ *
+ * @param a The arena to release.
+ */
+
+void arena_release(arena *a) {
+	arena_block *block = a->current, *next;
+
+	STATS_ADD(COUNTER_ARENA_BYTES, a->used_bytes);
+	while (block != NULL) {
+		next = block->next;
+		put_block(block);
+		block = next;
+	}
+	arena_init(a);
+}
+
+
+/**
+ * Frees the blocks kept for reuse by arena_release.
+ */
+
+void arena_trim(void) {
+	arena_block *block, *next;
+
+	pthread_mutex_lock(&cache_lock);
+	block = cached_blocks;
+	cached_blocks = NULL;
+	cached_block_count = 0;
+	pthread_mutex_unlock(&cache_lock);
+
+	for (; block != NULL; block = next) {
+		next = block->next;
+		free_with_check(block);
+	}
+}
+
+
+/**
+ * Makes an arena the current arena of the calling thread.
+ *
+ * @param a The arena to select, or NULL to select none.
+ *
+ * @return The previously selected arena, so that it can be restored.
+ */
+
+arena *arena_select(arena *a) {
+	arena *previous = current_arena;
+	current_arena = a;
+	return previous;
+}
+
+
+/**
+ * Allocates memory that lives as long as the assembly of the current file, from the calling thread's current arena.
+ *
+ * @param size The number of bytes to allocate.
+ *
+ * @return Pointer to the allocated memory.
+ */
+
+void *assembly_alloc(long size) {
+	if (current_arena == NULL) {
+		fprintf(stderr, "Error: Fatal: No arena selected for allocation.\n");
+		exit(1);
+	}
+	return arena_alloc(current_arena, size);
+}
+
+
+/**
+ * Copies a string into the calling thread's current arena.
+ *
+ * @param string The string to copy.
+ *
+ * @return The copy.
+ */
+
+char *assembly_strdup(char *string) {
+	long length = strlen(string);
+	char *copy = assembly_alloc(length + 1);
+	memcpy(copy, string, length + 1);
+	return copy;
+}
@@ -0,0 +1,115 @@
+/**
+ * File: arena.h
+ *
+ * Description:
+ *  This header file declares the arena allocator that holds everything living as long as the assembly of one file:
+ *  symbols and their keys, code and data words, operand strings, macro nodes and file names. Allocation bumps a
+ *  pointer through large blocks, and the whole arena is released in one step when the file is done, so none of
+ *  these objects is ever freed on its own.
+ *
+ *  process_file owns an arena and selects it as the calling thread's current arena; assembly_alloc allocates from
+ *  the current arena, which spares every function between them an extra parameter.
+ *
+ * Functions:
+ *  arena_init(): Prepares an empty arena.
+ *  arena_alloc(): Allocates memory from an arena.
+ *  arena_release(): Releases all memory of an arena at once.
+ *  arena_trim(): Frees the blocks kept for reuse by later arenas.
+ *  arena_select(): Makes an arena the calling thread's current arena.
+ *  assembly_alloc(): Allocates memory from the current arena.
+ *  assembly_strdup(): Copies a string into the current arena.
+ */
+
+#ifndef _ARENA_H
+#define _ARENA_H
+#include "globals.h"
+
+/** Size of a regular arena block; larger requests get a block of their own */
+#define ARENA_BLOCK_SIZE 65536
+
+/** How many released regular blocks are kept for reuse, so that a long-running process stays warm */
+#define ARENA_CACHED_BLOCKS 64
+
+typedef struct arena_block arena_block;
+
+/** A bump-pointer arena */
+typedef struct arena {
+	/** The block being allocated from, chained to the older ones */
+	arena_block *current;
+	/** Bytes handed out since the arena was initialized */
+	long used_bytes;
+} arena;
+
+
+/**
+ * Prepares an empty arena. No memory is taken until the first allocation.
+ *
+ * @param a The arena to initialize.
+ */
+
+void arena_init(arena *a);
+
+
+/**
+ * Allocates memory from an arena. The memory is suitably aligned for any object and stays valid until the arena is
+ * released. Exits the program if memory cannot be obtained.
+ *
+ * @param a The arena to allocate from.
+ * @param size The number of bytes to allocate.
+ *
+ * @return Pointer to the allocated memory.
+ */
+
+void *arena_alloc(arena *a, long size);
+
+
+/**
+ * Releases all memory of an arena at once. The arena is empty afterwards and can be reused.
+ * Regular blocks are kept (up to ARENA_CACHED_BLOCKS) for the next arenas rather than freed.
+ *
+ * @param a The arena to release.
+ */
+
+void arena_release(arena *a);
+
+
+/**
+ * Frees the blocks kept for reuse by arena_release.
+ */
+
+void arena_trim(void);
+
+
+/**
+ * Makes an arena the current arena of the calling thread.
+ *
+ * @param a The arena to select, or NULL to select none.
+ *
+ * @return The previously selected arena, so that it can be restored.
+ */
+
+arena *arena_select(arena *a);
+
+
+/**
+ * Allocates memory that lives as long as the assembly of the current file, from the calling thread's current arena.
+ *
+ * @param size The number of bytes to allocate.
+ *
+ * @return Pointer to the allocated memory.
+ */
+
+void *assembly_alloc(long size);
+
+
+/**
+ * Copies a string into the calling thread's current arena.
+ *
+ * @param string The string to copy.
+ *
+ * @return The copy.
+ */
+
+char *assembly_strdup(char *string);
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * File: asmar.c
+ *
+ * Description:
+ *  This file contains the archiver's command line. It packs assembled modules into one static library (.lib, see
+ *  libfile.h) with a hashed directory from every entry to the module defining it, for asmlink to pull members
+ *  from.
+ *
+ *  Usage: asmar <archive>.lib module...
+ *  A module is named as it was given to the assembler, without extension, and read as asmlink reads it.
+ *
+ * Functions:
+ *  main(): Entry point of the archiver.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "utils.h"
+#include "linker.h"
+#include "arena.h"
+
+
+/**
+ * Main function of the archiver.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The archive's file name, then the modules.
+ *
+ * @return int - 0 if the archive was written, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	link_module *modules;
+	arena archive_arena;
+	bool succeeded = TRUE;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <archive>.lib module...\n", argv[0]);
+		return 1;
+	}
+
+	modules = malloc_with_check(argc * sizeof(link_module));
+	arena_init(&archive_arena);
+	arena_select(&archive_arena);
+	for (i = 2; i < argc; i++) succeeded &= link_load_module(argv[i], &modules[i - 2]);
+	succeeded = succeeded && link_write_archive(argv[1], modules, argc - 2);
+
+	arena_select(NULL);
+	arena_release(&archive_arena);
+	free_with_check(modules);
+	return succeeded ? 0 : 1;
+}
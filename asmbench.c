@@ -0,0 +1,333 @@
+/**
+ * File: asmbench.c
+ *
+ * Description:
+ *  This file contains the end-to-end benchmark driver. For every configured size it generates a program of that
+ *  many lines with srcgen (as many modules as the image limit requires), assembles every module with process_file
+ *  as the assembler would, and reports lines per second, words per second and the peak resident memory. The time
+ *  per line across sizes is the scaling curve: it stays flat while the assembler is linear, and grows with the
+ *  size when something is not (e.g. the symbol table with --externs, or the macro table with --macros).
+ *
+ *  Usage: asmbench [options]
+ *   --sizes=<n>,<n>,...        Lines of each configuration (default: 1000,10000,100000,1000000,10000000).
+ *   --dir=<dir>                Where the sources are generated (default: asmbench.tmp).
+ *   --keep                     Keep the sources and outputs instead of removing them.
+ *   --emit                     Only generate the sources.
+ *   --seed=<n>                 Seed of the generator.
+ *   --module-lines=<n>         Lines of a module at most.
+ *   --labels=<share>           Share of statements with a label.
+ *   --externs=<n>, --entries=<n>, --macros=<n>
+ *                              Declarations and macro definitions per module.
+ *   --macro-rate=<share>       Share of statements invoking a macro.
+ *   --data=<share>, --strings=<share>, --comments=<share>
+ *                              Share of .data/.string statements, of strings among them, and of comment lines.
+ *   --modes=<i>,<d>,<x>,<r>    Weights of immediate, direct, register indirect and register operands.
+ *   --grow=externs|macros      Generate each configuration as a single module in which half of the lines are
+ *                              .extern declarations or macro definitions, so that costs growing faster than the
+ *                              symbol table or the macro table show in the scaling column.
+ *   --json=<file>              Also write the results as JSON.
+ *
+ * Functions:
+ *  parse_option(): Applies a single command line option.
+ *  generate(): Generates the modules of one configuration.
+ *  remove_outputs(): Removes the sources and outputs of one configuration.
+ *  main(): Entry point of the benchmark driver.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "globals.h"
+#include "utils.h"
+#include "process_file.h"
+#include "srcgen.h"
+#include "stats.h"
+#include "cache.h"
+#include "arena.h"
+
+#define MAX_SIZES 32
+#define DEFAULT_SIZES "1000,10000,100000,1000000,10000000"
+
+/* What --grow makes grow with the size of a configuration */
+#define GROW_NONE 0
+#define GROW_EXTERNS 1
+#define GROW_MACROS 2
+
+/** The command line of the driver */
+typedef struct bench_options {
+	long sizes[MAX_SIZES];
+	int size_count;
+	char *directory;
+	bool keep;
+	bool emit_only;
+	char *json_filename;
+	int grow;
+	srcgen_config shape;
+} bench_options;
+
+/** The result of one configuration */
+typedef struct bench_result {
+	long lines;
+	long modules;
+	long words;
+	double seconds;
+	long peak_kb;
+	bool succeeded;
+} bench_result;
+
+
+/**
+ * Reads a comma separated list of numbers.
+ *
+ * @param text The list.
+ * @param values Receives the numbers.
+ * @param max_count The most numbers to read.
+ *
+ * @return The number of numbers read, or -1 if the list is malformed.
+ */
+
+static int parse_list(char *text, double *values, int max_count) {
+	char *end;
+	int count = 0;
+
+	while (*text != '\0' && count < max_count) {
+		values[count++] = strtod(text, &end);
+		if (end == text || (*end != ',' && *end != '\0')) return -1;
+		text = *end == ',' ? end + 1 : end;
+	}
+	return *text == '\0' ? count : -1;
+}
+
+
+/**
+ * Applies a single command line option.
+ *
+ * @param arg The option.
+ * @param options The options to update.
+ *
+ * @return TRUE if the option is known and well-formed, FALSE otherwise.
+ */
+
+static bool parse_option(char *arg, bench_options *options) {
+	double values[MAX_SIZES];
+	int i, count;
+
+	if (strncmp(arg, "--sizes=", 8) == 0) {
+		if ((count = parse_list(arg + 8, values, MAX_SIZES)) <= 0) return FALSE;
+		for (i = 0; i < count; i++) {
+			if (values[i] < 1) return FALSE;
+			options->sizes[i] = (long) values[i];
+		}
+		options->size_count = count;
+	} else if (strncmp(arg, "--dir=", 6) == 0) {
+		options->directory = arg + 6;
+	} else if (strcmp(arg, "--keep") == 0) {
+		options->keep = TRUE;
+	} else if (strcmp(arg, "--emit") == 0) {
+		options->emit_only = options->keep = TRUE;
+	} else if (strncmp(arg, "--seed=", 7) == 0) {
+		options->shape.seed = strtoull(arg + 7, NULL, 10);
+	} else if (strncmp(arg, "--module-lines=", 15) == 0) {
+		options->shape.module_lines = atol(arg + 15);
+		return options->shape.module_lines > 0;
+	} else if (strncmp(arg, "--labels=", 9) == 0) {
+		options->shape.label_density = atof(arg + 9);
+	} else if (strncmp(arg, "--externs=", 10) == 0) {
+		options->shape.extern_count = atol(arg + 10);
+	} else if (strncmp(arg, "--entries=", 10) == 0) {
+		options->shape.entry_count = atol(arg + 10);
+	} else if (strncmp(arg, "--macros=", 9) == 0) {
+		options->shape.macro_count = atol(arg + 9);
+	} else if (strncmp(arg, "--macro-rate=", 13) == 0) {
+		options->shape.macro_rate = atof(arg + 13);
+	} else if (strncmp(arg, "--data=", 7) == 0) {
+		options->shape.data_ratio = atof(arg + 7);
+	} else if (strncmp(arg, "--strings=", 10) == 0) {
+		options->shape.string_ratio = atof(arg + 10);
+	} else if (strncmp(arg, "--comments=", 11) == 0) {
+		options->shape.comment_ratio = atof(arg + 11);
+	} else if (strncmp(arg, "--modes=", 8) == 0) {
+		if (parse_list(arg + 8, options->shape.addressing_weights, 4) != 4) return FALSE;
+	} else if (strcmp(arg, "--grow=externs") == 0) {
+		options->grow = GROW_EXTERNS;
+	} else if (strcmp(arg, "--grow=macros") == 0) {
+		options->grow = GROW_MACROS;
+	} else if (strncmp(arg, "--json=", 7) == 0) {
+		options->json_filename = arg + 7;
+	} else {
+		return FALSE;
+	}
+	return options->shape.extern_count >= 0 && options->shape.entry_count >= 0 && options->shape.macro_count >= 0;
+}
+
+
+/**
+ * Generates the modules of one configuration: <directory>/s<lines>_m<n>.as, until the lines are reached. With
+ * --grow, a single module is generated, half of whose lines are the declarations or definitions that grow.
+ *
+ * @param options The options.
+ * @param lines The lines of the configuration.
+ * @param modules Receives the number of modules.
+ * @param words Receives the number of words the modules assemble to.
+ *
+ * @return The lines written, or -1 if a module could not be written.
+ */
+
+static long generate(bench_options *options, long lines, long *modules, long *words) {
+	char name[FILENAME_MAX];
+	long written = 0, module_words;
+	srcgen_config shape = options->shape;
+	FILE *out;
+
+	*modules = *words = 0;
+	if (options->grow != GROW_NONE) {
+		shape.module_lines = lines;
+		if (options->grow == GROW_EXTERNS) shape.extern_count = lines / 2;
+		/* A macro definition takes about four lines */
+		else shape.macro_count = lines / 8;
+	}
+	while (written < lines && (options->grow == GROW_NONE || *modules == 0)) {
+		snprintf(name, sizeof(name), "%s/s%ld_m%ld.as", options->directory, lines, *modules);
+		if ((out = fopen(name, "w")) == NULL) {
+			fprintf(stderr, "Error: can't create %s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		written += srcgen_write_module(out, &shape, lines - written, &module_words);
+		*words += module_words;
+		(*modules)++;
+		if (fclose(out) != 0) return -1;
+	}
+	options->shape.seed = shape.seed;
+	return written;
+}
+
+
+/**
+ * Removes the sources and outputs of one configuration.
+ *
+ * @param options The options.
+ * @param lines The lines of the configuration.
+ * @param modules The number of modules.
+ */
+
+static void remove_outputs(bench_options *options, long lines, long modules) {
+	static char *extensions[] = {"as", "am", "ob", "ent", "ext", "rel"};
+	char name[FILENAME_MAX];
+	long i;
+	int j;
+
+	for (i = 0; i < modules; i++) {
+		for (j = 0; j < (int) (sizeof(extensions) / sizeof(extensions[0])); j++) {
+			snprintf(name, sizeof(name), "%s/s%ld_m%ld.%s", options->directory, lines, i, extensions[j]);
+			unlink(name);
+		}
+	}
+}
+
+
+/**
+ * Main function of the benchmark driver.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file.
+ *
+ * @return int - 0 if every configuration was generated and assembled without errors, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	bench_options options;
+	bench_result results[MAX_SIZES], *result;
+	assembler_options assembler;
+	struct timespec start, end;
+	struct rusage usage;
+	char base_name[FILENAME_MAX];
+	long words_before, i;
+	int n;
+	double nanoseconds_per_line, first_nanoseconds_per_line = 0;
+	bool succeeded = TRUE;
+	FILE *json;
+
+	memset(&options, 0, sizeof(options));
+	srcgen_defaults(&options.shape);
+	options.directory = "asmbench.tmp";
+	parse_option("--sizes=" DEFAULT_SIZES, &options);
+	for (n = 1; n < argc; n++) {
+		if (!parse_option(argv[n], &options)) {
+			fprintf(stderr, "Error: unknown or malformed option %s\n", argv[n]);
+			return 1;
+		}
+	}
+	if (mkdir(options.directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: can't create %s: %s\n", options.directory, strerror(errno));
+		return 1;
+	}
+
+	init_assembler_options(&assembler);
+
+	if (!options.emit_only) {
+		printf("%10s %8s %10s %10s %12s %12s %9s %8s %10s\n", "lines", "modules", "words", "seconds", "lines/s",
+		       "words/s", "ns/line", "scaling", "peak KB");
+	}
+	for (n = 0; n < options.size_count; n++) {
+		result = &results[n];
+		result->lines = generate(&options, options.sizes[n], &result->modules, &result->words);
+		if (result->lines < 0) return 1;
+		if (options.emit_only) {
+			printf("%s: %ld lines in %ld module(s), %ld words\n", options.directory, result->lines,
+			       result->modules, result->words);
+			continue;
+		}
+
+		words_before = stats_counters[COUNTER_WORDS];
+		result->succeeded = TRUE;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (i = 0; i < result->modules; i++) {
+			snprintf(base_name, sizeof(base_name), "%s/s%ld_m%ld", options.directory, options.sizes[n], i);
+			result->succeeded &= process_file(base_name, &assembler);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		arena_trim();
+
+		result->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+		result->words = stats_counters[COUNTER_WORDS] - words_before;
+		getrusage(RUSAGE_SELF, &usage);
+		result->peak_kb = usage.ru_maxrss;
+		succeeded &= result->succeeded;
+
+		nanoseconds_per_line = result->seconds * 1e9 / result->lines;
+		if (n == 0) first_nanoseconds_per_line = nanoseconds_per_line;
+		printf("%10ld %8ld %10ld %10.3f %12.0f %12.0f %9.1f %7.2fx %10ld%s\n", result->lines, result->modules,
+		       result->words, result->seconds, result->lines / result->seconds, result->words / result->seconds,
+		       nanoseconds_per_line, nanoseconds_per_line / first_nanoseconds_per_line, result->peak_kb,
+		       result->succeeded ? "" : "  (errors)");
+		fflush(stdout);
+		if (!options.keep) remove_outputs(&options, options.sizes[n], result->modules);
+	}
+	if (!options.keep) rmdir(options.directory);
+
+	if (options.json_filename != NULL && !options.emit_only) {
+		if ((json = fopen(options.json_filename, "w")) == NULL) {
+			fprintf(stderr, "Error: can't create %s\n", options.json_filename);
+			return 1;
+		}
+		fprintf(json, "{\n  \"assembler_version\": \"%s\",\n  \"results\": [", ASSEMBLER_VERSION);
+		for (n = 0; n < options.size_count; n++) {
+			result = &results[n];
+			fprintf(json, "%s\n    {\"lines\": %ld, \"modules\": %ld, \"words\": %ld, \"seconds\": %.6f, "
+			              "\"lines_per_second\": %.0f, \"words_per_second\": %.0f, \"peak_kb\": %ld, "
+			              "\"succeeded\": %s}", n == 0 ? "" : ",", result->lines, result->modules, result->words,
+			        result->seconds, result->lines / result->seconds, result->words / result->seconds,
+			        result->peak_kb, result->succeeded ? "true" : "false");
+		}
+		fprintf(json, "\n  ]\n}\n");
+		fclose(json);
+	}
+	return succeeded ? 0 : 1;
+}
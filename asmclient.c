@@ -0,0 +1,272 @@
+/**
+ * File: asmclient.c
+ *
+ * Description:
+ *  This file contains a small client of the assembler daemon (assembler --serve=<socket>, see server.h). It sends
+ *  each source named on the command line over one connection and writes the returned outputs next to it, as the
+ *  assembler itself would (no .am file is written). The errors and warnings go to stderr.
+ *
+ *  Usage: asmclient <socket> [--obb] [--line-limit=error|warn|off] file...
+ *  A file named "-" is a source read from stdin whose frame is copied to stdout as it is.
+ *
+ * Functions:
+ *  connect_to_server(): Connects to the daemon's socket.
+ *  send_all(): Writes a whole buffer to the connection.
+ *  send_request(): Sends one source.
+ *  read_source(): Reads a whole input into memory.
+ *  receive_frame(): Reads the frame answering a request and writes its outputs.
+ *  main(): Entry point of the client.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "globals.h"
+
+#define MAX_OPTIONS_LENGTH 256
+#define MAX_FRAME_LINE 64
+
+
+/**
+ * Connects to the daemon's socket.
+ *
+ * @param socket_path The path of the socket.
+ *
+ * @return The connected socket, or -1 on failure.
+ */
+
+static int connect_to_server(char *socket_path) {
+	int fd;
+	struct sockaddr_un address;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) return -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+	if (connect(fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+
+/**
+ * Writes a whole buffer to the connection.
+ *
+ * @param fd The connection.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
+ *
+ * @return TRUE if everything was written, FALSE otherwise.
+ */
+
+static bool send_all(int fd, char *buffer, long length) {
+	long count;
+
+	while (length > 0) {
+		count = write(fd, buffer, length);
+		if (count < 0) return FALSE;
+		buffer += count;
+		length -= count;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Sends one source as a request.
+ *
+ * @param fd The connection.
+ * @param name The name used in diagnostics.
+ * @param options The options of the request, separated by spaces.
+ * @param source The source.
+ * @param length The length of the source.
+ *
+ * @return TRUE if the request was sent, FALSE otherwise.
+ */
+
+static bool send_request(int fd, char *name, char *options, char *source, long length) {
+	char header[MAX_OPTIONS_LENGTH + FILENAME_MAX + 128];
+	int header_length;
+
+	header_length = snprintf(header, sizeof(header), "ASM-REQUEST 1\nname %ld\n%s\noptions %ld\n%s\nsource %ld\n",
+	                         (long) strlen(name), name, (long) strlen(options), options, length);
+	if (header_length >= (int) sizeof(header)) return FALSE;
+	return send_all(fd, header, header_length) && send_all(fd, source, length) && send_all(fd, "\nend\n", 5);
+}
+
+
+/**
+ * Reads a whole input into memory.
+ *
+ * @param file The input.
+ * @param length Receives the number of bytes read.
+ *
+ * @return The contents, from malloc; NULL on a read error.
+ */
+
+static char *read_source(FILE *file, long *length) {
+	long capacity = 65536, count;
+	char *data = malloc(capacity);
+
+	*length = 0;
+	while (data != NULL && (count = fread(data + *length, 1, capacity - *length, file)) > 0) {
+		*length += count;
+		if (*length == capacity) {
+			capacity *= 2;
+			data = realloc(data, capacity);
+		}
+	}
+	if (data != NULL && ferror(file)) {
+		free(data);
+		data = NULL;
+	}
+	return data;
+}
+
+
+/**
+ * Reads the frame answering a request. Without a base name the frame is copied to stdout as it is; otherwise the
+ * diagnostics go to stderr and every output section is written to the base name and the section's extension.
+ *
+ * @param in The connection.
+ * @param base_name The base name of the output files, or NULL.
+ *
+ * @return TRUE if the frame ends with "end ok" and all outputs were written, FALSE otherwise.
+ */
+
+static bool receive_frame(FILE *in, char *base_name) {
+	char line[MAX_FRAME_LINE], section[MAX_FRAME_LINE], *content, *file_name;
+	long length;
+	bool result = TRUE;
+	FILE *out;
+
+	if (fgets(line, sizeof(line), in) == NULL || strcmp(line, "ASM-FRAME 1\n") != 0) return FALSE;
+	if (base_name == NULL) fputs(line, stdout);
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		if (base_name == NULL) fputs(line, stdout);
+		if (strncmp(line, "end ", 4) == 0) return result && strcmp(line, "end ok\n") == 0;
+		if (sscanf(line, "%63s %ld", section, &length) != 2 || length < 0) return FALSE;
+
+		content = malloc(length + 1);
+		if (content == NULL || fread(content, 1, length + 1, in) != (size_t) length + 1) {
+			free(content);
+			return FALSE;
+		}
+
+		if (base_name == NULL) {
+			fwrite(content, 1, length + 1, stdout);
+		} else if (strcmp(section, "diag") == 0) {
+			fwrite(content, 1, length, stderr);
+		} else {
+			file_name = malloc(strlen(base_name) + strlen(section) + 2);
+			if (file_name == NULL) {
+				free(content);
+				return FALSE;
+			}
+			sprintf(file_name, "%s.%s", base_name, section);
+			out = fopen(file_name, "w");
+			if (out == NULL || fwrite(content, 1, length, out) != (size_t) length) {
+				fprintf(stderr, "Can't create or rewrite to file %s.\n", file_name);
+				result = FALSE;
+			}
+			if (out != NULL) fclose(out);
+			free(file_name);
+		}
+		free(content);
+	}
+	return FALSE;
+}
+
+
+/**
+ * Main function of the client.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The socket path, then options and the base names of the sources ("-" for stdin).
+ *
+ * @return int - 0 if every source assembled and its outputs were written, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	int i, fd;
+	char options[MAX_OPTIONS_LENGTH] = "", *source, *name;
+	long length;
+	bool succeeded = TRUE, is_stdin;
+	FILE *in, *file;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <socket> [--obb] [--line-limit=error|warn|off] file...\n", argv[0]);
+		return 1;
+	}
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "--obb") == 0 || strncmp(argv[i], "--line-limit=", 13) == 0) {
+			if (strlen(options) + strlen(argv[i]) + 1 >= sizeof(options)) return 1;
+			if (options[0] != '\0') strcat(options, " ");
+			strcat(options, argv[i] + 2);
+		} else if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	fd = connect_to_server(argv[1]);
+	if (fd < 0) {
+		fprintf(stderr, "Error: can't connect to %s\n", argv[1]);
+		return 1;
+	}
+	in = fdopen(fd, "r");
+
+	for (i = 2; i < argc; i++) {
+		is_stdin = strcmp(argv[i], "-") == 0;
+		if (argv[i][0] == '-' && !is_stdin) continue;
+
+		name = malloc(strlen(argv[i]) + sizeof("<stdin>"));
+		if (is_stdin) {
+			strcpy(name, "<stdin>");
+			file = stdin;
+		} else {
+			sprintf(name, "%s.as", argv[i]);
+			file = fopen(name, "r");
+		}
+		if (file == NULL) {
+			fprintf(stderr, "Error opening file: %s\n", name);
+			free(name);
+			succeeded = FALSE;
+			continue;
+		}
+
+		source = read_source(file, &length);
+		if (file != stdin) fclose(file);
+		if (source == NULL) {
+			fprintf(stderr, "Error reading file: %s\n", name);
+			free(name);
+			succeeded = FALSE;
+			continue;
+		}
+
+		if (!send_request(fd, name, options, source, length)) {
+			fprintf(stderr, "Error: can't send %s to the server.\n", name);
+			free(source);
+			free(name);
+			fclose(in);
+			return 1;
+		}
+		succeeded &= receive_frame(in, is_stdin ? NULL : argv[i]);
+		free(source);
+		free(name);
+	}
+
+	fclose(in);
+	return succeeded ? 0 : 1;
+}
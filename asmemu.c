@@ -0,0 +1,97 @@
+/**
+ * File: asmemu.c
+ *
+ * Description:
+ *  This file contains the emulator's command line (see emulator.h). It loads an assembled, linked image and runs it
+ *  until it executes stop, with red reading the standard input and prn writing the standard output. It runs a basic
+ *  block at a time through the block cache (see blockcache.h).
+ *
+ *  Usage: asmemu [--interpret] [--max-steps=<n>] [--registers] [--stats] image
+ *   --interpret      Run one decoded instruction at a time instead of through the block cache.
+ *   --max-steps=<n>  Stop the run after n instructions (default: no limit).
+ *   --registers      Print the registers, the flag and the address the run ended at, to stderr.
+ *   --stats          Print the number of instructions executed, the run time and the rate, to stderr.
+ *  The image is named as it was given to the assembler or the linker, without extension, and read as asmlink reads
+ *  a module.
+ *
+ * Functions:
+ *  main(): Entry point of the emulator.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "globals.h"
+#include "utils.h"
+#include "emulator.h"
+#include "blockcache.h"
+
+
+/**
+ * Main function of the emulator.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file, then the image.
+ *
+ * @return int - 0 if the image ran until it executed stop, 2 if it reached the step limit, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	char *image_name = NULL, *end;
+	bool interpret = FALSE, print_registers = FALSE, print_stats = FALSE;
+	unsigned long long step_limit = 0;
+	struct timespec start, end_time;
+	machine_status status;
+	machine *vm;
+	double seconds;
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--max-steps=", 12) == 0) {
+			step_limit = strtoull(argv[i] + 12, &end, 10);
+			if (*end != '\0' || step_limit == 0) {
+				fprintf(stderr, "Error: invalid step limit %s\n", argv[i] + 12);
+				return 1;
+			}
+		} else if (strcmp(argv[i], "--interpret") == 0) interpret = TRUE;
+		else if (strcmp(argv[i], "--registers") == 0) print_registers = TRUE;
+		else if (strcmp(argv[i], "--stats") == 0) print_stats = TRUE;
+		else if (argv[i][0] == '-' || image_name != NULL) {
+			fprintf(stderr, "Error: unexpected argument %s\n", argv[i]);
+			return 1;
+		} else image_name = argv[i];
+	}
+	if (image_name == NULL) {
+		fprintf(stderr, "Usage: %s [--interpret] [--max-steps=<n>] [--registers] [--stats] image\n", argv[0]);
+		return 1;
+	}
+
+	vm = malloc_with_check(sizeof(machine));
+	machine_init(vm);
+	if (!machine_load(image_name, vm)) {
+		machine_release(vm);
+		free_with_check(vm);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	status = interpret ? machine_run(vm, step_limit) : machine_run_blocks(vm, step_limit);
+	clock_gettime(CLOCK_MONOTONIC, &end_time);
+	fflush(stdout);
+
+	if (status == MACHINE_STEP_LIMIT) fprintf(stderr, "Error: step limit reached at address %ld\n", vm->pc);
+	if (print_registers) {
+		for (i = 0; i < MACHINE_REGISTER_COUNT; i++) fprintf(stderr, "r%d=%d ", i, vm->registers[i]);
+		fprintf(stderr, "zero=%d pc=%ld\n", vm->zero, vm->pc);
+	}
+	if (print_stats) {
+		seconds = (end_time.tv_sec - start.tv_sec) + (end_time.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "%llu instructions in %.6f s (%.1f MIPS)\n", vm->executed, seconds,
+		        seconds > 0 ? vm->executed / seconds / 1e6 : 0.0);
+	}
+	machine_release(vm);
+	free_with_check(vm);
+	return status == MACHINE_STOPPED ? 0 : status == MACHINE_STEP_LIMIT ? 2 : 1;
+}
@@ -0,0 +1,124 @@
+/**
+ * File: asmlink.c
+ *
+ * Description:
+ *  This file contains the linker's command line (see linker.h). It reads the assembled modules named on the
+ *  command line, links them in the order given and writes the image.
+ *
+ *  Usage: asmlink [-o <name>] [--obb] [--map] module|archive.lib...
+ *   -o <name>   The image's name, without extension (default: a); writes <name>.ob, <name>.ent and <name>.rel.
+ *   --obb       Also write <name>.obb.
+ *   --map       Print where every module went and the address of every global entry.
+ *  A module is named as it was given to the assembler, without extension. An archive (see asmar.c) is named with its
+ *  .lib extension; only the members that define an external no other module defines are linked, after the modules.
+ *
+ * Functions:
+ *  print_map(): Prints the link map.
+ *  main(): Entry point of the linker.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "globals.h"
+#include "utils.h"
+#include "linker.h"
+#include "arena.h"
+#include "libfile.h"
+
+
+static int compare_slots_by_address(const void *a, const void *b) {
+	const link_index_slot *x = *(const link_index_slot **) a, *y = *(const link_index_slot **) b;
+	return (x->address > y->address) - (x->address < y->address);
+}
+
+
+/**
+ * Prints where every module went and the address of every global entry, in address order.
+ *
+ * @param modules The linked modules.
+ * @param count The number of modules.
+ * @param image The image.
+ */
+
+static void print_map(link_module *modules, int count, link_image *image) {
+	link_index_slot **sorted = malloc_with_check((image->globals.count + 1) * sizeof(link_index_slot *));
+	long i, used = 0;
+	int m;
+
+	printf("%-24s %8s %8s %8s %8s\n", "module", "code", "length", "data", "length");
+	for (m = 0; m < count; m++) {
+		printf("%-24s %8ld %8ld %8ld %8ld\n", modules[m].name, modules[m].code_base, modules[m].code_length,
+		       modules[m].data_base, modules[m].data_length);
+	}
+	for (i = 0; i < image->globals.capacity; i++) {
+		if (image->globals.slots[i].name != NULL) sorted[used++] = &image->globals.slots[i];
+	}
+	qsort(sorted, used, sizeof(link_index_slot *), compare_slots_by_address);
+	printf("\n%-24s %8s  %s\n", "entry", "address", "module");
+	for (i = 0; i < used; i++) {
+		printf("%-24s %8ld  %s\n", sorted[i]->name, sorted[i]->address, modules[sorted[i]->module].name);
+	}
+	free_with_check(sorted);
+}
+
+
+/**
+ * Main function of the linker.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file, then the modules.
+ *
+ * @return int - 0 if the image was linked and written, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	char *output_name = "a";
+	bool write_binary = FALSE, print_link_map = FALSE, succeeded = TRUE;
+	link_module *modules;
+	lib_archive *archives;
+	link_image image;
+	arena link_arena;
+	long length;
+	int i, count = 0, archive_count = 0;
+
+	modules = malloc_with_check(argc * sizeof(link_module));
+	archives = malloc_with_check(argc * sizeof(lib_archive));
+	arena_init(&link_arena);
+	arena_select(&link_arena);
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output_name = argv[++i];
+		else if (strcmp(argv[i], "--obb") == 0) write_binary = TRUE;
+		else if (strcmp(argv[i], "--map") == 0) print_link_map = TRUE;
+		else if (argv[i][0] == '-') {
+			fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+			return 1;
+		} else if ((length = strlen(argv[i])) > 4 && strcmp(argv[i] + length - 4, ".lib") == 0) {
+			if (lib_map(argv[i], &archives[archive_count])) archive_count++;
+			else {
+				fprintf(stderr, "Error: %s is not a valid archive\n", argv[i]);
+				succeeded = FALSE;
+			}
+		} else {
+			succeeded &= link_load_module(argv[i], &modules[count++]);
+		}
+	}
+	if (count == 0) {
+		fprintf(stderr, "Usage: %s [-o <name>] [--obb] [--map] module|archive.lib...\n", argv[0]);
+		return 1;
+	}
+
+	succeeded = succeeded && link_pull_members(archives, archive_count, &modules, &count) &&
+	            link_modules(modules, count, &image) &&
+	            link_write_image(output_name, &image, write_binary);
+	if (succeeded && print_link_map) print_map(modules, count, &image);
+
+	for (i = 0; i < archive_count; i++) lib_unmap(&archives[i]);
+	arena_select(NULL);
+	arena_release(&link_arena);
+	free_with_check(archives);
+	free_with_check(modules);
+	return succeeded ? 0 : 1;
+}
@@ -6,8 +6,16 @@
  *  function to handle the processing of each file, and manages the overall execution flow of the assembler program.
  *
  * Functions:
+ *  parse_fd_option(): Reads the file descriptor of an --ob-fd style option.
+ *  parse_size_option(): Reads the size given to --cache-size.
+ *  parse_option(): Applies a single command line option.
+ *  write_stats_json(): Writes the --stats-json report.
+ *  link_program(): Assembles the files as one program (--link).
  *  main(): Entry point of the assembler program. Processes each input file provided as a command-line argument,
- *  calling the process_file function for each file. Returns 0 upon successful completion.
+ *  calling the process_file function for each file ("-" being a source read from stdin, see process_stream),
+ *  then with --watch keeps assembling them as they change (see watch_files), or with --link assembles them as
+ *  one program (see assemble_program).
+ *  Returns 0 upon successful completion.
  *
  * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
  */
@@ -15,12 +23,183 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include "writefiles.h"
 #include "utils.h"
 #include "first_pass.h"
 #include "second_pass.h"
 #include "macr.h"
 #include "process_file.h"
+#include "trace.h"
+#include "stats.h"
+#include "traceevents.h"
+#include "allocstats.h"
+#include "arena.h"
+#include "server.h"
+#include "cache.h"
+#include "watch.h"
+#include "program.h"
+
+
+/**
+ * Reads the file descriptor given to an --ob-fd style option.
+ *
+ * @param value - The text after the '='.
+ * @param fd - Receives the file descriptor.
+ *
+ * @return bool - TRUE if the value is a file descriptor number, FALSE otherwise.
+ */
+
+static bool parse_fd_option(char *value, int *fd) {
+	char *end;
+	long number = strtol(value, &end, 10);
+
+	if (end == value || *end != '\0' || number < 0 || number > 1024 * 1024) return FALSE;
+	*fd = (int) number;
+	return TRUE;
+}
+
+
+/**
+ * Reads the size given to --cache-size: a number of bytes, optionally followed by K, M or G.
+ *
+ * @param value - The text after the '='.
+ * @param size - Receives the size in bytes.
+ *
+ * @return bool - TRUE if the value is a size, FALSE otherwise.
+ */
+
+static bool parse_size_option(char *value, long *size) {
+	char *end;
+	long number = strtol(value, &end, 10);
+
+	if (end == value || number < 0) return FALSE;
+	if (*end == 'K') number *= 1024L, end++;
+	else if (*end == 'M') number *= 1024L * 1024, end++;
+	else if (*end == 'G') number *= 1024L * 1024 * 1024, end++;
+	if (*end != '\0') return FALSE;
+	*size = number;
+	return TRUE;
+}
+
+
+/**
+ * Applies a single command line option to the options structure.
+ *
+ * @param arg - The command line argument, starting with '-'.
+ * @param options - The options to update.
+ *
+ * @return bool - TRUE if the option was recognized, FALSE otherwise.
+ */
+
+static bool parse_option(char *arg, assembler_options *options) {
+	if (strcmp(arg, "--line-limit=error") == 0) {
+		options->line_limit = LINE_LIMIT_ERROR;
+	} else if (strcmp(arg, "--line-limit=warn") == 0) {
+		options->line_limit = LINE_LIMIT_WARN;
+	} else if (strcmp(arg, "--line-limit=off") == 0) {
+		options->line_limit = LINE_LIMIT_OFF;
+	} else if (strcmp(arg, "--obb") == 0) {
+		options->write_binary_object = TRUE;
+	} else if (strcmp(arg, "--stats") == 0) {
+		options->print_stats = TRUE;
+		stats_enabled = TRUE;
+	} else if (strncmp(arg, "--stats-json=", 13) == 0) {
+		options->stats_json_filename = arg + 13;
+		stats_enabled = TRUE;
+	} else if (strncmp(arg, "--trace-out=", 12) == 0) {
+		options->trace_events_filename = arg + 12;
+		trace_events_start();
+	} else if (strncmp(arg, "--ob-fd=", 8) == 0) {
+		return parse_fd_option(arg + 8, &options->object_fd);
+	} else if (strncmp(arg, "--ent-fd=", 9) == 0) {
+		return parse_fd_option(arg + 9, &options->entries_fd);
+	} else if (strncmp(arg, "--ext-fd=", 9) == 0) {
+		return parse_fd_option(arg + 9, &options->externals_fd);
+	} else if (strncmp(arg, "--rel-fd=", 9) == 0) {
+		return parse_fd_option(arg + 9, &options->relocations_fd);
+	} else if (strncmp(arg, "--obb-fd=", 9) == 0) {
+		options->write_binary_object = TRUE;
+		return parse_fd_option(arg + 9, &options->binary_object_fd);
+	} else if (strncmp(arg, "--macro-lib=", 12) == 0) {
+		options->macro_library_filename = arg + 12;
+	} else if (strncmp(arg, "--serve=", 8) == 0) {
+		options->serve_socket_path = arg + 8;
+	} else if (strncmp(arg, "--cache-dir=", 12) == 0) {
+		options->cache_directory = arg + 12;
+	} else if (strncmp(arg, "--cache-size=", 13) == 0) {
+		return parse_size_option(arg + 13, &options->cache_size_limit);
+	} else if (strcmp(arg, "--cache-stats") == 0) {
+		options->print_cache_stats = TRUE;
+	} else if (strcmp(arg, "--incremental") == 0) {
+		options->incremental = TRUE;
+	} else if (strcmp(arg, "--watch") == 0) {
+		options->watch = TRUE;
+		options->incremental = TRUE;
+	} else if (strncmp(arg, "--link=", 7) == 0 && arg[7] != '\0') {
+		options->link_output_name = arg + 7;
+	} else if (strcmp(arg, "-v") == 0) {
+		trace_mask = TRACE_ALL;
+	} else if (strncmp(arg, "--trace=", 8) == 0) {
+		return trace_enable(arg + 8);
+	} else {
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Writes the statistics as JSON to a file.
+ *
+ * @param filename - The file to write, or "-" for the report stream.
+ * @param report_out - The report stream: stdout, or stderr when stdout carries framed output.
+ */
+
+static void write_stats_json(char *filename, FILE *report_out) {
+	FILE *file_desc;
+
+	if (strcmp(filename, "-") == 0) {
+		stats_print_json(report_out);
+		return;
+	}
+	file_desc = fopen(filename, "w");
+	if (file_desc == NULL) {
+		fprintf(stderr, "Error: can't write statistics to %s\n", filename);
+		return;
+	}
+	stats_print_json(file_desc);
+	fclose(file_desc);
+}
+
+
+/**
+ * Assembles the files named on the command line as one program (--link).
+ *
+ * @param argc - The number of command-line arguments.
+ * @param argv - The command-line arguments; those not starting with '-' are the files.
+ * @param options - The options.
+ *
+ * @return bool - TRUE if the program assembled and its image was written, FALSE otherwise.
+ */
+
+static bool link_program(int argc, char *argv[], assembler_options *options) {
+	char **files = malloc_with_check(argc * sizeof(char *));
+	int i, file_count = 0;
+	bool result;
+
+	for (i = 1; i < argc; ++i) {
+		if (argv[i][0] != '-') files[file_count++] = argv[i];
+		else if (strcmp(argv[i], "-") == 0) {
+			fprintf(stderr, "Error: --link can't read a source from stdin\n");
+			free_with_check(files);
+			return FALSE;
+		}
+	}
+	result = file_count > 0 && assemble_program(files, file_count, options->link_output_name, options);
+	free_with_check(files);
+	return result;
+}
 
 
 /**
@@ -28,25 +207,97 @@
  *
  * @param argc - The number of command-line arguments passed, including the program name.
  * @param argv - Array of command-line arguments. The first argument is the program name,
- * and the subsequent arguments represent the files to be processed.
+ * and the subsequent arguments are options (starting with '-') and the files to be processed.
+ * A file named "-" is a source read from stdin; its outputs go to stdout as one frame (see write_output_stream),
+ * and the --stats reports then go to stderr.
+ * Options apply to all files, wherever they appear:
+ *  --line-limit=error|warn|off  How lines longer than 80 characters are treated (default: error).
+ *  --obb                        Also write a binary object file (.obb) next to the .ob file.
+ *  --stats                      Print time per phase and work counters when done.
+ *  --stats-json=<file>          Write the same statistics as JSON to a file ("-" for stdout).
+ *  --trace-out=<file>           Write the phases of every file as Chrome trace events (JSON) to a file.
+ *  --ob-fd=<n>, --ent-fd=<n>, --ext-fd=<n>, --rel-fd=<n>, --obb-fd=<n>
+ *                               Write these outputs of a source read from stdin to the given file descriptors
+ *                               instead of the frame on stdout; the outputs not given are dropped.
+ *  --macro-lib=<file>           Make the macros defined in a file available to every source.
+ *  --serve=<socket>             Assemble the sources sent to a Unix socket instead of files (see server.h);
+ *                               the options above are the defaults of every request.
+ *  --cache-dir=<dir>            Keep the outputs of files that assembled cleanly in a cache, and restore them
+ *                               instead of assembling a file again when its source and the options are unchanged.
+ *  --cache-size=<n>[K|M|G]      Trim the cache to this size, least recently used first (default: 256M).
+ *  --cache-stats                Print the cache hits, misses, stores and evictions when done.
+ *  --incremental                Keep the state of each file in <file>.inc and, on the next run, only assemble
+ *                               again the lines that changed and the operands that depend on them.
+ *  --watch                      After assembling the files, keep running and assemble a file again whenever it
+ *                               (or the macro library) changes, until interrupted; implies --incremental.
+ *  --link=<name>                Assemble the files as one program, in parallel, and write the linked image as
+ *                               <name>.ob, <name>.ent and <name>.rel instead of each file's outputs (see program.h);
+ *                               --incremental, --watch and the cache don't apply.
+ *  -v, --trace=<categories>     Print trace messages for all, or the listed, subsystems
+ *                               (macro, pass1, pass2, symtab, output). Needs a build with -DASM_TRACE.
  * 
- * @return int - Returns 0 when the assembler finishes running successfully.
+ * @return int - Returns 0 when the assembler finishes running successfully, 1 on a bad option or when a source read
+ * from stdin or the --link program fails to assemble, or when the macro library, the cache, the socket or the watches cannot be set up.
  */
 
 int main(int argc, char *argv[]) {
-	int i;
+	int i, file_count = 0;
 
-	bool succeeded = TRUE;
+	bool succeeded = TRUE, stream_failed = FALSE, stream_on_stdout = FALSE;
+	char **files = malloc_with_check(argc * sizeof(char *));
+	FILE *report_out;
+	assembler_options options;
+	init_assembler_options(&options);
 
 	for (i = 1; i < argc; ++i) {
-	
-		if (!succeeded) puts("");
+		if (strcmp(argv[i], "-") == 0) {
+			stream_on_stdout = TRUE;
+			continue;
+		}
+		if (argv[i][0] == '-' && !parse_option(argv[i], &options)) {
+			fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	/* Chosen file descriptors take the outputs of a stdin source off stdout */
+	stream_on_stdout &= options.object_fd < 0 && options.entries_fd < 0 && options.externals_fd < 0 &&
+	                    options.relocations_fd < 0 && options.binary_object_fd < 0;
+	if (trace_mask && !TRACE_COMPILED_IN) {
+		fprintf(stderr, "Warning: tracing was not compiled in (build with -DASM_TRACE), ignoring -v/--trace\n");
+	}
+	if (options.macro_library_filename != NULL && !load_macro_library(options.macro_library_filename)) return 1;
+	if (options.cache_directory != NULL && !cache_open(&options)) return 1;
+	if (options.serve_socket_path != NULL) return serve(options.serve_socket_path, &options);
 
-		succeeded = process_file(argv[i]);
+	/* With --link the files are assembled together, and neither the loop below nor --watch has any left */
+	if (options.link_output_name != NULL) stream_failed = !link_program(argc, argv, &options);
 
-	}
-	return 0;
-}
+	for (i = 1; options.link_output_name == NULL && i < argc; ++i) {
+		if (strcmp(argv[i], "-") == 0) {
+			succeeded = process_stream(STDIN_FILENO, &options);
+			stream_failed |= !succeeded;
+			continue;
+		}
+		if (argv[i][0] == '-') continue;
+	
+		if (!succeeded && !stream_on_stdout) puts("");
 
+		succeeded = process_file(argv[i], &options);
+		files[file_count++] = argv[i];
 
+	}
+	if (options.watch && file_count > 0 && watch_files(files, file_count, &options) != 0) stream_failed = TRUE;
+	free_with_check(files);
 
+	report_out = stream_on_stdout ? stderr : stdout;
+	if (options.print_stats) stats_print(report_out);
+	if (options.print_cache_stats) cache_print_stats(report_out);
+	if (options.stats_json_filename != NULL) write_stats_json(options.stats_json_filename, report_out);
+	if (options.trace_events_filename != NULL) trace_events_write(options.trace_events_filename);
+	unload_macro_library();
+	arena_trim();
+#ifdef ASM_ALLOC_STATS
+	alloc_stats_report_leaks(stderr);
+#endif
+	return stream_failed ? 1 : 0;
+}
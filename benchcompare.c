@@ -0,0 +1,673 @@
+/**
+ * File: benchcompare.c
+ *
+ * Description:
+ *  This file contains the performance regression gate. It assembles a fixed set of generated scenarios (see
+ *  scenarios[]) a number of times each, and compares the wall times with a baseline file recorded the same way and
+ *  checked in next to the sources. A scenario regresses when both hold:
+ *   - the Mann-Whitney U test finds its times larger than the baseline's (one-sided, p below --alpha), so that a
+ *     difference is not called from a few unlucky runs, and
+ *   - its median is slower than the baseline's median by more than the larger of --threshold percent and --noise
+ *     times the baseline's relative standard deviation, so that a scenario that is noisy needs a larger change.
+ *  Faster scenarios are reported the same way. The report also lists, per scenario, the median wall time of every
+ *  phase from the --stats timers against the baseline's, to show where a change went.
+ *
+ *  The runs go round-robin over the scenarios, after one warm-up round, so that a slow spell of the machine is
+ *  spread over all of them rather than landing on one.
+ *
+ *  The baseline holds, per scenario, the median, the variance and every sample (the test needs them), and the
+ *  median time of each phase. It is written with one scenario per line, which is how it is read back. It also
+ *  names the assembler version that recorded it; comparing against another version's baseline prints a warning.
+ *
+ *  Usage: benchcompare [options]
+ *   --baseline=<file>   The baseline (default: bench_baseline.json).
+ *   --record            Measure and write the baseline instead of comparing with it.
+ *   --runs=<n>          Runs per scenario (default: 15).
+ *   --alpha=<p>         Significance level of the test (default: 0.01).
+ *   --threshold=<pct>   Smallest change reported, in percent (default: 5).
+ *   --noise=<k>         Multiple of the baseline's relative standard deviation a change must exceed (default: 3).
+ *   --filter=<text>     Only run the scenarios whose name contains the text.
+ *   --report=<file>     Also write the report to a file.
+ *   --dir=<dir>         Where the sources are generated (default: benchcompare.tmp).
+ *
+ *  The exit code is 1 if a scenario regressed or failed to assemble, 0 otherwise.
+ *
+ * Functions:
+ *  shape_*(): The shapes of the scenarios.
+ *  generate_scenario(): Generates the modules of a scenario.
+ *  run_scenario(): Assembles a scenario once and records its times.
+ *  mann_whitney_greater(): One-sided Mann-Whitney U test.
+ *  read_baseline() / write_baseline(): Read and write the baseline file.
+ *  report(): Compares the runs with the baseline and prints the report.
+ *  main(): Entry point of the regression gate.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "globals.h"
+#include "utils.h"
+#include "process_file.h"
+#include "srcgen.h"
+#include "stats.h"
+#include "cache.h"
+#include "arena.h"
+
+#define DEFAULT_BASELINE "bench_baseline.json"
+#define DEFAULT_RUNS 15
+#define MAX_RUNS 1000
+#define MAX_NAME_LENGTH 32
+/** Smallest sample count for which the test's normal approximation holds */
+#define MIN_TEST_SAMPLES 5
+
+/** A scenario: a generated program of a given shape */
+typedef struct scenario {
+	char *name;
+	long lines;
+	/** Generate a single module, with the lines as the module limit */
+	bool single_module;
+	void (*shape)(srcgen_config *config, long lines);
+} scenario;
+
+/** The measurements of a scenario, either from the runs or from the baseline */
+typedef struct measurements {
+	bool found;
+	bool succeeded;
+	int count;
+	double *samples_ms;
+	/* Per run, then per phase */
+	double *phases_ms[PHASE_COUNT];
+	/* The medians, as computed or as read */
+	double median_ms;
+	double variance_ms2;
+	double phase_medians_ms[PHASE_COUNT];
+} measurements;
+
+/** The command line of the gate */
+typedef struct compare_options {
+	char *baseline_filename;
+	char *report_filename;
+	char *filter;
+	char *directory;
+	bool record;
+	int runs;
+	double alpha;
+	double threshold_percent;
+	double noise_factor;
+} compare_options;
+
+
+/**
+ * Shapes the mixed scenario.
+ *
+ * @param config The generator's configuration, holding its defaults.
+ * @param lines The number of lines of the scenario.
+ */
+
+static void shape_mixed(srcgen_config *config, long lines) {
+	/* The generator's defaults are the mixed shape */
+	(void) config;
+	(void) lines;
+}
+
+
+/**
+ * Shapes the labels scenario: most lines labeled, and many entries.
+ *
+ * @param config The generator's configuration, holding its defaults.
+ * @param lines The number of lines of the scenario.
+ */
+
+static void shape_labels(srcgen_config *config, long lines) {
+	(void) lines;
+	config->label_density = 0.9;
+	config->entry_count = 64;
+}
+
+
+/**
+ * Shapes the macros scenario: many macros, expanded often.
+ *
+ * @param config The generator's configuration, holding its defaults.
+ * @param lines The number of lines of the scenario.
+ */
+
+static void shape_macros(srcgen_config *config, long lines) {
+	(void) lines;
+	config->macro_count = 40;
+	config->macro_rate = 0.3;
+}
+
+
+/**
+ * Shapes the data scenario: mostly data lines, half of them strings.
+ *
+ * @param config The generator's configuration, holding its defaults.
+ * @param lines The number of lines of the scenario.
+ */
+
+static void shape_data(srcgen_config *config, long lines) {
+	(void) lines;
+	config->data_ratio = 0.6;
+	config->string_ratio = 0.5;
+}
+
+
+/**
+ * Shapes the externs scenario: an external for every other line.
+ *
+ * @param config The generator's configuration, holding its defaults.
+ * @param lines The number of lines of the scenario.
+ */
+
+static void shape_externs(srcgen_config *config, long lines) {
+	config->extern_count = lines / 2;
+}
+
+/** The scenarios; the names are the keys of the baseline, so renaming one needs a new baseline */
+static scenario scenarios[] = {
+		{"mixed",   20000, FALSE, shape_mixed},
+		{"labels",  20000, FALSE, shape_labels},
+		{"macros",  20000, FALSE, shape_macros},
+		{"data",    20000, FALSE, shape_data},
+		{"externs", 4000,  TRUE,  shape_externs}
+};
+
+#define SCENARIO_COUNT ((int) (sizeof(scenarios) / sizeof(scenarios[0])))
+
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Computes the median of values, leaving them untouched.
+ *
+ * @param values The values.
+ * @param count The number of values.
+ *
+ * @return The median, 0 if there are none.
+ */
+
+static double median(double *values, int count) {
+	double *sorted, result;
+
+	if (count == 0) return 0;
+	sorted = malloc_with_check(count * sizeof(double));
+	memcpy(sorted, values, count * sizeof(double));
+	qsort(sorted, count, sizeof(double), compare_doubles);
+	result = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+	free_with_check(sorted);
+	return result;
+}
+
+
+/**
+ * Computes the sample variance of values.
+ *
+ * @param values The values.
+ * @param count The number of values.
+ *
+ * @return The variance, 0 if there are fewer than two values.
+ */
+
+static double variance(double *values, int count) {
+	double mean = 0, sum = 0;
+	int i;
+
+	if (count < 2) return 0;
+	for (i = 0; i < count; i++) mean += values[i];
+	mean /= count;
+	for (i = 0; i < count; i++) sum += (values[i] - mean) * (values[i] - mean);
+	return sum / (count - 1);
+}
+
+
+/**
+ * One-sided Mann-Whitney U test of whether the first sample tends to be larger than the second, using the normal
+ * approximation with the correction for ties and for continuity.
+ *
+ * @param first The first sample.
+ * @param first_count Its size.
+ * @param second The second sample.
+ * @param second_count Its size.
+ *
+ * @return The p-value; 1 if a sample is too small for the approximation.
+ */
+
+static double mann_whitney_greater(double *first, int first_count, double *second, int second_count) {
+	int total = first_count + second_count, i, j, k;
+	double *values, first_rank_sum = 0, tie_sum = 0, u, mean, sigma, z, value, rank;
+	bool *from_first, origin;
+
+	if (first_count < MIN_TEST_SAMPLES || second_count < MIN_TEST_SAMPLES) return 1;
+	values = malloc_with_check(total * sizeof(double));
+	from_first = malloc_with_check(total * sizeof(bool));
+	memcpy(values, first, first_count * sizeof(double));
+	memcpy(values + first_count, second, second_count * sizeof(double));
+	/* Sort the pooled values, keeping where each came from (insertion sort: the samples are small) */
+	for (i = 0; i < total; i++) from_first[i] = i < first_count;
+	for (i = 1; i < total; i++) {
+		value = values[i];
+		origin = from_first[i];
+		for (j = i - 1; j >= 0 && values[j] > value; j--) {
+			values[j + 1] = values[j];
+			from_first[j + 1] = from_first[j];
+		}
+		values[j + 1] = value;
+		from_first[j + 1] = origin;
+	}
+	/* Tied values, at positions i..j-1, share the mean of their ranks i+1..j */
+	for (i = 0; i < total; i = j) {
+		for (j = i + 1; j < total && values[j] == values[i]; j++);
+		rank = (i + 1 + j) / 2.0;
+		for (k = i; k < j; k++) if (from_first[k]) first_rank_sum += rank;
+		tie_sum += (double) (j - i) * (j - i) * (j - i) - (j - i);
+	}
+
+	u = first_rank_sum - first_count * (first_count + 1) / 2.0;
+	mean = first_count * (double) second_count / 2;
+	sigma = sqrt(first_count * (double) second_count / 12 * ((total + 1) - tie_sum / (total * (double) (total - 1))));
+	free_with_check(values);
+	free_with_check(from_first);
+	if (sigma == 0) return 1;
+	z = (u - mean - 0.5) / sigma;
+	return 0.5 * erfc(z / sqrt(2));
+}
+
+
+/**
+ * Generates the modules of a scenario: <directory>/<name>_m<n>.as.
+ *
+ * @param options The options.
+ * @param s The scenario.
+ *
+ * @return The number of modules, or -1 if a module could not be written.
+ */
+
+static long generate_scenario(compare_options *options, scenario *s) {
+	char name[FILENAME_MAX];
+	long written = 0, modules = 0, words;
+	srcgen_config shape;
+	FILE *out;
+
+	srcgen_defaults(&shape);
+	if (s->single_module) shape.module_lines = s->lines;
+	s->shape(&shape, s->lines);
+	while (written < s->lines && (!s->single_module || modules == 0)) {
+		snprintf(name, sizeof(name), "%s/%s_m%ld.as", options->directory, s->name, modules);
+		if ((out = fopen(name, "w")) == NULL) {
+			fprintf(stderr, "Error: can't create %s: %s\n", name, strerror(errno));
+			return -1;
+		}
+		written += srcgen_write_module(out, &shape, s->lines - written, &words);
+		modules++;
+		if (fclose(out) != 0) return -1;
+	}
+	return modules;
+}
+
+
+/**
+ * Removes the sources and outputs of a scenario.
+ *
+ * @param options The options.
+ * @param s The scenario.
+ * @param modules The number of modules.
+ */
+
+static void remove_scenario(compare_options *options, scenario *s, long modules) {
+	static char *extensions[] = {"as", "am", "ob", "ent", "ext", "rel"};
+	char name[FILENAME_MAX];
+	long i;
+	int j;
+
+	for (i = 0; i < modules; i++) {
+		for (j = 0; j < (int) (sizeof(extensions) / sizeof(extensions[0])); j++) {
+			snprintf(name, sizeof(name), "%s/%s_m%ld.%s", options->directory, s->name, i, extensions[j]);
+			unlink(name);
+		}
+	}
+}
+
+
+/**
+ * Assembles the modules of a scenario once, and appends the wall time of the run and of each phase.
+ *
+ * @param options The options.
+ * @param s The scenario.
+ * @param assembler The options of the assembler.
+ * @param m The measurements to append to, or NULL for a warm-up run.
+ * @param modules The number of modules of the scenario.
+ */
+
+static void run_scenario(compare_options *options, scenario *s, assembler_options *assembler, measurements *m,
+                         long modules) {
+	char base_name[FILENAME_MAX];
+	double phases_before[PHASE_COUNT];
+	struct timespec start, end;
+	bool succeeded = TRUE;
+	long i;
+	int p;
+
+	for (p = 0; p < PHASE_COUNT; p++) phases_before[p] = stats_phase_wall_ms(p);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < modules; i++) {
+		snprintf(base_name, sizeof(base_name), "%s/%s_m%ld", options->directory, s->name, i);
+		succeeded &= process_file(base_name, assembler);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	arena_trim();
+	if (m == NULL) return;
+
+	m->succeeded &= succeeded;
+	m->samples_ms[m->count] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+	for (p = 0; p < PHASE_COUNT; p++) m->phases_ms[p][m->count] = stats_phase_wall_ms(p) - phases_before[p];
+	m->count++;
+}
+
+
+/**
+ * Reads a number following a key within a line of the baseline.
+ *
+ * @param line The line.
+ * @param key The key, with its quotes and colon.
+ * @param value Receives the number.
+ *
+ * @return TRUE if the key was found and followed by a number.
+ */
+
+static bool read_number(char *line, char *key, double *value) {
+	char *at = strstr(line, key), *end;
+
+	if (at == NULL) return FALSE;
+	at += strlen(key);
+	*value = strtod(at, &end);
+	return end != at;
+}
+
+
+/**
+ * Reads the baseline file into the measurements of the scenarios it names; the others are left not found. A
+ * baseline recorded by another version of the assembler is still read, with a warning, since its outputs differ.
+ *
+ * @param filename The baseline file.
+ * @param baseline The measurements, one per scenario, in the order of scenarios[].
+ *
+ * @return TRUE if the file was read, FALSE if it could not be opened.
+ */
+
+static bool read_baseline(char *filename, measurements *baseline) {
+	char *line = NULL, *at, *end, name[MAX_NAME_LENGTH], key[MAX_NAME_LENGTH + 8], version[MAX_NAME_LENGTH];
+	size_t capacity = 0;
+	measurements *m;
+	double value;
+	int i, p;
+	FILE *in;
+
+	if ((in = fopen(filename, "r")) == NULL) return FALSE;
+	while (getline(&line, &capacity, in) > 0) {
+		if ((at = strstr(line, "\"assembler_version\": \"")) != NULL &&
+		    sscanf(at + 22, "%31[^\"]", version) == 1 && strcmp(version, ASSEMBLER_VERSION) != 0) {
+			fprintf(stderr, "Warning: the baseline %s was recorded by assembler version %s, not %s; "
+			                "record it again with --record\n", filename, version, ASSEMBLER_VERSION);
+		}
+		if ((at = strstr(line, "\"name\": \"")) == NULL || sscanf(at + 9, "%31[^\"]", name) != 1) continue;
+		for (i = 0; i < SCENARIO_COUNT && strcmp(scenarios[i].name, name) != 0; i++);
+		if (i == SCENARIO_COUNT) continue;
+
+		m = &baseline[i];
+		m->found = read_number(line, "\"median_ms\": ", &m->median_ms) &&
+		           read_number(line, "\"variance_ms2\": ", &m->variance_ms2);
+		for (p = 0; p < PHASE_COUNT; p++) {
+			snprintf(key, sizeof(key), "\"%s\": ", stats_phase_name(p));
+			if (!read_number(line, key, &m->phase_medians_ms[p])) m->phase_medians_ms[p] = 0;
+		}
+		m->count = 0;
+		if ((at = strstr(line, "\"samples_ms\": [")) != NULL) {
+			for (at += 15; m->count < MAX_RUNS; at = end + (*end == ',')) {
+				value = strtod(at, &end);
+				if (end == at) break;
+				m->samples_ms[m->count++] = value;
+			}
+		}
+	}
+	free(line);
+	fclose(in);
+	return TRUE;
+}
+
+
+/**
+ * Writes the measurements as the new baseline, one scenario per line.
+ *
+ * @param filename The baseline file.
+ * @param current The measurements, one per scenario.
+ * @param runs The runs per scenario.
+ *
+ * @return TRUE if the file was written.
+ */
+
+static bool write_baseline(char *filename, measurements *current, int runs) {
+	bool first = TRUE;
+	int i, j, p;
+	FILE *out;
+
+	if ((out = fopen(filename, "w")) == NULL) {
+		fprintf(stderr, "Error: can't create %s\n", filename);
+		return FALSE;
+	}
+	fprintf(out, "{\n  \"assembler_version\": \"%s\",\n  \"runs\": %d,\n  \"scenarios\": [", ASSEMBLER_VERSION, runs);
+	for (i = 0; i < SCENARIO_COUNT; i++) {
+		if (!current[i].found) continue;
+		fprintf(out, "%s\n    {\"name\": \"%s\", \"lines\": %ld, \"median_ms\": %.4f, \"variance_ms2\": %.6f, "
+		             "\"phases_ms\": {", first ? "" : ",", scenarios[i].name, scenarios[i].lines,
+		        current[i].median_ms, current[i].variance_ms2);
+		for (p = 0; p < PHASE_COUNT; p++) {
+			fprintf(out, "%s\"%s\": %.4f", p ? ", " : "", stats_phase_name(p), current[i].phase_medians_ms[p]);
+		}
+		fprintf(out, "}, \"samples_ms\": [");
+		for (j = 0; j < current[i].count; j++) fprintf(out, "%s%.4f", j ? ", " : "", current[i].samples_ms[j]);
+		fprintf(out, "]}");
+		first = FALSE;
+	}
+	fprintf(out, "\n  ]\n}\n");
+	return fclose(out) == 0;
+}
+
+
+/**
+ * Compares the runs with the baseline and prints the report.
+ *
+ * @param out The stream to print to.
+ * @param options The options.
+ * @param current The measurements of the runs.
+ * @param baseline The measurements of the baseline.
+ *
+ * @return The number of scenarios that regressed or failed.
+ */
+
+static int report(FILE *out, compare_options *options, measurements *current, measurements *baseline) {
+	double change, limit, noise, p_slower, p_faster;
+	int i, p, failures = 0;
+	char *verdict;
+
+	fprintf(out, "%-10s %11s %11s %9s %9s %9s  %s\n", "scenario", "base ms", "now ms", "change", "limit", "p",
+	        "verdict");
+	for (i = 0; i < SCENARIO_COUNT; i++) {
+		if (!current[i].found) continue;
+		if (!baseline[i].found) {
+			fprintf(out, "%-10s %11s %11.3f %9s %9s %9s  new (not in the baseline)\n", scenarios[i].name, "-",
+			        current[i].median_ms, "-", "-", "-");
+			continue;
+		}
+		change = (current[i].median_ms - baseline[i].median_ms) / baseline[i].median_ms * 100;
+		noise = sqrt(baseline[i].variance_ms2) / baseline[i].median_ms * 100 * options->noise_factor;
+		limit = noise > options->threshold_percent ? noise : options->threshold_percent;
+		p_slower = mann_whitney_greater(current[i].samples_ms, current[i].count, baseline[i].samples_ms,
+		                                baseline[i].count);
+		p_faster = mann_whitney_greater(baseline[i].samples_ms, baseline[i].count, current[i].samples_ms,
+		                                current[i].count);
+
+		if (!current[i].succeeded) verdict = "FAILED (assembly errors)";
+		else if (change > limit && p_slower < options->alpha) verdict = "REGRESSION";
+		else if (-change > limit && p_faster < options->alpha) verdict = "faster";
+		else verdict = "ok";
+		if (!current[i].succeeded || strcmp(verdict, "REGRESSION") == 0) failures++;
+		fprintf(out, "%-10s %11.3f %11.3f %+8.1f%% %8.1f%% %9.4f  %s\n", scenarios[i].name, baseline[i].median_ms,
+		        current[i].median_ms, change, limit, change >= 0 ? p_slower : p_faster, verdict);
+	}
+
+	fprintf(out, "\nPhase medians, ms (base -> now):\n%-10s", "scenario");
+	for (p = 0; p < PHASE_COUNT; p++) fprintf(out, " %24s", stats_phase_name(p));
+	fprintf(out, "\n");
+	for (i = 0; i < SCENARIO_COUNT; i++) {
+		if (!current[i].found || !baseline[i].found) continue;
+		fprintf(out, "%-10s", scenarios[i].name);
+		for (p = 0; p < PHASE_COUNT; p++) {
+			fprintf(out, " %7.2f -> %7.2f", baseline[i].phase_medians_ms[p], current[i].phase_medians_ms[p]);
+			if (baseline[i].phase_medians_ms[p] > 0) {
+				fprintf(out, " %+4.0f%%", (current[i].phase_medians_ms[p] - baseline[i].phase_medians_ms[p]) /
+				                          baseline[i].phase_medians_ms[p] * 100);
+			} else {
+				fprintf(out, " %5s", "");
+			}
+		}
+		fprintf(out, "\n");
+	}
+	fprintf(out, "\n%d of the scenarios regressed or failed (alpha %.3g, threshold %.3g%%, noise x%.3g).\n", failures,
+	        options->alpha, options->threshold_percent, options->noise_factor);
+	return failures;
+}
+
+
+/**
+ * Applies a single command line option.
+ *
+ * @param arg The option.
+ * @param options The options to update.
+ *
+ * @return TRUE if the option is known and well-formed, FALSE otherwise.
+ */
+
+static bool parse_option(char *arg, compare_options *options) {
+	if (strncmp(arg, "--baseline=", 11) == 0) options->baseline_filename = arg + 11;
+	else if (strcmp(arg, "--record") == 0) options->record = TRUE;
+	else if (strncmp(arg, "--runs=", 7) == 0) options->runs = atoi(arg + 7);
+	else if (strncmp(arg, "--alpha=", 8) == 0) options->alpha = atof(arg + 8);
+	else if (strncmp(arg, "--threshold=", 12) == 0) options->threshold_percent = atof(arg + 12);
+	else if (strncmp(arg, "--noise=", 8) == 0) options->noise_factor = atof(arg + 8);
+	else if (strncmp(arg, "--filter=", 9) == 0) options->filter = arg + 9;
+	else if (strncmp(arg, "--report=", 9) == 0) options->report_filename = arg + 9;
+	else if (strncmp(arg, "--dir=", 6) == 0) options->directory = arg + 6;
+	else return FALSE;
+	return options->runs > 0 && options->runs <= MAX_RUNS && options->alpha > 0 && options->alpha < 1 &&
+	       options->threshold_percent >= 0 && options->noise_factor >= 0;
+}
+
+
+/**
+ * Main function of the regression gate.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file.
+ *
+ * @return int - 0 if no scenario regressed or failed, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	compare_options options;
+	measurements current[SCENARIO_COUNT], baseline[SCENARIO_COUNT];
+	assembler_options assembler;
+	long modules[SCENARIO_COUNT];
+	int i, run, p, failures = 0;
+	bool selected[SCENARIO_COUNT], succeeded = TRUE;
+	FILE *report_file;
+
+	memset(&options, 0, sizeof(options));
+	options.baseline_filename = DEFAULT_BASELINE;
+	options.directory = "benchcompare.tmp";
+	options.runs = DEFAULT_RUNS;
+	options.alpha = 0.01;
+	options.threshold_percent = 5;
+	options.noise_factor = 3;
+	for (i = 1; i < argc; i++) {
+		if (!parse_option(argv[i], &options)) {
+			fprintf(stderr, "Error: unknown or malformed option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (mkdir(options.directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: can't create %s: %s\n", options.directory, strerror(errno));
+		return 1;
+	}
+
+	/* A plain assembler run, with the phase timers on */
+	init_assembler_options(&assembler);
+	stats_enabled = TRUE;
+
+	memset(current, 0, sizeof(current));
+	memset(baseline, 0, sizeof(baseline));
+	for (i = 0; i < SCENARIO_COUNT; i++) {
+		selected[i] = options.filter == NULL || strstr(scenarios[i].name, options.filter) != NULL;
+		current[i].found = selected[i];
+		current[i].succeeded = TRUE;
+		current[i].samples_ms = malloc_with_check(options.runs * sizeof(double));
+		for (p = 0; p < PHASE_COUNT; p++) current[i].phases_ms[p] = malloc_with_check(options.runs * sizeof(double));
+		baseline[i].samples_ms = malloc_with_check(MAX_RUNS * sizeof(double));
+		modules[i] = 0;
+		if (selected[i] && (modules[i] = generate_scenario(&options, &scenarios[i])) < 0) return 1;
+	}
+	if (!options.record && !read_baseline(options.baseline_filename, baseline)) {
+		fprintf(stderr, "Error: can't read the baseline %s (make one with --record)\n", options.baseline_filename);
+		return 1;
+	}
+
+	/* A warm-up round, then the runs round-robin over the scenarios */
+	for (run = -1; run < options.runs; run++) {
+		for (i = 0; i < SCENARIO_COUNT; i++) {
+			if (selected[i]) run_scenario(&options, &scenarios[i], &assembler, run < 0 ? NULL : &current[i],
+			                              modules[i]);
+		}
+	}
+	for (i = 0; i < SCENARIO_COUNT; i++) {
+		current[i].median_ms = median(current[i].samples_ms, current[i].count);
+		current[i].variance_ms2 = variance(current[i].samples_ms, current[i].count);
+		for (p = 0; p < PHASE_COUNT; p++) {
+			current[i].phase_medians_ms[p] = median(current[i].phases_ms[p], current[i].count);
+		}
+		succeeded &= current[i].succeeded;
+		remove_scenario(&options, &scenarios[i], modules[i]);
+	}
+	rmdir(options.directory);
+
+	if (options.record) {
+		if (!succeeded) fprintf(stderr, "Error: a scenario failed to assemble; no baseline written\n");
+		else if (write_baseline(options.baseline_filename, current, options.runs)) {
+			printf("Baseline of %d run(s) per scenario written to %s\n", options.runs, options.baseline_filename);
+		} else {
+			succeeded = FALSE;
+		}
+		return succeeded ? 0 : 1;
+	}
+
+	failures = report(stdout, &options, current, baseline);
+	if (options.report_filename != NULL) {
+		if ((report_file = fopen(options.report_filename, "w")) == NULL) {
+			fprintf(stderr, "Error: can't create %s\n", options.report_filename);
+			return 1;
+		}
+		report(report_file, &options, current, baseline);
+		fclose(report_file);
+	}
+	return failures > 0 ? 1 : 0;
+}
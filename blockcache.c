@@ -0,0 +1,557 @@
+/**
+ * File: blockcache.c
+ *
+ * Description:
+ *  This file contains the block engine declared in blockcache.h. A translated instruction's handler is picked by
+ *  its opcode and the kinds of its operands: a source is read through a pointer or through a register, and a
+ *  target is a register or an immediate (no store to check), a memory word (the store is checked against the
+ *  covered map), or register-indirect. lea of a direct address runs as mov of the address; lea of a register has
+ *  handlers of its own, which check the register's value against the size of memory as machine_run does.
+ *  Within a block every handler goes straight on to the next record; the last one, or the record after a block cut
+ *  short, looks the next block up by address.
+ *
+ * Functions:
+ *  machine_run_blocks(): Runs a machine until it stops, a block at a time.
+ *  block_forget(): Frees the blocks whose code holds a word.
+ *  block_cache_clear(): Frees every block of a machine.
+ *  translate_block(): Decodes and translates the block starting at an address.
+ *  translate_insn(): Translates one decoded instruction.
+ *  resolve_operand(): Resolves an operand to a pointer, or to a register to go through.
+ *  read_character(): Reads a character for red.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "blockcache.h"
+#include "utils.h"
+
+/* The kinds of a resolved operand */
+#define OPERAND_PLAIN 0    /* a register or an immediate value: read and written through a pointer */
+#define OPERAND_MEMORY 1   /* a memory word: as plain, but a store into it is checked */
+#define OPERAND_INDIRECT 2 /* register-indirect: addressed while the block runs */
+
+#define ENDS_BLOCK(handler) ((handler) >= JMP_OP && (handler) != RED_OP && (handler) != PRN_OP)
+
+/* The handlers, in the order of the table in machine_run_blocks. A two-operand writer has six: a plain or
+ * indirect source, times the three kinds of target; lea of a register, like a one-operand writer, has one per kind
+ * of target; cmp has four and prn two, reading plain or indirect operands; and a jump has one for a direct and one
+ * for an indirect target. */
+typedef enum block_handler {
+	HANDLER_MOV = 0,
+	HANDLER_ADD = 6,
+	HANDLER_SUB = 12,
+	HANDLER_LEA_INDIRECT = 18,
+	HANDLER_CMP = 21,
+	HANDLER_CLR = 25,
+	HANDLER_NOT = 28,
+	HANDLER_INC = 31,
+	HANDLER_DEC = 34,
+	HANDLER_RED = 37,
+	HANDLER_PRN = 40,
+	HANDLER_JMP = 42,
+	HANDLER_BNE = 44,
+	HANDLER_JSR = 46,
+	HANDLER_RTS = 48,
+	HANDLER_STOP,
+	HANDLER_ILLEGAL,
+	HANDLER_EXIT
+} block_handler;
+
+
+/**
+ * Frees the blocks whose code holds a word. Only a block starting at most BLOCK_MAX_WORDS - 1 words before the
+ * word can hold it.
+ *
+ * @param vm The machine.
+ * @param address The address of the word.
+ */
+
+void block_forget(machine *vm, long address) {
+	long start;
+
+	for (start = address >= BLOCK_MAX_WORDS ? address - BLOCK_MAX_WORDS + 1 : 0; start <= address; start++) {
+		if (vm->blocks[start] != NULL && vm->blocks[start]->end > address) {
+			free_with_check(vm->blocks[start]);
+			vm->blocks[start] = NULL;
+		}
+	}
+}
+
+
+/**
+ * Frees every block of a machine.
+ *
+ * @param vm The machine.
+ */
+
+void block_cache_clear(machine *vm) {
+	long start;
+
+	for (start = 0; start < MACHINE_MEMORY_SIZE; start++) {
+		if (vm->blocks[start] != NULL) {
+			free_with_check(vm->blocks[start]);
+			vm->blocks[start] = NULL;
+		}
+	}
+}
+
+
+/**
+ * Resolves an operand: a register, a memory word or an immediate value (kept in the translated instruction) to a
+ * pointer, and a register-indirect operand to its register.
+ *
+ * @param vm The machine.
+ * @param mode The operand's addressing type.
+ * @param field The decoded operand.
+ * @param location Receives the pointer.
+ * @param value The translated instruction's field for the operand, which receives the value or the register.
+ *
+ * @return The kind of the operand.
+ */
+
+static int resolve_operand(machine *vm, int mode, uint16_t field, uint16_t **location, uint16_t *value) {
+	*location = NULL;
+	*value = field;
+	switch (mode) {
+		case IMMEDIATE_ADDR:
+			*location = value;
+			return OPERAND_PLAIN;
+		case DIRECT_ADDR:
+			*location = &vm->memory[field];
+			return OPERAND_MEMORY;
+		case REGISTER_INDIRECT_ADDR:
+			return OPERAND_INDIRECT;
+		default:
+			*location = &vm->registers[field];
+			return OPERAND_PLAIN;
+	}
+}
+
+
+/**
+ * Translates one decoded instruction.
+ *
+ * @param vm The machine.
+ * @param op The decoded instruction.
+ * @param address The instruction's address.
+ * @param insn Receives the translated instruction.
+ * @param handlers The handlers of machine_run_blocks.
+ */
+
+static void translate_insn(machine *vm, machine_op *op, long address, block_insn *insn, void *const *handlers) {
+	int source = OPERAND_PLAIN, target = OPERAND_PLAIN, handler;
+
+	insn->address = address;
+	insn->next = address + op->length;
+	if (op->handler <= LEA_OP) {
+		if (op->handler == LEA_OP) {
+			/* The direct address itself, read as an immediate, or the register, addressed while the block runs */
+			insn->source_value = op->source;
+			if (op->source_mode == DIRECT_ADDR) insn->source = &insn->source_value;
+			else source = OPERAND_INDIRECT;
+		} else {
+			source = resolve_operand(vm, op->source_mode, op->source, &insn->source, &insn->source_value);
+		}
+	}
+	if (op->handler <= PRN_OP) {
+		target = resolve_operand(vm, op->target_mode, op->target, &insn->target, &insn->target_value);
+	} else {
+		insn->target_value = op->target;
+	}
+	source = source == OPERAND_INDIRECT;
+
+	switch (op->handler) {
+		case MOV_OP:
+			handler = HANDLER_MOV + source * 3 + target;
+			break;
+		case LEA_OP:
+			handler = source ? HANDLER_LEA_INDIRECT + target : HANDLER_MOV + target;
+			break;
+		case ADD_OP:
+			handler = HANDLER_ADD + source * 3 + target;
+			break;
+		case SUB_OP:
+			handler = HANDLER_SUB + source * 3 + target;
+			break;
+		case CMP_OP:
+			handler = HANDLER_CMP + source * 2 + (target == OPERAND_INDIRECT);
+			break;
+		case CLR_OP:
+		case NOT_OP:
+		case INC_OP:
+		case DEC_OP:
+			handler = HANDLER_CLR + (op->handler - CLR_OP) * 3 + target;
+			break;
+		case RED_OP:
+			handler = HANDLER_RED + target;
+			break;
+		case PRN_OP:
+			handler = HANDLER_PRN + (target == OPERAND_INDIRECT);
+			break;
+		case JMP_OP:
+			handler = HANDLER_JMP + (op->target_mode == REGISTER_INDIRECT_ADDR);
+			break;
+		case BNE_OP:
+			handler = HANDLER_BNE + (op->target_mode == REGISTER_INDIRECT_ADDR);
+			break;
+		case JSR_OP:
+			handler = HANDLER_JSR + (op->target_mode == REGISTER_INDIRECT_ADDR);
+			break;
+		case RTS_OP:
+			handler = HANDLER_RTS;
+			break;
+		case STOP_OP:
+			handler = HANDLER_STOP;
+			break;
+		default:
+			handler = HANDLER_ILLEGAL;
+	}
+	insn->handler = handlers[handler];
+}
+
+
+/**
+ * Decodes and translates the block starting at an address, keeps it in the machine and marks its code covered.
+ *
+ * @param vm The machine.
+ * @param start The block's address, inside memory.
+ * @param handlers The handlers of machine_run_blocks.
+ *
+ * @return The block.
+ */
+
+static machine_block *translate_block(machine *vm, long start, void *const *handlers) {
+	machine_op ops[BLOCK_MAX_INSNS];
+	machine_block *block;
+	long address = start;
+	int count = 0, i;
+
+	do {
+		machine_decode(vm->memory, address, &ops[count]);
+		address += ops[count].length;
+		count++;
+	} while (count < BLOCK_MAX_INSNS && !ENDS_BLOCK(ops[count - 1].handler));
+	if (address > MACHINE_MEMORY_SIZE) address = MACHINE_MEMORY_SIZE;
+
+	block = malloc_with_check(sizeof(machine_block) + (count + 1) * sizeof(block_insn));
+	block->start = start;
+	block->end = address;
+	block->count = count;
+	for (i = 0, address = start; i < count; address += ops[i].length, i++) {
+		translate_insn(vm, &ops[i], address, &block->insns[i], handlers);
+	}
+	block->insns[count].handler = handlers[HANDLER_EXIT];
+	block->insns[count].address = block->insns[count].next = address;
+
+	memset(&vm->covered[start], 1, block->end - start);
+	vm->blocks[start] = block;
+	return block;
+}
+
+
+/**
+ * Reads a character for red.
+ *
+ * @return The character, or the word -1 at the end of the input.
+ */
+
+static unsigned int read_character(void) {
+	int c = getchar();
+	return c == EOF ? MACHINE_WORD_MASK : (unsigned int) c;
+}
+
+
+/* Goes on to the next instruction of the block */
+#define NEXT() do { \
+	insn++; \
+	goto *insn->handler; \
+} while (0)
+
+/* Reads a register-indirect source into value */
+#define SOURCE_INDIRECT() do { \
+	address = registers[insn->source_value]; \
+	if (address >= MACHINE_MEMORY_SIZE) goto bad_address; \
+	value = memory[address]; \
+} while (0)
+
+/* Reads the address a register points at, for lea, into value */
+#define SOURCE_ADDRESS() do { \
+	value = registers[insn->source_value]; \
+	if (value >= MACHINE_MEMORY_SIZE) goto bad_address; \
+} while (0)
+
+/* Points target at a register-indirect target */
+#define TARGET_INDIRECT() do { \
+	address = registers[insn->target_value]; \
+	if (address >= MACHINE_MEMORY_SIZE) goto bad_address; \
+	target = &memory[address]; \
+} while (0)
+
+/* Goes on after a store into memory, dropping what covers the word; leaves the block if it wrote into its code */
+#define NEXT_AFTER_STORE() do { \
+	address = target - memory; \
+	if (covered[address]) { \
+		if ((long) address >= block->start && (long) address < block->end) { \
+			remaining += last - insn; \
+			pc = insn->next; \
+			machine_forget(vm, address); \
+			goto enter; \
+		} \
+		machine_forget(vm, address); \
+	} \
+	NEXT(); \
+} while (0)
+
+/* The six handlers of a two-operand instruction that writes expression, of value and *target, to its target */
+#define WRITE_HANDLERS(name, expression) \
+name##_plain_plain: \
+	value = *insn->source; \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT(); \
+name##_plain_memory: \
+	value = *insn->source; \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE(); \
+name##_plain_indirect: \
+	value = *insn->source; \
+	TARGET_INDIRECT(); \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE(); \
+name##_indirect_plain: \
+	SOURCE_INDIRECT(); \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT(); \
+name##_indirect_memory: \
+	SOURCE_INDIRECT(); \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE(); \
+name##_indirect_indirect: \
+	SOURCE_INDIRECT(); \
+	TARGET_INDIRECT(); \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE();
+
+/* The three handlers of a one-operand instruction that writes expression, of *target, to its target */
+#define UNARY_HANDLERS(name, expression) \
+name##_plain: \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT(); \
+name##_memory: \
+	target = insn->target; \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE(); \
+name##_indirect: \
+	TARGET_INDIRECT(); \
+	*target = (expression) & MACHINE_WORD_MASK; \
+	NEXT_AFTER_STORE();
+
+/* Sets address to where an indirect jump goes */
+#define JUMP_INDIRECT() do { \
+	address = registers[insn->target_value]; \
+	if (address >= MACHINE_MEMORY_SIZE) goto bad_address; \
+} while (0)
+
+/* Pushes the return address of jsr */
+#define PUSH_RETURN() do { \
+	if (vm->stack_depth == MACHINE_STACK_DEPTH) { \
+		pc = insn->address; \
+		fprintf(stderr, "Error: return stack overflow at address %ld\n", pc); \
+		goto fault; \
+	} \
+	vm->stack[vm->stack_depth++] = insn->next; \
+} while (0)
+
+
+/**
+ * Runs a machine from its current address until it executes stop, faults or reaches the step limit, a block at a
+ * time. It runs exactly as machine_run does; when fewer steps are left than the next block holds, it finishes with
+ * machine_run.
+ *
+ * @param vm The machine.
+ * @param step_limit The most instructions to execute, or 0 for no limit.
+ *
+ * @return How the run ended.
+ */
+
+machine_status machine_run_blocks(machine *vm, unsigned long long step_limit) {
+	static void *const handlers[] = {
+		&&mov_plain_plain, &&mov_plain_memory, &&mov_plain_indirect,
+		&&mov_indirect_plain, &&mov_indirect_memory, &&mov_indirect_indirect,
+		&&add_plain_plain, &&add_plain_memory, &&add_plain_indirect,
+		&&add_indirect_plain, &&add_indirect_memory, &&add_indirect_indirect,
+		&&sub_plain_plain, &&sub_plain_memory, &&sub_plain_indirect,
+		&&sub_indirect_plain, &&sub_indirect_memory, &&sub_indirect_indirect,
+		&&lea_indirect_plain, &&lea_indirect_memory, &&lea_indirect_indirect,
+		&&cmp_plain_plain, &&cmp_plain_indirect, &&cmp_indirect_plain, &&cmp_indirect_indirect,
+		&&clr_plain, &&clr_memory, &&clr_indirect,
+		&&not_plain, &&not_memory, &&not_indirect,
+		&&inc_plain, &&inc_memory, &&inc_indirect,
+		&&dec_plain, &&dec_memory, &&dec_indirect,
+		&&red_plain, &&red_memory, &&red_indirect,
+		&&prn_plain, &&prn_indirect,
+		&&jmp_direct, &&jmp_indirect,
+		&&bne_direct, &&bne_indirect,
+		&&jsr_direct, &&jsr_indirect,
+		&&rts, &&stop, &&illegal, &&cut_short
+	};
+	uint16_t *memory = vm->memory, *registers = vm->registers, *target;
+	uint8_t *covered = vm->covered;
+	machine_block *block;
+	block_insn *insn, *last;
+	unsigned long long budget = step_limit == 0 ? ULLONG_MAX : step_limit, remaining = budget;
+	unsigned int value, address;
+	long pc = vm->pc;
+	bool zero = vm->zero;
+	machine_status status;
+
+enter:
+	if (remaining == 0) {
+		status = MACHINE_STEP_LIMIT;
+		goto done;
+	}
+	if (pc >= MACHINE_MEMORY_SIZE) {
+		fprintf(stderr, "Error: ran past the end of memory\n");
+		status = MACHINE_FAULT;
+		goto done;
+	}
+	block = vm->blocks[pc];
+	if (block == NULL) block = translate_block(vm, pc, handlers);
+	if ((unsigned long long) block->count > remaining) {
+		/* Too few steps left for the whole block: finish one instruction at a time */
+		vm->pc = pc;
+		vm->zero = zero;
+		vm->executed += budget - remaining;
+		return machine_run(vm, remaining);
+	}
+	remaining -= block->count;
+	insn = block->insns;
+	last = &block->insns[block->count - 1];
+	goto *insn->handler;
+
+	WRITE_HANDLERS(mov, value)
+	WRITE_HANDLERS(add, *target + value)
+	WRITE_HANDLERS(sub, *target - value)
+
+lea_indirect_plain:
+	SOURCE_ADDRESS();
+	target = insn->target;
+	*target = value;
+	NEXT();
+lea_indirect_memory:
+	SOURCE_ADDRESS();
+	target = insn->target;
+	*target = value;
+	NEXT_AFTER_STORE();
+lea_indirect_indirect:
+	SOURCE_ADDRESS();
+	TARGET_INDIRECT();
+	*target = value;
+	NEXT_AFTER_STORE();
+
+cmp_plain_plain:
+	zero = *insn->source == *insn->target;
+	NEXT();
+cmp_plain_indirect:
+	value = *insn->source;
+	TARGET_INDIRECT();
+	zero = value == *target;
+	NEXT();
+cmp_indirect_plain:
+	SOURCE_INDIRECT();
+	zero = value == *insn->target;
+	NEXT();
+cmp_indirect_indirect:
+	SOURCE_INDIRECT();
+	TARGET_INDIRECT();
+	zero = value == *target;
+	NEXT();
+
+	UNARY_HANDLERS(clr, 0)
+	UNARY_HANDLERS(not, ~*target)
+	UNARY_HANDLERS(inc, *target + 1)
+	UNARY_HANDLERS(dec, *target - 1)
+	UNARY_HANDLERS(red, read_character())
+
+prn_plain:
+	printf("%d\n", MACHINE_SIGNED(*insn->target));
+	NEXT();
+prn_indirect:
+	TARGET_INDIRECT();
+	printf("%d\n", MACHINE_SIGNED(*target));
+	NEXT();
+
+jmp_direct:
+	pc = insn->target_value;
+	goto enter;
+jmp_indirect:
+	JUMP_INDIRECT();
+	pc = address;
+	goto enter;
+
+bne_direct:
+	pc = zero ? insn->next : insn->target_value;
+	goto enter;
+bne_indirect:
+	if (zero) pc = insn->next;
+	else {
+		JUMP_INDIRECT();
+		pc = address;
+	}
+	goto enter;
+
+jsr_direct:
+	PUSH_RETURN();
+	pc = insn->target_value;
+	goto enter;
+jsr_indirect:
+	JUMP_INDIRECT();
+	PUSH_RETURN();
+	pc = address;
+	goto enter;
+
+rts:
+	if (vm->stack_depth == 0) {
+		pc = insn->address;
+		fprintf(stderr, "Error: rts with an empty return stack at address %ld\n", pc);
+		goto fault;
+	}
+	pc = vm->stack[--vm->stack_depth];
+	goto enter;
+
+stop:
+	pc = insn->address;
+	status = MACHINE_STOPPED;
+	goto done;
+
+illegal:
+	pc = insn->address;
+	fprintf(stderr, "Error: illegal instruction %05o at address %ld\n", memory[pc], pc);
+	goto fault;
+
+cut_short:
+	pc = insn->address;
+	goto enter;
+
+bad_address:
+	pc = insn->address;
+	fprintf(stderr, "Error: address outside memory at address %ld\n", pc);
+
+fault:
+	/* The faulting instruction and the rest of its block did not execute */
+	remaining += last - insn + 1;
+	status = MACHINE_FAULT;
+
+done:
+	vm->pc = pc;
+	vm->zero = zero;
+	vm->executed += budget - remaining;
+	return status;
+}
@@ -0,0 +1,90 @@
+/**
+ * File: blockcache.h
+ *
+ * Description:
+ *  This header file declares the block engine of the emulator (see emulator.h). A basic block is a straight run of
+ *  instructions ending at jmp, bne, jsr, rts or stop (or at an illegal instruction, or after BLOCK_MAX_INSNS). The
+ *  first time a block's start address runs, the block is decoded and translated into block_insn records, each
+ *  naming the handler specialised for its opcode and the kinds of its operands, with every operand that does not
+ *  go through a register resolved to a pointer into the registers, into memory or into the record itself. Running
+ *  the block then only addresses its register-indirect operands.
+ *
+ *  Blocks are kept in the machine by start address. A store into a word the covered map of the machine marks
+ *  frees every block whose code holds the word (see machine_forget), and a block that writes into its own code
+ *  leaves it right after the store.
+ *
+ * Functions:
+ *  machine_run_blocks(): Runs a machine until it stops, a block at a time.
+ *  block_forget(): Frees the blocks whose code holds a word.
+ *  block_cache_clear(): Frees every block of a machine.
+ */
+
+#ifndef _BLOCKCACHE_H
+#define _BLOCKCACHE_H
+#include <stdint.h>
+#include "globals.h"
+#include "emulator.h"
+
+#define BLOCK_MAX_INSNS 64
+/* The most words a block's code can span, the longest instruction being three */
+#define BLOCK_MAX_WORDS (BLOCK_MAX_INSNS * 3)
+
+/** A translated instruction */
+typedef struct block_insn {
+	/** The address of the handler, a label of machine_run_blocks */
+	void *handler;
+	/** Where the operands are read and written, for the operands that are not register-indirect */
+	uint16_t *source;
+	uint16_t *target;
+	/** The register of a register-indirect operand, the value of an immediate one, or a direct jump's address */
+	uint16_t source_value;
+	uint16_t target_value;
+	/** The address of the instruction and of the one after it */
+	uint16_t address;
+	uint16_t next;
+} block_insn;
+
+/** A translated block */
+typedef struct machine_block {
+	/** The block's code: the address of its first instruction, and the address past its last */
+	long start;
+	long end;
+	/** The number of instructions; they are followed by a record that goes on at end, for a block cut short */
+	int count;
+	block_insn insns[];
+} machine_block;
+
+
+/**
+ * Runs a machine from its current address until it executes stop, faults or reaches the step limit, a block at a
+ * time. It runs exactly as machine_run does; when fewer steps are left than the next block holds, it finishes with
+ * machine_run.
+ *
+ * @param vm The machine.
+ * @param step_limit The most instructions to execute, or 0 for no limit.
+ *
+ * @return How the run ended.
+ */
+
+machine_status machine_run_blocks(machine *vm, unsigned long long step_limit);
+
+
+/**
+ * Frees the blocks whose code holds a word.
+ *
+ * @param vm The machine.
+ * @param address The address of the word.
+ */
+
+void block_forget(machine *vm, long address);
+
+
+/**
+ * Frees every block of a machine.
+ *
+ * @param vm The machine.
+ */
+
+void block_cache_clear(machine *vm);
+
+#endif
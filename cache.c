@@ -0,0 +1,409 @@
+/**
+ * File: cache.c
+ *
+ * Description:
+ *  This file contains the result cache declared in cache.h. Every entry is a directory of the cache named by the
+ *  key in hex, holding one file per output (am, ob, ent, ext, obb). Entries are built in a temporary directory
+ *  and renamed into place, so a reader never sees half an entry, and restoring an entry touches its directory so
+ *  that its modification time tells how recently it was used. Trimming rescans the cache directory after every
+ *  store and removes the least recently used entries first.
+ *
+ *  The hash is a small word-at-a-time multiply-rotate hash with a murmur-style finalizer: fast, and good enough
+ *  to tell sources apart, which is all a cache key needs (it is not meant to resist crafted collisions).
+ *
+ * Functions:
+ *  cache_open(): Prepares the cache directory and the part of the key shared by all files.
+ *  cache_restore(): Looks a file up and restores its outputs on a hit.
+ *  cache_store(): Keeps the outputs of a file that assembled cleanly.
+ *  cache_unshare_output(): Detaches an output from the cache before it is rewritten.
+ *  cache_print_stats(): Prints the --cache-stats report.
+ *  hash_bytes(): Hashes a buffer.
+ *  link_or_copy(): Puts a file under a second name.
+ *  remove_entry(): Removes an entry directory with its files.
+ *  trim_cache(): Removes the least recently used entries until the cache fits its size limit.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <utime.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "utils.h"
+#include "source.h"
+#include "writefiles.h"
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define ROTATE_LEFT(value, bits) (((value) << (bits)) | ((value) >> (64 - (bits))))
+
+/* Hex digits in an entry name */
+#define KEY_DIGITS 16
+
+/* The outputs kept for a file; the last one only with --obb */
+static char *output_extensions[] = {".am", ".ob", ".ent", ".ext", ".rel", ".obb"};
+#define OUTPUT_COUNT(options) ((options)->write_binary_object ? 6 : 5)
+
+/* An entry seen while trimming */
+typedef struct cache_entry {
+	char name[KEY_DIGITS + 1];
+	time_t last_used;
+	long size;
+} cache_entry;
+
+static char *cache_directory = NULL;
+static long cache_size_limit;
+/* Hash of everything in the key but the source: version, options and macro library */
+static uint64_t shared_key;
+
+/* The --cache-stats counters, and the lock that also keeps trimming to one thread at a time */
+static long cache_hits = 0, cache_misses = 0, cache_stores = 0, cache_evictions = 0;
+static long bytes_restored = 0, files_linked = 0, files_copied = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/**
+ * Hashes a buffer with the hash used for cache keys: fast, but not meant to resist crafted collisions.
+ *
+ * @param seed The hash of whatever comes before the buffer, or 0.
+ * @param data The bytes to hash.
+ * @param length The number of bytes.
+ *
+ * @return The hash.
+ */
+
+uint64_t hash_bytes(uint64_t seed, const char *data, long length) {
+	uint64_t hash = seed ^ ((uint64_t) length * HASH_PRIME_1), word;
+	long i;
+
+	for (i = 0; i + 8 <= length; i += 8) {
+		memcpy(&word, data + i, 8);
+		hash ^= word * HASH_PRIME_2;
+		hash = ROTATE_LEFT(hash, 31) * HASH_PRIME_1;
+	}
+	word = 0;
+	memcpy(&word, data + i, length - i);
+	hash ^= word * HASH_PRIME_2;
+	hash = ROTATE_LEFT(hash, 31) * HASH_PRIME_1;
+
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+
+/**
+ * Prepares the cache directory (creating it if needed) and hashes the part of the key shared by all files.
+ * Must be called before the other functions, after the macro library is loaded.
+ *
+ * @param options The options; cache_directory must be set.
+ *
+ * @return TRUE if the cache can be used, FALSE otherwise.
+ */
+
+bool cache_open(assembler_options *options) {
+	char settings[64];
+	struct stat dir_stat;
+	source_buffer library;
+
+	if (mkdir(options->cache_directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: can't create the cache directory %s\n", options->cache_directory);
+		return FALSE;
+	}
+	if (stat(options->cache_directory, &dir_stat) != 0 || !S_ISDIR(dir_stat.st_mode)) {
+		fprintf(stderr, "Error: %s is not a directory\n", options->cache_directory);
+		return FALSE;
+	}
+
+	sprintf(settings, "%s line-limit=%d obb=%d", ASSEMBLER_VERSION, options->line_limit,
+	        options->write_binary_object);
+	shared_key = hash_bytes(0, settings, strlen(settings));
+	if (options->macro_library_filename != NULL) {
+		if (!source_open(options->macro_library_filename, &library)) {
+			fprintf(stderr, "Error opening macro library: %s\n", options->macro_library_filename);
+			return FALSE;
+		}
+		shared_key = hash_bytes(shared_key, library.data, library.length);
+		source_close(&library);
+	}
+
+	cache_directory = options->cache_directory;
+	cache_size_limit = options->cache_size_limit;
+	return TRUE;
+}
+
+
+/**
+ * Puts a file under a second name: a hard link when possible, a copy otherwise (e.g. across file systems).
+ * Whatever is at the second name is replaced.
+ *
+ * @param from The existing file.
+ * @param to The second name.
+ *
+ * @return TRUE if the file is now also at the second name, FALSE otherwise.
+ */
+
+static bool link_or_copy(char *from, char *to) {
+	source_buffer contents;
+	bool result;
+	int fd;
+
+	unlink(to);
+	if (link(from, to) == 0) {
+		pthread_mutex_lock(&cache_lock);
+		files_linked++;
+		pthread_mutex_unlock(&cache_lock);
+		return TRUE;
+	}
+
+	if (!source_open(from, &contents)) return FALSE;
+	fd = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	result = fd >= 0 && write_all(fd, contents.data, contents.length);
+	if (fd >= 0) close(fd);
+	source_close(&contents);
+
+	pthread_mutex_lock(&cache_lock);
+	files_copied++;
+	pthread_mutex_unlock(&cache_lock);
+	return result;
+}
+
+
+/**
+ * Computes the key of a file and, if the cache holds its outputs, restores them next to it.
+ *
+ * @param filename The base name of the file (without extension).
+ * @param options The options.
+ * @param key Receives the key, for cache_store on a miss.
+ *
+ * @return TRUE on a hit, when every output was restored; FALSE otherwise, and the file should be assembled.
+ */
+
+bool cache_restore(char *filename, assembler_options *options, cache_key *key) {
+	char *as_filename = strallocat(filename, ".as"), *entry_file, *output_file;
+	source_buffer source;
+	struct stat file_stat;
+	long restored = 0;
+	int i;
+	bool is_hit = TRUE;
+
+	key->valid = source_open(as_filename, &source);
+	free_with_check(as_filename);
+	if (!key->valid) return FALSE;
+	key->hash = hash_bytes(shared_key, source.data, source.length);
+	source_close(&source);
+
+	entry_file = malloc_with_check(strlen(cache_directory) + KEY_DIGITS + 8);
+	for (i = 0; is_hit && i < OUTPUT_COUNT(options); i++) {
+		sprintf(entry_file, "%s/%016llx/%s", cache_directory, (unsigned long long) key->hash,
+		        output_extensions[i] + 1);
+		is_hit = stat(entry_file, &file_stat) == 0;
+		restored += is_hit ? file_stat.st_size : 0;
+	}
+	for (i = 0; is_hit && i < OUTPUT_COUNT(options); i++) {
+		sprintf(entry_file, "%s/%016llx/%s", cache_directory, (unsigned long long) key->hash,
+		        output_extensions[i] + 1);
+		output_file = strallocat(filename, output_extensions[i]);
+		is_hit = link_or_copy(entry_file, output_file);
+		free_with_check(output_file);
+	}
+	if (is_hit) {
+		sprintf(entry_file, "%s/%016llx", cache_directory, (unsigned long long) key->hash);
+		utime(entry_file, NULL);
+	}
+	free_with_check(entry_file);
+
+	pthread_mutex_lock(&cache_lock);
+	if (is_hit) {
+		cache_hits++;
+		bytes_restored += restored;
+	} else {
+		cache_misses++;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	return is_hit;
+}
+
+
+/**
+ * Removes an entry directory with its files.
+ *
+ * @param path The entry directory.
+ */
+
+static void remove_entry(char *path) {
+	DIR *dir = opendir(path);
+	struct dirent *file;
+	char *file_path;
+
+	if (dir != NULL) {
+		while ((file = readdir(dir)) != NULL) {
+			if (file->d_name[0] == '.') continue;
+			file_path = malloc_with_check(strlen(path) + strlen(file->d_name) + 2);
+			sprintf(file_path, "%s/%s", path, file->d_name);
+			unlink(file_path);
+			free_with_check(file_path);
+		}
+		closedir(dir);
+	}
+	rmdir(path);
+}
+
+
+/**
+ * Orders entries from the least to the most recently used.
+ *
+ * @param a The first entry.
+ * @param b The second entry.
+ *
+ * @return Negative, zero or positive, as for qsort.
+ */
+
+static int compare_last_used(const void *a, const void *b) {
+	time_t first = ((cache_entry *) a)->last_used, second = ((cache_entry *) b)->last_used;
+	return first < second ? -1 : first > second;
+}
+
+
+/**
+ * Removes the least recently used entries until the cache fits its size limit. Called with cache_lock held.
+ */
+
+static void trim_cache(void) {
+	DIR *dir = opendir(cache_directory), *entry_dir;
+	struct dirent *item, *file;
+	struct stat file_stat;
+	cache_entry *entries = NULL;
+	long count = 0, capacity = 0, total = 0, i;
+	char *path = malloc_with_check(strlen(cache_directory) + 2 * NAME_MAX + 3);
+
+	if (dir == NULL) {
+		free_with_check(path);
+		return;
+	}
+	while ((item = readdir(dir)) != NULL) {
+		if (strlen(item->d_name) != KEY_DIGITS || strspn(item->d_name, "0123456789abcdef") != KEY_DIGITS) continue;
+		sprintf(path, "%s/%s", cache_directory, item->d_name);
+		if (stat(path, &file_stat) != 0 || (entry_dir = opendir(path)) == NULL) continue;
+
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			entries = realloc_with_check(entries, capacity * sizeof(cache_entry));
+		}
+		strcpy(entries[count].name, item->d_name);
+		entries[count].last_used = file_stat.st_mtime;
+		entries[count].size = 0;
+		while ((file = readdir(entry_dir)) != NULL) {
+			sprintf(path, "%s/%s/%s", cache_directory, item->d_name, file->d_name);
+			if (file->d_name[0] != '.' && stat(path, &file_stat) == 0) entries[count].size += file_stat.st_size;
+		}
+		closedir(entry_dir);
+		total += entries[count++].size;
+	}
+	closedir(dir);
+
+	if (total > cache_size_limit) {
+		qsort(entries, count, sizeof(cache_entry), compare_last_used);
+		for (i = 0; i < count && total > cache_size_limit; i++) {
+			sprintf(path, "%s/%s", cache_directory, entries[i].name);
+			remove_entry(path);
+			total -= entries[i].size;
+			cache_evictions++;
+		}
+	}
+	free_with_check(entries);
+	free_with_check(path);
+}
+
+
+/**
+ * Keeps the outputs of a file that assembled cleanly, then trims the cache to its size limit.
+ * Failures are silent: the cache is only an optimization.
+ *
+ * @param filename The base name of the file (without extension).
+ * @param options The options.
+ * @param key The key computed by cache_restore.
+ */
+
+void cache_store(char *filename, assembler_options *options, cache_key *key) {
+	char *temp_dir, *entry_dir, *entry_file, *output_file;
+	int i;
+	bool is_complete = TRUE;
+
+	if (!key->valid) return;
+
+	temp_dir = malloc_with_check(strlen(cache_directory) + 64);
+	entry_dir = malloc_with_check(strlen(cache_directory) + KEY_DIGITS + 2);
+	entry_file = malloc_with_check(strlen(cache_directory) + 64 + 8);
+	sprintf(temp_dir, "%s/tmp-%ld-%lu", cache_directory, (long) getpid(), (unsigned long) pthread_self());
+	sprintf(entry_dir, "%s/%016llx", cache_directory, (unsigned long long) key->hash);
+
+	if (mkdir(temp_dir, 0777) == 0) {
+		for (i = 0; is_complete && i < OUTPUT_COUNT(options); i++) {
+			sprintf(entry_file, "%s/%s", temp_dir, output_extensions[i] + 1);
+			output_file = strallocat(filename, output_extensions[i]);
+			is_complete = link_or_copy(output_file, entry_file);
+			free_with_check(output_file);
+		}
+		/* Another process may have stored the same entry meanwhile; either copy will do */
+		if (!is_complete || rename(temp_dir, entry_dir) != 0) {
+			remove_entry(temp_dir);
+		} else {
+			pthread_mutex_lock(&cache_lock);
+			cache_stores++;
+			trim_cache();
+			pthread_mutex_unlock(&cache_lock);
+		}
+	}
+
+	free_with_check(temp_dir);
+	free_with_check(entry_dir);
+	free_with_check(entry_file);
+}
+
+
+/**
+ * Detaches an output file from the cache before it is rewritten in place: if the file is a hard link, it is
+ * removed, so that the writer creates a new one.
+ *
+ * @param filename The name of the output file.
+ */
+
+void cache_unshare_output(char *filename) {
+	struct stat file_stat;
+
+	if (stat(filename, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_nlink > 1) {
+		unlink(filename);
+	}
+}
+
+
+/**
+ * Prints the hits, misses, stores, evictions and bytes restored so far.
+ *
+ * @param out The stream to print to.
+ */
+
+void cache_print_stats(FILE *out) {
+	pthread_mutex_lock(&cache_lock);
+	fprintf(out, "%-20s %12s\n", "cache", "value");
+	fprintf(out, "%-20s %12ld\n", "hits", cache_hits);
+	fprintf(out, "%-20s %12ld\n", "misses", cache_misses);
+	fprintf(out, "%-20s %12ld\n", "stores", cache_stores);
+	fprintf(out, "%-20s %12ld\n", "evictions", cache_evictions);
+	fprintf(out, "%-20s %12ld\n", "bytes_restored", bytes_restored);
+	fprintf(out, "%-20s %12ld\n", "files_linked", files_linked);
+	fprintf(out, "%-20s %12ld\n", "files_copied", files_copied);
+	pthread_mutex_unlock(&cache_lock);
+}
@@ -0,0 +1,111 @@
+/**
+ * File: cache.h
+ *
+ * Description:
+ *  This header file declares the on-disk result cache used with --cache-dir. The outputs of a file that assembled
+ *  cleanly (.am, .ob, .ent, .ext, .rel and, with --obb, .obb) are kept in a directory named by a 64-bit hash of the .as
+ *  bytes, ASSEMBLER_VERSION, the options that change the outputs and the macro library. Before assembling a file,
+ *  process_file looks the hash up; on a hit the outputs are hard-linked (or, across file systems, copied) into
+ *  place and the file is not assembled at all.
+ *
+ *  Files that reported warnings or errors are not cached, since a hit would not repeat them. When the cache grows
+ *  past --cache-size, the least recently used entries are removed.
+ *
+ *  Restored outputs share their inode with the cache, so anything that rewrites an output in place calls
+ *  cache_unshare_output first.
+ *
+ * Functions:
+ *  cache_open(): Prepares the cache directory and the part of the key shared by all files.
+ *  cache_restore(): Looks a file up and restores its outputs on a hit.
+ *  cache_store(): Keeps the outputs of a file that assembled cleanly.
+ *  cache_unshare_output(): Detaches an output from the cache before it is rewritten.
+ *  cache_print_stats(): Prints the --cache-stats report.
+ *  hash_bytes(): Hashes a buffer.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+#include <stdio.h>
+#include <stdint.h>
+#include "globals.h"
+
+/** Default of --cache-size */
+#define DEFAULT_CACHE_SIZE_LIMIT (256L * 1024 * 1024)
+
+/** The cache key of a file */
+typedef struct cache_key {
+	/** FALSE when the .as file could not be read, so there is nothing to look up or store */
+	bool valid;
+	uint64_t hash;
+} cache_key;
+
+
+/**
+ * Prepares the cache directory (creating it if needed) and hashes the part of the key shared by all files.
+ * Must be called before the other functions, after the macro library is loaded.
+ *
+ * @param options The options; cache_directory must be set.
+ *
+ * @return TRUE if the cache can be used, FALSE otherwise.
+ */
+
+bool cache_open(assembler_options *options);
+
+
+/**
+ * Computes the key of a file and, if the cache holds its outputs, restores them next to it.
+ *
+ * @param filename The base name of the file (without extension).
+ * @param options The options.
+ * @param key Receives the key, for cache_store on a miss.
+ *
+ * @return TRUE on a hit, when every output was restored; FALSE otherwise, and the file should be assembled.
+ */
+
+bool cache_restore(char *filename, assembler_options *options, cache_key *key);
+
+
+/**
+ * Keeps the outputs of a file that assembled cleanly, then trims the cache to its size limit.
+ * Failures are silent: the cache is only an optimization.
+ *
+ * @param filename The base name of the file (without extension).
+ * @param options The options.
+ * @param key The key computed by cache_restore.
+ */
+
+void cache_store(char *filename, assembler_options *options, cache_key *key);
+
+
+/**
+ * Detaches an output file from the cache before it is rewritten in place: if the file is a hard link, it is
+ * removed, so that the writer creates a new one.
+ *
+ * @param filename The name of the output file.
+ */
+
+void cache_unshare_output(char *filename);
+
+
+/**
+ * Prints the hits, misses, stores, evictions and bytes restored so far.
+ *
+ * @param out The stream to print to.
+ */
+
+void cache_print_stats(FILE *out);
+
+
+/**
+ * Hashes a buffer with the hash used for cache keys: fast, but not meant to resist crafted collisions.
+ *
+ * @param seed The hash of whatever comes before the buffer, or 0.
+ * @param data The bytes to hash.
+ * @param length The number of bytes.
+ *
+ * @return The hash.
+ */
+
+uint64_t hash_bytes(uint64_t seed, const char *data, long length);
+
+#endif
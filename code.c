@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include "code.h"
 #include "utils.h"
+#include "arena.h"
+#include "trace.h"
 
 
 
@@ -58,21 +60,19 @@ bool analyze_operands(line_info line, int i, char **destination, int *operand_co
 	for (*operand_count = 0; line.content[i] != EOF && line.content[i] != '\n' && line.content[i];) {
 		if (*operand_count == 2)  {
 			printf_line_error(line, "Too many operands for operation (got >%d)", *operand_count);
-			free(destination[0]);
-			free(destination[1]);
 			return FALSE; 
 		}
 
-		/*Allocate memory for the current operand*/
-		current_operand = malloc_with_check(MAX_LINE_LENGTH);
-
-		for (j = 0; line.content[i] && line.content[i] != '\t' && line.content[i] != ' ' && line.content[i] != '\n' && line.content[i] != EOF &&
-		            line.content[i] != ','; i++, j++) {
-			current_operand[j] = line.content[i];
-		}
+		/*Measure the current operand, then allocate exactly enough memory for it*/
+		for (j = 0; line.content[i + j] && line.content[i + j] != '\t' && line.content[i + j] != ' ' && line.content[i + j] != '\n' &&
+		            line.content[i + j] != EOF && line.content[i + j] != ','; j++)
+			;
+		current_operand = assembly_alloc(j + 1);
+		memcpy(current_operand, line.content + i, j);
 		current_operand[j] = '\0';
+		i += j;
                 destination[*operand_count] =  current_operand;
-                printf("Operand: %s count: %d, i=%d\n",current_operand, *operand_count, i);
+                TRACE(TRACE_PASS1, "Operand: %s count: %d, i=%d", current_operand, *operand_count, i);
 		(*operand_count)++; 
 		MOVE_TO_NOT_WHITE(line.content, i)
 
@@ -80,11 +80,6 @@ bool analyze_operands(line_info line, int i, char **destination, int *operand_co
 		else if (line.content[i] != ',') {
 			
 			printf_line_error(line, "Expecting ',' between operands");
-
-			free(destination[0]);
-			if (*operand_count > 1) {
-				free(destination[1]);
-			}
 			return FALSE;
 		}
 		i++;
@@ -94,13 +89,7 @@ bool analyze_operands(line_info line, int i, char **destination, int *operand_co
 			printf_line_error(line, "Missing operand after comma.");
 		else if (line.content[i] == ',') printf_line_error(line, "Multiple consecutive commas.");
 		else continue; 
-		{ 
-			free(destination[0]);
-			if (*operand_count > 1) {
-				free(destination[1]);
-			}
-			return FALSE;
-		}
+		return FALSE;
 	}
 	return TRUE;
 }
@@ -265,7 +254,7 @@ code_word *get_code_word(line_info line, opcode curr_opcode, funct curr_funct, i
 	}
 	
 
-	codeword = (code_word *) malloc_with_check(sizeof(code_word));
+	codeword = (code_word *) assembly_alloc(sizeof(code_word));
 	codeword->opcode = curr_opcode;
 	codeword->funct = curr_funct; 
 	codeword->ARE = 4; 
@@ -276,9 +265,6 @@ code_word *get_code_word(line_info line, opcode curr_opcode, funct curr_funct, i
 	codeword->dest_register = second_addressing == REGISTER_ADDR ? get_register_by_name(operands[1]) : 0;
 
 	return codeword;
-error: 
-	free(codeword);
-	return NULL;
 }
 
 
@@ -382,7 +368,7 @@ bool is_register_indirect_addr (char *name) {
  */
 
 data_word *build_data_word_immediate(long value) {
-	data_word *dw = malloc_with_check(sizeof(data_word));
+	data_word *dw = assembly_alloc(sizeof(data_word));
 	dw->ARE = 4;
 	dw->data = value & 0xFFF;
 	return dw;
@@ -398,7 +384,7 @@ data_word *build_data_word_immediate(long value) {
  */
 
 data_word *build_data_word_register(int reg) {
-	data_word *dw = malloc_with_check(sizeof(data_word));
+	data_word *dw = assembly_alloc(sizeof(data_word));
 	dw->ARE = 4;
 	dw->data = reg & 0xF;
 	return dw;
@@ -408,6 +394,7 @@ data_word *build_data_word_register(int reg) {
 
 /**
  * Builds a data word for a direct address (e.g., label or symbol).
+ * The word is marked relocatable, or external for an external symbol, so that a linker can find the addresses.
  *
  * @param value - The address or value associated with the symbol.
  * @param is_extern_symbol - Boolean flag indicating if the symbol is external.
@@ -416,25 +403,11 @@ data_word *build_data_word_register(int reg) {
  */
 
 data_word *build_data_word_direct(long value, bool is_extern_symbol) {
-	data_word *dw = malloc_with_check(sizeof(data_word));
-	dw->ARE = is_extern_symbol ? 1 : 4;
+	data_word *dw = assembly_alloc(sizeof(data_word));
+	dw->ARE = is_extern_symbol ? ARE_EXTERNAL : ARE_RELOCATABLE;
 	dw->data = value & 0xFFF;
 	return dw;
 }
 
 
-/**
- * Frees the memory allocated for operand strings.
- *
- * @param operand1 - Pointer to the first operand string.
- * @param operand2 - Pointer to the second operand string.
- */
-
-void free_operands(char *operand1, char *operand2) {
-
-	if (operand1) free(operand1);
-	if (operand2) free(operand2);
-}
-
-
 
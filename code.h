@@ -6,7 +6,7 @@
  * - Retrieving opcode and function codes.
  * - Determining addressing types.
  * - Building code and data words from operands.
- * - Analyzing and freeing operands.
+ * - Analyzing operands. Operand strings and words are allocated from the current arena (see arena.h).
  */
 
 #ifndef _CODE_H
@@ -88,6 +88,7 @@ data_word *build_data_word_register(int reg);
 
 /**
  * Builds a data word for a direct address (e.g., label or symbol).
+ * The word is marked relocatable, or external for an external symbol, so that a linker can find the addresses.
  *
  * @param value - The address or value associated with the symbol.
  * @param is_extern_symbol - Boolean flag indicating if the symbol is external.
@@ -113,14 +114,5 @@ data_word *build_data_word_direct(long value, bool is_extern_symbol) ;
 
 bool analyze_operands(line_info line, int i, char **destination, int *operand_count, char *command);
 
-/**
- * Frees the memory allocated for operand strings.
- *
- * @param operand1 - Pointer to the first operand string.
- * @param operand2 - Pointer to the second operand string.
- */
-
-void free_operands(char *operand1, char *operand2);
-
 #endif
 
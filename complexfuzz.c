@@ -0,0 +1,551 @@
+/**
+ * File: complexfuzz.c
+ *
+ * Description:
+ *  This file contains the complexity fuzzer, which hunts for inputs on which the assembler's work grows faster
+ *  than the input. It measures the work counters of --stats (symbol_probes, table_steps, macro_probes and
+ *  bytes_scanned) rather than wall time, so that its findings are exact and repeatable on any machine.
+ *
+ *  Every iteration takes a seed source and a mix of mutations, each of which inserts one small valid construct:
+ *  a label, a labelled .data, an .extern, a reference to an external, an .entry and its label, a macro and an
+ *  invocation of it, a comment, or a label referring to itself. The mix is grown to STEP_COUNT sizes, doubling
+ *  each time; the smaller sources are prefixes of the larger ones (the same units at the same places), so only
+ *  the size changes. Each size is assembled, and the growth exponent of each counter over the seed alone is the
+ *  slope of a log-log fit: 1 is linear, 2 quadratic. A counter whose exponent exceeds --limit is a finding; the
+ *  largest source of the iteration is kept as a reproducer.
+ *
+ *  The first iterations use one mutation each, so that each construct's own cost is reported, and the rest use
+ *  random mixes. The sizes stay within the image limit of a single file (see SRCGEN_WORD_BUDGET).
+ *
+ *  Usage: complexfuzz [options] [seed.as ...]
+ *   --iterations=<n>   Iterations (default: 32).
+ *   --seed=<n>         Seed of the random choices.
+ *   --limit=<x>        Growth exponent reported as superlinear (default: 1.5).
+ *   --max-units=<n>    Mutations in the largest source (default: 1024).
+ *   --seed-lines=<n>   Lines of the generated seeds, used when no seed file is given (default: 80).
+ *   --dir=<dir>        Where the sources are written and the reproducers kept (default: complexfuzz.tmp).
+ *
+ *  The exit code is 1 if anything superlinear was found, so that a fixed --seed run serves as a regression test.
+ *
+ * Functions:
+ *  load_seed() / generate_seed(): Read a seed file or generate one.
+ *  choose_mix(): Picks the mutations of an iteration.
+ *  write_mutant(): Writes a seed grown by a number of mutations.
+ *  assemble(): Assembles a source and returns its counters.
+ *  growth_exponent(): Fits the growth of a counter.
+ *  run_iteration(): Grows, assembles and fits one iteration.
+ *  main(): Entry point of the complexity fuzzer.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "globals.h"
+#include "utils.h"
+#include "process_file.h"
+#include "source.h"
+#include "srcgen.h"
+#include "stats.h"
+#include "cache.h"
+#include "arena.h"
+
+#define DEFAULT_ITERATIONS 32
+#define DEFAULT_LIMIT 1.5
+#define DEFAULT_MAX_UNITS 1024
+#define DEFAULT_SEED_LINES 80
+#define GENERATED_SEEDS 4
+#define MAX_SEEDS 64
+/** Sizes per iteration, each twice the previous one */
+#define STEP_COUNT 4
+/** Smallest number of mutations at the first size for a fit to mean anything */
+#define MIN_BASE_UNITS 8
+
+/** The mutations */
+typedef enum mutation {
+	MUTATE_LABEL,
+	MUTATE_DATA,
+	MUTATE_EXTERN,
+	MUTATE_EXTERN_REFERENCE,
+	MUTATE_ENTRY,
+	MUTATE_MACRO,
+	MUTATE_COMMENT,
+	MUTATE_SELF_REFERENCE,
+	MUTATION_COUNT
+} mutation;
+
+static char *mutation_names[MUTATION_COUNT] = {
+		"label", "data", "extern", "extern_ref", "entry", "macro", "comment", "self_ref"
+};
+
+/** Words each mutation adds to the images */
+static int mutation_words[MUTATION_COUNT] = {1, 1, 0, 2, 1, 2, 0, 2};
+
+/** The counters fitted */
+static counter fitted_counters[] = {
+		COUNTER_SYMBOL_PROBES, COUNTER_TABLE_STEPS, COUNTER_MACRO_PROBES, COUNTER_BYTES_SCANNED
+};
+static char *fitted_names[] = {"symbol_probes", "table_steps", "macro_probes", "bytes_scanned"};
+
+#define FITTED_COUNT ((int) (sizeof(fitted_counters) / sizeof(fitted_counters[0])))
+
+/** A seed source, split into lines */
+typedef struct seed_source {
+	source_buffer text;
+	char **lines;
+	long line_count;
+	/** Whether a mutation may be inserted before each line (not inside a macro definition); one more for the end */
+	bool *insertable;
+	/** Words and counters of the seed alone */
+	long words;
+	long counters[FITTED_COUNT];
+} seed_source;
+
+/** The command line of the fuzzer */
+typedef struct fuzz_options {
+	int iterations;
+	uint64_t seed;
+	double limit;
+	long max_units;
+	long seed_lines;
+	char *directory;
+} fuzz_options;
+
+static assembler_options assembler;
+
+
+/**
+ * Advances a random state (xorshift64*).
+ *
+ * @param state The state.
+ *
+ * @return 64 random bits.
+ */
+
+static uint64_t next_random(uint64_t *state) {
+	if (*state == 0) *state = 0x9E3779B97F4A7C15ULL;
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+	return *state * 2685821657736338717ULL;
+}
+
+
+/**
+ * Assembles a source and returns the values its assembly added to the fitted counters.
+ *
+ * @param base_name The source's name without the .as extension.
+ * @param counters Receives the counters.
+ * @param words Receives the words of the images, or NULL.
+ *
+ * @return TRUE if the source assembled without errors.
+ */
+
+static bool assemble(char *base_name, long *counters, long *words) {
+	static char *extensions[] = {".am", ".ob", ".ent", ".ext", ".rel"};
+	long before[COUNTER_COUNT];
+	char *name;
+	bool succeeded;
+	int i;
+
+	memcpy(before, stats_counters, sizeof(before));
+	succeeded = process_file(base_name, &assembler);
+	arena_trim();
+	for (i = 0; i < FITTED_COUNT; i++) counters[i] = stats_counters[fitted_counters[i]] - before[fitted_counters[i]];
+	if (words != NULL) *words = stats_counters[COUNTER_WORDS] - before[COUNTER_WORDS];
+
+	for (i = 0; i < (int) (sizeof(extensions) / sizeof(extensions[0])); i++) {
+		name = strallocat(base_name, extensions[i]);
+		unlink(name);
+		free_with_check(name);
+	}
+	return succeeded;
+}
+
+
+/**
+ * Splits a seed into lines, marks where mutations may go, and assembles it alone.
+ *
+ * @param options The options.
+ * @param filename The seed's .as file.
+ * @param seed Receives the seed.
+ *
+ * @return TRUE if the seed was read and assembles without errors.
+ */
+
+static bool load_seed(fuzz_options *options, char *filename, seed_source *seed) {
+	char base_name[FILENAME_MAX], *copy;
+	long offset = 0, capacity = 64;
+	bool in_macro = FALSE;
+	line_info line;
+	FILE *out;
+
+	if (!source_open(filename, &seed->text)) {
+		fprintf(stderr, "Error: can't read the seed %s\n", filename);
+		return FALSE;
+	}
+	seed->lines = malloc_with_check(capacity * sizeof(char *));
+	seed->insertable = malloc_with_check((capacity + 1) * sizeof(bool));
+	seed->line_count = 0;
+	while (source_next_line(&seed->text, &offset, &line)) {
+		if (seed->line_count == capacity) {
+			capacity *= 2;
+			seed->lines = realloc_with_check(seed->lines, capacity * sizeof(char *));
+			seed->insertable = realloc_with_check(seed->insertable, (capacity + 1) * sizeof(bool));
+		}
+		seed->insertable[seed->line_count] = !in_macro;
+		seed->lines[seed->line_count++] = line.content;
+		if (strncmp(line.content, "macr ", 5) == 0) in_macro = TRUE;
+		else if (strstr(line.content, "endmacr") != NULL) in_macro = FALSE;
+	}
+	seed->insertable[seed->line_count] = TRUE;
+
+	/* Assembled from a copy, so that a seed file given on the command line is left alone */
+	snprintf(base_name, sizeof(base_name), "%s/seed", options->directory);
+	copy = strallocat(base_name, ".as");
+	if ((out = fopen(copy, "w")) == NULL) {
+		fprintf(stderr, "Error: can't create %s: %s\n", copy, strerror(errno));
+		free_with_check(copy);
+		return FALSE;
+	}
+	for (offset = 0; offset < seed->line_count; offset++) fprintf(out, "%s\n", seed->lines[offset]);
+	fclose(out);
+	if (!assemble(base_name, seed->counters, &seed->words)) {
+		fprintf(stderr, "Error: the seed %s does not assemble without errors\n", filename);
+		unlink(copy);
+		free_with_check(copy);
+		return FALSE;
+	}
+	unlink(copy);
+	free_with_check(copy);
+	return TRUE;
+}
+
+
+/**
+ * Generates a seed with srcgen and loads it.
+ *
+ * @param options The options.
+ * @param index The number of the seed, which also seeds the generator.
+ * @param seed Receives the seed.
+ *
+ * @return TRUE if the seed was generated and loaded.
+ */
+
+static bool generate_seed(fuzz_options *options, int index, seed_source *seed) {
+	char name[FILENAME_MAX];
+	srcgen_config shape;
+	long words;
+	FILE *out;
+
+	snprintf(name, sizeof(name), "%s/generated_seed%d.as", options->directory, index);
+	if ((out = fopen(name, "w")) == NULL) {
+		fprintf(stderr, "Error: can't create %s: %s\n", name, strerror(errno));
+		return FALSE;
+	}
+	srcgen_defaults(&shape);
+	shape.seed = options->seed + index + 1;
+	srcgen_write_module(out, &shape, options->seed_lines, &words);
+	fclose(out);
+	/* The seed's lines are read into memory, so the file can go */
+	if (!load_seed(options, name, seed)) return FALSE;
+	unlink(name);
+	return TRUE;
+}
+
+
+/**
+ * Picks the mutations of an iteration: the first MUTATION_COUNT iterations use one mutation each, the others a
+ * random subset with random weights.
+ *
+ * @param iteration The iteration.
+ * @param state The random state.
+ * @param weights Receives the weight of each mutation; they sum to 1.
+ */
+
+static void choose_mix(int iteration, uint64_t *state, double *weights) {
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < MUTATION_COUNT; i++) {
+		if (iteration < MUTATION_COUNT) weights[i] = i == iteration;
+		else weights[i] = next_random(state) % 2 ? (double) (1 + next_random(state) % 4) : 0;
+		sum += weights[i];
+	}
+	if (sum == 0) weights[next_random(state) % MUTATION_COUNT] = sum = 1;
+	for (i = 0; i < MUTATION_COUNT; i++) weights[i] /= sum;
+}
+
+
+/**
+ * Writes a seed grown by a number of mutations. The units are drawn from a generator reseeded with unit_seed,
+ * so that the first units, and where they go, are the same whatever the number.
+ *
+ * @param out The stream to write the source to.
+ * @param seed The seed.
+ * @param weights The weight of each mutation.
+ * @param unit_seed The seed of the units.
+ * @param units The number of mutations.
+ */
+
+static void write_mutant(FILE *out, seed_source *seed, double *weights, uint64_t unit_seed, long units) {
+	mutation *kinds = malloc_with_check(units * sizeof(mutation));
+	long *gaps = malloc_with_check(units * sizeof(long)), j, gap;
+	uint64_t state = unit_seed;
+	double pick;
+	int kind;
+
+	for (j = 0; j < units; j++) {
+		pick = (next_random(&state) >> 11) * (1.0 / 9007199254740992.0);
+		for (kind = 0; kind < MUTATION_COUNT - 1 && (pick -= weights[kind]) >= 0; kind++);
+		/* Rounding may leave the pick past the last weight; keep to a mutation of the mix */
+		while (weights[kind] == 0) kind--;
+		kinds[j] = kind;
+		do gaps[j] = (long) (next_random(&state) % (uint64_t) (seed->line_count + 1));
+		while (!seed->insertable[gaps[j]]);
+	}
+
+	/* Declarations and definitions first, statements in their gaps, .entry declarations last */
+	for (j = 0; j < units; j++) {
+		if (kinds[j] == MUTATE_EXTERN) fprintf(out, ".extern Qx%ld\n", j);
+		else if (kinds[j] == MUTATE_EXTERN_REFERENCE) fprintf(out, ".extern Qr%ld\n", j);
+		else if (kinds[j] == MUTATE_MACRO) fprintf(out, "macr Qm%ld\n inc r1\nendmacr\n", j);
+	}
+	for (gap = 0; gap <= seed->line_count; gap++) {
+		for (j = 0; j < units; j++) {
+			if (gaps[j] != gap) continue;
+			switch (kinds[j]) {
+				case MUTATE_LABEL:
+					fprintf(out, "Ql%ld: stop\n", j);
+					break;
+				case MUTATE_DATA:
+					fprintf(out, "Qd%ld: .data %ld\n", j, j);
+					break;
+				case MUTATE_EXTERN_REFERENCE:
+					fprintf(out, " jmp Qr%ld\n", j);
+					break;
+				case MUTATE_ENTRY:
+					fprintf(out, "Qe%ld: rts\n", j);
+					break;
+				case MUTATE_MACRO:
+					fprintf(out, " Qm%ld\n", j);
+					break;
+				case MUTATE_COMMENT:
+					fprintf(out, "; filler %ld\n", j);
+					break;
+				case MUTATE_SELF_REFERENCE:
+					fprintf(out, "Qy%ld: jmp Qy%ld\n", j, j);
+					break;
+				default:
+					break;
+			}
+		}
+		if (gap < seed->line_count) fprintf(out, "%s\n", seed->lines[gap]);
+	}
+	for (j = 0; j < units; j++) {
+		if (kinds[j] == MUTATE_ENTRY) fprintf(out, ".entry Qe%ld\n", j);
+	}
+
+	free_with_check(kinds);
+	free_with_check(gaps);
+}
+
+
+/**
+ * Fits the growth of a counter: the slope of the logarithm of its value, over the seed's, against the logarithm
+ * of the number of mutations.
+ *
+ * @param units The number of mutations of each size.
+ * @param costs The counter's value at each size, over the seed's.
+ *
+ * @return The exponent, or 0 if the counter did not grow by at least one per mutation (too little to fit).
+ */
+
+static double growth_exponent(long *units, long *costs) {
+	double x, y, sum_x = 0, sum_y = 0, sum_xx = 0, sum_xy = 0;
+	int i;
+
+	if (costs[STEP_COUNT - 1] < units[STEP_COUNT - 1]) return 0;
+	for (i = 0; i < STEP_COUNT; i++) {
+		if (costs[i] <= 0) return 0;
+		x = log((double) units[i]);
+		y = log((double) costs[i]);
+		sum_x += x;
+		sum_y += y;
+		sum_xx += x * x;
+		sum_xy += x * y;
+	}
+	return (STEP_COUNT * sum_xy - sum_x * sum_y) / (STEP_COUNT * sum_xx - sum_x * sum_x);
+}
+
+
+/**
+ * Runs one iteration: grows the seed by the mix to STEP_COUNT sizes, assembles each and fits every counter.
+ * Prints the iteration, and keeps the largest source when a counter grows faster than the limit.
+ *
+ * @param options The options.
+ * @param iteration The iteration.
+ * @param seed The seed.
+ * @param weights The weight of each mutation.
+ * @param unit_seed The seed of the units.
+ * @param worst The largest exponent of each counter so far; updated.
+ *
+ * @return TRUE if a counter grew faster than the limit.
+ */
+
+static bool run_iteration(fuzz_options *options, int iteration, seed_source *seed, double *weights,
+                          uint64_t unit_seed, double *worst) {
+	char base_name[FILENAME_MAX], *source_name, *kept_name;
+	long units[STEP_COUNT], costs[FITTED_COUNT][STEP_COUNT], counters[FITTED_COUNT], largest;
+	double words_per_unit = 0, exponent;
+	bool superlinear = FALSE, first = TRUE;
+	int i, step;
+	FILE *out;
+
+	for (i = 0; i < MUTATION_COUNT; i++) words_per_unit += weights[i] * mutation_words[i];
+	largest = options->max_units;
+	if (words_per_unit > 0 && (SRCGEN_WORD_BUDGET - seed->words) / words_per_unit < largest) {
+		largest = (long) ((SRCGEN_WORD_BUDGET - seed->words) / words_per_unit);
+	}
+	if (largest >> (STEP_COUNT - 1) < MIN_BASE_UNITS) {
+		printf("%4d  skipped: the seed leaves no room in the images\n", iteration);
+		return FALSE;
+	}
+
+	snprintf(base_name, sizeof(base_name), "%s/mutant%d", options->directory, iteration);
+	source_name = strallocat(base_name, ".as");
+	for (step = 0; step < STEP_COUNT; step++) {
+		units[step] = largest >> (STEP_COUNT - 1 - step);
+		if ((out = fopen(source_name, "w")) == NULL) {
+			fprintf(stderr, "Error: can't create %s: %s\n", source_name, strerror(errno));
+			free_with_check(source_name);
+			return FALSE;
+		}
+		write_mutant(out, seed, weights, unit_seed, units[step]);
+		fclose(out);
+		if (!assemble(base_name, counters, NULL)) {
+			printf("%4d  error: %s (%ld mutations) does not assemble; kept for inspection\n", iteration,
+			       source_name, units[step]);
+			free_with_check(source_name);
+			return FALSE;
+		}
+		for (i = 0; i < FITTED_COUNT; i++) costs[i][step] = counters[i] - seed->counters[i];
+	}
+
+	printf("%4d  ", iteration);
+	for (i = 0; i < MUTATION_COUNT; i++) {
+		if (weights[i] > 0) {
+			printf("%s%s=%.2f", first ? "" : ",", mutation_names[i], weights[i]);
+			first = FALSE;
+		}
+	}
+	printf("  units %ld..%ld ", units[0], units[STEP_COUNT - 1]);
+	for (i = 0; i < FITTED_COUNT; i++) {
+		exponent = growth_exponent(units, costs[i]);
+		if (exponent > worst[i]) worst[i] = exponent;
+		if (exponent > 0) printf(" %s^%.2f%s", fitted_names[i], exponent, exponent > options->limit ? "!" : "");
+		superlinear |= exponent > options->limit;
+	}
+
+	if (superlinear) {
+		snprintf(base_name, sizeof(base_name), "%s/superlinear%d.as", options->directory, iteration);
+		kept_name = base_name;
+		rename(source_name, kept_name);
+		printf("  -> %s", kept_name);
+	} else {
+		unlink(source_name);
+	}
+	printf("\n");
+	fflush(stdout);
+	free_with_check(source_name);
+	return superlinear;
+}
+
+
+/**
+ * Main function of the complexity fuzzer.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file, then the seed files.
+ *
+ * @return int - 0 if no superlinear growth was found, 1 otherwise.
+ */
+
+int main(int argc, char *argv[]) {
+	seed_source seeds[MAX_SEEDS];
+	fuzz_options options;
+	double weights[MUTATION_COUNT], worst[FITTED_COUNT];
+	uint64_t state;
+	int i, seed_count = 0, findings = 0;
+
+	options.iterations = DEFAULT_ITERATIONS;
+	options.seed = 1;
+	options.limit = DEFAULT_LIMIT;
+	options.max_units = DEFAULT_MAX_UNITS;
+	options.seed_lines = DEFAULT_SEED_LINES;
+	options.directory = "complexfuzz.tmp";
+	for (i = 1; i < argc && strncmp(argv[i], "--", 2) == 0; i++) {
+		if (strncmp(argv[i], "--iterations=", 13) == 0) options.iterations = atoi(argv[i] + 13);
+		else if (strncmp(argv[i], "--seed=", 7) == 0) options.seed = strtoull(argv[i] + 7, NULL, 10);
+		else if (strncmp(argv[i], "--limit=", 8) == 0) options.limit = atof(argv[i] + 8);
+		else if (strncmp(argv[i], "--max-units=", 12) == 0) options.max_units = atol(argv[i] + 12);
+		else if (strncmp(argv[i], "--seed-lines=", 13) == 0) options.seed_lines = atol(argv[i] + 13);
+		else if (strncmp(argv[i], "--dir=", 6) == 0) options.directory = argv[i] + 6;
+		else {
+			fprintf(stderr, "Error: unknown option %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (options.iterations < 1 || options.limit <= 0 || options.max_units < MIN_BASE_UNITS << (STEP_COUNT - 1) ||
+	    options.seed_lines < 1) {
+		fprintf(stderr, "Error: --iterations, --limit and --seed-lines must be positive, --max-units at least %d\n",
+		        MIN_BASE_UNITS << (STEP_COUNT - 1));
+		return 1;
+	}
+	if (mkdir(options.directory, 0777) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Error: can't create %s: %s\n", options.directory, strerror(errno));
+		return 1;
+	}
+
+	init_assembler_options(&assembler);
+
+	for (; i < argc && seed_count < MAX_SEEDS; i++) {
+		if (load_seed(&options, argv[i], &seeds[seed_count])) seed_count++;
+	}
+	if (seed_count == 0) {
+		for (i = 0; i < GENERATED_SEEDS; i++) {
+			if (generate_seed(&options, i, &seeds[seed_count])) seed_count++;
+		}
+	}
+	if (seed_count == 0) {
+		fprintf(stderr, "Error: no seed assembles without errors\n");
+		return 1;
+	}
+
+	for (i = 0; i < FITTED_COUNT; i++) worst[i] = 0;
+	state = options.seed;
+	printf("iter  mutations  units  growth exponents (! above %.2f)\n", options.limit);
+	for (i = 0; i < options.iterations; i++) {
+		choose_mix(i, &state, weights);
+		findings += run_iteration(&options, i, &seeds[next_random(&state) % seed_count], weights,
+		                          next_random(&state), worst);
+	}
+
+	printf("\nLargest growth exponents:");
+	for (i = 0; i < FITTED_COUNT; i++) printf(" %s^%.2f", fitted_names[i], worst[i]);
+	printf("\n%d of %d iteration(s) grew faster than n^%.2f.\n", findings, options.iterations, options.limit);
+	if (findings == 0) rmdir(options.directory);
+
+	for (i = 0; i < seed_count; i++) {
+		source_close(&seeds[i].text);
+		free_with_check(seeds[i].lines);
+		free_with_check(seeds[i].insertable);
+	}
+	return findings > 0 ? 1 : 0;
+}
@@ -0,0 +1,410 @@
+/**
+ * File: emulator.c
+ *
+ * Description:
+ *  This file contains the emulator declared in emulator.h. The run loop dispatches on the decoded op of the current
+ *  address through a table of label addresses (computed goto), so an instruction costs one indirect jump and no
+ *  decoding once it has run.
+ *
+ *  The first word of an instruction holds its opcode in bits 10-13, the addressing type of its first operand in
+ *  bits 8-9 and of its second in bits 6-7 (see get_word_value); the operands themselves are in the extra words.
+ *
+ * Functions:
+ *  machine_init(): Prepares a machine for its first use.
+ *  machine_release(): Frees what a machine holds.
+ *  machine_reset(): Clears the memory, the registers and the decoded instructions of a machine.
+ *  machine_load(): Loads an assembled image into a machine.
+ *  machine_decode(): Decodes the instruction at an address.
+ *  machine_forget(): Drops the decoded instructions and the blocks that cover a word.
+ *  machine_run(): Runs a machine until it stops.
+ *  decode_operand(): Reads an operand from its extra word.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include "emulator.h"
+#include "blockcache.h"
+#include "linker.h"
+#include "arena.h"
+
+#define IS_REGISTER_MODE(mode) ((mode) == REGISTER_ADDR || (mode) == REGISTER_INDIRECT_ADDR)
+
+
+/**
+ * Prepares a machine for its first use: it holds no blocks, and is reset.
+ *
+ * @param vm The machine.
+ */
+
+void machine_init(machine *vm) {
+	memset(vm->blocks, 0, sizeof(vm->blocks));
+	machine_reset(vm);
+}
+
+
+/**
+ * Frees the translated blocks a machine holds. The machine can be used again after machine_init.
+ *
+ * @param vm The machine.
+ */
+
+void machine_release(machine *vm) {
+	block_cache_clear(vm);
+}
+
+
+/**
+ * Clears the memory, the registers, the flag, the stack, the decoded instructions and the translated blocks of a
+ * machine, and points it at IC_INIT_VALUE.
+ *
+ * @param vm The machine.
+ */
+
+void machine_reset(machine *vm) {
+	long i;
+
+	block_cache_clear(vm);
+	memset(vm->covered, 0, sizeof(vm->covered));
+	memset(vm->memory, 0, sizeof(vm->memory));
+	memset(vm->registers, 0, sizeof(vm->registers));
+	for (i = 0; i <= MACHINE_MEMORY_SIZE; i++) vm->ops[i].handler = MACHINE_OP_UNDECODED;
+	vm->zero = FALSE;
+	vm->pc = IC_INIT_VALUE;
+	vm->stack_depth = 0;
+	vm->code_end = vm->data_end = IC_INIT_VALUE;
+	vm->executed = 0;
+}
+
+
+/**
+ * Resets a machine and loads an assembled image into it, read as asmlink reads a module: <base_name>.obb, or
+ * <base_name>.ob with its .rel file. An image with externals must be linked first. The machine must have been
+ * prepared with machine_init.
+ *
+ * @param base_name The image's name, without extension.
+ * @param vm The machine.
+ *
+ * @return TRUE if the image was loaded, FALSE if it could not be read, has externals or does not fit in memory (the
+ *         error is printed).
+ */
+
+bool machine_load(char *base_name, machine *vm) {
+	link_module module;
+	arena load_arena;
+	arena *previous_arena;
+	bool is_success;
+	long i;
+
+	arena_init(&load_arena);
+	previous_arena = arena_select(&load_arena);
+	is_success = link_load_module(base_name, &module);
+	if (is_success && module.extern_count > 0) {
+		fprintf(stderr, "Error: %s refers to external %s; link it first\n", base_name, module.externs[0].name);
+		is_success = FALSE;
+	}
+	if (is_success && IC_INIT_VALUE + module.code_length + module.data_length > MACHINE_MEMORY_SIZE) {
+		fprintf(stderr, "Error: %s does not fit in the %d words of memory\n", base_name, MACHINE_MEMORY_SIZE);
+		is_success = FALSE;
+	}
+	if (is_success) {
+		machine_reset(vm);
+		for (i = 0; i < module.code_length + module.data_length; i++) {
+			vm->memory[IC_INIT_VALUE + i] = module.words[i] & MACHINE_WORD_MASK;
+		}
+		vm->code_end = IC_INIT_VALUE + module.code_length;
+		vm->data_end = vm->code_end + module.data_length;
+	}
+	arena_select(previous_arena);
+	arena_release(&load_arena);
+	return is_success;
+}
+
+
+/**
+ * Reads an operand from its extra word: an immediate value sign-extended from 12 to 15 bits, an address, or a
+ * register number.
+ *
+ * @param mode The operand's addressing type.
+ * @param word The extra word.
+ *
+ * @return The operand.
+ */
+
+static uint16_t decode_operand(int mode, unsigned int word) {
+	unsigned int field = (word >> 3) & 0xFFF;
+
+	if (mode == IMMEDIATE_ADDR) return (field & 0x800) ? (field | 0x7000) : field;
+	if (mode == DIRECT_ADDR) return field;
+	return field & 7;
+}
+
+
+/**
+ * Decodes the instruction at an address. An instruction that is not one the assembler could produce, that writes
+ * to an immediate operand, or that runs past the end of memory, is decoded as illegal.
+ *
+ * @param memory The machine's memory.
+ * @param address The address of the instruction.
+ * @param op Receives the decoded instruction.
+ */
+
+void machine_decode(const uint16_t *memory, long address, machine_op *op) {
+	unsigned int word, opcode, extra;
+
+	memset(op, 0, sizeof(machine_op));
+	op->handler = MACHINE_OP_ILLEGAL;
+	op->length = 1;
+	if (address >= MACHINE_MEMORY_SIZE) return;
+	word = memory[address];
+	/* Every first word is absolute, and no opcode reaches bit 14 */
+	if ((word & 7) != ARE_ABSOLUTE || (word >> 14) != 0) return;
+	opcode = (word >> 10) & 0xF;
+
+	if (opcode <= LEA_OP) {
+		op->source_mode = (word >> 8) & 3;
+		op->target_mode = (word >> 6) & 3;
+		if (IS_REGISTER_MODE(op->source_mode) && IS_REGISTER_MODE(op->target_mode)) {
+			/* Both registers share one word: the source's in bits 3-6, the target's in bits 9-12 */
+			if (address + 1 >= MACHINE_MEMORY_SIZE) return;
+			extra = memory[address + 1];
+			op->source = (extra >> 3) & 7;
+			op->target = (extra >> 9) & 7;
+			op->length = 2;
+		} else {
+			if (address + 2 >= MACHINE_MEMORY_SIZE) return;
+			op->source = decode_operand(op->source_mode, memory[address + 1]);
+			op->target = decode_operand(op->target_mode, memory[address + 2]);
+			op->length = 3;
+		}
+		if (op->target_mode == IMMEDIATE_ADDR && opcode != CMP_OP) return;
+		if (opcode == LEA_OP && op->source_mode != DIRECT_ADDR && op->source_mode != REGISTER_INDIRECT_ADDR) return;
+	} else if (opcode <= JSR_OP) {
+		op->target_mode = (word >> 8) & 3;
+		if (address + 1 >= MACHINE_MEMORY_SIZE) return;
+		op->target = decode_operand(op->target_mode, memory[address + 1]);
+		op->length = 2;
+		if (opcode == JMP_OP || opcode == BNE_OP || opcode == JSR_OP) {
+			if (op->target_mode != DIRECT_ADDR && op->target_mode != REGISTER_INDIRECT_ADDR) return;
+		} else if (opcode != PRN_OP && op->target_mode == IMMEDIATE_ADDR) return;
+	}
+	op->handler = opcode;
+}
+
+
+/**
+ * Drops the decoded instructions and the translated blocks that cover a word, before or after it is written. The
+ * decoded instructions that could cover it start at most two words before it, the longest instruction being three.
+ *
+ * @param vm The machine.
+ * @param address The address of the word.
+ */
+
+void machine_forget(machine *vm, long address) {
+	long i;
+
+	for (i = address >= 2 ? address - 2 : 0; i <= address; i++) vm->ops[i].handler = MACHINE_OP_UNDECODED;
+	block_forget(vm, address);
+	vm->covered[address] = 0;
+}
+
+
+/* Points location at an operand: the op's own field for an immediate, else a register or a memory word */
+#define OPERAND(mode, field, location) do { \
+	switch (mode) { \
+		case IMMEDIATE_ADDR: location = &(field); break; \
+		case DIRECT_ADDR: location = &memory[field]; break; \
+		case REGISTER_INDIRECT_ADDR: \
+			if (registers[field] >= MACHINE_MEMORY_SIZE) goto bad_address; \
+			location = &memory[registers[field]]; \
+			break; \
+		default: location = &registers[field]; \
+	} \
+} while (0)
+
+/* Writes a value to an operand located by OPERAND, dropping what covers a memory word */
+#define STORE(mode, location, value) do { \
+	*(location) = (value) & MACHINE_WORD_MASK; \
+	if ((mode) != REGISTER_ADDR && covered[(location) - memory]) machine_forget(vm, (location) - memory); \
+} while (0)
+
+/* Sets address to the address an operand names: the direct address, or the register's value */
+#define ADDRESS(mode, field, address) do { \
+	address = (mode) == DIRECT_ADDR ? (field) : registers[field]; \
+	if (address >= MACHINE_MEMORY_SIZE) goto bad_address; \
+} while (0)
+
+/* Goes to the handler of the instruction at pc */
+#define DISPATCH() do { \
+	if (remaining == 0) goto step_limit; \
+	remaining--; \
+	op = &ops[pc]; \
+	goto *handlers[op->handler]; \
+} while (0)
+
+
+/**
+ * Runs a machine from its current address until it executes stop, faults or reaches the step limit.
+ *
+ * @param vm The machine.
+ * @param step_limit The most instructions to execute, or 0 for no limit.
+ *
+ * @return How the run ended.
+ */
+
+machine_status machine_run(machine *vm, unsigned long long step_limit) {
+	static void *const handlers[] = {
+		&&op_mov, &&op_cmp, &&op_add, &&op_sub, &&op_lea, &&op_clr, &&op_not, &&op_inc, &&op_dec,
+		&&op_jmp, &&op_bne, &&op_red, &&op_prn, &&op_jsr, &&op_rts, &&op_stop,
+		&&op_decode, &&op_illegal
+	};
+	uint16_t *memory = vm->memory, *registers = vm->registers, *source, *target;
+	uint8_t *covered = vm->covered;
+	machine_op *ops = vm->ops, *op;
+	unsigned long long budget = step_limit == 0 ? ULLONG_MAX : step_limit, remaining = budget;
+	long pc = vm->pc, address;
+	bool zero = vm->zero;
+	machine_status status;
+	int c;
+
+	DISPATCH();
+
+op_decode:
+	machine_decode(memory, pc, op);
+	if (pc < MACHINE_MEMORY_SIZE) memset(&covered[pc], 1, op->length);
+	goto *handlers[op->handler];
+
+op_mov:
+	OPERAND(op->source_mode, op->source, source);
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, *source);
+	pc += op->length;
+	DISPATCH();
+
+op_cmp:
+	OPERAND(op->source_mode, op->source, source);
+	OPERAND(op->target_mode, op->target, target);
+	zero = *source == *target;
+	pc += op->length;
+	DISPATCH();
+
+op_add:
+	OPERAND(op->source_mode, op->source, source);
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, *target + *source);
+	pc += op->length;
+	DISPATCH();
+
+op_sub:
+	OPERAND(op->source_mode, op->source, source);
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, *target - *source);
+	pc += op->length;
+	DISPATCH();
+
+op_lea:
+	ADDRESS(op->source_mode, op->source, address);
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, address);
+	pc += op->length;
+	DISPATCH();
+
+op_clr:
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, 0);
+	pc += op->length;
+	DISPATCH();
+
+op_not:
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, ~*target);
+	pc += op->length;
+	DISPATCH();
+
+op_inc:
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, *target + 1);
+	pc += op->length;
+	DISPATCH();
+
+op_dec:
+	OPERAND(op->target_mode, op->target, target);
+	STORE(op->target_mode, target, *target - 1);
+	pc += op->length;
+	DISPATCH();
+
+op_jmp:
+	ADDRESS(op->target_mode, op->target, address);
+	pc = address;
+	DISPATCH();
+
+op_bne:
+	if (zero) {
+		pc += op->length;
+		DISPATCH();
+	}
+	ADDRESS(op->target_mode, op->target, address);
+	pc = address;
+	DISPATCH();
+
+op_red:
+	OPERAND(op->target_mode, op->target, target);
+	c = getchar();
+	STORE(op->target_mode, target, c == EOF ? MACHINE_WORD_MASK : c);
+	pc += op->length;
+	DISPATCH();
+
+op_prn:
+	OPERAND(op->target_mode, op->target, target);
+	printf("%d\n", MACHINE_SIGNED(*target));
+	pc += op->length;
+	DISPATCH();
+
+op_jsr:
+	ADDRESS(op->target_mode, op->target, address);
+	if (vm->stack_depth == MACHINE_STACK_DEPTH) {
+		fprintf(stderr, "Error: return stack overflow at address %ld\n", pc);
+		goto fault;
+	}
+	vm->stack[vm->stack_depth++] = pc + op->length;
+	pc = address;
+	DISPATCH();
+
+op_rts:
+	if (vm->stack_depth == 0) {
+		fprintf(stderr, "Error: rts with an empty return stack at address %ld\n", pc);
+		goto fault;
+	}
+	pc = vm->stack[--vm->stack_depth];
+	DISPATCH();
+
+op_stop:
+	status = MACHINE_STOPPED;
+	goto done;
+
+op_illegal:
+	if (pc >= MACHINE_MEMORY_SIZE) fprintf(stderr, "Error: ran past the end of memory\n");
+	else fprintf(stderr, "Error: illegal instruction %05o at address %ld\n", memory[pc], pc);
+	goto fault;
+
+bad_address:
+	fprintf(stderr, "Error: address outside memory at address %ld\n", pc);
+	goto fault;
+
+step_limit:
+	status = MACHINE_STEP_LIMIT;
+	goto done;
+
+fault:
+	/* The faulting instruction did not execute */
+	remaining++;
+	status = MACHINE_FAULT;
+
+done:
+	vm->pc = pc;
+	vm->zero = zero;
+	vm->executed += budget - remaining;
+	return status;
+}
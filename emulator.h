@@ -0,0 +1,169 @@
+/**
+ * File: emulator.h
+ *
+ * Description:
+ *  This header file declares the emulator of the machine the assembler targets (see globals.h): 15-bit words, a
+ *  memory of 4096 of them (every direct address fits in 12 bits), eight registers r0-r7, a zero flag set by cmp and
+ *  tested by bne, and a return stack for jsr and rts. An image is loaded at IC_INIT_VALUE, its data right after its
+ *  code, and runs from its first word until it executes stop.
+ *
+ *  Every instruction is decoded the first time it runs into a machine_op, with its operands resolved to a register
+ *  number, an address or a value, and every later run dispatches straight on the decoded op. machine_run_blocks
+ *  (see blockcache.h) runs the same machine a basic block at a time instead. A store into a word that a decoded op
+ *  or a translated block covers drops them, so code that writes over itself is decoded again.
+ *
+ *  red reads one character from the standard input (-1 at its end) and prn prints the value of its operand as a
+ *  signed number on a line of its own.
+ *
+ * Functions:
+ *  machine_init(): Prepares a machine for its first use.
+ *  machine_release(): Frees what a machine holds.
+ *  machine_reset(): Clears the memory, the registers and the decoded instructions of a machine.
+ *  machine_load(): Loads an assembled image into a machine.
+ *  machine_decode(): Decodes the instruction at an address.
+ *  machine_forget(): Drops the decoded instructions and the blocks that cover a word.
+ *  machine_run(): Runs a machine until it stops.
+ */
+
+#ifndef _EMULATOR_H
+#define _EMULATOR_H
+#include <stdint.h>
+#include "globals.h"
+
+#define MACHINE_MEMORY_SIZE 4096
+#define MACHINE_REGISTER_COUNT 8
+#define MACHINE_STACK_DEPTH 1024
+#define MACHINE_WORD_MASK 0x7FFF
+
+/* The handler of a machine_op that is not an opcode */
+#define MACHINE_OP_UNDECODED 16
+#define MACHINE_OP_ILLEGAL 17
+
+#define MACHINE_SIGNED(value) ((value) & 0x4000 ? (int) (value) - 0x8000 : (int) (value))
+
+struct machine_block;
+
+/* How a run of the machine ended */
+typedef enum machine_status {
+	/** The machine executed stop */
+	MACHINE_STOPPED,
+	/** The machine executed as many instructions as it was allowed */
+	MACHINE_STEP_LIMIT,
+	/** The machine executed an illegal instruction or addressed outside its memory (the error is printed) */
+	MACHINE_FAULT
+} machine_status;
+
+/** A decoded instruction */
+typedef struct machine_op {
+	/** The opcode, or MACHINE_OP_UNDECODED or MACHINE_OP_ILLEGAL */
+	uint8_t handler;
+	/** The number of words of the instruction */
+	uint8_t length;
+	/** The addressing types of the source and target operands; a one-operand instruction only has a target */
+	uint8_t source_mode;
+	uint8_t target_mode;
+	/** A register number for the register addressing types, else an address or an immediate value */
+	uint16_t source;
+	uint16_t target;
+} machine_op;
+
+/** The state of the machine */
+typedef struct machine {
+	uint16_t memory[MACHINE_MEMORY_SIZE];
+	/** The decoded instruction at every address, with one more that is never decoded, for running off the end */
+	machine_op ops[MACHINE_MEMORY_SIZE + 1];
+	uint16_t registers[MACHINE_REGISTER_COUNT];
+	/** Set by cmp when its operands are equal */
+	bool zero;
+	long pc;
+	uint16_t stack[MACHINE_STACK_DEPTH];
+	int stack_depth;
+	/** Where the loaded code and data end */
+	long code_end;
+	long data_end;
+	/** The number of instructions executed since the machine was reset */
+	unsigned long long executed;
+	/** The translated block starting at every address, or NULL */
+	struct machine_block *blocks[MACHINE_MEMORY_SIZE];
+	/** Whether a decoded op or a translated block may cover each word, so that a store into it must drop them */
+	uint8_t covered[MACHINE_MEMORY_SIZE];
+} machine;
+
+
+/**
+ * Prepares a machine for its first use: it holds no blocks, and is reset.
+ *
+ * @param vm The machine.
+ */
+
+void machine_init(machine *vm);
+
+
+/**
+ * Frees the translated blocks a machine holds. The machine can be used again after machine_init.
+ *
+ * @param vm The machine.
+ */
+
+void machine_release(machine *vm);
+
+
+/**
+ * Clears the memory, the registers, the flag, the stack, the decoded instructions and the translated blocks of a
+ * machine, and points it at IC_INIT_VALUE.
+ *
+ * @param vm The machine.
+ */
+
+void machine_reset(machine *vm);
+
+
+/**
+ * Resets a machine and loads an assembled image into it, read as asmlink reads a module: <base_name>.obb, or
+ * <base_name>.ob with its .rel file. An image with externals must be linked first. The machine must have been
+ * prepared with machine_init.
+ *
+ * @param base_name The image's name, without extension.
+ * @param vm The machine.
+ *
+ * @return TRUE if the image was loaded, FALSE if it could not be read, has externals or does not fit in memory (the
+ *         error is printed).
+ */
+
+bool machine_load(char *base_name, machine *vm);
+
+
+/**
+ * Decodes the instruction at an address. An instruction that is not one the assembler could produce, that writes
+ * to an immediate operand, or that runs past the end of memory, is decoded as illegal.
+ *
+ * @param memory The machine's memory.
+ * @param address The address of the instruction.
+ * @param op Receives the decoded instruction.
+ */
+
+void machine_decode(const uint16_t *memory, long address, machine_op *op);
+
+
+/**
+ * Drops the decoded instructions and the translated blocks that cover a word, before or after it is written.
+ *
+ * @param vm The machine.
+ * @param address The address of the word.
+ */
+
+void machine_forget(machine *vm, long address);
+
+
+/**
+ * Runs a machine from its current address until it executes stop, faults or reaches the step limit.
+ *
+ * @param vm The machine.
+ * @param step_limit The most instructions to execute, or 0 for no limit.
+ *
+ * @return How the run ended.
+ */
+
+machine_status machine_run(machine *vm, unsigned long long step_limit);
+
+#endif
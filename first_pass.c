@@ -22,8 +22,11 @@
 #include "globals.h"
 #include "code.h"
 #include "utils.h"
+#include "arena.h"
 #include "instructions.h"
 #include "first_pass.h"
+#include "trace.h"
+#include "stats.h"
 
 
 
@@ -49,7 +52,7 @@ bool process_line_fpass(line_info line, long *IC, long *DC, machine_word **code_
 	int i = 0, j;
 	char symbol[MAX_LINE_LENGTH];
 	instruction instruction;
-	printf("**");
+	TRACE(TRACE_PASS1, "%s:%ld: %s", line.file_name, line.line_number, line.content);
 	
 	MOVE_TO_NOT_WHITE(line.content, i) 
 	if (!line.content[i] || line.content[i] == '\n' || line.content[i] == EOF || line.content[i] == ';')
@@ -71,7 +74,7 @@ bool process_line_fpass(line_info line, long *IC, long *DC, machine_word **code_
 
 	MOVE_TO_NOT_WHITE(line.content, i) 
 
-	if (line.content[i] == '\n') return TRUE;
+	if (!line.content[i] || line.content[i] == '\n') return TRUE;
 
 
 	if (find_by_types(*symbol_table, symbol, 3, EXTERNAL_SYMBOL, DATA_SYMBOL, CODE_SYMBOL)) {
@@ -94,9 +97,9 @@ bool process_line_fpass(line_info line, long *IC, long *DC, machine_word **code_
 	if (instruction != NONE_INST) {
 
 		
-		if ((instruction == DATA_INST || instruction == STRING_INST) && symbol[0] != '\0')
-			add_table_item(symbol_table, symbol, *DC, DATA_SYMBOL);{
-			
+		if ((instruction == DATA_INST || instruction == STRING_INST) && symbol[0] != '\0') {
+			add_table_item(symbol_table, symbol, *DC, DATA_SYMBOL);
+			STATS_ADD(COUNTER_SYMBOLS, 1);
 		}
 	
 		if (instruction == STRING_INST){
@@ -114,16 +117,23 @@ bool process_line_fpass(line_info line, long *IC, long *DC, machine_word **code_
 			MOVE_TO_NOT_WHITE(line.content, i)
 			
 			for (j = 0; line.content[i] && line.content[i] != '\n' && line.content[i] != '\t' 
-                                          && line.content[i] != ' ' && line.content[i] != EOF; i++, j++) {
+                                          && line.content[i] != ' ' && line.content[i] != EOF && j < MAX_LINE_LENGTH - 1; i++, j++) {
 				symbol[j] = line.content[i];
 			}
 			symbol[j] = 0;
 
+			/* A name cut short at the end of the buffer is longer than any label too */
+			if (j > MAX_LABEL_LENGTH) {
+				printf_line_error(line, "Invalid external label name - cannot be longer than %d chars.",
+				                  MAX_LABEL_LENGTH);
+				return FALSE;
+			}
 			if (!is_valid_label_name(symbol)) {
 				printf_line_error(line, "Invalid external label name: %s", symbol);
-				return TRUE;
+				return FALSE;
 			}
 			add_table_item(symbol_table, symbol, 0, EXTERNAL_SYMBOL); 
+			STATS_ADD(COUNTER_SYMBOLS, 1);
 		}
 
 		else if (instruction == ENTRY_INST && symbol[0] != '\0') {
@@ -135,8 +145,10 @@ bool process_line_fpass(line_info line, long *IC, long *DC, machine_word **code_
 
 	else {
 
-		if (symbol[0] != '\0')
+		if (symbol[0] != '\0') {
 			add_table_item(symbol_table, symbol, *IC, CODE_SYMBOL);
+			STATS_ADD(COUNTER_SYMBOLS, 1);
+		}
                 return process_code(line, i, IC, code_img);;
 			
 
@@ -191,38 +203,34 @@ static bool process_code(line_info line, int i, long *ic, machine_word **code_im
 	}
 
 	if ((codeword = get_code_word(line, curr_opcode, curr_funct, operand_count, operands)) == NULL) {
-
-		if (operands[0]) {
-			free(operands[0]);
-			if (operands[1]) {
-				free(operands[1]);
-			}
-		}
 		return FALSE;
 	}
 
 
+	/* An instruction takes at most three words */
+	if (*ic - IC_INIT_VALUE + 3 > CODE_ARR_IMG_LENGTH) {
+		printf_line_error(line, "Program too large: the code image is limited to %d words.", CODE_ARR_IMG_LENGTH);
+		return FALSE;
+	}
+
 	ic_before = *ic;
 	
 
-	word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+	word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 	(word_to_write->word).code = codeword;
 	code_img[(*ic) - IC_INIT_VALUE] = word_to_write; 
 
-        printf("code_img entered at ic %d : %d\n", *ic , (void*)code_img[(*ic) -IC_INIT_VALUE]);
+        TRACE(TRACE_PASS1, "code_img entered at ic %ld", *ic);
 	
 
 	if(operand_count --){
 		build_extra_codeword_fpass(code_img, ic, operands[0], operands[1]);
-		free(operands[0]);
-		if(operand_count){
-			free(operands[1]);
-		}
 	}
 		
 
 	(*ic)++; 
 	code_img[ic_before - IC_INIT_VALUE]->length = (*ic) - ic_before;
+	STATS_ADD(COUNTER_INSTRUCTIONS, 1);
 	
 
 	return TRUE; 
@@ -246,7 +254,7 @@ static void build_extra_codeword_fpass(machine_word **code_img, long *ic, char *
 	int reg1, reg2 ;
 	machine_word *word_to_write;
 	char *ptr;
-	data_word *dw = malloc(sizeof(data_word));
+	data_word *dw;
 	if (operand2 != NULL){
 		op_addr2 = get_addressing_type(operand2);
 	}
@@ -256,26 +264,25 @@ static void build_extra_codeword_fpass(machine_word **code_img, long *ic, char *
                 (*ic)++;
 		
 		if((op_addr1 == REGISTER_INDIRECT_ADDR || op_addr1 == REGISTER_ADDR)&& (op_addr2 == REGISTER_INDIRECT_ADDR || op_addr2 == REGISTER_ADDR)){
-			reg1 = get_register_by_name(operand1);
-			reg2 = get_register_by_name(operand2);
-			dw = build_data_word_register(op_addr1, reg1, FALSE);
+			reg1 = get_register_by_name(op_addr1 == REGISTER_INDIRECT_ADDR ? operand1 + 1 : operand1);
+			reg2 = get_register_by_name(op_addr2 == REGISTER_INDIRECT_ADDR ? operand2 + 1 : operand2);
+			dw = build_data_word_register(reg1);
 			dw->data |= (reg2 << 6);
 			
-			word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+			word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 			word_to_write->length = 0;
 			word_to_write->word.data = dw;
 			code_img[(*ic) - IC_INIT_VALUE] = word_to_write;
-			printf("Finished processing operands\n");
 			return;
 		}
 
 		else if(op_addr1 == REGISTER_INDIRECT_ADDR || op_addr1 == REGISTER_ADDR){
-			reg1 = get_register_by_name(operand1);
-			dw = build_data_word_register(op_addr1, reg1, FALSE);
-			word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+			reg1 = get_register_by_name(op_addr1 == REGISTER_INDIRECT_ADDR ? operand1 + 1 : operand1);
+			dw = build_data_word_register(reg1);
+			word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 			word_to_write->length = 0;
 			word_to_write->word.data = dw;
-			printf("find reg1 %d :\n ", reg1);
+			TRACE(TRACE_PASS1, "register operand r%d", reg1);
 			
 			code_img[(*ic) - IC_INIT_VALUE] = word_to_write;
 			
@@ -284,13 +291,13 @@ static void build_extra_codeword_fpass(machine_word **code_img, long *ic, char *
 			
 			
 			long value = strtol(operand1 + 1, &ptr, 10);
-			dw = build_data_word_immediate(op_addr1, value, FALSE);
-			word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+			dw = build_data_word_immediate(value);
+			word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 			word_to_write->length = 0; 
 			word_to_write->word.data = dw;
 
 			code_img[(*ic) - IC_INIT_VALUE] = word_to_write;
-                        printf("build_extra_codeword code_img entered for immediate address at ic %d : %d\n", *ic , (void*)code_img[(*ic) -IC_INIT_VALUE]);
+                        TRACE(TRACE_PASS1, "immediate operand word entered at ic %ld", *ic);
 		}
 	}
 	if (operand2 == NONE_ADDR) return;
@@ -298,12 +305,12 @@ static void build_extra_codeword_fpass(machine_word **code_img, long *ic, char *
 		
                 (*ic)++;
 		if(op_addr2 == REGISTER_INDIRECT_ADDR || op_addr2 == REGISTER_ADDR){
-			reg2 = get_register_by_name(operand2);
-			dw = build_data_word_register(op_addr2, reg2, FALSE);
-			word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+			reg2 = get_register_by_name(op_addr2 == REGISTER_INDIRECT_ADDR ? operand2 + 1 : operand2);
+			dw = build_data_word_register(reg2);
+			word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 			word_to_write->length = 0;
 			word_to_write->word.data = dw;
-			printf("find reg2 %d :\n ", reg2);
+			TRACE(TRACE_PASS1, "register operand r%d", reg2);
 			
 			code_img[(*ic) - IC_INIT_VALUE] = word_to_write;
 		}
@@ -312,13 +319,13 @@ static void build_extra_codeword_fpass(machine_word **code_img, long *ic, char *
 		if (op_addr2 == IMMEDIATE_ADDR) {
 			
 			long value = strtol(operand2 + 1, &ptr, 10);
-			dw = build_data_word_immediate(op_addr2, value, FALSE);
-			word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+			dw = build_data_word_immediate(value);
+			word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 			word_to_write->length = 0; 
 			word_to_write->word.data = dw;
 
 			code_img[(*ic) - IC_INIT_VALUE] = word_to_write;
-                        printf("build_extra_codeword code_img entered for immediate address at ic %d : %d\n", *ic , (void*)code_img[(*ic) -IC_INIT_VALUE]);
+                        TRACE(TRACE_PASS1, "immediate operand word entered at ic %ld", *ic);
 		}
 	}
 }
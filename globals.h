@@ -33,8 +33,12 @@ typedef enum booleans {
 
 #define CODE_ARR_IMG_LENGTH 1200
 #define MAX_LINE_LENGTH 80
+#define MAX_LABEL_LENGTH 31
 #define IC_INIT_VALUE 100
 
+/* Part of the --cache-dir key; change it whenever the outputs for the same input change */
+#define ASSEMBLER_VERSION "1.7"
+
 
 /*Operand addressing type */
 typedef enum addressing_types {
@@ -114,6 +118,11 @@ typedef enum registers {
 	NONE_REG = -1
 } reg;
 /** Represents a single code word */
+/* The ARE bits of a word: absolute, relocatable (an address inside the file) and external (an address outside it) */
+#define ARE_ABSOLUTE 4
+#define ARE_RELOCATABLE 2
+#define ARE_EXTERNAL 1
+
 typedef struct code_word {
 	/* First byte: ARE+funct */
 	unsigned int ARE: 3;
@@ -147,6 +156,53 @@ typedef struct machine_word {
 } machine_word;
 
 
+/** How lines longer than MAX_LINE_LENGTH are treated */
+typedef enum line_limit_modes {
+	/** Reject the line (default) */
+	LINE_LIMIT_ERROR,
+	/** Assemble the line, but warn about it */
+	LINE_LIMIT_WARN,
+	/** Lines may be of any length */
+	LINE_LIMIT_OFF
+} line_limit_mode;
+
+/** Options given on the command line, applying to every processed file */
+typedef struct assembler_options {
+	line_limit_mode line_limit;
+	/** Also write the binary object file (.obb) */
+	bool write_binary_object;
+	/** Print the --stats table when done */
+	bool print_stats;
+	/** Where to write the statistics as JSON ("-" for stdout), or NULL */
+	char *stats_json_filename;
+	/** Where to write Chrome trace events (--trace-out), or NULL */
+	char *trace_events_filename;
+	/** File descriptors chosen for the outputs of a source read from stdin, or -1 (--ob-fd and friends) */
+	int object_fd;
+	int entries_fd;
+	int externals_fd;
+	int relocations_fd;
+	int binary_object_fd;
+	/** File of macro definitions available to every source (--macro-lib), or NULL */
+	char *macro_library_filename;
+	/** Unix socket to serve requests on instead of processing files (--serve), or NULL */
+	char *serve_socket_path;
+	/** Directory of the result cache (--cache-dir), or NULL for no cache */
+	char *cache_directory;
+	/** Size the result cache is trimmed to, in bytes (--cache-size) */
+	long cache_size_limit;
+	/** Print the --cache-stats report when done */
+	bool print_cache_stats;
+	/** Reuse the state of the previous run of each file (--incremental, see incremental.h) */
+	bool incremental;
+	/** Keep running and assemble the files again as they change (--watch, see watch.h) */
+	bool watch;
+	/** Assemble the files as one program and write the linked image under this name (--link, see program.h),
+	 * or NULL */
+	char *link_output_name;
+} assembler_options;
+
+
 typedef enum instruction {
 	/** .data instruction */
 	DATA_INST,
@@ -172,6 +228,9 @@ typedef struct line_info {
 	char *file_name;
 
 	char *content;
+
+	/** Number of characters in content, not counting the terminating NUL */
+	long length;
 } line_info;
 
 
@@ -0,0 +1,960 @@
+/**
+ * File: incremental.c
+ *
+ * Description:
+ *  This file contains incremental reassembly (--incremental), described in incremental.h. The lines of the
+ *  expanded source are hashed and matched against the lines of the previous run; an unchanged line whose kind the
+ *  replay models (blank, code, data, .extern and .entry lines) has its symbol and words rebuilt from the state
+ *  instead of being parsed, and everything else goes through process_line_fpass and process_line_spass as in a
+ *  full assembly. As soon as a line fails, or is of a kind the replay does not model, the rest of the file is
+ *  assembled in full, so that the messages are those of a full assembly.
+ *
+ * Functions:
+ *  assemble_incremental(): Assembles a source, reusing the state of the previous run.
+ *  load_state(): Maps and validates the state of the previous run.
+ *  unload_state(): Releases a mapped state.
+ *  match_lines(): Matches the unchanged prefix and suffix of the source against the previous state.
+ *  replay_line(): Rebuilds an unchanged line's symbol and words during the first pass.
+ *  describe_line(): Records what a line assembled in full defines, for the next run.
+ *  resolve_replayed_fixups(): Resolves the direct operands of an unchanged code line during the second pass.
+ *  save_state(): Writes the state of a file that assembled cleanly.
+ *  symbol_map_find(), symbol_map_add(): A hash map from symbol names to the symbol table.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "incremental.h"
+#include "arena.h"
+#include "cache.h"
+#include "code.h"
+#include "instructions.h"
+#include "trace.h"
+#include "stats.h"
+
+/* Line kinds */
+#define LINE_BLANK 0
+#define LINE_CODE 1
+#define LINE_DATA 2
+#define LINE_EXTERN 3
+#define LINE_ENTRY 4
+/** A line the replay does not model; never written to a state */
+#define LINE_OTHER 5
+
+/** The most words an instruction takes */
+#define MAX_INSTRUCTION_WORDS 3
+
+/** Sections of the state file start on multiples of this */
+#define INC_ALIGNMENT 8
+#define ALIGN_UP(n) (((n) + INC_ALIGNMENT - 1) / INC_ALIGNMENT * INC_ALIGNMENT)
+
+
+/** A line of the source being assembled */
+typedef struct work_line {
+	line_info line;
+	uint64_t hash;
+	/** Index of the same line in the previous state, or -1 */
+	long old;
+	/** TRUE if the first pass rebuilt the line from the state */
+	bool replayed;
+	int kind;
+	/** The counters when the first pass reached the line */
+	long ic;
+	long dc;
+	int code_length;
+	long data_length;
+	/** The label of a code or data line, or the name declared by an .extern line; NULL if none */
+	char *symbol;
+	/** The symbol of each direct operand word of a code line, by word; NULL for the other words */
+	char *fixups[MAX_INSTRUCTION_WORDS];
+} work_line;
+
+/** The mapped state of the previous run */
+typedef struct previous_state {
+	const inc_header *header;
+	const inc_line *lines;
+	const inc_symbol *symbols;
+	const int64_t *data;
+	const inc_word *words;
+	const char *strings;
+	/** For every line, the index of its first word and of its first data word */
+	long *word_start;
+	long *data_start;
+	void *mapping;
+	long mapped_length;
+} previous_state;
+
+/** A slot of a symbol_map */
+typedef struct symbol_slot {
+	char *name;
+	/** The first code, data or external symbol of that name in the table, when the map is built from the table */
+	table_entry *entry;
+	long index;
+} symbol_slot;
+
+/** An open-addressing hash map keyed by symbol name */
+typedef struct symbol_map {
+	symbol_slot *slots;
+	/** A power of two */
+	long capacity;
+	long count;
+} symbol_map;
+
+
+/**
+ * Prepares an empty map.
+ *
+ * @param map The map.
+ */
+
+static void symbol_map_init(symbol_map *map) {
+	map->capacity = 64;
+	map->count = 0;
+	map->slots = malloc_with_check(map->capacity * sizeof(symbol_slot));
+	memset(map->slots, 0, map->capacity * sizeof(symbol_slot));
+}
+
+
+/**
+ * Finds the slot of a name, or the empty slot where it belongs.
+ *
+ * @param map The map.
+ * @param name The name.
+ *
+ * @return The slot.
+ */
+
+static symbol_slot *symbol_map_slot(symbol_map *map, const char *name) {
+	long index = (long) (hash_bytes(0, name, strlen(name)) & (map->capacity - 1));
+
+	while (map->slots[index].name != NULL && strcmp(map->slots[index].name, name) != 0) {
+		index = (index + 1) & (map->capacity - 1);
+	}
+	return &map->slots[index];
+}
+
+
+/**
+ * Finds a name in the map.
+ *
+ * @param map The map.
+ * @param name The name.
+ *
+ * @return The slot of the name, or NULL if it is not in the map.
+ */
+
+static symbol_slot *symbol_map_find(symbol_map *map, const char *name) {
+	symbol_slot *slot = symbol_map_slot(map, name);
+	return slot->name != NULL ? slot : NULL;
+}
+
+
+/**
+ * Adds a name to the map, unless it is there already. The name is not copied.
+ *
+ * @param map The map.
+ * @param name The name.
+ *
+ * @return The slot of the name; entry is NULL in a new slot, and index the number of names added before.
+ */
+
+static symbol_slot *symbol_map_add(symbol_map *map, char *name) {
+	symbol_slot *slot, *old_slots;
+	long i, old_capacity;
+
+	if ((map->count + 1) * 2 > map->capacity) {
+		old_slots = map->slots;
+		old_capacity = map->capacity;
+		map->capacity *= 2;
+		map->slots = malloc_with_check(map->capacity * sizeof(symbol_slot));
+		memset(map->slots, 0, map->capacity * sizeof(symbol_slot));
+		for (i = 0; i < old_capacity; i++) {
+			if (old_slots[i].name != NULL) *symbol_map_slot(map, old_slots[i].name) = old_slots[i];
+		}
+		free_with_check(old_slots);
+	}
+
+	slot = symbol_map_slot(map, name);
+	if (slot->name == NULL) {
+		slot->name = name;
+		slot->entry = NULL;
+		slot->index = map->count++;
+	}
+	return slot;
+}
+
+
+/**
+ * Releases a map.
+ *
+ * @param map The map.
+ */
+
+static void symbol_map_free(symbol_map *map) {
+	free_with_check(map->slots);
+	map->slots = NULL;
+}
+
+
+/**
+ * Packs the fields of the first word of an instruction.
+ *
+ * @param word The word.
+ *
+ * @return The packed fields.
+ */
+
+static uint32_t pack_code_word(const code_word *word) {
+	return word->ARE | word->funct << 3 | word->dest_register << 8 | word->dest_addressing << 11 |
+	       word->src_register << 13 | word->src_addressing << 16 | (uint32_t) word->opcode << 18;
+}
+
+
+/**
+ * Rebuilds the first word of an instruction from its packed fields.
+ *
+ * @param value The packed fields.
+ * @param length The number of words of the instruction.
+ *
+ * @return The word, allocated from the current arena.
+ */
+
+static machine_word *unpack_code_word(uint32_t value, int length) {
+	machine_word *word = assembly_alloc(sizeof(machine_word));
+	code_word *code = assembly_alloc(sizeof(code_word));
+
+	code->ARE = value & 7;
+	code->funct = value >> 3 & 31;
+	code->dest_register = value >> 8 & 7;
+	code->dest_addressing = value >> 11 & 3;
+	code->src_register = value >> 13 & 7;
+	code->src_addressing = value >> 16 & 3;
+	code->opcode = value >> 18 & 63;
+	word->length = length;
+	word->word.code = code;
+	return word;
+}
+
+
+/**
+ * Rebuilds an operand word.
+ *
+ * @param value The word as (data << 3) | ARE.
+ *
+ * @return The word, allocated from the current arena.
+ */
+
+static machine_word *unpack_operand_word(uint32_t value) {
+	machine_word *word = assembly_alloc(sizeof(machine_word));
+	data_word *data = assembly_alloc(sizeof(data_word));
+
+	data->ARE = value & 7;
+	data->data = value >> 3;
+	word->length = 0;
+	word->word.data = data;
+	return word;
+}
+
+
+/**
+ * Checks that a section of count records of the given size lies inside the mapping.
+ *
+ * @param mapped_length The size of the mapping.
+ * @param offset The offset of the section.
+ * @param count The number of records in the section.
+ * @param size The size of a single record.
+ *
+ * @return TRUE if the section fits, FALSE otherwise.
+ */
+
+static bool section_fits(long mapped_length, uint32_t offset, uint32_t count, long size) {
+	return offset % INC_ALIGNMENT == 0 && offset <= mapped_length &&
+	       (long) count <= (mapped_length - (long) offset) / size;
+}
+
+
+/**
+ * Checks the records of a mapped state and computes where the words of each line start.
+ *
+ * @param state The state, with its sections set.
+ *
+ * @return TRUE if every index in the state is in range, FALSE otherwise.
+ */
+
+static bool validate_state(previous_state *state) {
+	const inc_header *header = state->header;
+	const inc_line *line;
+	long i, words = 0, data = 0;
+
+	for (i = 0; i < (long) header->symbol_count; i++) {
+		if (state->symbols[i].name_offset >= header->strings_size) return FALSE;
+	}
+	for (i = 0; i < (long) header->word_count; i++) {
+		if (state->words[i].symbol != INC_NONE && state->words[i].symbol >= header->symbol_count) return FALSE;
+	}
+
+	state->word_start = malloc_with_check((header->line_count + 1) * sizeof(long));
+	state->data_start = malloc_with_check((header->line_count + 1) * sizeof(long));
+	for (i = 0; i < (long) header->line_count; i++) {
+		line = &state->lines[i];
+		state->word_start[i] = words;
+		state->data_start[i] = data;
+		if (line->kind >= LINE_OTHER || line->code_length > MAX_INSTRUCTION_WORDS ||
+		    (line->kind == LINE_CODE) != (line->code_length > 0) ||
+		    (line->kind != LINE_DATA && line->data_length > 0) ||
+		    (line->symbol != INC_NONE && line->symbol >= header->symbol_count) ||
+		    (line->kind == LINE_EXTERN && line->symbol == INC_NONE)) {
+			return FALSE;
+		}
+		words += line->code_length;
+		data += line->data_length;
+		if (words > (long) header->word_count || data > (long) header->data_count) return FALSE;
+		if (line->code_length > 0 && state->words[state->word_start[i]].symbol != INC_NONE) return FALSE;
+	}
+	return words == (long) header->word_count && data == (long) header->data_count;
+}
+
+
+/**
+ * Releases a mapped state.
+ *
+ * @param state The state.
+ */
+
+static void unload_state(previous_state *state) {
+	if (state->mapping != NULL) munmap(state->mapping, state->mapped_length);
+	free_with_check(state->word_start);
+	free_with_check(state->data_start);
+	memset(state, 0, sizeof(previous_state));
+}
+
+
+/**
+ * Maps the state of the previous run and validates it. A state written by another version of the assembler, or
+ * on a host of the other byte order, is ignored.
+ *
+ * @param filename The name of the state file.
+ * @param state Receives the mapped state.
+ *
+ * @return TRUE if a valid state was mapped, FALSE otherwise.
+ */
+
+static bool load_state(char *filename, previous_state *state) {
+	const uint16_t byte_order_probe = 1;
+	const inc_header *header;
+	char version[sizeof(header->assembler_version)];
+	struct stat file_stat;
+	void *mapping;
+	int fd;
+
+	memset(state, 0, sizeof(previous_state));
+	if (*(const unsigned char *) &byte_order_probe != 1) return FALSE;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return FALSE;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (long) sizeof(inc_header)) {
+		close(fd);
+		return FALSE;
+	}
+	mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return FALSE;
+	state->mapping = mapping;
+	state->mapped_length = file_stat.st_size;
+
+	header = mapping;
+	memset(version, 0, sizeof(version));
+	strncpy(version, ASSEMBLER_VERSION, sizeof(version));
+	if (memcmp(header->magic, INC_MAGIC, 4) != 0 || header->version != INC_VERSION ||
+	    header->header_size < sizeof(inc_header) || header->header_size > file_stat.st_size ||
+	    memcmp(header->assembler_version, version, sizeof(version)) != 0 ||
+	    !section_fits(file_stat.st_size, header->lines_offset, header->line_count, sizeof(inc_line)) ||
+	    !section_fits(file_stat.st_size, header->symbols_offset, header->symbol_count, sizeof(inc_symbol)) ||
+	    !section_fits(file_stat.st_size, header->data_offset, header->data_count, sizeof(int64_t)) ||
+	    !section_fits(file_stat.st_size, header->words_offset, header->word_count, sizeof(inc_word)) ||
+	    !section_fits(file_stat.st_size, header->strings_offset, header->strings_size, 1) ||
+	    (header->strings_size > 0 &&
+	     ((const char *) mapping)[header->strings_offset + header->strings_size - 1] != '\0') ||
+	    hash_bytes(0, (const char *) mapping + header->header_size, file_stat.st_size - header->header_size) !=
+	    header->checksum) {
+		unload_state(state);
+		return FALSE;
+	}
+
+	state->header = header;
+	state->lines = (const inc_line *) ((const char *) mapping + header->lines_offset);
+	state->symbols = (const inc_symbol *) ((const char *) mapping + header->symbols_offset);
+	state->data = (const int64_t *) ((const char *) mapping + header->data_offset);
+	state->words = (const inc_word *) ((const char *) mapping + header->words_offset);
+	state->strings = (const char *) mapping + header->strings_offset;
+	if (!validate_state(state)) {
+		unload_state(state);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Returns the name of a symbol of the previous state.
+ *
+ * @param state The state.
+ * @param index The index of the symbol.
+ *
+ * @return The name, inside the mapping.
+ */
+
+static char *state_symbol_name(previous_state *state, uint32_t index) {
+	return (char *) state->strings + state->symbols[index].name_offset;
+}
+
+
+/**
+ * Matches the lines of the source against the lines of the previous state: the longest common prefix and then
+ * the longest common suffix of the rest. Lines in between are treated as changed.
+ *
+ * @param lines The lines of the source.
+ * @param count The number of lines.
+ * @param state The previous state.
+ *
+ * @return The number of lines matched.
+ */
+
+static long match_lines(work_line *lines, long count, previous_state *state) {
+	long prefix = 0, suffix = 0, old_count = state->header->line_count;
+
+	while (prefix < count && prefix < old_count && lines[prefix].hash == state->lines[prefix].hash) {
+		lines[prefix].old = prefix;
+		prefix++;
+	}
+	while (suffix < count - prefix && suffix < old_count - prefix &&
+	       lines[count - 1 - suffix].hash == state->lines[old_count - 1 - suffix].hash) {
+		lines[count - 1 - suffix].old = old_count - 1 - suffix;
+		suffix++;
+	}
+	return prefix + suffix;
+}
+
+
+/**
+ * Rebuilds an unchanged line during the first pass: defines its symbol and writes its words at the current
+ * counters, as process_line_fpass would. A line that would not fit in the images is left to process_line_fpass,
+ * which reports it.
+ *
+ * @param w The line, matched to a line of the state.
+ * @param state The previous state.
+ * @param ic Pointer to the instruction counter.
+ * @param dc Pointer to the data counter.
+ * @param image The image being assembled.
+ * @param defined The code, data and external symbols defined so far.
+ * @param is_success Set to FALSE if the line redefines a symbol.
+ *
+ * @return TRUE if the line was handled, FALSE if it must go through process_line_fpass.
+ */
+
+static bool replay_line(work_line *w, previous_state *state, long *ic, long *dc, assembly_image *image,
+                        symbol_map *defined, bool *is_success) {
+	const inc_line *old = &state->lines[w->old];
+	const inc_word *words;
+	long k;
+
+	w->kind = old->kind;
+	w->symbol = old->symbol != INC_NONE ? state_symbol_name(state, old->symbol) : NULL;
+
+	if ((w->kind == LINE_CODE && *ic - IC_INIT_VALUE + MAX_INSTRUCTION_WORDS > CODE_ARR_IMG_LENGTH) ||
+	    (w->kind == LINE_DATA && *dc + (long) old->data_length > CODE_ARR_IMG_LENGTH)) {
+		return FALSE;
+	}
+
+	if ((w->kind == LINE_CODE || w->kind == LINE_DATA) && w->symbol != NULL &&
+	    symbol_map_find(defined, w->symbol) != NULL) {
+		printf_line_error(w->line, "Symbol %s is already defined.", w->symbol);
+		*is_success = FALSE;
+		return TRUE;
+	}
+
+	w->replayed = TRUE;
+	STATS_ADD(COUNTER_LINES_REUSED, 1);
+	if (w->kind == LINE_EXTERN) {
+		add_table_item(&image->symbol_table, w->symbol, 0, EXTERNAL_SYMBOL);
+		STATS_ADD(COUNTER_SYMBOLS, 1);
+		symbol_map_add(defined, w->symbol);
+	} else if (w->kind == LINE_DATA) {
+		if (w->symbol != NULL) {
+			add_table_item(&image->symbol_table, w->symbol, *dc, DATA_SYMBOL);
+			STATS_ADD(COUNTER_SYMBOLS, 1);
+			symbol_map_add(defined, w->symbol);
+		}
+		w->data_length = old->data_length;
+		for (k = 0; k < w->data_length; k++) image->data_img[*dc + k] = state->data[state->data_start[w->old] + k];
+		*dc += w->data_length;
+	} else if (w->kind == LINE_CODE) {
+		if (w->symbol != NULL) {
+			add_table_item(&image->symbol_table, w->symbol, *ic, CODE_SYMBOL);
+			STATS_ADD(COUNTER_SYMBOLS, 1);
+			symbol_map_add(defined, w->symbol);
+		}
+		w->code_length = old->code_length;
+		words = state->words + state->word_start[w->old];
+		image->code_img[*ic - IC_INIT_VALUE] = unpack_code_word(words[0].value, w->code_length);
+		for (k = 1; k < w->code_length; k++) {
+			if (words[k].symbol != INC_NONE) {
+				/* Resolved in the second pass, as a direct operand left empty by the first pass */
+				w->fixups[k] = state_symbol_name(state, words[k].symbol);
+				image->code_img[*ic + k - IC_INIT_VALUE] = NULL;
+			} else {
+				image->code_img[*ic + k - IC_INIT_VALUE] = unpack_operand_word(words[k].value);
+			}
+		}
+		*ic += w->code_length;
+		STATS_ADD(COUNTER_INSTRUCTIONS, 1);
+	}
+	return TRUE;
+}
+
+
+/**
+ * Finds the direct operands of a code line that went through process_line_fpass, parsing its operands the way
+ * add_symbols_to_code does, and checks they match the words the first pass left empty.
+ *
+ * @param w The line.
+ * @param i The index of the command in the line.
+ * @param code_img The code image.
+ *
+ * @return TRUE if every empty word belongs to a direct operand, FALSE otherwise.
+ */
+
+static bool find_fixups(work_line *w, int i, machine_word **code_img) {
+	char *operands[2];
+	int operand_count, position = 0, k;
+	addressing_type addr1, addr2 = NONE_ADDR;
+
+	for (; w->line.content[i] && w->line.content[i] != ' ' && w->line.content[i] != '\t' &&
+	       w->line.content[i] != '\n' && w->line.content[i] != EOF; i++);
+	MOVE_TO_NOT_WHITE(w->line.content, i)
+	if (!analyze_operands(w->line, i, operands, &operand_count, NULL)) return FALSE;
+
+	if (operand_count > 0) {
+		addr1 = get_addressing_type(operands[0]);
+		if (operand_count > 1) addr2 = get_addressing_type(operands[1]);
+
+		if (addr1 == REGISTER_INDIRECT_ADDR || addr1 == REGISTER_ADDR) {
+			position++;
+			if (addr2 == REGISTER_INDIRECT_ADDR || addr2 == REGISTER_ADDR) operand_count = 1;
+		}
+		if (addr1 == IMMEDIATE_ADDR) position++;
+		if (addr1 == DIRECT_ADDR) w->fixups[++position] = operands[0];
+		if (operand_count > 1) {
+			if (addr2 == REGISTER_INDIRECT_ADDR || addr2 == REGISTER_ADDR || addr2 == IMMEDIATE_ADDR) position++;
+			if (addr2 == DIRECT_ADDR) w->fixups[++position] = operands[1];
+		}
+	}
+
+	if (position != w->code_length - 1) return FALSE;
+	for (k = 1; k < w->code_length; k++) {
+		if ((w->fixups[k] != NULL) != (code_img[w->ic + k - IC_INIT_VALUE] == NULL)) return FALSE;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Records what a line that went through process_line_fpass without errors defines: its kind, its label or
+ * external name, its length and the symbols of its direct operands.
+ *
+ * @param w The line; ic and dc are the counters before the line.
+ * @param ic The instruction counter after the line.
+ * @param dc The data counter after the line.
+ * @param code_img The code image.
+ */
+
+static void describe_line(work_line *w, long ic, long dc, machine_word **code_img) {
+	char symbol[MAX_LINE_LENGTH];
+	int i = 0, j;
+	instruction instruction;
+
+	w->kind = LINE_OTHER;
+	MOVE_TO_NOT_WHITE(w->line.content, i)
+	if (!w->line.content[i] || w->line.content[i] == '\n' || w->line.content[i] == EOF || w->line.content[i] == ';') {
+		w->kind = LINE_BLANK;
+		return;
+	}
+
+	find_label(w->line, symbol);
+	if (symbol[0] != '\0') {
+		for (; w->line.content[i] != ':'; i++);
+		i++;
+		/* add_symbols_to_code only finds the command after a label followed by a blank */
+		if (w->line.content[i] != ' ' && w->line.content[i] != '\t') return;
+	}
+	MOVE_TO_NOT_WHITE(w->line.content, i)
+	if (!w->line.content[i] || w->line.content[i] == '\n') return;
+
+	instruction = find_instruction_from_index(w->line, &i);
+	if (instruction == DATA_INST || instruction == STRING_INST) {
+		w->kind = LINE_DATA;
+		w->data_length = dc - w->dc;
+		if (symbol[0] != '\0') w->symbol = assembly_strdup(symbol);
+	} else if (instruction == EXTERN_INST && symbol[0] == '\0') {
+		MOVE_TO_NOT_WHITE(w->line.content, i)
+		for (j = 0; w->line.content[i] && w->line.content[i] != '\n' && w->line.content[i] != '\t' &&
+		            w->line.content[i] != ' ' && w->line.content[i] != EOF && j < MAX_LINE_LENGTH - 1; i++, j++) {
+			symbol[j] = w->line.content[i];
+		}
+		symbol[j] = '\0';
+		w->kind = LINE_EXTERN;
+		w->symbol = assembly_strdup(symbol);
+	} else if (instruction == ENTRY_INST && symbol[0] == '\0') {
+		w->kind = LINE_ENTRY;
+	} else if (instruction == NONE_INST && ic > w->ic && ic - w->ic <= MAX_INSTRUCTION_WORDS) {
+		w->kind = LINE_CODE;
+		w->code_length = ic - w->ic;
+		if (symbol[0] != '\0') w->symbol = assembly_strdup(symbol);
+		if (!find_fixups(w, i, code_img)) w->kind = LINE_OTHER;
+	}
+}
+
+
+/**
+ * Resolves the direct operands of an unchanged code line in the second pass. An operand whose symbol has the
+ * same value and type as in the previous run keeps its word; the others, and references to external symbols
+ * (which must be listed again in the .ext file), are resolved by process_direct_operand.
+ *
+ * @param w The line.
+ * @param state The previous state.
+ * @param changed For every symbol of the state, whether it changed.
+ * @param image The image being assembled.
+ */
+
+static void resolve_replayed_fixups(work_line *w, previous_state *state, bool *changed, assembly_image *image) {
+	const inc_word *words = state->words + state->word_start[w->old];
+	int k;
+
+	for (k = 1; k < w->code_length; k++) {
+		if (words[k].symbol == INC_NONE) continue;
+		if (!changed[words[k].symbol] && state->symbols[words[k].symbol].type != EXTERNAL_SYMBOL) {
+			image->code_img[w->ic + k - IC_INIT_VALUE] = unpack_operand_word(words[k].value);
+			STATS_ADD(COUNTER_FIXUPS_REUSED, 1);
+		} else {
+			process_direct_operand(w->line, w->ic + k, w->fixups[k], image->code_img, &image->symbol_table);
+		}
+	}
+}
+
+
+/**
+ * Builds a map from the names of the code, data and external symbols of the table to the first such symbol of
+ * each name, the one find_by_types returns, and its index among those symbols (as written by save_state).
+ *
+ * @param symbol_table The table.
+ * @param map Receives the map.
+ */
+
+static void map_symbol_table(table symbol_table, symbol_map *map) {
+	symbol_slot *slot;
+	long index = 0;
+
+	symbol_map_init(map);
+	for (; symbol_table != NULL; symbol_table = symbol_table->next) {
+		if (symbol_table->type != CODE_SYMBOL && symbol_table->type != DATA_SYMBOL &&
+		    symbol_table->type != EXTERNAL_SYMBOL) {
+			continue;
+		}
+		slot = symbol_map_add(map, symbol_table->key);
+		if (slot->entry == NULL) {
+			slot->entry = symbol_table;
+			slot->index = index;
+		}
+		index++;
+	}
+}
+
+
+/**
+ * Writes the state of a file that assembled cleanly, through a temporary file. Failures are silent: the state
+ * is only an optimization, and a missing one means a full assembly next time.
+ *
+ * @param filename The name of the state file.
+ * @param lines The lines of the source.
+ * @param count The number of lines.
+ * @param image The assembled image.
+ * @param symbols The map built by map_symbol_table after the first pass.
+ */
+
+static void save_state(char *filename, work_line *lines, long count, assembly_image *image, symbol_map *symbols) {
+	inc_header *header;
+	inc_line *line_records;
+	inc_symbol *symbol_records;
+	int64_t *data_records;
+	inc_word *word_records;
+	symbol_slot *slot;
+	table entry;
+	machine_word *word;
+	char *buffer, *temp_filename;
+	long i, k, total, symbol_count = 0, strings_size = 0, word_count = 0, data_count = 0, words = 0, data = 0;
+	bool is_complete = TRUE;
+	int fd;
+
+	for (entry = image->symbol_table; entry != NULL; entry = entry->next) {
+		if (entry->type == CODE_SYMBOL || entry->type == DATA_SYMBOL || entry->type == EXTERNAL_SYMBOL) {
+			symbol_count++;
+			strings_size += strlen(entry->key) + 1;
+		}
+	}
+	for (i = 0; i < count; i++) {
+		word_count += lines[i].code_length;
+		data_count += lines[i].data_length;
+	}
+
+	total = ALIGN_UP(sizeof(inc_header)) + ALIGN_UP(count * sizeof(inc_line)) +
+	        ALIGN_UP(symbol_count * sizeof(inc_symbol)) + ALIGN_UP(data_count * sizeof(int64_t)) +
+	        ALIGN_UP(word_count * sizeof(inc_word)) + strings_size;
+	buffer = malloc_with_check(total);
+	memset(buffer, 0, total);
+
+	header = (inc_header *) buffer;
+	memcpy(header->magic, INC_MAGIC, 4);
+	header->version = INC_VERSION;
+	header->header_size = sizeof(inc_header);
+	strncpy(header->assembler_version, ASSEMBLER_VERSION, sizeof(header->assembler_version));
+	header->line_count = count;
+	header->symbol_count = symbol_count;
+	header->data_count = data_count;
+	header->word_count = word_count;
+	header->strings_size = strings_size;
+	header->lines_offset = ALIGN_UP(sizeof(inc_header));
+	header->symbols_offset = header->lines_offset + ALIGN_UP(count * sizeof(inc_line));
+	header->data_offset = header->symbols_offset + ALIGN_UP(symbol_count * sizeof(inc_symbol));
+	header->words_offset = header->data_offset + ALIGN_UP(data_count * sizeof(int64_t));
+	header->strings_offset = header->words_offset + ALIGN_UP(word_count * sizeof(inc_word));
+	line_records = (inc_line *) (buffer + header->lines_offset);
+	symbol_records = (inc_symbol *) (buffer + header->symbols_offset);
+	data_records = (int64_t *) (buffer + header->data_offset);
+	word_records = (inc_word *) (buffer + header->words_offset);
+
+	for (entry = image->symbol_table, i = 0, k = 0; entry != NULL; entry = entry->next) {
+		if (entry->type != CODE_SYMBOL && entry->type != DATA_SYMBOL && entry->type != EXTERNAL_SYMBOL) continue;
+		symbol_records[i].name_offset = k;
+		symbol_records[i].type = entry->type;
+		symbol_records[i].value = entry->value;
+		strcpy(buffer + header->strings_offset + k, entry->key);
+		k += strlen(entry->key) + 1;
+		i++;
+	}
+
+	for (i = 0; i < count && is_complete; i++) {
+		line_records[i].hash = lines[i].hash;
+		line_records[i].kind = lines[i].kind;
+		line_records[i].code_length = lines[i].code_length;
+		line_records[i].data_length = lines[i].data_length;
+		line_records[i].symbol = INC_NONE;
+		if (lines[i].symbol != NULL) {
+			if ((slot = symbol_map_find(symbols, lines[i].symbol)) == NULL) is_complete = FALSE;
+			else line_records[i].symbol = slot->index;
+		}
+
+		for (k = 0; k < lines[i].data_length; k++) data_records[data++] = image->data_img[lines[i].dc + k];
+		for (k = 0; k < lines[i].code_length && is_complete; k++, words++) {
+			word = image->code_img[lines[i].ic + k - IC_INIT_VALUE];
+			word_records[words].symbol = INC_NONE;
+			if (word == NULL) {
+				is_complete = FALSE;
+			} else if (k == 0) {
+				word_records[words].value = pack_code_word(word->word.code);
+			} else {
+				word_records[words].value = word->word.data->data << 3 | word->word.data->ARE;
+				if (lines[i].fixups[k] != NULL) {
+					if ((slot = symbol_map_find(symbols, lines[i].fixups[k])) == NULL) is_complete = FALSE;
+					else word_records[words].symbol = slot->index;
+				}
+			}
+		}
+	}
+
+	header->checksum = hash_bytes(0, buffer + header->header_size, total - header->header_size);
+	temp_filename = strallocat(filename, ".tmp");
+	if (is_complete && (fd = open(temp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+		is_complete = write_all(fd, buffer, total);
+		if (close(fd) != 0) is_complete = FALSE;
+		if (!is_complete || rename(temp_filename, filename) != 0) {
+			unlink(temp_filename);
+			unlink(filename);
+		}
+	} else {
+		unlink(filename);
+	}
+	free_with_check(temp_filename);
+	free_with_check(buffer);
+}
+
+
+/**
+ * Assembles a macro-expanded source like assemble_source, reusing the state the previous run left in
+ * <base_name>.inc, then writes the new state there (or removes it if the source did not assemble cleanly).
+ *
+ * @param source The expanded source. Its lines are NUL-terminated in place.
+ * @param file_name The name reported in error messages.
+ * @param base_name The base name of the state file.
+ * @param options The options; only the line limit applies here.
+ * @param image Receives the code and data images and the symbol table, allocated from the current arena.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise.
+ *
+ * This function:
+ * - Splits the source into lines and hashes them, and matches them against the previous state.
+ * - Runs the first pass, replaying unchanged lines and passing the others to process_line_fpass.
+ * - Relocates the data symbols and finds the symbols whose value or type changed since the previous run.
+ * - Runs the second pass, resolving only the direct operands of unchanged lines that depend on changed symbols.
+ * - Saves the new state when the file assembled without errors and every line was modelled.
+ */
+
+bool assemble_incremental(source_buffer *source, char *file_name, char *base_name, assembler_options *options,
+                          assembly_image *image) {
+	long offset, count = 0, capacity = 1024, n, ic = IC_INIT_VALUE, dc = 0, errors_before = error_count(),
+	     line_errors, matched;
+	bool is_success = TRUE, has_previous, can_replay, can_save = TRUE, *changed = NULL;
+	char *state_filename = strallocat(base_name, ".inc");
+	work_line *lines = malloc_with_check(capacity * sizeof(work_line)), *w;
+	line_info curr_line_info;
+	previous_state previous;
+	symbol_map defined, symbols;
+	symbol_slot *slot;
+	const inc_symbol *old_symbol;
+	int i;
+
+	image->code_img = assembly_alloc(CODE_ARR_IMG_LENGTH * sizeof(machine_word *));
+	memset(image->code_img, 0, CODE_ARR_IMG_LENGTH * sizeof(machine_word *));
+	image->data_img = assembly_alloc(CODE_ARR_IMG_LENGTH * sizeof(long));
+	image->symbol_table = NULL;
+
+	curr_line_info.file_name = file_name;
+	for (offset = 0, curr_line_info.line_number = 1;
+	     source_next_line(source, &offset, &curr_line_info); curr_line_info.line_number++) {
+		if (count == capacity) {
+			capacity *= 2;
+			lines = realloc_with_check(lines, capacity * sizeof(work_line));
+		}
+		memset(&lines[count], 0, sizeof(work_line));
+		lines[count].line = curr_line_info;
+		lines[count].hash = hash_bytes(0, curr_line_info.content, curr_line_info.length);
+		lines[count].old = -1;
+		count++;
+	}
+
+	has_previous = load_state(state_filename, &previous);
+	can_replay = FALSE;
+	if (has_previous) {
+		matched = match_lines(lines, count, &previous);
+		TRACE(TRACE_PASS1, "%s: %ld of %ld lines unchanged", file_name, matched, count);
+		/* With no line unchanged there is nothing to replay */
+		can_replay = matched > 0;
+	}
+
+	stats_phase_begin(PHASE_PASS1);
+	symbol_map_init(&defined);
+	for (n = 0; n < count; n++) {
+		w = &lines[n];
+		w->ic = ic;
+		w->dc = dc;
+		STATS_ADD(COUNTER_LINES, 1);
+
+		if (w->line.length > MAX_LINE_LENGTH && options->line_limit == LINE_LIMIT_ERROR) {
+			printf_line_error(w->line, "Line too long to process. Maximum line length should be %d.",
+			                  MAX_LINE_LENGTH);
+			is_success = can_replay = can_save = FALSE;
+			continue;
+		}
+		if (w->line.length > MAX_LINE_LENGTH && options->line_limit == LINE_LIMIT_WARN) {
+			printf_line_warning(w->line, "Line is longer than %d characters.", MAX_LINE_LENGTH);
+		}
+
+		if (can_replay && w->old >= 0 && replay_line(w, &previous, &ic, &dc, image, &defined, &is_success)) {
+			if (!is_success) can_replay = can_save = FALSE;
+			continue;
+		}
+
+		w->kind = LINE_OTHER;
+		w->code_length = 0;
+		w->data_length = 0;
+		w->symbol = NULL;
+		line_errors = error_count();
+		if (!process_line_fpass(w->line, &ic, &dc, image->code_img, image->data_img, &image->symbol_table)) {
+			is_success = FALSE;
+		}
+		if (!is_success || error_count() != line_errors) {
+			/* The rest of the file is assembled in full, so that every message is that of a full assembly */
+			can_replay = can_save = FALSE;
+			continue;
+		}
+
+		describe_line(w, ic, dc, image->code_img);
+		if (w->kind == LINE_OTHER) {
+			/* The line may have defined something the replay does not track */
+			can_replay = can_save = FALSE;
+		} else if (w->symbol != NULL && w->kind != LINE_ENTRY) {
+			symbol_map_add(&defined, w->symbol);
+		}
+	}
+	symbol_map_free(&defined);
+	stats_phase_end(PHASE_PASS1);
+
+	image->icf = ic;
+	image->dcf = dc;
+	TRACE(TRACE_PASS1, "%s: first pass done, ic: %ld dc: %ld", file_name, ic, dc);
+
+	if (is_success) {
+		stats_phase_begin(PHASE_RELOCATE);
+		add_value_to_type(image->symbol_table, image->icf, DATA_SYMBOL);
+		stats_phase_end(PHASE_RELOCATE);
+
+		map_symbol_table(image->symbol_table, &symbols);
+		if (has_previous) {
+			changed = malloc_with_check((previous.header->symbol_count + 1) * sizeof(bool));
+			for (n = 0; n < (long) previous.header->symbol_count; n++) {
+				old_symbol = &previous.symbols[n];
+				slot = symbol_map_find(&symbols, state_symbol_name(&previous, n));
+				changed[n] = slot == NULL || slot->entry->value != old_symbol->value ||
+				             slot->entry->type != old_symbol->type;
+			}
+		}
+
+		stats_phase_begin(PHASE_PASS2);
+		ic = IC_INIT_VALUE;
+		for (n = 0; n < count; n++) {
+			w = &lines[n];
+			/* A line reached at another address than in the first pass is not modelled */
+			if (ic != w->ic) can_save = FALSE;
+			i = 0;
+			MOVE_TO_NOT_WHITE(w->line.content, i)
+			if (image->code_img[ic - IC_INIT_VALUE] != NULL || w->line.content[i] == '.') {
+				if (w->replayed && w->kind == LINE_CODE && ic == w->ic) {
+					resolve_replayed_fixups(w, &previous, changed, image);
+					ic += w->code_length;
+				} else {
+					is_success &= process_line_spass(w->line, &ic, image->code_img, &image->symbol_table);
+				}
+			}
+		}
+		stats_phase_end(PHASE_PASS2);
+
+		if (is_success && can_save && error_count() == errors_before) {
+			save_state(state_filename, lines, count, image, &symbols);
+		} else {
+			can_save = FALSE;
+		}
+		symbol_map_free(&symbols);
+	}
+
+	if (!is_success || !can_save) unlink(state_filename);
+	if (has_previous) unload_state(&previous);
+	free_with_check(changed);
+	free_with_check(lines);
+	free_with_check(state_filename);
+	return is_success;
+}
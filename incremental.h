@@ -0,0 +1,115 @@
+/**
+ * File: incremental.h
+ *
+ * Description:
+ *  This header file declares incremental reassembly (--incremental) and the state file it keeps between runs
+ *  (<file>.inc). The state holds, for every line of the macro-expanded source, a hash of the line, what kind of
+ *  line it is, the symbol it defines and its encoded words, with the direct operands (fixups) recorded by symbol;
+ *  and the symbol table after relocation.
+ *
+ *  On the next run the new lines are matched against the old ones (the unchanged prefix and suffix). Unchanged
+ *  lines are not parsed again: their symbols and words are replayed at their new addresses, and only the changed
+ *  lines go through the first pass. In the second pass, a fixup of an unchanged line keeps its old word unless its
+ *  symbol moved or is external, so when no instruction changed size only the fixups that depend on changed lines
+ *  are resolved again. When sizes do change, every later symbol moves, and the fixups referring to them are
+ *  resolved again from the new symbol table.
+ *
+ *  The outputs and messages are the same as a full assembly. A state is only written for a file that assembled
+ *  without errors; files with lines the replay does not model (e.g. a label on an otherwise empty line) are always
+ *  assembled in full.
+ *
+ *  Like objfile.h, the state is little-endian and used in place once mapped:
+ *
+ *   offset 0                inc_header
+ *   lines_offset            line_count inc_line records
+ *   symbols_offset          symbol_count inc_symbol records: the code, data and external symbols in table order
+ *   data_offset             data_count 64-bit words: the data image words of the data lines, in line order
+ *   words_offset            word_count inc_word records: the code words of the code lines, in line order
+ *   strings_offset          strings_size bytes of NUL-terminated symbol names
+ *
+ * Functions:
+ *  assemble_incremental(): Assembles a source, reusing the state of the previous run.
+ */
+
+#ifndef _INCREMENTAL_H
+#define _INCREMENTAL_H
+#include <stdint.h>
+#include "globals.h"
+#include "source.h"
+#include "process_file.h"
+
+#define INC_MAGIC "ASMI"
+#define INC_VERSION 1
+
+/** A missing symbol index */
+#define INC_NONE 0xFFFFFFFFu
+
+/** The fixed header at the start of a state file */
+typedef struct inc_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	/** ASSEMBLER_VERSION of the run that wrote the state, NUL-padded */
+	char assembler_version[8];
+	uint32_t line_count;
+	uint32_t symbol_count;
+	uint32_t data_count;
+	uint32_t word_count;
+	uint32_t strings_size;
+	uint32_t lines_offset;
+	uint32_t symbols_offset;
+	uint32_t data_offset;
+	uint32_t words_offset;
+	uint32_t strings_offset;
+	/** hash_bytes of everything after the header, so that a damaged state is ignored rather than replayed */
+	uint64_t checksum;
+} inc_header;
+
+/** A line of the expanded source */
+typedef struct inc_line {
+	uint64_t hash;
+	/** One of the line kinds of incremental.c */
+	uint8_t kind;
+	/** Code words of a code line */
+	uint8_t code_length;
+	uint16_t reserved;
+	/** Data words of a data line */
+	uint32_t data_length;
+	/** Index of the symbol a code or data line defines, or of the symbol an .extern line declares, or INC_NONE */
+	uint32_t symbol;
+	uint32_t reserved2;
+} inc_line;
+
+/** A symbol after relocation */
+typedef struct inc_symbol {
+	uint32_t name_offset;
+	uint32_t type;
+	int64_t value;
+} inc_symbol;
+
+/** A code word */
+typedef struct inc_word {
+	/** The first word's fields, or an operand word as (data << 3) | ARE */
+	uint32_t value;
+	/** For a direct operand, the index of its symbol; INC_NONE otherwise */
+	uint32_t symbol;
+} inc_word;
+
+
+/**
+ * Assembles a macro-expanded source like assemble_source, reusing the state the previous run left in
+ * <base_name>.inc, then writes the new state there (or removes it if the source did not assemble cleanly).
+ *
+ * @param source The expanded source. Its lines are NUL-terminated in place.
+ * @param file_name The name reported in error messages.
+ * @param base_name The base name of the state file.
+ * @param options The options; only the line limit applies here.
+ * @param image Receives the code and data images and the symbol table, allocated from the current arena.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise.
+ */
+
+bool assemble_incremental(source_buffer *source, char *file_name, char *base_name, assembler_options *options,
+                          assembly_image *image);
+
+#endif
@@ -18,6 +18,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "utils.h"
+#include "trace.h"
 
 
 /**
@@ -36,17 +37,16 @@ instruction find_instruction_from_index(line_info line, int *index) {
 	char temp[MAX_LINE_LENGTH];
 	int j;
 	instruction result;
- 	printf("find instruction from index %d : \n",line);	
 
 	MOVE_TO_NOT_WHITE(line.content, *index) 
 	if (line.content[*index] != '.') return NONE_INST;
 
 	
-        for (j = 0; line.content[*index] && line.content[*index] != '\t' && line.content[*index] != ' '; (*index)++, j++) {
+        for (j = 0; line.content[*index] && line.content[*index] != '\t' && line.content[*index] != ' ' && j < MAX_LINE_LENGTH - 1; (*index)++, j++) {
 		temp[j] = line.content[*index];
 	}
 	temp[j] = '\0'; 
-        printf("Instruction: %s\n", temp);
+        TRACE(TRACE_PASS1, "Instruction: %s", temp);
 
 	if ((result = find_instruction_by_name(temp+1)) != NONE_INST) return result;
 	printf_line_error(line, "Invalid instruction name: %s", temp);
@@ -86,16 +86,17 @@ bool process_string_instruction(line_info line, int index, long *data_img, long
 	
 		for (;line.content[index] && line.content[index] != '\n' &&
 		       line.content[index] != EOF; index++,i++) {
+				if (*dc >= CODE_ARR_IMG_LENGTH) {
+					printf_line_error(line, "Program too large: the data image is limited to %d words.",
+					                  CODE_ARR_IMG_LENGTH);
+					return FALSE;
+				}
 				data_img[*dc] = line.content[index];
                                 (*dc)++;
 		}
 
-		
-                printf("dc  %s", data_img);
-
-                
 	}
-	printf("Processing string: %s\n", temp_str);
+	TRACE(TRACE_PASS1, "Processed string, dc is now %ld", *dc);
 
 	return TRUE;
 }
@@ -128,11 +129,16 @@ bool process_data_instruction(line_info line, int index, long *data_img, long *d
 		for (i = 0;
 		     line.content[index] && line.content[index] != EOF && line.content[index] != '\t' &&
 		     line.content[index] != ' ' && line.content[index] != ',' &&
-		     line.content[index] != '\n'; index++, i++) {
+		     line.content[index] != '\n' && i < (int) sizeof(temp) - 1; index++, i++) {
 			temp[i] = line.content[index];
 		}
 		temp[i] = '\0'; 
 
+		if (i == (int) sizeof(temp) - 1) {
+			printf_line_error(line, "Value too long for .data instruction (starting with '%.10s')", temp);
+			return FALSE;
+		}
+
 		if (!is_int(temp)) {
 			printf_line_error(line, "Expected integer for .data instruction (got '%s')", temp);
 			return FALSE;
@@ -140,6 +146,10 @@ bool process_data_instruction(line_info line, int index, long *data_img, long *d
 
 		value = strtol(temp, &temp_ptr, 10);
 
+		if (*dc >= CODE_ARR_IMG_LENGTH) {
+			printf_line_error(line, "Program too large: the data image is limited to %d words.", CODE_ARR_IMG_LENGTH);
+			return FALSE;
+		}
 		data_img[*dc] = value;
 
 		(*dc)++; 
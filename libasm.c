@@ -0,0 +1,210 @@
+/**
+ * File: libasm.c
+ *
+ * Description:
+ *  This file contains the in-memory entry points of the assembler declared in libasm.h. They run the same macro
+ *  expansion and passes as process_file, with the result's arena selected as the current arena and a diagnostic
+ *  sink that collects errors and warnings instead of printing them, then copy the images and symbol lists into
+ *  plain arrays.
+ *
+ * Functions:
+ *  asm_assemble(): Assembles a source held in memory with the default options.
+ *  asm_assemble_with_options(): Assembles a source held in memory.
+ *  asm_result_free(): Releases everything held by a result.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "libasm.h"
+#include "utils.h"
+#include "macr.h"
+#include "process_file.h"
+#include "writefiles.h"
+
+#define KEEP_ONLY_15_LSB(value) ((value) & 0x7FFF)
+
+/* One collected diagnostic, chained in the order reported */
+typedef struct collected_diagnostic {
+	asm_diagnostic diagnostic;
+	struct collected_diagnostic *next;
+} collected_diagnostic;
+
+/* A diagnostic sink that keeps everything reported to it */
+typedef struct diagnostic_collector {
+	diagnostic_sink sink;
+	collected_diagnostic *first, *last;
+	long count;
+} diagnostic_collector;
+
+static char source_name[] = ASM_SOURCE_NAME;
+
+
+/**
+ * Keeps a reported diagnostic. The diagnostic is allocated from the current arena, which is the result's.
+ *
+ * @param sink The collector's sink.
+ * @param line The line the message is about.
+ * @param is_warning TRUE for a warning, FALSE for an error.
+ * @param message The formatted message.
+ */
+
+static void collect_diagnostic(diagnostic_sink *sink, line_info line, bool is_warning, char *message) {
+	diagnostic_collector *collector = (diagnostic_collector *) sink;
+	collected_diagnostic *collected = assembly_alloc(sizeof(collected_diagnostic));
+
+	collected->diagnostic.is_warning = is_warning;
+	collected->diagnostic.line_number = line.line_number;
+	collected->diagnostic.message = assembly_strdup(message);
+	collected->next = NULL;
+	if (collector->last == NULL) collector->first = collected;
+	else collector->last->next = collected;
+	collector->last = collected;
+	collector->count++;
+}
+
+
+/**
+ * Copies the symbols of a table into an array allocated from the current arena.
+ *
+ * @param tab The symbols to copy.
+ * @param count Receives the number of symbols.
+ *
+ * @return The array of symbols. Their names are the table's keys.
+ */
+
+static asm_symbol *collect_symbols(table tab, long *count) {
+	asm_symbol *symbols;
+	table curr_entry;
+	long i;
+
+	for (*count = 0, curr_entry = tab; curr_entry != NULL; curr_entry = curr_entry->next) (*count)++;
+	symbols = assembly_alloc(*count * sizeof(asm_symbol));
+	for (i = 0, curr_entry = tab; curr_entry != NULL; curr_entry = curr_entry->next, i++) {
+		symbols[i].name = curr_entry->key;
+		symbols[i].address = curr_entry->value;
+	}
+	return symbols;
+}
+
+
+/**
+ * Fills the words, symbol lists and relocations of a result from an assembled image, the same way the output files are written.
+ *
+ * @param image The assembled image.
+ * @param out The result to fill.
+ */
+
+static void collect_image(assembly_image *image, asm_result *out) {
+	long i, val = 0;
+
+	out->code_length = image->icf - IC_INIT_VALUE;
+	out->data_length = image->dcf;
+	out->words = assembly_alloc((out->code_length + out->data_length) * sizeof(unsigned int));
+	out->relocations = assembly_alloc((out->code_length + 1) * sizeof(long));
+	out->relocation_count = 0;
+	for (i = 0; i < out->code_length; i++) {
+		if (image->code_img[i] != NULL) val = get_word_value(image->code_img[i]);
+		out->words[i] = KEEP_ONLY_15_LSB(val);
+		if (is_relocatable_word(image->code_img[i])) out->relocations[out->relocation_count++] = IC_INIT_VALUE + i;
+	}
+	for (i = 0; i < out->data_length; i++) {
+		out->words[out->code_length + i] = KEEP_ONLY_15_LSB(image->data_img[i]);
+	}
+
+	out->entries = collect_symbols(filter_table_by_type(image->symbol_table, ENTRY_SYMBOL), &out->entry_count);
+	out->externs = collect_symbols(filter_table_by_type(image->symbol_table, EXTERNAL_REFERENCE), &out->extern_count);
+}
+
+
+/**
+ * Assembles a source held in memory with the default options. The source is not modified.
+ *
+ * @param src The source text; it need not be NUL-terminated.
+ * @param len The length of the source in bytes.
+ * @param out Receives the result; release it with asm_result_free, whether or not assembly succeeded.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise (see out->diagnostics).
+ */
+
+bool asm_assemble(const char *src, size_t len, asm_result *out) {
+	assembler_options options;
+
+	init_assembler_options(&options);
+	return asm_assemble_with_options(src, len, &options, out);
+}
+
+
+/**
+ * Assembles a source held in memory. The source is not modified.
+ *
+ * @param src The source text; it need not be NUL-terminated.
+ * @param len The length of the source in bytes.
+ * @param options The options; only the line limit applies.
+ * @param out Receives the result; release it with asm_result_free, whether or not assembly succeeded.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise (see out->diagnostics).
+ */
+
+bool asm_assemble_with_options(const char *src, size_t len, assembler_options *options, asm_result *out) {
+	source_buffer input, expanded;
+	assembly_image image;
+	diagnostic_collector collector;
+	diagnostic_sink *previous_sink;
+	arena *previous_arena;
+	collected_diagnostic *collected;
+	bool is_success;
+	long i;
+
+	memset(out, 0, sizeof(asm_result));
+	arena_init(&out->memory);
+	out->code_base = IC_INIT_VALUE;
+
+	previous_arena = arena_select(&out->memory);
+	collector.sink.report = collect_diagnostic;
+	collector.first = collector.last = NULL;
+	collector.count = 0;
+	previous_sink = set_diagnostic_sink(&collector.sink);
+
+	/* The passes terminate lines in place, so they work on a copy */
+	input.data = malloc_with_check(len + 1);
+	memcpy(input.data, src, len);
+	input.data[len] = '\0';
+	input.length = len;
+	input.mapped_length = 0;
+
+	is_success = expand_macros(&input, source_name, &expanded);
+	source_close(&input);
+
+	out->expanded_length = expanded.length;
+	out->expanded_source = assembly_alloc(expanded.length + 1);
+	memcpy(out->expanded_source, expanded.data, expanded.length + 1);
+
+	if (is_success) is_success = assemble_source(&expanded, source_name, options, &image);
+	if (is_success) collect_image(&image, out);
+	source_close(&expanded);
+
+	out->diagnostic_count = collector.count;
+	out->diagnostics = assembly_alloc(collector.count * sizeof(asm_diagnostic));
+	for (i = 0, collected = collector.first; collected != NULL; collected = collected->next, i++) {
+		out->diagnostics[i] = collected->diagnostic;
+	}
+
+	set_diagnostic_sink(previous_sink);
+	arena_select(previous_arena);
+	out->success = is_success;
+	return is_success;
+}
+
+
+/**
+ * Releases everything held by a result.
+ *
+ * @param out The result to release.
+ */
+
+void asm_result_free(asm_result *out) {
+	arena_release(&out->memory);
+	memset(out, 0, sizeof(asm_result));
+}
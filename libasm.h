@@ -0,0 +1,106 @@
+/**
+ * File: libasm.h
+ *
+ * Description:
+ *  This header file declares the assembler as a library: a source held in memory goes in, and the machine words,
+ *  entries, external references, relocations and diagnostics come back in memory, without touching the filesystem. It is meant
+ *  for tools that assemble many small sources (test harnesses, code generators) and would otherwise pay for a
+ *  process and a set of temporary files each time.
+ *
+ *  Everything in a result is allocated from the result's own arena and released by asm_result_free. Each call keeps
+ *  its state to itself, so calls from different threads do not interfere (the --stats counters are shared).
+ *
+ * Functions:
+ *  asm_assemble(): Assembles a source held in memory with the default options.
+ *  asm_assemble_with_options(): Assembles a source held in memory.
+ *  asm_result_free(): Releases everything held by a result.
+ */
+
+#ifndef _LIBASM_H
+#define _LIBASM_H
+#include <stddef.h>
+#include "globals.h"
+#include "arena.h"
+
+/** The name given to in-memory sources in diagnostics */
+#define ASM_SOURCE_NAME "<memory>"
+
+/** An error or warning about a line of the source */
+typedef struct asm_diagnostic {
+	bool is_warning;
+	/** The line of the macro-expanded source the message is about */
+	long line_number;
+	char *message;
+} asm_diagnostic;
+
+/** An entry symbol, or a word that refers to an external symbol */
+typedef struct asm_symbol {
+	char *name;
+	long address;
+} asm_symbol;
+
+/** Everything produced by assembling a source */
+typedef struct asm_result {
+	/** TRUE if the source assembled without errors; the words and symbols are only filled in then */
+	bool success;
+	/** Address of the first code word (IC_INIT_VALUE) */
+	long code_base;
+	long code_length;
+	long data_length;
+	/** code_length code words followed by data_length data words, 15 bits each, as written to the .ob file */
+	unsigned int *words;
+	/** The .entry symbols, as written to the .ent file */
+	asm_symbol *entries;
+	long entry_count;
+	/** The references to external symbols, as written to the .ext file */
+	asm_symbol *externs;
+	long extern_count;
+	/** The addresses of the relocatable words, as written to the .rel file */
+	long *relocations;
+	long relocation_count;
+	asm_diagnostic *diagnostics;
+	long diagnostic_count;
+	/** The macro-expanded source, as written to the .am file */
+	char *expanded_source;
+	long expanded_length;
+	/** Holds everything above */
+	arena memory;
+} asm_result;
+
+
+/**
+ * Assembles a source held in memory with the default options. The source is not modified.
+ *
+ * @param src The source text; it need not be NUL-terminated.
+ * @param len The length of the source in bytes.
+ * @param out Receives the result; release it with asm_result_free, whether or not assembly succeeded.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise (see out->diagnostics).
+ */
+
+bool asm_assemble(const char *src, size_t len, asm_result *out);
+
+
+/**
+ * Assembles a source held in memory. The source is not modified.
+ *
+ * @param src The source text; it need not be NUL-terminated.
+ * @param len The length of the source in bytes.
+ * @param options The options; only the line limit applies.
+ * @param out Receives the result; release it with asm_result_free, whether or not assembly succeeded.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise (see out->diagnostics).
+ */
+
+bool asm_assemble_with_options(const char *src, size_t len, assembler_options *options, asm_result *out);
+
+
+/**
+ * Releases everything held by a result.
+ *
+ * @param out The result to release.
+ */
+
+void asm_result_free(asm_result *out);
+
+#endif
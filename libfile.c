@@ -0,0 +1,184 @@
+/**
+ * File: libfile.c
+ *
+ * Description:
+ *  This file contains the loader for the static library format (.lib) described in libfile.h. The file is mapped
+ *  read-only and its directory is probed in place. As with .obb files, a big-endian host refuses the file.
+ *
+ * Functions:
+ *  lib_hash(): Hashes an entry name for the directory.
+ *  lib_map(): Maps a .lib file into memory and validates its header.
+ *  lib_unmap(): Releases a mapped .lib file.
+ *  lib_find(): Finds the member defining an entry.
+ *  lib_member_name(): Returns the name of a member.
+ *  lib_member_object(): Validates the object of a member and points into it.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "libfile.h"
+#include "cache.h"
+
+
+/**
+ * Hashes an entry name for the directory.
+ *
+ * @param name The entry name.
+ *
+ * @return The hash.
+ */
+
+uint32_t lib_hash(const char *name) {
+	return (uint32_t) hash_bytes(0, name, strlen(name));
+}
+
+
+/**
+ * Checks that a section of count records of the given size lies inside the mapping.
+ *
+ * @param mapped_length The size of the mapping.
+ * @param offset The offset of the section.
+ * @param count The number of records in the section.
+ * @param size The size of a single record.
+ *
+ * @return TRUE if the section fits, FALSE otherwise.
+ */
+
+static bool section_fits(long mapped_length, uint32_t offset, uint32_t count, long size) {
+	return offset % 4 == 0 && offset <= mapped_length && (long) count <= (mapped_length - (long) offset) / size;
+}
+
+
+/**
+ * Maps a .lib file into memory and validates its header and section bounds. The objects of the members are only
+ * validated when lib_member_object is asked for them.
+ *
+ * @param filename The name of the file to map.
+ * @param archive Receives pointers to the sections of the mapped file.
+ *
+ * @return TRUE if the file was mapped and is a valid archive, FALSE otherwise.
+ */
+
+bool lib_map(char *filename, lib_archive *archive) {
+	const uint16_t byte_order_probe = 1;
+	const lib_header *header;
+	struct stat file_stat;
+	void *mapping;
+	int fd;
+
+	if (*(const unsigned char *) &byte_order_probe != 1) return FALSE;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return FALSE;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (long) sizeof(lib_header)) {
+		close(fd);
+		return FALSE;
+	}
+	mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return FALSE;
+
+	header = mapping;
+	/* The capacity must be a power of two, with an empty slot to end every probe */
+	if (memcmp(header->magic, LIB_MAGIC, 4) != 0 || header->version != LIB_VERSION ||
+	    header->header_size < sizeof(lib_header) ||
+	    header->directory_capacity == 0 || (header->directory_capacity & (header->directory_capacity - 1)) != 0 ||
+	    header->entry_count >= header->directory_capacity ||
+	    !section_fits(file_stat.st_size, header->members_offset, header->member_count, sizeof(lib_member)) ||
+	    !section_fits(file_stat.st_size, header->directory_offset, header->directory_capacity, sizeof(lib_slot)) ||
+	    !section_fits(file_stat.st_size, header->strings_offset, header->strings_size, 1)) {
+		munmap(mapping, file_stat.st_size);
+		return FALSE;
+	}
+	if (header->strings_size > 0 && ((const char *) mapping)[header->strings_offset + header->strings_size - 1] != '\0') {
+		munmap(mapping, file_stat.st_size);
+		return FALSE;
+	}
+
+	archive->header = header;
+	archive->members = (const lib_member *) ((const char *) mapping + header->members_offset);
+	archive->directory = (const lib_slot *) ((const char *) mapping + header->directory_offset);
+	archive->strings = (const char *) mapping + header->strings_offset;
+	archive->mapping = mapping;
+	archive->mapped_length = file_stat.st_size;
+	return TRUE;
+}
+
+
+/**
+ * Releases a mapped .lib file.
+ *
+ * @param archive The archive to release.
+ */
+
+void lib_unmap(lib_archive *archive) {
+	if (archive->mapping != NULL) munmap(archive->mapping, archive->mapped_length);
+	archive->mapping = NULL;
+}
+
+
+/**
+ * Finds the member defining an entry.
+ *
+ * @param archive The mapped archive.
+ * @param name The entry name.
+ *
+ * @return The index of the member, or -1 if no member defines the entry.
+ */
+
+long lib_find(const lib_archive *archive, const char *name) {
+	uint32_t hash = lib_hash(name), mask = archive->header->directory_capacity - 1, i, probes;
+	const lib_slot *slot;
+
+	/* Bounded by the capacity, in case a damaged file has no empty slot */
+	for (i = hash & mask, probes = 0; probes <= mask; i = (i + 1) & mask, probes++) {
+		slot = &archive->directory[i];
+		if (slot->member == 0) return -1;
+		if (slot->hash == hash && slot->name_offset < archive->header->strings_size &&
+		    strcmp(archive->strings + slot->name_offset, name) == 0) {
+			return slot->member <= archive->header->member_count ? (long) slot->member - 1 : -1;
+		}
+	}
+	return -1;
+}
+
+
+/**
+ * Returns the name of a member.
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ *
+ * @return The NUL-terminated name inside the mapping, or "" if the record points outside the strings.
+ */
+
+const char *lib_member_name(const lib_archive *archive, long member) {
+	if (archive->members[member].name_offset >= archive->header->strings_size) return "";
+	return archive->strings + archive->members[member].name_offset;
+}
+
+
+/**
+ * Validates the object of a member and points into it, in place (see obb_view).
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ * @param image Receives pointers to the sections of the object.
+ *
+ * @return TRUE if the member's object is a valid object, FALSE otherwise.
+ */
+
+bool lib_member_object(const lib_archive *archive, long member, obb_image *image) {
+	const lib_member *record = &archive->members[member];
+
+	if (record->object_offset % 4 != 0 || record->object_offset > archive->mapped_length ||
+	    record->object_length > archive->mapped_length - record->object_offset) {
+		return FALSE;
+	}
+	return obb_view((const char *) archive->mapping + record->object_offset, record->object_length, image);
+}
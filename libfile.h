@@ -0,0 +1,146 @@
+/**
+ * File: libfile.h
+ *
+ * Description:
+ *  This header file defines the static library format (.lib): many assembled modules packed into one file, with a
+ *  hashed directory from every entry name to the module defining it, so that a linker can find the modules it needs
+ *  with one probe per external instead of opening and reading every module's .ent file. Like the .obb format it is
+ *  little-endian with every section on a 4-byte boundary, so a mapped file, directory included, is used in place:
+ *
+ *   offset 0                lib_header
+ *   members_offset          member_count lib_member records: the module's name and where its object is
+ *   directory_offset        directory_capacity lib_slot records (a power of two, at most half of them used): open
+ *                           addressing with linear probing on lib_hash of the entry name
+ *   strings_offset          strings_size bytes of NUL-terminated module and entry names
+ *   (objects)               every member's object, in the .obb format of objfile.h
+ *
+ * Functions:
+ *  lib_hash(): Hashes an entry name for the directory.
+ *  lib_map(): Maps a .lib file into memory and validates its header.
+ *  lib_unmap(): Releases a mapped .lib file.
+ *  lib_find(): Finds the member defining an entry.
+ *  lib_member_name(): Returns the name of a member.
+ *  lib_member_object(): Validates the object of a member and points into it.
+ */
+
+#ifndef _LIBFILE_H
+#define _LIBFILE_H
+#include <stdint.h>
+#include "globals.h"
+#include "objfile.h"
+
+#define LIB_MAGIC "LIB1"
+#define LIB_VERSION 1
+
+/** The fixed header at the start of a .lib file */
+typedef struct lib_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	uint32_t member_count;
+	uint32_t members_offset;
+	/** The number of entries in the directory */
+	uint32_t entry_count;
+	uint32_t directory_offset;
+	uint32_t directory_capacity;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+} lib_header;
+
+/** A member: an offset into the string section, and the offset and size of its object in the file */
+typedef struct lib_member {
+	uint32_t name_offset;
+	uint32_t object_offset;
+	uint32_t object_length;
+} lib_member;
+
+/** A directory slot */
+typedef struct lib_slot {
+	uint32_t hash;
+	uint32_t name_offset;
+	/** The member defining the entry, plus one; 0 for an empty slot */
+	uint32_t member;
+} lib_slot;
+
+/** A .lib file mapped into memory */
+typedef struct lib_archive {
+	const lib_header *header;
+	const lib_member *members;
+	const lib_slot *directory;
+	const char *strings;
+	/** The whole mapping, for lib_unmap */
+	void *mapping;
+	long mapped_length;
+} lib_archive;
+
+
+/**
+ * Hashes an entry name for the directory.
+ *
+ * @param name The entry name.
+ *
+ * @return The hash.
+ */
+
+uint32_t lib_hash(const char *name);
+
+
+/**
+ * Maps a .lib file into memory and validates its header and section bounds. The objects of the members are only
+ * validated when lib_member_object is asked for them.
+ *
+ * @param filename The name of the file to map.
+ * @param archive Receives pointers to the sections of the mapped file.
+ *
+ * @return TRUE if the file was mapped and is a valid archive, FALSE otherwise.
+ */
+
+bool lib_map(char *filename, lib_archive *archive);
+
+
+/**
+ * Releases a mapped .lib file.
+ *
+ * @param archive The archive to release.
+ */
+
+void lib_unmap(lib_archive *archive);
+
+
+/**
+ * Finds the member defining an entry.
+ *
+ * @param archive The mapped archive.
+ * @param name The entry name.
+ *
+ * @return The index of the member, or -1 if no member defines the entry.
+ */
+
+long lib_find(const lib_archive *archive, const char *name);
+
+
+/**
+ * Returns the name of a member.
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ *
+ * @return The NUL-terminated name inside the mapping, or "" if the record points outside the strings.
+ */
+
+const char *lib_member_name(const lib_archive *archive, long member);
+
+
+/**
+ * Validates the object of a member and points into it, in place (see obb_view).
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ * @param image Receives pointers to the sections of the object.
+ *
+ * @return TRUE if the member's object is a valid object, FALSE otherwise.
+ */
+
+bool lib_member_object(const lib_archive *archive, long member, obb_image *image);
+
+#endif
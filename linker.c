@@ -0,0 +1,922 @@
+/**
+ * File: linker.c
+ *
+ * Description:
+ *  This file contains the linker described in linker.h: reading assembled modules, the hashed global symbol
+ *  index, the layout and resolution pass, and writing the linked image.
+ *
+ * Functions:
+ *  link_load_module(): Reads an assembled module.
+ *  link_load_member(): Reads a module out of a .lib archive.
+ *  link_pull_members(): Adds the archive members that define the unresolved externals.
+ *  load_binary_image(): Copies a module out of a binary object.
+ *  load_binary_module(): Reads a module from its .obb file.
+ *  load_text_module(): Reads a module from its .ob file.
+ *  load_symbol_file(): Reads the records of a .ent or .ext file.
+ *  load_relocation_file(): Reads the records of a .rel file.
+ *  link_index_init() / link_index_add() / link_index_find(): The global symbol index.
+ *  relocate_address(): Moves an address of a module to its linked place.
+ *  compare_addresses(): Orders addresses for qsort.
+ *  link_layout(): Lays out the modules and prepares the image.
+ *  link_publish_entries(): Adds the entries of a module to the global index.
+ *  link_check_entries(): Reports the entries defined by more than one module.
+ *  link_resolve_module(): Copies a module's words into the image and patches them.
+ *  link_finish_image(): Gathers the relocation records of the image.
+ *  link_modules(): Lays out the modules and resolves their references into one image.
+ *  link_write_image(): Writes the linked image.
+ *  write_file(): Writes a whole buffer to a file.
+ *  format_obb(): Formats a binary object (see objfile.h).
+ *  link_write_archive(): Packs modules into a .lib archive.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "linker.h"
+#include "objfile.h"
+#include "libfile.h"
+#include "source.h"
+#include "writefiles.h"
+#include "cache.h"
+#include "utils.h"
+#include "arena.h"
+
+/* Digits of an address in the .ob and .ent files */
+#define ADDRESS_DIGITS 7
+
+
+/**
+ * Copies a module out of a binary object, from a .obb file or a .lib member.
+ *
+ * @param image The object.
+ * @param module Receives the module; its name is left alone.
+ */
+
+static void load_binary_image(obb_image *image, link_module *module) {
+	long i;
+
+	module->code_length = image->header->code_length;
+	module->data_length = image->header->data_length;
+	module->words = assembly_alloc((module->code_length + module->data_length + 1) * sizeof(unsigned long));
+	for (i = 0; i < module->code_length + module->data_length; i++) module->words[i] = obb_word(image, i);
+
+	module->entry_count = image->header->entry_count;
+	module->entries = assembly_alloc((module->entry_count + 1) * sizeof(link_symbol));
+	for (i = 0; i < module->entry_count; i++) {
+		module->entries[i].name = assembly_strdup((char *) obb_symbol_name(image, &image->entries[i]));
+		module->entries[i].address = image->entries[i].address;
+	}
+	module->extern_count = image->header->extern_count;
+	module->externs = assembly_alloc((module->extern_count + 1) * sizeof(link_symbol));
+	for (i = 0; i < module->extern_count; i++) {
+		module->externs[i].name = assembly_strdup((char *) obb_symbol_name(image, &image->externs[i]));
+		module->externs[i].address = image->externs[i].address;
+	}
+	module->relocation_count = image->header->relocation_count;
+	module->relocations = assembly_alloc((module->relocation_count + 1) * sizeof(long));
+	for (i = 0; i < module->relocation_count; i++) module->relocations[i] = image->relocations[i];
+}
+
+
+/**
+ * Reads a module from its .obb file.
+ *
+ * @param filename The .obb file.
+ * @param module Receives the module; its name is left alone.
+ *
+ * @return TRUE if the module was read.
+ */
+
+static bool load_binary_module(char *filename, link_module *module) {
+	obb_image image;
+
+	if (!obb_map(filename, &image)) {
+		fprintf(stderr, "Error: %s is not a valid binary object\n", filename);
+		return FALSE;
+	}
+	load_binary_image(&image, module);
+	obb_unmap(&image);
+	return TRUE;
+}
+
+
+/**
+ * Reads the "name address" records of a .ent or .ext file. A missing file has no records.
+ *
+ * @param filename The file.
+ * @param symbols Receives the records.
+ * @param count Receives the number of records.
+ *
+ * @return TRUE if the file is missing or was read, FALSE if a record is malformed.
+ */
+
+static bool load_symbol_file(char *filename, link_symbol **symbols, long *count) {
+	source_buffer file;
+	line_info line;
+	long offset = 0, capacity = 0;
+	char *space, *end;
+
+	*symbols = NULL;
+	*count = 0;
+	if (!source_open(filename, &file)) return TRUE;
+
+	/* Every record takes more than 8 bytes */
+	capacity = file.length / 8 + 1;
+	*symbols = assembly_alloc(capacity * sizeof(link_symbol));
+	while (source_next_line(&file, &offset, &line)) {
+		if (line.length == 0) continue;
+		space = strrchr(line.content, ' ');
+		if (space == NULL || space == line.content || *count == capacity) {
+			fprintf(stderr, "Error: %s: malformed record \"%s\"\n", filename, line.content);
+			source_close(&file);
+			return FALSE;
+		}
+		*space = '\0';
+		(*symbols)[*count].name = assembly_strdup(line.content);
+		(*symbols)[*count].address = strtol(space + 1, &end, 10);
+		if (end == space + 1 || *end != '\0') {
+			fprintf(stderr, "Error: %s: malformed address of %s\n", filename, line.content);
+			source_close(&file);
+			return FALSE;
+		}
+		(*count)++;
+	}
+	source_close(&file);
+	return TRUE;
+}
+
+
+/**
+ * Reads the addresses of a .rel file, one per line. Unlike the symbol files, the file must be there: every module
+ * the assembler writes has one, even when it is empty.
+ *
+ * @param filename The file.
+ * @param addresses Receives the addresses.
+ * @param count Receives the number of addresses.
+ *
+ * @return TRUE if the file was read, FALSE if it is missing or an address is malformed.
+ */
+
+static bool load_relocation_file(char *filename, long **addresses, long *count) {
+	source_buffer file;
+	line_info line;
+	long offset = 0, capacity;
+	char *end;
+
+	*count = 0;
+	if (!source_open(filename, &file)) {
+		fprintf(stderr, "Error: can't read %s; assemble the module again\n", filename);
+		return FALSE;
+	}
+	/* Every record the assembler writes takes 7 digits and a newline but the last */
+	capacity = file.length / ADDRESS_DIGITS + 1;
+	*addresses = assembly_alloc(capacity * sizeof(long));
+	while (source_next_line(&file, &offset, &line)) {
+		if (line.length == 0) continue;
+		if (*count == capacity) {
+			fprintf(stderr, "Error: %s: malformed record \"%s\"\n", filename, line.content);
+			source_close(&file);
+			return FALSE;
+		}
+		(*addresses)[*count] = strtol(line.content, &end, 10);
+		if (end == line.content || *end != '\0') {
+			fprintf(stderr, "Error: %s: malformed address \"%s\"\n", filename, line.content);
+			source_close(&file);
+			return FALSE;
+		}
+		(*count)++;
+	}
+	source_close(&file);
+	return TRUE;
+}
+
+
+/**
+ * Reads a module from its .ob file, with the records of its .ent, .ext and .rel files.
+ *
+ * @param base_name The module's name, without extension.
+ * @param module Receives the module; its name is left alone.
+ *
+ * @return TRUE if the module was read.
+ */
+
+static bool load_text_module(char *base_name, link_module *module) {
+	char *filename = strallocat(base_name, ".ob"), *end;
+	source_buffer file;
+	line_info line;
+	long offset = 0, index = 0, address;
+	bool result = FALSE;
+
+	if (!source_open(filename, &file)) {
+		fprintf(stderr, "Error: can't read %s\n", filename);
+		free_with_check(filename);
+		return FALSE;
+	}
+	if (!source_next_line(&file, &offset, &line) ||
+	    sscanf(line.content, "%ld %ld", &module->code_length, &module->data_length) != 2 ||
+	    module->code_length < 0 || module->data_length < 0 ||
+	    module->code_length + module->data_length > LINK_MAX_ADDRESS) {
+		fprintf(stderr, "Error: %s: malformed header\n", filename);
+		goto done;
+	}
+	module->words = assembly_alloc((module->code_length + module->data_length + 1) * sizeof(unsigned long));
+	while (index < module->code_length + module->data_length && source_next_line(&file, &offset, &line)) {
+		address = strtol(line.content, &end, 10);
+		if (address != IC_INIT_VALUE + index || *end != ' ') break;
+		module->words[index++] = strtoul(end + 1, &end, 8);
+		if (*end != '\0') break;
+	}
+	if (index < module->code_length + module->data_length) {
+		fprintf(stderr, "Error: %s: malformed or missing word at address %ld\n", filename, IC_INIT_VALUE + index);
+		goto done;
+	}
+	free_with_check(filename);
+	filename = strallocat(base_name, ".ent");
+	if (!load_symbol_file(filename, &module->entries, &module->entry_count)) goto done;
+	free_with_check(filename);
+	filename = strallocat(base_name, ".ext");
+	if (!load_symbol_file(filename, &module->externs, &module->extern_count)) goto done;
+	free_with_check(filename);
+	filename = strallocat(base_name, ".rel");
+	result = load_relocation_file(filename, &module->relocations, &module->relocation_count);
+
+done:
+	source_close(&file);
+	free_with_check(filename);
+	return result;
+}
+
+
+/**
+ * Reads an assembled module: <base_name>.obb if it exists and is not older than the .ob file, else
+ * <base_name>.ob with its .rel file, and its .ent and .ext files (either may be missing when empty). The
+ * module's memory is allocated from the current arena.
+ *
+ * @param base_name The module's name, without extension.
+ * @param module Receives the module.
+ *
+ * @return TRUE if the module was read, FALSE if a file could not be read or is malformed (the error is printed).
+ */
+
+bool link_load_module(char *base_name, link_module *module) {
+	char *binary_name = strallocat(base_name, ".obb"), *text_name = strallocat(base_name, ".ob");
+	struct stat binary_stat, text_stat;
+	bool result;
+
+	memset(module, 0, sizeof(link_module));
+	module->name = assembly_strdup(base_name);
+	/* A .obb left from an older assembly is ignored */
+	if (stat(binary_name, &binary_stat) == 0 &&
+	    (stat(text_name, &text_stat) != 0 || binary_stat.st_mtime >= text_stat.st_mtime)) {
+		result = load_binary_module(binary_name, module);
+	} else {
+		result = load_text_module(base_name, module);
+	}
+	free_with_check(binary_name);
+	free_with_check(text_name);
+	return result;
+}
+
+
+/**
+ * Reads a module out of a .lib archive. The module's memory is allocated from the current arena.
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ * @param module Receives the module, named after the member.
+ *
+ * @return TRUE if the module was read, FALSE if the member is malformed (the error is printed).
+ */
+
+bool link_load_member(lib_archive *archive, long member, link_module *module) {
+	obb_image image;
+
+	memset(module, 0, sizeof(link_module));
+	module->name = assembly_strdup((char *) lib_member_name(archive, member));
+	if (!lib_member_object(archive, member, &image)) {
+		fprintf(stderr, "Error: the archive member %s is not a valid binary object\n", module->name);
+		return FALSE;
+	}
+	load_binary_image(&image, module);
+	return TRUE;
+}
+
+
+/**
+ * Adds to the modules every archive member needed to define an external that no module defines, and the members
+ * those need in turn. Each external is looked up in the archives in the order given, one directory probe per
+ * archive; a member is added once, when it is first needed. Externals that no archive defines are left for
+ * link_modules to report.
+ *
+ * @param archives The mapped archives.
+ * @param archive_count The number of archives.
+ * @param modules The modules, from malloc_with_check; grown as members are added.
+ * @param count The number of modules; updated.
+ *
+ * @return TRUE if every needed member was read, FALSE otherwise (the error is printed).
+ */
+
+bool link_pull_members(lib_archive *archives, int archive_count, link_module **modules, int *count) {
+	long i, j, member = -1, entry_count = 0;
+	link_index defined;
+	link_module *module;
+	bool **pulled;
+	int a, m, capacity = *count;
+
+	/* Every entry a module or a member may bring */
+	pulled = assembly_alloc((archive_count + 1) * sizeof(bool *));
+	for (a = 0; a < archive_count; a++) {
+		entry_count += archives[a].header->entry_count;
+		pulled[a] = assembly_alloc((archives[a].header->member_count + 1) * sizeof(bool));
+		memset(pulled[a], 0, (archives[a].header->member_count + 1) * sizeof(bool));
+	}
+	for (m = 0; m < *count; m++) entry_count += (*modules)[m].entry_count;
+	link_index_init(&defined, entry_count);
+	for (m = 0; m < *count; m++) {
+		for (i = 0; i < (*modules)[m].entry_count; i++) link_index_add(&defined, (*modules)[m].entries[i].name, 0, m);
+	}
+
+	/* The members added are scanned in turn when the loop reaches them; (*modules)[m] is read afresh every time,
+	 * as adding a member may move the array */
+	for (m = 0; m < *count; m++) {
+		for (i = 0; i < (*modules)[m].extern_count; i++) {
+			if (link_index_find(&defined, (*modules)[m].externs[i].name) != NULL) continue;
+			for (a = 0; a < archive_count; a++) {
+				if ((member = lib_find(&archives[a], (*modules)[m].externs[i].name)) >= 0) break;
+			}
+			if (a == archive_count || pulled[a][member]) continue;
+
+			pulled[a][member] = TRUE;
+			if (*count == capacity) {
+				capacity = 2 * capacity + 1;
+				*modules = realloc_with_check(*modules, capacity * sizeof(link_module));
+			}
+			module = &(*modules)[*count];
+			if (!link_load_member(&archives[a], member, module)) return FALSE;
+			for (j = 0; j < module->entry_count; j++) link_index_add(&defined, module->entries[j].name, 0, *count);
+			(*count)++;
+		}
+	}
+	return TRUE;
+}
+
+
+/**
+ * Prepares an empty index for a number of symbols. The slots are allocated from the current arena.
+ *
+ * @param index The index.
+ * @param expected_count The number of symbols it will hold at most.
+ */
+
+void link_index_init(link_index *index, long expected_count) {
+	index->capacity = 16;
+	while (index->capacity < 2 * expected_count) index->capacity *= 2;
+	index->slots = assembly_alloc(index->capacity * sizeof(link_index_slot));
+	memset(index->slots, 0, index->capacity * sizeof(link_index_slot));
+	index->count = 0;
+}
+
+
+/**
+ * Finds the slot of a name: the slot holding it, or the empty slot where it would go.
+ *
+ * @param index The index.
+ * @param name The name.
+ * @param hash The name's hash.
+ *
+ * @return The slot.
+ */
+
+static link_index_slot *find_slot(link_index *index, const char *name, uint64_t hash) {
+	long i = (long) (hash & (index->capacity - 1));
+
+	while (index->slots[i].name != NULL &&
+	       (index->slots[i].hash != hash || strcmp(index->slots[i].name, name) != 0)) {
+		i = (i + 1) & (index->capacity - 1);
+	}
+	return &index->slots[i];
+}
+
+
+/**
+ * Adds a symbol to the index, unless a symbol of the same name is there already. Threads may add symbols at once;
+ * the index is only looked up after they are all done.
+ *
+ * @param index The index, prepared for at least one more symbol.
+ * @param name The symbol's name, which must outlive the index.
+ * @param address The symbol's address.
+ * @param module The module defining the symbol.
+ *
+ * @return The slot of the new symbol, or the slot of the symbol already there. While other threads are adding,
+ *         only its name may be read.
+ */
+
+link_index_slot *link_index_add(link_index *index, const char *name, long address, int module) {
+	uint64_t hash = hash_bytes(0, name, strlen(name));
+	long i = (long) (hash & (index->capacity - 1));
+	const char *held;
+
+	/* A slot is claimed by setting its name, so that threads adding at once never take the same slot; the rest
+	 * of the slot is only read once all the adding is done */
+	for (;; i = (i + 1) & (index->capacity - 1)) {
+		held = NULL;
+		if (__atomic_compare_exchange_n(&index->slots[i].name, &held, name, FALSE, __ATOMIC_ACQ_REL,
+		                                __ATOMIC_ACQUIRE)) {
+			index->slots[i].hash = hash;
+			index->slots[i].address = address;
+			index->slots[i].module = module;
+			__atomic_add_fetch(&index->count, 1, __ATOMIC_RELAXED);
+			return &index->slots[i];
+		}
+		if (held == name || strcmp(held, name) == 0) return &index->slots[i];
+	}
+}
+
+
+/**
+ * Looks a symbol up in the index.
+ *
+ * @param index The index.
+ * @param name The symbol's name.
+ *
+ * @return The symbol's slot, or NULL if it is not there.
+ */
+
+link_index_slot *link_index_find(link_index *index, const char *name) {
+	link_index_slot *slot = find_slot(index, name, hash_bytes(0, name, strlen(name)));
+	return slot->name != NULL ? slot : NULL;
+}
+
+
+/**
+ * Moves an address of a module to its linked place.
+ *
+ * @param module The module, already placed.
+ * @param address An address of the module's code or data, as assembled.
+ *
+ * @return The linked address, or -1 if the address is outside the module.
+ */
+
+static long relocate_address(link_module *module, long address) {
+	long offset = address - IC_INIT_VALUE;
+
+	if (offset < 0 || offset >= module->code_length + module->data_length) return -1;
+	if (offset < module->code_length) return module->code_base + offset;
+	return module->data_base + offset - module->code_length;
+}
+
+
+/**
+ * Orders two addresses, for qsort.
+ *
+ * @param a The first address.
+ * @param b The second address.
+ *
+ * @return Negative, zero or positive as the first address is lower, equal or higher.
+ */
+
+static int compare_addresses(const void *a, const void *b) {
+	long x = *(const long *) a, y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Lays out the modules and prepares the image: code segments first, then data segments, both in module order.
+ * The image's words, relocation records and global index are allocated from the current arena, and every module
+ * is given its share of the relocation records.
+ *
+ * @param modules The modules; their code_base, data_base and relocation_base are set.
+ * @param count The number of modules.
+ * @param image Receives the lengths of the image and its empty words, records and index.
+ *
+ * @return TRUE if the image fits, FALSE if it goes past LINK_MAX_ADDRESS (the error is printed).
+ */
+
+bool link_layout(link_module *modules, int count, link_image *image) {
+	long entry_count = 0, relocation_count = 0, next_code = IC_INIT_VALUE, next_data;
+	int m;
+
+	image->code_length = image->data_length = 0;
+	for (m = 0; m < count; m++) {
+		modules[m].code_base = next_code;
+		next_code += modules[m].code_length;
+		image->code_length += modules[m].code_length;
+		image->data_length += modules[m].data_length;
+		entry_count += modules[m].entry_count;
+		/* The resolved external words become relocatable too */
+		modules[m].relocation_base = relocation_count;
+		relocation_count += modules[m].relocation_count + modules[m].extern_count;
+	}
+	for (m = 0, next_data = next_code; m < count; m++) {
+		modules[m].data_base = next_data;
+		next_data += modules[m].data_length;
+	}
+	if (next_data - 1 > LINK_MAX_ADDRESS) {
+		fprintf(stderr, "Error: the linked image needs %ld words; addresses end at %d\n",
+		        image->code_length + image->data_length, LINK_MAX_ADDRESS);
+		return FALSE;
+	}
+
+	image->words = assembly_alloc((image->code_length + image->data_length + 1) * sizeof(unsigned long));
+	image->relocations = assembly_alloc((relocation_count + 1) * sizeof(long));
+	image->relocation_count = 0;
+	link_index_init(&image->globals, entry_count);
+	return TRUE;
+}
+
+
+/**
+ * Adds the entries of a module to the image's global index, at their linked addresses. Different modules may be
+ * published by different threads at once.
+ *
+ * @param modules The modules, laid out by link_layout.
+ * @param m The module to publish.
+ * @param image The image.
+ *
+ * @return TRUE if every entry lies inside the module, FALSE otherwise (the error is printed).
+ */
+
+bool link_publish_entries(link_module *modules, int m, link_image *image) {
+	link_module *module = &modules[m];
+	bool result = TRUE;
+	long i, address;
+
+	for (i = 0; i < module->entry_count; i++) {
+		address = relocate_address(module, module->entries[i].address);
+		if (address < 0) {
+			fprintf(stderr, "Error: %s: entry %s is outside the module\n", module->name, module->entries[i].name);
+			result = FALSE;
+		} else {
+			link_index_add(&image->globals, module->entries[i].name, address, m);
+		}
+	}
+	return result;
+}
+
+
+/**
+ * Reports every entry defined by more than one module, once all the modules are published.
+ *
+ * @param modules The modules.
+ * @param count The number of modules.
+ * @param image The image.
+ *
+ * @return TRUE if no entry is defined twice.
+ */
+
+bool link_check_entries(link_module *modules, int count, link_image *image) {
+	link_index_slot *slot;
+	bool result = TRUE;
+	long i;
+	int m;
+
+	for (m = 0; m < count; m++) {
+		for (i = 0; i < modules[m].entry_count; i++) {
+			slot = link_index_find(&image->globals, modules[m].entries[i].name);
+			if (slot != NULL && slot->module != m) {
+				fprintf(stderr, "Error: %s is an entry of both %s and %s\n", modules[m].entries[i].name,
+				        modules[slot->module].name, modules[m].name);
+				result = FALSE;
+			}
+		}
+	}
+	return result;
+}
+
+
+/**
+ * Copies a module's words into the image and patches them: the words named by its relocation records are moved to
+ * the module's place, and the words named by its .ext records are pointed at the entries they name. The records
+ * of the patched words go to the module's share of the image's. Different modules may be resolved by different
+ * threads at once.
+ *
+ * @param modules The modules, laid out and published.
+ * @param m The module to resolve.
+ * @param image The image.
+ *
+ * @return TRUE if every record was patched and no external word is left, FALSE otherwise (the error is printed).
+ */
+
+bool link_resolve_module(link_module *modules, int m, link_image *image) {
+	link_module *module = &modules[m];
+	unsigned long *words = image->words + module->code_base - IC_INIT_VALUE;
+	long i, address, target, *records = image->relocations + module->relocation_base;
+	link_index_slot *slot;
+	bool result = TRUE;
+
+	module->linked_relocation_count = 0;
+	memcpy(words, module->words, module->code_length * sizeof(unsigned long));
+	memcpy(image->words + module->data_base - IC_INIT_VALUE, module->words + module->code_length,
+	       module->data_length * sizeof(unsigned long));
+
+	/* Each record is patched from the module's own word, so a repeated record does no harm */
+	for (i = 0; i < module->relocation_count; i++) {
+		address = module->relocations[i] - IC_INIT_VALUE;
+		if (address < 0 || address >= module->code_length ||
+		    (module->words[address] & 7) != ARE_RELOCATABLE) {
+			fprintf(stderr, "Error: %s: no relocatable word at %ld\n", module->name, module->relocations[i]);
+			result = FALSE;
+		} else if ((target = relocate_address(module, (long) (module->words[address] >> 3))) < 0) {
+			fprintf(stderr, "Error: %s: the word at %ld refers to %ld, outside the module\n", module->name,
+			        module->relocations[i], (long) (module->words[address] >> 3));
+			result = FALSE;
+		} else {
+			words[address] = (unsigned long) target << 3 | ARE_RELOCATABLE;
+			records[module->linked_relocation_count++] = module->code_base + address;
+		}
+	}
+
+	for (i = 0; i < module->extern_count; i++) {
+		address = module->externs[i].address - IC_INIT_VALUE;
+		if (address < 0 || address >= module->code_length || (module->words[address] & 7) != ARE_EXTERNAL) {
+			fprintf(stderr, "Error: %s: no external word at %ld for %s\n", module->name,
+			        module->externs[i].address, module->externs[i].name);
+			result = FALSE;
+		} else if ((slot = link_index_find(&image->globals, module->externs[i].name)) == NULL) {
+			fprintf(stderr, "Error: %s: unresolved external %s\n", module->name, module->externs[i].name);
+			/* Reported once: the check below only looks for words no record names */
+			words[address] = 0;
+			result = FALSE;
+		} else {
+			words[address] = (unsigned long) slot->address << 3 | ARE_RELOCATABLE;
+			records[module->linked_relocation_count++] = module->code_base + address;
+		}
+	}
+	for (i = 0; i < module->code_length; i++) {
+		if ((words[i] & 7) == ARE_EXTERNAL) {
+			fprintf(stderr, "Error: %s: the external word at %ld has no .ext record\n", module->name,
+			        IC_INIT_VALUE + i);
+			result = FALSE;
+		}
+	}
+	return result;
+}
+
+
+/**
+ * Gathers the relocation records the modules left in their shares into one list, in address order.
+ *
+ * @param modules The resolved modules.
+ * @param count The number of modules.
+ * @param image The image.
+ */
+
+void link_finish_image(link_module *modules, int count, link_image *image) {
+	int m;
+
+	for (m = 0, image->relocation_count = 0; m < count; m++) {
+		memmove(image->relocations + image->relocation_count, image->relocations + modules[m].relocation_base,
+		        modules[m].linked_relocation_count * sizeof(long));
+		image->relocation_count += modules[m].linked_relocation_count;
+	}
+	qsort(image->relocations, image->relocation_count, sizeof(long), compare_addresses);
+}
+
+
+/**
+ * Lays out the modules and resolves their references into one image, one module after the other. Every problem is
+ * printed: an entry defined by two modules, an external no module defines, a word marked external that no .ext
+ * record names, a relocation record naming a word that is not relocatable, a relocatable address outside its
+ * module, and an image past LINK_MAX_ADDRESS. The image is allocated from the current arena.
+ *
+ * @param modules The modules; their code_base and data_base are set.
+ * @param count The number of modules.
+ * @param image Receives the image.
+ *
+ * @return TRUE if the image was linked, FALSE if there was a problem.
+ */
+
+bool link_modules(link_module *modules, int count, link_image *image) {
+	bool result = TRUE;
+	int m;
+
+	if (!link_layout(modules, count, image)) return FALSE;
+	for (m = 0; m < count; m++) result &= link_publish_entries(modules, m, image);
+	result &= link_check_entries(modules, count, image);
+	for (m = 0; m < count; m++) result &= link_resolve_module(modules, m, image);
+	link_finish_image(modules, count, image);
+	return result;
+}
+
+
+/**
+ * Writes a whole buffer to a file, and releases the buffer.
+ *
+ * @param base_name The file's name, without extension.
+ * @param extension The file's extension.
+ * @param buffer The contents, from malloc_with_check.
+ * @param length The number of bytes.
+ *
+ * @return TRUE if the file was written.
+ */
+
+static bool write_file(char *base_name, char *extension, char *buffer, long length) {
+	char *filename = strallocat(base_name, extension);
+	bool result;
+	int fd;
+
+	cache_unshare_output(filename);
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	result = fd >= 0 && write_all(fd, buffer, length);
+	if (fd >= 0) close(fd);
+	if (!result) fprintf(stderr, "Error: can't write %s\n", filename);
+	free_with_check(filename);
+	free_with_check(buffer);
+	return result;
+}
+
+
+/**
+ * Formats words, symbols and relocations in the .obb layout of objfile.h.
+ *
+ * @param code_length The number of code words.
+ * @param data_length The number of data words.
+ * @param words The code words, then the data words.
+ * @param entries The entries.
+ * @param entry_count The number of entries.
+ * @param externs The words referring to externals.
+ * @param extern_count The number of externals.
+ * @param relocations The addresses of the relocatable words.
+ * @param relocation_count The number of relocatable words.
+ * @param length Receives the number of bytes formatted, a multiple of 4.
+ *
+ * @return The formatted object, from malloc_with_check.
+ */
+
+static char *format_obb(long code_length, long data_length, unsigned long *words, link_symbol *entries,
+                        long entry_count, link_symbol *externs, long extern_count, long *relocations,
+                        long relocation_count, long *length) {
+	long i, strings_size = 0;
+	obb_writer writer;
+
+	for (i = 0; i < entry_count; i++) strings_size += strlen(entries[i].name) + 1;
+	for (i = 0; i < extern_count; i++) strings_size += strlen(externs[i].name) + 1;
+
+	obb_format_begin(&writer, code_length, data_length, entry_count, extern_count, relocation_count, strings_size);
+	for (i = 0; i < code_length + data_length; i++) obb_put_word(&writer, i, words[i]);
+	for (i = 0; i < relocation_count; i++) obb_put_relocation(&writer, relocations[i]);
+	for (i = 0; i < entry_count; i++) obb_put_entry(&writer, entries[i].name, entries[i].address);
+	for (i = 0; i < extern_count; i++) obb_put_extern(&writer, externs[i].name, externs[i].address);
+
+	*length = writer.length;
+	return (char *) writer.buffer;
+}
+
+
+/**
+ * Writes the linked image as <base_name>.ob, <base_name>.ent and <base_name>.rel, and <base_name>.obb if asked.
+ *
+ * @param base_name The image's name, without extension.
+ * @param image The image.
+ * @param write_binary Whether to write the .obb file too.
+ *
+ * @return TRUE if the files were written.
+ */
+
+bool link_write_image(char *base_name, link_image *image, bool write_binary) {
+	long i, length, word_count = image->code_length + image->data_length, strings_size = 0, entry_count = 0;
+	link_symbol *globals;
+	char *buffer;
+	bool result;
+
+	/* The same form as the assembler's .ob: a header line, then one "address word" record per word */
+	buffer = malloc_with_check(32 + word_count * 16);
+	length = sprintf(buffer, "%ld %ld", image->code_length, image->data_length);
+	for (i = 0; i < word_count; i++) {
+		length += sprintf(buffer + length, "\n%.7ld %.6lo", IC_INIT_VALUE + i, image->words[i]);
+	}
+	if (!write_file(base_name, ".ob", buffer, length)) return FALSE;
+
+	globals = malloc_with_check((image->globals.count + 1) * sizeof(link_symbol));
+	for (i = 0; i < image->globals.capacity; i++) {
+		if (image->globals.slots[i].name == NULL) continue;
+		globals[entry_count].name = (char *) image->globals.slots[i].name;
+		globals[entry_count++].address = image->globals.slots[i].address;
+		strings_size += strlen(image->globals.slots[i].name) + 1;
+	}
+	buffer = malloc_with_check(strings_size + entry_count * (ADDRESS_DIGITS + 2) + 1);
+	for (i = 0, length = 0; i < entry_count; i++) {
+		length += sprintf(buffer + length, "%s%s %.7ld", i ? "\n" : "", globals[i].name, globals[i].address);
+	}
+	result = write_file(base_name, ".ent", buffer, length);
+
+	if (result) {
+		buffer = malloc_with_check(image->relocation_count * (ADDRESS_DIGITS + 1) + 1);
+		for (i = 0, length = 0; i < image->relocation_count; i++) {
+			length += sprintf(buffer + length, "%s%.7ld", i ? "\n" : "", image->relocations[i]);
+		}
+		result = write_file(base_name, ".rel", buffer, length);
+	}
+	/* The global entries, and no externals: they are all resolved */
+	if (result && write_binary) {
+		buffer = format_obb(image->code_length, image->data_length, image->words, globals, entry_count, NULL, 0,
+		                    image->relocations, image->relocation_count, &length);
+		result = write_file(base_name, ".obb", buffer, length);
+	}
+	free_with_check(globals);
+	return result;
+}
+
+
+/**
+ * Packs modules into a .lib archive (see libfile.h), with a directory from every entry to its module.
+ *
+ * @param filename The archive's file name.
+ * @param modules The modules.
+ * @param count The number of modules.
+ *
+ * @return TRUE if the archive was written, FALSE if two modules define the same entry or the file could not be
+ *         written (the error is printed).
+ */
+
+bool link_write_archive(char *filename, link_module *modules, int count) {
+	long i, entry_count = 0, strings_size = 0, strings_used = 0, capacity = 16, offset, length;
+	long *object_lengths;
+	char **objects, *buffer;
+	lib_header header;
+	lib_member member;
+	lib_slot *directory;
+	uint32_t hash, slot;
+	bool result = TRUE;
+	int m;
+
+	objects = malloc_with_check((count + 1) * sizeof(char *));
+	object_lengths = malloc_with_check((count + 1) * sizeof(long));
+	for (m = 0; m < count; m++) {
+		objects[m] = format_obb(modules[m].code_length, modules[m].data_length, modules[m].words,
+		                        modules[m].entries, modules[m].entry_count, modules[m].externs,
+		                        modules[m].extern_count, modules[m].relocations, modules[m].relocation_count,
+		                        &object_lengths[m]);
+		strings_size += strlen(modules[m].name) + 1;
+		for (i = 0; i < modules[m].entry_count; i++) strings_size += strlen(modules[m].entries[i].name) + 1;
+		entry_count += modules[m].entry_count;
+	}
+	while (capacity < 2 * entry_count) capacity *= 2;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LIB_MAGIC, 4);
+	header.version = LIB_VERSION;
+	header.header_size = sizeof(lib_header);
+	header.member_count = count;
+	header.members_offset = sizeof(lib_header);
+	header.directory_offset = header.members_offset + count * sizeof(lib_member);
+	header.directory_capacity = capacity;
+	header.strings_offset = header.directory_offset + capacity * sizeof(lib_slot);
+	header.strings_size = strings_size;
+	length = (header.strings_offset + strings_size + 3) & ~3L;
+	for (m = 0; m < count; m++) length += object_lengths[m];
+
+	buffer = malloc_with_check(length);
+	memset(buffer, 0, length);
+	directory = (lib_slot *) (buffer + header.directory_offset);
+	offset = (header.strings_offset + strings_size + 3) & ~3L;
+	for (m = 0; m < count; m++) {
+		member.name_offset = strings_used;
+		member.object_offset = offset;
+		member.object_length = object_lengths[m];
+		memcpy(buffer + header.members_offset + m * sizeof(lib_member), &member, sizeof(member));
+		strcpy(buffer + header.strings_offset + strings_used, modules[m].name);
+		strings_used += strlen(modules[m].name) + 1;
+		memcpy(buffer + offset, objects[m], object_lengths[m]);
+		offset += object_lengths[m];
+		free_with_check(objects[m]);
+
+		for (i = 0; i < modules[m].entry_count; i++) {
+			hash = lib_hash(modules[m].entries[i].name);
+			for (slot = hash & (capacity - 1); directory[slot].member != 0; slot = (slot + 1) & (capacity - 1)) {
+				if (directory[slot].hash == hash &&
+				    strcmp(buffer + header.strings_offset + directory[slot].name_offset,
+				           modules[m].entries[i].name) == 0) {
+					break;
+				}
+			}
+			if (directory[slot].member != 0) {
+				fprintf(stderr, "Error: %s is an entry of both %s and %s\n", modules[m].entries[i].name,
+				        modules[directory[slot].member - 1].name, modules[m].name);
+				result = FALSE;
+				continue;
+			}
+			directory[slot].hash = hash;
+			directory[slot].name_offset = strings_used;
+			directory[slot].member = m + 1;
+			strcpy(buffer + header.strings_offset + strings_used, modules[m].entries[i].name);
+			strings_used += strlen(modules[m].entries[i].name) + 1;
+			header.entry_count++;
+		}
+	}
+	memcpy(buffer, &header, sizeof(header));
+	free_with_check(objects);
+	free_with_check(object_lengths);
+
+	if (!result) {
+		free_with_check(buffer);
+		return FALSE;
+	}
+	return write_file(filename, "", buffer, length);
+}
@@ -0,0 +1,294 @@
+/**
+ * File: linker.h
+ *
+ * Description:
+ *  This header file declares the linker, which joins assembled modules into one executable image. Every module
+ *  is read from its .obb file when there is an up-to-date one, else from its .ob, .ent, .ext and .rel files. The
+ *  code segments are laid out one after the other from IC_INIT_VALUE, in the order given, followed by the data
+ *  segments in the same order. The entries of all the modules go into one hashed global symbol index; then each
+ *  module's words are copied and patched: the words its relocation records name (ARE_RELOCATABLE) are moved to
+ *  the module's new place, and the external words (ARE_EXTERNAL) its .ext records name are pointed at the entries
+ *  they name, one index lookup each, so that linking is linear in the words and records.
+ *
+ *  The image is written as a .ob file of the same form as the assembler's (and as a .obb file on request), with
+ *  the external words made relocatable, the global entries as its .ent file and its relocations as its .rel file.
+ *
+ *  Modules may also come from .lib archives (see libfile.h). A member is linked only when it defines an external
+ *  that nothing linked so far defines; the archive's directory answers that with one probe per external.
+ *
+ * Functions:
+ *  link_load_module(): Reads an assembled module.
+ *  link_load_member(): Reads a module out of a .lib archive.
+ *  link_pull_members(): Adds the archive members that define the unresolved externals.
+ *  link_index_init() / link_index_add() / link_index_find(): The global symbol index.
+ *  link_layout() / link_publish_entries() / link_check_entries() / link_resolve_module() / link_finish_image():
+ *   The steps of link_modules, for callers that run them on several threads.
+ *  link_modules(): Lays out the modules and resolves their references into one image.
+ *  link_write_image(): Writes the linked image.
+ *  link_write_archive(): Packs modules into a .lib archive.
+ */
+
+#ifndef _LINKER_H
+#define _LINKER_H
+#include <stdint.h>
+#include "globals.h"
+#include "libfile.h"
+
+/** The highest address a direct word can hold (see build_data_word_direct) */
+#define LINK_MAX_ADDRESS 0xFFF
+
+/** A named address of a module: an entry, or a word referring to an external */
+typedef struct link_symbol {
+	char *name;
+	long address;
+} link_symbol;
+
+/** An assembled module, as read from its output files */
+typedef struct link_module {
+	/** The base name it was read from */
+	char *name;
+	long code_length;
+	long data_length;
+	/** The code words, then the data words, as in the .ob file: a code word is (value << 3) | ARE */
+	unsigned long *words;
+	link_symbol *entries;
+	long entry_count;
+	link_symbol *externs;
+	long extern_count;
+	/** The addresses of the relocatable code words, from the relocation records */
+	long *relocations;
+	long relocation_count;
+	/** Where link_layout placed the module's code and data, and its share of the image's relocation records */
+	long code_base;
+	long data_base;
+	long relocation_base;
+	/** The number of records link_resolve_module left in that share */
+	long linked_relocation_count;
+} link_module;
+
+/** A slot of the global symbol index */
+typedef struct link_index_slot {
+	/** NULL for an empty slot */
+	const char *name;
+	uint64_t hash;
+	long address;
+	/** The module defining the symbol */
+	int module;
+} link_index_slot;
+
+/** The global symbol index: open addressing with linear probing, never more than half full. Symbols may be added
+ * by several threads at once (see link_index_add) */
+typedef struct link_index {
+	link_index_slot *slots;
+	long capacity;
+	long count;
+} link_index;
+
+/** A linked image */
+typedef struct link_image {
+	long code_length;
+	long data_length;
+	/** The code words, then the data words, from IC_INIT_VALUE on */
+	unsigned long *words;
+	/** The entries of all the modules, at their linked addresses */
+	link_index globals;
+	/** The addresses of the relocatable code words, in address order */
+	long *relocations;
+	long relocation_count;
+} link_image;
+
+
+/**
+ * Reads an assembled module: <base_name>.obb if it exists and is not older than the .ob file, else
+ * <base_name>.ob with its .rel file, and its .ent and .ext files (either may be missing when empty). The
+ * module's memory is allocated from the current arena.
+ *
+ * @param base_name The module's name, without extension.
+ * @param module Receives the module.
+ *
+ * @return TRUE if the module was read, FALSE if a file could not be read or is malformed (the error is printed).
+ */
+
+bool link_load_module(char *base_name, link_module *module);
+
+
+/**
+ * Reads a module out of a .lib archive. The module's memory is allocated from the current arena.
+ *
+ * @param archive The mapped archive.
+ * @param member The index of the member.
+ * @param module Receives the module, named after the member.
+ *
+ * @return TRUE if the module was read, FALSE if the member is malformed (the error is printed).
+ */
+
+bool link_load_member(lib_archive *archive, long member, link_module *module);
+
+
+/**
+ * Adds to the modules every archive member needed to define an external that no module defines, and the members
+ * those need in turn. Each external is looked up in the archives in the order given, one directory probe per
+ * archive; a member is added once, when it is first needed. Externals that no archive defines are left for
+ * link_modules to report.
+ *
+ * @param archives The mapped archives.
+ * @param archive_count The number of archives.
+ * @param modules The modules, from malloc_with_check; grown as members are added.
+ * @param count The number of modules; updated.
+ *
+ * @return TRUE if every needed member was read, FALSE otherwise (the error is printed).
+ */
+
+bool link_pull_members(lib_archive *archives, int archive_count, link_module **modules, int *count);
+
+
+/**
+ * Prepares an empty index for a number of symbols. The slots are allocated from the current arena.
+ *
+ * @param index The index.
+ * @param expected_count The number of symbols it will hold at most.
+ */
+
+void link_index_init(link_index *index, long expected_count);
+
+
+/**
+ * Adds a symbol to the index, unless a symbol of the same name is there already. Threads may add symbols at once;
+ * the index is only looked up after they are all done.
+ *
+ * @param index The index, prepared for at least one more symbol.
+ * @param name The symbol's name, which must outlive the index.
+ * @param address The symbol's address.
+ * @param module The module defining the symbol.
+ *
+ * @return The slot of the new symbol, or the slot of the symbol already there. While other threads are adding,
+ *         only its name may be read.
+ */
+
+link_index_slot *link_index_add(link_index *index, const char *name, long address, int module);
+
+
+/**
+ * Looks a symbol up in the index.
+ *
+ * @param index The index.
+ * @param name The symbol's name.
+ *
+ * @return The symbol's slot, or NULL if it is not there.
+ */
+
+link_index_slot *link_index_find(link_index *index, const char *name);
+
+
+/**
+ * Lays out the modules and prepares the image: code segments first, then data segments, both in module order.
+ * The image's words, relocation records and global index are allocated from the current arena, and every module
+ * is given its share of the relocation records.
+ *
+ * @param modules The modules; their code_base, data_base and relocation_base are set.
+ * @param count The number of modules.
+ * @param image Receives the lengths of the image and its empty words, records and index.
+ *
+ * @return TRUE if the image fits, FALSE if it goes past LINK_MAX_ADDRESS (the error is printed).
+ */
+
+bool link_layout(link_module *modules, int count, link_image *image);
+
+
+/**
+ * Adds the entries of a module to the image's global index, at their linked addresses. Different modules may be
+ * published by different threads at once.
+ *
+ * @param modules The modules, laid out by link_layout.
+ * @param m The module to publish.
+ * @param image The image.
+ *
+ * @return TRUE if every entry lies inside the module, FALSE otherwise (the error is printed).
+ */
+
+bool link_publish_entries(link_module *modules, int m, link_image *image);
+
+
+/**
+ * Reports every entry defined by more than one module, once all the modules are published.
+ *
+ * @param modules The modules.
+ * @param count The number of modules.
+ * @param image The image.
+ *
+ * @return TRUE if no entry is defined twice.
+ */
+
+bool link_check_entries(link_module *modules, int count, link_image *image);
+
+
+/**
+ * Copies a module's words into the image and patches them: the words named by its relocation records are moved to
+ * the module's place, and the words named by its .ext records are pointed at the entries they name. The records
+ * of the patched words go to the module's share of the image's. Different modules may be resolved by different
+ * threads at once.
+ *
+ * @param modules The modules, laid out and published.
+ * @param m The module to resolve.
+ * @param image The image.
+ *
+ * @return TRUE if every record was patched and no external word is left, FALSE otherwise (the error is printed).
+ */
+
+bool link_resolve_module(link_module *modules, int m, link_image *image);
+
+
+/**
+ * Gathers the relocation records the modules left in their shares into one list, in address order.
+ *
+ * @param modules The resolved modules.
+ * @param count The number of modules.
+ * @param image The image.
+ */
+
+void link_finish_image(link_module *modules, int count, link_image *image);
+
+
+/**
+ * Lays out the modules and resolves their references into one image, one module after the other. Every problem is
+ * printed: an entry defined by two modules, an external no module defines, a word marked external that no .ext
+ * record names, a relocation record naming a word that is not relocatable, a relocatable address outside its
+ * module, and an image past LINK_MAX_ADDRESS. The image is allocated from the current arena.
+ *
+ * @param modules The modules; their code_base and data_base are set.
+ * @param count The number of modules.
+ * @param image Receives the image.
+ *
+ * @return TRUE if the image was linked, FALSE if there was a problem.
+ */
+
+bool link_modules(link_module *modules, int count, link_image *image);
+
+
+/**
+ * Writes the linked image as <base_name>.ob, <base_name>.ent and <base_name>.rel, and <base_name>.obb if asked.
+ *
+ * @param base_name The image's name, without extension.
+ * @param image The image.
+ * @param write_binary Whether to write the .obb file too.
+ *
+ * @return TRUE if the files were written.
+ */
+
+bool link_write_image(char *base_name, link_image *image, bool write_binary);
+
+
+/**
+ * Packs modules into a .lib archive (see libfile.h), with a directory from every entry to its module.
+ *
+ * @param filename The archive's file name.
+ * @param modules The modules.
+ * @param count The number of modules.
+ *
+ * @return TRUE if the archive was written, FALSE if two modules define the same entry or the file could not be
+ *         written (the error is printed).
+ */
+
+bool link_write_archive(char *filename, link_module *modules, int count);
+
+#endif
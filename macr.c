@@ -10,15 +10,21 @@
  *  hash(): Computes a hash value for a given string to index into the hash table.
  *  init_table(): Initializes the hash table for storing macros.
  *  add_macro(): Adds a new macro to the hash table with a specified name.
- *  find_macro(): Retrieves a macro from the hash table by its name.
- *  free_table1(): Frees all allocated memory associated with the hash table and its elements.
+ *  find_macro(): Retrieves a macro from the hash table, or else from the macro library, by its name.
+ *  load_macro_library() / unload_macro_library(): Manage the macros shared by every expansion.
+ *  expand_macros(): Replaces macro invocations with their definitions, from one source buffer into a new one.
  *  macro(): Processes the given file to replace macro invocations with their definitions and save the result to an output file.
  */
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
-#include <stdbool.h>
+#include "source.h"
+#include "trace.h"
+#include "stats.h"
+#include "utils.h"
+#include "arena.h"
+#include "cache.h"
 
 #define SIZE_LINE 82
 #define TABLE_SIZE 100
@@ -26,7 +32,8 @@
 typedef struct {
     char name[SIZE_LINE];
     int lineCount;
-    char lines[SIZE_LINE][SIZE_LINE];
+    char *lines[SIZE_LINE];
+    long lineLengths[SIZE_LINE];
 } Macro;
 
 typedef struct HashNode {
@@ -38,7 +45,15 @@ typedef struct {
     HashNode *buckets[TABLE_SIZE];
 } HashTable;
 
-HashTable *table = NULL;
+/* The macro table of the expansion running on this thread */
+static __thread HashTable *table = NULL;
+
+/* Macros loaded by load_macro_library, shared read-only by every expansion, with the source and arena holding them */
+static HashTable *library = NULL;
+static source_buffer librarySource;
+static arena libraryArena;
+
+void unload_macro_library(void);
 
 
 /**
@@ -61,13 +76,9 @@ unsigned int hash(char *str) {
  * Initializes the hash table for storing macros.
  */
 
-void init_table() {
+void init_table(void) {
     int i;
-    table = (HashTable *)malloc(sizeof(HashTable));
-    if (!table) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    table = (HashTable *)assembly_alloc(sizeof(HashTable));
     for ( i = 0; i < TABLE_SIZE; i++) {
         table->buckets[i] = NULL;
     }
@@ -83,26 +94,20 @@ void init_table() {
 
 Macro *add_macro(char *name) {
     unsigned int index = hash(name);
-    HashNode *newNode = (HashNode *)malloc(sizeof(HashNode));
-    if (newNode == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
-    newNode->macro = (Macro *)malloc(sizeof(Macro));
-    if (newNode->macro == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
+    HashNode *newNode = (HashNode *)assembly_alloc(sizeof(HashNode));
+    newNode->macro = (Macro *)assembly_alloc(sizeof(Macro));
     strcpy(newNode->macro->name, name);
     newNode->macro->lineCount = 0;
     newNode->next = NULL;
-    printf("macro added at index %d", index);
+    TRACE(TRACE_MACRO, "macro %s added at index %u", name, index);
+    STATS_ADD(COUNTER_MACRO_DEFINITIONS, 1);
     HashNode *node = table->buckets[index];
     if (node == NULL) {
         table->buckets[index] = newNode;
         return newNode->macro;
     }
     while (node->next != NULL) {
+           STATS_ADD(COUNTER_MACRO_PROBES, 1);
            node=node->next;
     }
        node->next = newNode;
@@ -112,139 +117,256 @@ Macro *add_macro(char *name) {
 
 
 /**
- * Retrieves a macro from the hash table by its name.
- * 
+ * Looks a macro up in one hash table.
+ *
+ * @param hashTable The table to search.
  * @param name The name of the macro to find.
  * @return Pointer to the Macro structure if found, NULL otherwise.
  */
 
-Macro *find_macro(char *name) {
-    unsigned int index = hash(name);
-    HashNode *node = table->buckets[index];
+static Macro *find_in_table(HashTable *hashTable, char *name) {
+    HashNode *node = hashTable->buckets[hash(name)];
     while (node != NULL) {
-        printf("Node %s\n", node->macro->name);
+        STATS_ADD(COUNTER_MACRO_PROBES, 1);
         if (strcmp(node->macro->name, name) == 0) {
             return node->macro;
         }
         node = node->next;
     }
-    printf("macro not found at index %d", index);
     return NULL;
 }
 
 
 /**
- * Frees all allocated memory associated with the hash table and its elements.
+ * Retrieves a macro from the hash table by its name. Macros of the file shadow those of the macro library.
+ * 
+ * @param name The name of the macro to find.
+ * @return Pointer to the Macro structure if found, NULL otherwise.
  */
 
-void free_table1() {
-    int i;
-    for (i = 0; i < TABLE_SIZE; i++) {
-        HashNode *node = table->buckets[i];
-        while (node != NULL) {
-            HashNode *temp = node;
-            node = node->next;
-            free(temp->macro);  
-            free(temp);  
-        }
+Macro *find_macro(char *name) {
+    Macro *found = find_in_table(table, name);
+    if (found == NULL && library != NULL) {
+        found = find_in_table(library, name);
     }
-    free(table);  
+    return found;
 }
 
 
 /**
- * Processes the given file to replace macro invocations with their definitions and save the result to an output file.
- * 
- * @param fileName The base name of the input file (without extension).
+ * Adds a line to the body of a macro being defined.
+ *
+ * @param currentMacro The macro being defined.
+ * @param line The line, kept as a span into the source.
+ * @return TRUE if the line was added, FALSE if the macro already has SIZE_LINE lines.
  */
 
-void macro(char *fileName) {
-    FILE *fromUser;
-    FILE *outputFile;
+static bool add_macro_line(Macro *currentMacro, line_info line) {
+    if (currentMacro->lineCount >= SIZE_LINE) {
+        printf_line_error(line, "Macro %s exceeded maximum number of lines (%d).", currentMacro->name, SIZE_LINE);
+        return FALSE;
+    }
+    currentMacro->lines[currentMacro->lineCount] = line.content;
+    currentMacro->lineLengths[currentMacro->lineCount++] = line.length;
+    return TRUE;
+}
+
+
+/**
+ * Loads a file of macro definitions that every later expansion can use, as if each source started with it.
+ * The library is read once and kept in memory until unload_macro_library; it must be loaded before any
+ * expansion starts, and is only read afterwards, so threads can share it.
+ *
+ * @param fileName The name of the library file.
+ * @return TRUE if the library was loaded, FALSE if it could not be read or holds anything but macro definitions.
+ */
+
+bool load_macro_library(char *fileName) {
+    long offset = 0;
     int i;
-    char line[SIZE_LINE] = {0};
-    char *asFileName = malloc(strlen(fileName) + 4);
-    char *amFileName = malloc(strlen(fileName) + 4);
-    if (asFileName == NULL || amFileName == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
+    line_info line;
+    bool isValid = TRUE;
+    Macro *currentMacro = NULL;
+    arena *previousArena;
+
+    if (!source_open(fileName, &librarySource)) {
+        fprintf(stderr, "Error opening macro library: %s\n", fileName);
+        return FALSE;
     }
 
-    strcpy(asFileName, fileName);
-    strcat(asFileName, ".as");
+    arena_init(&libraryArena);
+    previousArena = arena_select(&libraryArena);
+    init_table();
 
-    fromUser = fopen(asFileName, "r");
-    if (fromUser == NULL) {
-        fprintf(stderr, "Error opening file: %s\n", asFileName);
-        free(asFileName);
-        free(amFileName);
-        return;
+    line.file_name = fileName;
+    for (line.line_number = 1; source_next_line(&librarySource, &offset, &line); line.line_number++) {
+        if (strncmp(line.content, "macr ", 5) == 0) {
+            char macroName[SIZE_LINE];
+            sscanf(line.content, "macr %81s", macroName);
+            currentMacro = add_macro(macroName);
+        } else if (strstr(line.content, "endmacr") != NULL) {
+            currentMacro = NULL;
+        } else if (currentMacro != NULL) {
+            isValid &= add_macro_line(currentMacro, line);
+        } else {
+            for (i = 0; line.content[i] == ' ' || line.content[i] == '\t'; i++);
+            if (line.content[i] != '\0' && line.content[i] != ';') {
+                printf_line_error(line, "Only macro definitions may appear in a macro library.");
+                isValid = FALSE;
+            }
+        }
     }
 
-    strcpy(amFileName, fileName);
-    strcat(amFileName, ".am");
+    library = table;
+    table = NULL;
+    arena_select(previousArena);
+    if (!isValid) unload_macro_library();
+    return isValid;
+}
 
-    outputFile = fopen(amFileName, "w");
-    if (outputFile == NULL) {
-        fprintf(stderr, "Error opening output file: %s\n", amFileName);
-        fclose(fromUser);
-        free(asFileName);
-        free(amFileName);
-        return;
+
+/**
+ * Releases the macro library loaded by load_macro_library, if any.
+ */
+
+void unload_macro_library(void) {
+    if (librarySource.data == NULL) return;
+    library = NULL;
+    arena_release(&libraryArena);
+    source_close(&librarySource);
+}
+
+
+/**
+ * Appends a line and a newline to the expanded output, growing it as needed.
+ *
+ * @param output The expanded output.
+ * @param capacity The allocated size of output->data; updated when it grows.
+ * @param text The line to append.
+ * @param length The length of the line.
+ */
+
+static void append_line(source_buffer *output, long *capacity, char *text, long length) {
+    if (output->length + length + 2 > *capacity) {
+        while (output->length + length + 2 > *capacity) *capacity *= 2;
+        output->data = realloc_with_check(output->data, *capacity);
     }
+    memcpy(output->data + output->length, text, length);
+    output->length += length;
+    output->data[output->length++] = '\n';
+    output->data[output->length] = '\0';
+}
 
-    init_table();
 
-    bool isMacroOpen = false;
+/**
+ * Replaces macro invocations with their definitions, from one source buffer into a new one.
+ * Macro bodies are kept as spans into the input rather than copied, so the input must stay open until this returns.
+ * The macro table is allocated from the current arena.
+ *
+ * @param input The source to expand. Its lines are NUL-terminated in place.
+ * @param fileName The name of the source, for error messages.
+ * @param output Receives the expanded source, in the heap; release it with source_close.
+ *
+ * @return TRUE if the source was expanded, FALSE if a macro definition was in error.
+ */
+
+bool expand_macros(source_buffer *input, char *fileName, source_buffer *output) {
+    int i;
+    long offset = 0, capacity = input->length + 2;
+    line_info line;
+    bool isValid = TRUE;
+    bool isMacroOpen = FALSE;
     Macro *currentMacro = NULL;
 
-    while (fgets(line, SIZE_LINE, fromUser)) {
-         printf( "line **%s**",line);
-        char *ms = strstr(line, "macr ");
-        if (ms != NULL && ms == line) {
+    output->data = malloc_with_check(capacity);
+    output->data[0] = '\0';
+    output->length = 0;
+    output->mapped_length = 0;
+
+    init_table();
+
+    line.file_name = fileName;
+    for (line.line_number = 1; source_next_line(input, &offset, &line); line.line_number++) {
+        char *ms = strstr(line.content, "macr ");
+        if (ms != NULL && ms == line.content) {
             char macroName[SIZE_LINE];
-            sscanf(line, "macr %s\n", macroName);
-            printf( "starting macro entry **%s**\n",macroName);
+            sscanf(line.content, "macr %81s", macroName);
+            TRACE(TRACE_MACRO, "starting macro definition %s", macroName);
             currentMacro = add_macro(macroName);
-            isMacroOpen = true;
+            isMacroOpen = TRUE;
             continue;
-        }else if (strstr(line, "endmacr") != NULL) {
-            printf( "ending macro entry\n");
-            isMacroOpen = false;
+        }else if (strstr(line.content, "endmacr") != NULL) {
+            TRACE(TRACE_MACRO, "ending macro definition");
+            isMacroOpen = FALSE;
             currentMacro = NULL;
             continue;
         } else if (isMacroOpen) {
-            printf( "reading in macro line\n");
-            if (currentMacro != NULL && currentMacro->lineCount < SIZE_LINE) {
-                strcpy(currentMacro->lines[currentMacro->lineCount++], line);
-            } else {
-                fprintf(stderr, "Macro %s exceeded maximum number of lines\n", currentMacro->name);
-            }
+            isValid &= add_macro_line(currentMacro, line);
         } else {
-            char firstWord[SIZE_LINE];
-            sscanf(line, "%s\n", firstWord);
+            char firstWord[SIZE_LINE] = {0};
+            sscanf(line.content, "%81s", firstWord);
             Macro *foundMacro = find_macro(firstWord);
             if (foundMacro != NULL) {
-                printf( "found macro- replacing with content\n");
+                TRACE(TRACE_MACRO, "expanding macro %s", foundMacro->name);
+                STATS_ADD(COUNTER_MACRO_EXPANSIONS, 1);
                 for ( i = 0; i < foundMacro->lineCount; i++) {
-                    fputs(foundMacro->lines[i], outputFile);
+                    append_line(output, &capacity, foundMacro->lines[i], foundMacro->lineLengths[i]);
                 }
             } else {
-                printf( "copying simple line\n");
-                fputs(line, outputFile);
+                append_line(output, &capacity, line.content, line.length);
             }
         }
-     
-
     }
 
-    fclose(fromUser);
-    fclose(outputFile);
-    free(asFileName);
-    free(amFileName);
-    free_table1();
+    /* The table lives in the current arena and goes away with it */
+    table = NULL;
+    return isValid;
 }
 
 
+/**
+ * Processes the given file to replace macro invocations with their definitions and save the result to an output file.
+ * The input is loaded into memory once and the expansion is built in memory, then written out with a single call.
+ * The macro table is allocated from the current arena.
+ * 
+ * @param fileName The base name of the input file (without extension).
+ * @param expanded Receives the expanded source (the contents of the .am file); release it with source_close.
+ *
+ * @return TRUE if the .am file was written, FALSE if the input could not be read, a macro was in error or the
+ *         .am file could not be written.
+ */
+
+bool macro(char *fileName, source_buffer *expanded) {
+    source_buffer source;
+    FILE *outputFile;
+    bool isValid;
+    char *asFileName = assembly_alloc(strlen(fileName) + 4);
+    char *amFileName = assembly_alloc(strlen(fileName) + 4);
+
+    strcpy(asFileName, fileName);
+    strcat(asFileName, ".as");
+
+    if (!source_open(asFileName, &source)) {
+        fprintf(stderr, "Error opening file: %s\n", asFileName);
+        return FALSE;
+    }
+
+    strcpy(amFileName, fileName);
+    strcat(amFileName, ".am");
+
+    cache_unshare_output(amFileName);
+    outputFile = fopen(amFileName, "w");
+    if (outputFile == NULL) {
+        fprintf(stderr, "Error opening output file: %s\n", amFileName);
+        source_close(&source);
+        return FALSE;
+    }
 
+    isValid = expand_macros(&source, asFileName, expanded);
+    source_close(&source);
 
+    fwrite(expanded->data, 1, expanded->length, outputFile);
+    fclose(outputFile);
+    if (!isValid) source_close(expanded);
+    return isValid;
+}
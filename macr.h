@@ -10,16 +10,20 @@
  *  Macro: Represents a macro with its name, the number of lines it contains, and the lines of code within the macro.
  *
  * Functions:
+ *  hash() / init_table(): Compute a name's bucket in, and set up, the macro table of the calling thread.
  *  add_macro(): Adds a new macro to the macro table with a specified name.
  *  find_macro(): Finds and returns a pointer to a macro by its name.
+ *  load_macro_library() / unload_macro_library(): Manage the macros shared by every expansion (--macro-lib).
  *  print_macros(): Prints all macros that have been added to the macro table.
+ *  expand_macros(): Replaces macro invocations with their definitions, from one source buffer into a new one.
  *  macro(): Processes the given file, replacing macro invocations with their definitions and saving the result to an output file.
  */
 
 #ifndef MACR_H
 #define MACR_H
 
-#include <stdbool.h>
+#include "globals.h"
+#include "source.h"
 
 #define SIZE_LINE 82
 
@@ -30,17 +34,35 @@
 typedef struct {
     char name[SIZE_LINE];   
     int lineCount;          
-    char lines[SIZE_LINE][SIZE_LINE];  
+    char *lines[SIZE_LINE];           /* spans into the loaded source file */
+    long lineLengths[SIZE_LINE];
 } Macro;
 
 
+/**
+ * Computes the bucket of a macro name in the macro table.
+ *
+ * @param str The name.
+ * @return The bucket index.
+ */
+
+unsigned int hash(char *str);
+
+
+/**
+ * Initializes the macro table of the calling thread, allocated from the current arena (see arena.h).
+ */
+
+void init_table(void);
+
+
 /**
  * Adds a new macro to the hash table with a specified name.
  * 
  * @param name The name of the macro.
  * @return Pointer to the newly created Macro structure.
  */
-void add_macro(char *name);
+Macro *add_macro(char *name);
 
 
 /**
@@ -53,6 +75,25 @@ void add_macro(char *name);
 Macro* find_macro(char *name);
 
 
+/**
+ * Loads a file of macro definitions that every later expansion can use, as if each source started with it.
+ * The library is read once and kept in memory until unload_macro_library; it must be loaded before any
+ * expansion starts, and is only read afterwards, so threads can share it.
+ *
+ * @param fileName The name of the library file.
+ * @return TRUE if the library was loaded, FALSE if it could not be read or holds anything but macro definitions.
+ */
+
+bool load_macro_library(char *fileName);
+
+
+/**
+ * Releases the macro library loaded by load_macro_library, if any.
+ */
+
+void unload_macro_library(void);
+
+
 /**
  * Prints all macros that have been added to the macro table.
  */
@@ -60,13 +101,33 @@ Macro* find_macro(char *name);
 void print_macros(void);
 
 
+/**
+ * Replaces macro invocations with their definitions, from one source buffer into a new one.
+ * Macro bodies are kept as spans into the input rather than copied, so the input must stay open until this returns.
+ * The macro table is allocated from the current arena (see arena.h).
+ *
+ * @param input The source to expand. Its lines are NUL-terminated in place.
+ * @param fileName The name of the source, for error messages.
+ * @param output Receives the expanded source, in the heap; release it with source_close.
+ *
+ * @return TRUE if the source was expanded, FALSE if a macro definition was in error.
+ */
+
+bool expand_macros(source_buffer *input, char *fileName, source_buffer *output);
+
+
 /**
  * Processes the given file to replace macro invocations with their definitions and save the result to an output file.
+ * The macro table is allocated from the current arena (see arena.h).
  * 
  * @param fileName The base name of the input file (without extension).
+ * @param expanded Receives the expanded source (the contents of the .am file); release it with source_close.
+ *
+ * @return TRUE if the .am file was written, FALSE if the input could not be read, a macro was in error or the
+ *         .am file could not be written.
  */
 
-void macro(char *fileName);
+bool macro(char *fileName, source_buffer *expanded);
 
 
 
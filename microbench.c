@@ -0,0 +1,397 @@
+/**
+ * File: microbench.c
+ *
+ * Description:
+ *  This file contains a self-contained micro-benchmark of the assembler's hot kernels. Every kernel is timed in
+ *  isolation over a fixed set of realistic inputs, taken in turn: the batch size of a sample is first doubled
+ *  until a sample lasts long enough to time reliably, then a few warm-up samples are discarded and the remaining
+ *  samples are reported as the minimum, median, 90th and 99th percentiles and maximum time per call.
+ *
+ *  Kernels that allocate do so from an arena that is released after every sample, as the assembler releases the
+ *  arena of every file, so that memory use does not grow with the repetitions.
+ *
+ *  Usage: microbench [--filter=<text>] [--reps=<n>] [--warmup=<n>] [--sample-us=<n>] [--json=<file>]
+ *   --filter=<text>    Only run the kernels whose name contains the text.
+ *   --reps=<n>         Samples reported per kernel (default: 31).
+ *   --warmup=<n>       Samples discarded first (default: 5).
+ *   --sample-us=<n>    Shortest sample, in microseconds (default: 2000).
+ *   --json=<file>      Also write the results as JSON.
+ *
+ * Functions:
+ *  run_*(): The kernels, each running a batch of calls.
+ *  setup_inputs(): Prepares the inputs shared by the kernels.
+ *  time_batch(): Times one sample of a kernel.
+ *  measure(): Calibrates, warms up and samples a kernel.
+ *  main(): Entry point of the micro-benchmark.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "globals.h"
+#include "utils.h"
+#include "code.h"
+#include "table.h"
+#include "macr.h"
+#include "arena.h"
+
+#define DEFAULT_REPS 31
+#define DEFAULT_WARMUP 5
+#define DEFAULT_SAMPLE_US 2000
+/** Largest batch tried when calibrating */
+#define MAX_BATCH (1L << 28)
+/** Symbols in the table searched by find_by_types, and inserted per run by add_table_item */
+#define TABLE_SYMBOLS 200
+#define MACRO_COUNT 50
+
+#define COUNT_OF(array) ((long) (sizeof(array) / sizeof((array)[0])))
+
+/** A kernel: runs a batch of calls and returns something derived from the results */
+typedef struct kernel {
+	char *name;
+	long (*run)(long batch);
+} kernel;
+
+/** The result of one kernel */
+typedef struct kernel_result {
+	long batch;
+	double min, p50, p90, p99, max;
+} kernel_result;
+
+/* Keeps the compiler from dropping the calls */
+static volatile long sink;
+
+static char *operand_inputs[] = {"r3", "*r6", "#-5", "LOOP", "STR", "K", "#48", "r0", "*r1", "LIST", "r7",
+                                 "#1000", "END", "W"};
+static char *command_inputs[] = {"mov", "cmp", "add", "sub", "lea", "clr", "not", "inc", "dec", "jmp", "bne", "jsr",
+                                 "red", "prn", "rts", "stop", "move", "xyz"};
+static char *instruction_inputs[] = {"data", "string", "entry", "extern", "text", "dat"};
+static char *label_inputs[] = {"MAIN", "LOOP", "END", "STR", "LIST", "K", "r3", "mov", "data", "a123456789",
+                               "1abc", "ThisLabelIsLongButStillValid123"};
+static char *operand_line_inputs[] = {"r3, LIST", "#48", "STR, r6", "*r6, K", "r1, r4", "K", "LOOP", "W",
+                                      "#-6, r3"};
+
+/** Symbols for find_by_types; half of the lookups miss */
+static char symbol_names[TABLE_SYMBOLS * 2][16];
+static table lookup_table = NULL;
+
+/** Macro names for find_macro; half of the lookups miss */
+static char macro_names[MACRO_COUNT * 2][16];
+
+/** Pre-parsed instructions for get_code_word */
+typedef struct encoded_input {
+	opcode opcode;
+	funct funct;
+	int operand_count;
+	char *operands[2];
+} encoded_input;
+
+static encoded_input encoded_inputs[] = {
+		{MOV_OP, NONE_FUNCT, 2, {"r3", "K"}},
+		{ADD_OP, ADD_FUNCT, 2, {"#5", "r1"}},
+		{CMP_OP, NONE_FUNCT, 2, {"*r2", "#-6"}},
+		{LEA_OP, NONE_FUNCT, 2, {"STR", "r6"}},
+		{INC_OP, NONE_FUNCT, 1, {"*r6", NULL}},
+		{JMP_OP, NONE_FUNCT, 1, {"LOOP", NULL}},
+		{PRN_OP, NONE_FUNCT, 1, {"#48", NULL}},
+		{STOP_OP, NONE_FUNCT, 0, {NULL, NULL}}
+};
+
+static line_info bench_line;
+
+
+/**
+ * Prepares the inputs shared by the kernels: the symbol table searched by find_by_types and the macro table
+ * searched by find_macro, both allocated from the current arena.
+ */
+
+static void setup_inputs(void) {
+	long i;
+
+	for (i = 0; i < TABLE_SYMBOLS * 2; i++) sprintf(symbol_names[i], "SYM%ld", i);
+	for (i = 0; i < TABLE_SYMBOLS; i++) {
+		add_table_item(&lookup_table, symbol_names[i], 100 + i, i % 3 == 0 ? DATA_SYMBOL : CODE_SYMBOL);
+	}
+
+	init_table();
+	for (i = 0; i < MACRO_COUNT * 2; i++) sprintf(macro_names[i], "macro_%ld", i);
+	for (i = 0; i < MACRO_COUNT; i++) add_macro(macro_names[i]);
+
+	bench_line.file_name = "microbench";
+	bench_line.line_number = 1;
+}
+
+
+static long run_get_addressing_type(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += get_addressing_type(operand_inputs[i % COUNT_OF(operand_inputs)]);
+	return total;
+}
+
+
+static long run_get_opcode_func(long batch) {
+	long i, total = 0;
+	opcode op;
+	funct fn;
+	for (i = 0; i < batch; i++) {
+		get_opcode_func(command_inputs[i % COUNT_OF(command_inputs)], &op, &fn);
+		total += op + fn;
+	}
+	return total;
+}
+
+
+static long run_find_instruction_by_name(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += find_instruction_by_name(instruction_inputs[i % COUNT_OF(instruction_inputs)]);
+	return total;
+}
+
+
+static long run_is_valid_label_name(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += is_valid_label_name(label_inputs[i % COUNT_OF(label_inputs)]);
+	return total;
+}
+
+
+static long run_is_reserved_word(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += is_reserved_word(label_inputs[i % COUNT_OF(label_inputs)]);
+	return total;
+}
+
+
+static long run_find_by_types(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) {
+		total += find_by_types(lookup_table, symbol_names[(i * 7) % (TABLE_SYMBOLS * 2)], 3, DATA_SYMBOL,
+		                       CODE_SYMBOL, EXTERNAL_SYMBOL) != NULL;
+	}
+	return total;
+}
+
+
+static long run_add_table_item(long batch) {
+	table symbols = NULL;
+	long i;
+	for (i = 0; i < batch; i++) {
+		/* A table of TABLE_SYMBOLS symbols, inserted in a scattered order, then a new table */
+		if (i % TABLE_SYMBOLS == 0) symbols = NULL;
+		add_table_item(&symbols, symbol_names[i % TABLE_SYMBOLS], (i * 37) % 1000, CODE_SYMBOL);
+	}
+	return symbols != NULL;
+}
+
+
+static long run_find_macro(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += find_macro(macro_names[(i * 7) % (MACRO_COUNT * 2)]) != NULL;
+	return total;
+}
+
+
+static long run_hash(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += hash(macro_names[i % (MACRO_COUNT * 2)]);
+	return total;
+}
+
+
+static long run_analyze_operands(long batch) {
+	char *operands[2];
+	long i, total = 0;
+	int count;
+	for (i = 0; i < batch; i++) {
+		bench_line.content = operand_line_inputs[i % COUNT_OF(operand_line_inputs)];
+		total += analyze_operands(bench_line, 0, operands, &count, NULL) + count;
+	}
+	return total;
+}
+
+
+static long run_build_data_word_immediate(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += build_data_word_immediate(i % 1000 - 500)->data;
+	return total;
+}
+
+
+static long run_build_data_word_register(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += build_data_word_register(i % 8)->data;
+	return total;
+}
+
+
+static long run_build_data_word_direct(long batch) {
+	long i, total = 0;
+	for (i = 0; i < batch; i++) total += build_data_word_direct(100 + i % 1000, i % 5 == 0)->ARE;
+	return total;
+}
+
+
+static long run_get_code_word(long batch) {
+	encoded_input *input;
+	long i, total = 0;
+	for (i = 0; i < batch; i++) {
+		input = &encoded_inputs[i % COUNT_OF(encoded_inputs)];
+		total += get_code_word(bench_line, input->opcode, input->funct, input->operand_count,
+		                       input->operands)->opcode;
+	}
+	return total;
+}
+
+
+static kernel kernels[] = {
+		{"get_addressing_type",       run_get_addressing_type},
+		{"get_opcode_func",           run_get_opcode_func},
+		{"find_instruction_by_name",  run_find_instruction_by_name},
+		{"is_valid_label_name",       run_is_valid_label_name},
+		{"is_reserved_word",          run_is_reserved_word},
+		{"find_by_types",             run_find_by_types},
+		{"add_table_item",            run_add_table_item},
+		{"find_macro",                run_find_macro},
+		{"hash",                      run_hash},
+		{"analyze_operands",          run_analyze_operands},
+		{"build_data_word_immediate", run_build_data_word_immediate},
+		{"build_data_word_register",  run_build_data_word_register},
+		{"build_data_word_direct",    run_build_data_word_direct},
+		{"get_code_word",             run_get_code_word}
+};
+
+
+/**
+ * Times one sample of a kernel, in an arena released afterwards.
+ *
+ * @param k The kernel.
+ * @param batch The number of calls.
+ *
+ * @return The duration of the sample, in nanoseconds.
+ */
+
+static double time_batch(kernel *k, long batch) {
+	struct timespec start, end;
+	arena sample_arena;
+	arena *previous_arena;
+
+	arena_init(&sample_arena);
+	previous_arena = arena_select(&sample_arena);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sink += k->run(batch);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	arena_select(previous_arena);
+	arena_release(&sample_arena);
+	return (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+}
+
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+
+/**
+ * Calibrates a kernel's batch size, runs the warm-up samples and the reported samples.
+ *
+ * @param k The kernel.
+ * @param reps The samples reported.
+ * @param warmup The samples discarded first.
+ * @param sample_ns The shortest sample.
+ * @param result Receives the batch size and the percentiles of the time per call, in nanoseconds.
+ */
+
+static void measure(kernel *k, int reps, int warmup, double sample_ns, kernel_result *result) {
+	double *samples = malloc_with_check(reps * sizeof(double));
+	long batch = 1;
+	int i;
+
+	while (batch < MAX_BATCH && time_batch(k, batch) < sample_ns) batch *= 2;
+	for (i = 0; i < warmup; i++) time_batch(k, batch);
+	for (i = 0; i < reps; i++) samples[i] = time_batch(k, batch) / batch;
+	qsort(samples, reps, sizeof(double), compare_doubles);
+
+	result->batch = batch;
+	result->min = samples[0];
+	result->p50 = samples[(int) (0.50 * (reps - 1) + 0.5)];
+	result->p90 = samples[(int) (0.90 * (reps - 1) + 0.5)];
+	result->p99 = samples[(int) (0.99 * (reps - 1) + 0.5)];
+	result->max = samples[reps - 1];
+	free_with_check(samples);
+}
+
+
+/**
+ * Main function of the micro-benchmark.
+ *
+ * @param argc - The number of command-line arguments passed, including the program name.
+ * @param argv - The options described at the top of this file.
+ *
+ * @return int - 0 on success, 1 on a bad option.
+ */
+
+int main(int argc, char *argv[]) {
+	kernel_result results[COUNT_OF(kernels)];
+	char *filter = NULL, *json_filename = NULL;
+	int i, reps = DEFAULT_REPS, warmup = DEFAULT_WARMUP;
+	long sample_us = DEFAULT_SAMPLE_US;
+	bool first = TRUE;
+	arena setup_arena;
+	FILE *json = NULL;
+
+	for (i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "--filter=", 9) == 0) filter = argv[i] + 9;
+		else if (strncmp(argv[i], "--reps=", 7) == 0) reps = atoi(argv[i] + 7);
+		else if (strncmp(argv[i], "--warmup=", 9) == 0) warmup = atoi(argv[i] + 9);
+		else if (strncmp(argv[i], "--sample-us=", 12) == 0) sample_us = atol(argv[i] + 12);
+		else if (strncmp(argv[i], "--json=", 7) == 0) json_filename = argv[i] + 7;
+		else {
+			fprintf(stderr, "Usage: %s [--filter=<text>] [--reps=<n>] [--warmup=<n>] [--sample-us=<n>] "
+			                "[--json=<file>]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (reps < 1 || warmup < 0 || sample_us < 1) {
+		fprintf(stderr, "Error: --reps and --sample-us must be positive, --warmup not negative.\n");
+		return 1;
+	}
+	if (json_filename != NULL && (json = fopen(json_filename, "w")) == NULL) {
+		fprintf(stderr, "Error: can't create %s\n", json_filename);
+		return 1;
+	}
+
+	/* The inputs live until the end */
+	arena_init(&setup_arena);
+	arena_select(&setup_arena);
+	setup_inputs();
+
+	printf("%-26s %10s %9s %9s %9s %9s %9s   (ns per call)\n", "kernel", "batch", "min", "p50", "p90", "p99",
+	       "max");
+	if (json != NULL) fprintf(json, "{\n  \"reps\": %d,\n  \"kernels\": [", reps);
+	for (i = 0; i < COUNT_OF(kernels); i++) {
+		if (filter != NULL && strstr(kernels[i].name, filter) == NULL) continue;
+		measure(&kernels[i], reps, warmup, sample_us * 1e3, &results[i]);
+		printf("%-26s %10ld %9.2f %9.2f %9.2f %9.2f %9.2f\n", kernels[i].name, results[i].batch, results[i].min,
+		       results[i].p50, results[i].p90, results[i].p99, results[i].max);
+		fflush(stdout);
+		if (json != NULL) {
+			fprintf(json, "%s\n    {\"name\": \"%s\", \"batch\": %ld, \"min_ns\": %.3f, \"p50_ns\": %.3f, "
+			              "\"p90_ns\": %.3f, \"p99_ns\": %.3f, \"max_ns\": %.3f}", first ? "" : ",",
+			        kernels[i].name, results[i].batch, results[i].min, results[i].p50, results[i].p90,
+			        results[i].p99, results[i].max);
+		}
+		first = FALSE;
+	}
+	if (json != NULL) {
+		fprintf(json, "\n  ]\n}\n");
+		fclose(json);
+	}
+
+	arena_select(NULL);
+	arena_release(&setup_arena);
+	return 0;
+}
@@ -0,0 +1,308 @@
+/**
+ * File: objfile.c
+ *
+ * Description:
+ *  This file contains the loader and the writer for the binary object format (.obb) described in objfile.h. The
+ *  file is mapped read-only and its records are used in place. The format is little-endian, so on a big-endian
+ *  host the loader refuses the file rather than handing out byte-swapped records; the writer stores every field
+ *  byte by byte, so the assembler and the linker write the same file on any host.
+ *
+ * Functions:
+ *  obb_map(): Maps a .obb file into memory and validates its header.
+ *  obb_view(): Validates a .obb image already in memory.
+ *  obb_unmap(): Releases a mapped .obb file.
+ *  obb_word(): Reads one word of a mapped image.
+ *  obb_symbol_name(): Returns the name of an entry or extern record.
+ *  obb_format_begin(): Lays out a .obb file and writes its header.
+ *  obb_put_word() / obb_put_relocation() / obb_put_entry() / obb_put_extern(): Write the records of a .obb file.
+ *  put_u16() / put_u32() / put_symbol(): Store little-endian fields and symbol records.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "objfile.h"
+#include "utils.h"
+
+#define KEEP_ONLY_15_LSB(value) ((value) & 0x7FFF)
+
+
+/**
+ * Checks that a section of count records of the given size lies inside the mapping.
+ *
+ * @param mapped_length The size of the mapping.
+ * @param offset The offset of the section.
+ * @param count The number of records in the section.
+ * @param size The size of a single record.
+ *
+ * @return TRUE if the section fits, FALSE otherwise.
+ */
+
+static bool section_fits(long mapped_length, uint32_t offset, uint32_t count, long size) {
+	return offset % 4 == 0 && offset <= mapped_length && (long) count <= (mapped_length - (long) offset) / size;
+}
+
+
+/**
+ * Validates a .obb image already in memory, such as a member of a .lib archive, and points into its sections.
+ * Nothing is copied, and obb_unmap does nothing for it.
+ *
+ * @param data The image, 4-byte aligned.
+ * @param length The number of bytes of the image.
+ * @param image Receives pointers to the sections of the image.
+ *
+ * @return TRUE if the image is a valid object, FALSE otherwise.
+ */
+
+bool obb_view(const void *data, long length, obb_image *image) {
+	const uint16_t byte_order_probe = 1;
+	const obb_header *header = data;
+
+	if (*(const unsigned char *) &byte_order_probe != 1) return FALSE;
+	if (length < (long) sizeof(obb_header) || ((uintptr_t) data & 3) != 0) return FALSE;
+
+	if (memcmp(header->magic, OBB_MAGIC, 4) != 0 || header->version != OBB_VERSION ||
+	    header->header_size < sizeof(obb_header) ||
+	    !section_fits(length, header->words_offset, header->code_length + header->data_length, 2) ||
+	    !section_fits(length, header->entries_offset, header->entry_count, sizeof(obb_symbol)) ||
+	    !section_fits(length, header->externs_offset, header->extern_count, sizeof(obb_symbol)) ||
+	    !section_fits(length, header->relocations_offset, header->relocation_count, 2) ||
+	    !section_fits(length, header->strings_offset, header->strings_size, 1)) {
+		return FALSE;
+	}
+	if (header->strings_size > 0 && ((const char *) data)[header->strings_offset + header->strings_size - 1] != '\0') {
+		return FALSE;
+	}
+
+	image->header = header;
+	image->words = (const unsigned char *) data + header->words_offset;
+	image->entries = (const obb_symbol *) ((const char *) data + header->entries_offset);
+	image->externs = (const obb_symbol *) ((const char *) data + header->externs_offset);
+	image->relocations = (const uint16_t *) ((const char *) data + header->relocations_offset);
+	image->strings = (const char *) data + header->strings_offset;
+	image->mapping = NULL;
+	image->mapped_length = 0;
+	return TRUE;
+}
+
+
+/**
+ * Maps a .obb file into memory and validates its header and section bounds.
+ *
+ * @param filename The name of the file to map.
+ * @param image Receives pointers to the sections of the mapped file.
+ *
+ * @return TRUE if the file was mapped and is a valid object, FALSE otherwise.
+ */
+
+bool obb_map(char *filename, obb_image *image) {
+	struct stat file_stat;
+	void *mapping;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return FALSE;
+	if (fstat(fd, &file_stat) != 0 || file_stat.st_size < (long) sizeof(obb_header)) {
+		close(fd);
+		return FALSE;
+	}
+	mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (mapping == MAP_FAILED) return FALSE;
+
+	if (!obb_view(mapping, file_stat.st_size, image)) {
+		munmap(mapping, file_stat.st_size);
+		return FALSE;
+	}
+	image->mapping = mapping;
+	image->mapped_length = file_stat.st_size;
+	return TRUE;
+}
+
+
+/**
+ * Releases a mapped .obb file.
+ *
+ * @param image The image to release.
+ */
+
+void obb_unmap(obb_image *image) {
+	if (image->mapping != NULL) munmap(image->mapping, image->mapped_length);
+	image->mapping = NULL;
+}
+
+
+/**
+ * Reads one word of a mapped image.
+ *
+ * @param image The mapped image.
+ * @param index The index of the word: code words first, then data words.
+ *
+ * @return The 15-bit word.
+ */
+
+unsigned int obb_word(const obb_image *image, long index) {
+	return image->words[2 * index] | (image->words[2 * index + 1] << 8);
+}
+
+
+/**
+ * Returns the name of an entry or extern record.
+ *
+ * @param image The mapped image.
+ * @param symbol A record from the entries or externs section.
+ *
+ * @return The NUL-terminated symbol name inside the mapping, or "" if the record points outside the strings.
+ */
+
+const char *obb_symbol_name(const obb_image *image, const obb_symbol *symbol) {
+	if (symbol->name_offset >= image->header->strings_size) return "";
+	return image->strings + symbol->name_offset;
+}
+
+
+/**
+ * Stores a 16-bit value in little-endian byte order.
+ *
+ * @param dest Where to store the two bytes.
+ * @param value The value to store.
+ */
+
+static void put_u16(unsigned char *dest, unsigned long value) {
+	dest[0] = (unsigned char) (value & 0xFF);
+	dest[1] = (unsigned char) ((value >> 8) & 0xFF);
+}
+
+
+/**
+ * Stores a 32-bit value in little-endian byte order.
+ *
+ * @param dest Where to store the four bytes.
+ * @param value The value to store.
+ */
+
+static void put_u32(unsigned char *dest, unsigned long value) {
+	put_u16(dest, value & 0xFFFF);
+	put_u16(dest + 2, (value >> 16) & 0xFFFF);
+}
+
+
+/**
+ * Lays out a .obb file with the given number of records, allocates it zeroed and writes its header.
+ *
+ * @param writer Receives the file and its layout.
+ * @param code_length The number of code words.
+ * @param data_length The number of data words.
+ * @param entry_count The number of entries.
+ * @param extern_count The number of extern records.
+ * @param relocation_count The number of relocatable words.
+ * @param strings_size The bytes of all entry and extern names, each with its NUL.
+ */
+
+void obb_format_begin(obb_writer *writer, long code_length, long data_length, long entry_count, long extern_count,
+                      long relocation_count, long strings_size) {
+	unsigned char *buffer;
+
+	/* Every section starts on a 4-byte boundary */
+	writer->words_offset = sizeof(obb_header);
+	writer->entries_offset = (writer->words_offset + 2 * (code_length + data_length) + 3) & ~3L;
+	writer->externs_offset = writer->entries_offset + entry_count * sizeof(obb_symbol);
+	writer->relocations_offset = writer->externs_offset + extern_count * sizeof(obb_symbol);
+	writer->strings_offset = (writer->relocations_offset + 2 * relocation_count + 3) & ~3L;
+	writer->length = (writer->strings_offset + strings_size + 3) & ~3L;
+	writer->entries_put = writer->externs_put = writer->relocations_put = writer->strings_used = 0;
+
+	buffer = writer->buffer = malloc_with_check(writer->length);
+	memset(buffer, 0, writer->length);
+	memcpy(buffer, OBB_MAGIC, 4);
+	put_u16(buffer + 4, OBB_VERSION);
+	put_u16(buffer + 6, sizeof(obb_header));
+	put_u32(buffer + 8, IC_INIT_VALUE);
+	put_u32(buffer + 12, code_length);
+	put_u32(buffer + 16, data_length);
+	put_u32(buffer + 20, writer->words_offset);
+	put_u32(buffer + 24, writer->entries_offset);
+	put_u32(buffer + 28, entry_count);
+	put_u32(buffer + 32, writer->externs_offset);
+	put_u32(buffer + 36, extern_count);
+	put_u32(buffer + 40, writer->strings_offset);
+	put_u32(buffer + 44, strings_size);
+	put_u32(buffer + 48, writer->relocations_offset);
+	put_u32(buffer + 52, relocation_count);
+}
+
+
+/**
+ * Writes one word of a .obb file being formatted.
+ *
+ * @param writer The file.
+ * @param index The index of the word: code words first, then data words.
+ * @param word The word; only its 15 low bits are kept.
+ */
+
+void obb_put_word(obb_writer *writer, long index, unsigned long word) {
+	put_u16(writer->buffer + writer->words_offset + 2 * index, KEEP_ONLY_15_LSB(word));
+}
+
+
+/**
+ * Writes the next relocation record of a .obb file being formatted.
+ *
+ * @param writer The file.
+ * @param address The address of the relocatable word.
+ */
+
+void obb_put_relocation(obb_writer *writer, long address) {
+	put_u16(writer->buffer + writer->relocations_offset + 2 * writer->relocations_put++, address);
+}
+
+
+/**
+ * Writes a symbol record and its name.
+ *
+ * @param writer The file.
+ * @param record Where the obb_symbol record goes.
+ * @param name The symbol's name.
+ * @param address The symbol's address.
+ */
+
+static void put_symbol(obb_writer *writer, unsigned char *record, const char *name, long address) {
+	long name_length = strlen(name) + 1;
+
+	memcpy(writer->buffer + writer->strings_offset + writer->strings_used, name, name_length);
+	put_u32(record, writer->strings_used);
+	put_u32(record + 4, address);
+	writer->strings_used += name_length;
+}
+
+
+/**
+ * Writes the next entry record of a .obb file being formatted, and its name.
+ *
+ * @param writer The file.
+ * @param name The entry's name.
+ * @param address The entry's address.
+ */
+
+void obb_put_entry(obb_writer *writer, const char *name, long address) {
+	put_symbol(writer, writer->buffer + writer->entries_offset + writer->entries_put++ * sizeof(obb_symbol), name,
+	           address);
+}
+
+
+/**
+ * Writes the next extern record of a .obb file being formatted, and its name.
+ *
+ * @param writer The file.
+ * @param name The external's name.
+ * @param address The address of the word referring to it.
+ */
+
+void obb_put_extern(obb_writer *writer, const char *name, long address) {
+	put_symbol(writer, writer->buffer + writer->externs_offset + writer->externs_put++ * sizeof(obb_symbol), name,
+	           address);
+}
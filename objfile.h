@@ -0,0 +1,206 @@
+/**
+ * File: objfile.h
+ *
+ * Description:
+ *  This header file defines the binary object format (.obb), an alternative to the text .ob file for tools that
+ *  load objects many times (simulators, linkers). All fields are little-endian and every section starts on a
+ *  4-byte boundary, so a mapped file can be used in place without parsing:
+ *
+ *   offset 0                obb_header
+ *   words_offset            (code_length + data_length) 16-bit words: the code image, then the data image.
+ *                           Each holds the 15-bit machine word.
+ *   entries_offset          entry_count obb_symbol records: name, address of the .entry symbol
+ *   externs_offset          extern_count obb_symbol records: name, address of a word referring to an external
+ *   relocations_offset      relocation_count 16-bit addresses of the relocatable (ARE_RELOCATABLE) words, in
+ *                           address order: the words a linker moves with the module
+ *   strings_offset          strings_size bytes of NUL-terminated symbol names
+ *
+ * Functions:
+ *  obb_map(): Maps a .obb file into memory and validates its header.
+ *  obb_view(): Validates a .obb image already in memory.
+ *  obb_unmap(): Releases a mapped .obb file.
+ *  obb_word(): Reads one word of a mapped image.
+ *  obb_symbol_name(): Returns the name of an entry or extern record.
+ *  obb_format_begin(): Lays out a .obb file and writes its header.
+ *  obb_put_word() / obb_put_relocation() / obb_put_entry() / obb_put_extern(): Write the records of a .obb file.
+ */
+
+#ifndef _OBJFILE_H
+#define _OBJFILE_H
+#include <stdint.h>
+#include "globals.h"
+
+#define OBB_MAGIC "OBB1"
+#define OBB_VERSION 2
+
+/** The fixed header at the start of a .obb file */
+typedef struct obb_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;
+	/** Address of the first code word (IC_INIT_VALUE) */
+	uint32_t code_base;
+	uint32_t code_length;
+	uint32_t data_length;
+	uint32_t words_offset;
+	uint32_t entries_offset;
+	uint32_t entry_count;
+	uint32_t externs_offset;
+	uint32_t extern_count;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+	uint32_t relocations_offset;
+	uint32_t relocation_count;
+} obb_header;
+
+/** A symbol record: an offset into the string section and an address */
+typedef struct obb_symbol {
+	uint32_t name_offset;
+	uint32_t address;
+} obb_symbol;
+
+/** A .obb file mapped into memory */
+typedef struct obb_image {
+	const obb_header *header;
+	const unsigned char *words;
+	const obb_symbol *entries;
+	const obb_symbol *externs;
+	const uint16_t *relocations;
+	const char *strings;
+	/** The whole mapping, for obb_unmap; NULL for an image from obb_view */
+	void *mapping;
+	long mapped_length;
+} obb_image;
+
+/** A .obb file being formatted, see obb_format_begin */
+typedef struct obb_writer {
+	/** The formatted file, from malloc_with_check, and its number of bytes, a multiple of 4 */
+	unsigned char *buffer;
+	long length;
+	/** Where each section starts */
+	long words_offset, entries_offset, externs_offset, relocations_offset, strings_offset;
+	/** The records of each list, and the string bytes, written so far */
+	long entries_put, externs_put, relocations_put, strings_used;
+} obb_writer;
+
+
+/**
+ * Maps a .obb file into memory and validates its header and section bounds.
+ *
+ * @param filename The name of the file to map.
+ * @param image Receives pointers to the sections of the mapped file.
+ *
+ * @return TRUE if the file was mapped and is a valid object, FALSE otherwise.
+ */
+
+bool obb_map(char *filename, obb_image *image);
+
+
+/**
+ * Validates a .obb image already in memory, such as a member of a .lib archive, and points into its sections.
+ * Nothing is copied, and obb_unmap does nothing for it.
+ *
+ * @param data The image, 4-byte aligned.
+ * @param length The number of bytes of the image.
+ * @param image Receives pointers to the sections of the image.
+ *
+ * @return TRUE if the image is a valid object, FALSE otherwise.
+ */
+
+bool obb_view(const void *data, long length, obb_image *image);
+
+
+/**
+ * Releases a mapped .obb file.
+ *
+ * @param image The image to release.
+ */
+
+void obb_unmap(obb_image *image);
+
+
+/**
+ * Reads one word of a mapped image.
+ *
+ * @param image The mapped image.
+ * @param index The index of the word: code words first, then data words.
+ *
+ * @return The 15-bit word.
+ */
+
+unsigned int obb_word(const obb_image *image, long index);
+
+
+/**
+ * Returns the name of an entry or extern record.
+ *
+ * @param image The mapped image.
+ * @param symbol A record from the entries or externs section.
+ *
+ * @return The NUL-terminated symbol name inside the mapping.
+ */
+
+const char *obb_symbol_name(const obb_image *image, const obb_symbol *symbol);
+
+
+/**
+ * Lays out a .obb file with the given number of records, allocates it zeroed and writes its header. The words,
+ * relocations and symbols are then written with obb_put_word, obb_put_relocation, obb_put_entry and obb_put_extern,
+ * each list in order, so that the file is little-endian whatever the host.
+ *
+ * @param writer Receives the file and its layout.
+ * @param code_length The number of code words.
+ * @param data_length The number of data words.
+ * @param entry_count The number of entries.
+ * @param extern_count The number of extern records.
+ * @param relocation_count The number of relocatable words.
+ * @param strings_size The bytes of all entry and extern names, each with its NUL.
+ */
+
+void obb_format_begin(obb_writer *writer, long code_length, long data_length, long entry_count, long extern_count,
+                      long relocation_count, long strings_size);
+
+
+/**
+ * Writes one word of a .obb file being formatted.
+ *
+ * @param writer The file.
+ * @param index The index of the word: code words first, then data words.
+ * @param word The word; only its 15 low bits are kept.
+ */
+
+void obb_put_word(obb_writer *writer, long index, unsigned long word);
+
+
+/**
+ * Writes the next relocation record of a .obb file being formatted.
+ *
+ * @param writer The file.
+ * @param address The address of the relocatable word.
+ */
+
+void obb_put_relocation(obb_writer *writer, long address);
+
+
+/**
+ * Writes the next entry record of a .obb file being formatted, and its name.
+ *
+ * @param writer The file.
+ * @param name The entry's name.
+ * @param address The entry's address.
+ */
+
+void obb_put_entry(obb_writer *writer, const char *name, long address);
+
+
+/**
+ * Writes the next extern record of a .obb file being formatted, and its name.
+ *
+ * @param writer The file.
+ * @param name The external's name.
+ * @param address The address of the word referring to it.
+ */
+
+void obb_put_extern(obb_writer *writer, const char *name, long address);
+
+#endif
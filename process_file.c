@@ -11,6 +11,10 @@
  *  process_file(): Processes the specified assembly file by performing macro expansion, first pass and second pass
  *  processing, and writing output files. It also manages memory allocation for the file names and cleans up after
  *  processing.
+ *  init_assembler_options(): Sets the options of a plain assembler run.
+ *  process_stream(): Processes a source read from a file descriptor, writing the outputs to stdout or chosen
+ *  file descriptors instead of files.
+ *  assemble_source(): Runs the first pass, relocation and the second pass over a macro-expanded source in memory.
  *
  * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
  */
@@ -24,9 +28,42 @@
 #include "second_pass.h"
 #include "macr.h"
 #include "process_file.h"
+#include "source.h"
+#include "arena.h"
+#include "trace.h"
+#include "stats.h"
+#include "traceevents.h"
+#include "cache.h"
+#include "incremental.h"
 
 
-bool process_file(char *filename);
+bool process_file(char *filename, assembler_options *options);
+
+
+/**
+ * @brief Sets options to those of a plain assembler run: lines limited to MAX_LINE_LENGTH, only the text outputs,
+ *        no stats, no file descriptors chosen for the outputs, no macro library, cache, incremental state or link.
+ *
+ * @param options The options to set.
+ */
+
+void init_assembler_options(assembler_options *options) {
+	options->line_limit = LINE_LIMIT_ERROR;
+	options->write_binary_object = FALSE;
+	options->print_stats = FALSE;
+	options->stats_json_filename = NULL;
+	options->trace_events_filename = NULL;
+	options->object_fd = options->entries_fd = options->externals_fd = options->relocations_fd = -1;
+	options->binary_object_fd = -1;
+	options->macro_library_filename = NULL;
+	options->serve_socket_path = NULL;
+	options->cache_directory = NULL;
+	options->cache_size_limit = DEFAULT_CACHE_SIZE_LIMIT;
+	options->print_cache_stats = FALSE;
+	options->incremental = FALSE;
+	options->watch = FALSE;
+	options->link_output_name = NULL;
+}
 
 
 /**
@@ -34,118 +71,201 @@ bool process_file(char *filename);
  *        and writing output files.
  * 
  * @param filename The name of the assembly file to be processed.
+ * @param options The command line options.
  * @return true if the processing is successful, false otherwise.
  * 
  * This function:
- * - Calls macro() to expand macros in the file.
- * - Creates file names with .as and .am extensions.
- * - Opens the macro file and processes it line by line.
- * - Performs the first pass to parse and validate instructions.
- * - Performs the second pass to handle additional processing and generates output files.
- * - Frees allocated memory and closes open files.
+ * - With --cache-dir, restores the outputs from the result cache instead when the cache holds them.
+ * - Calls macro() to expand macros in the file, which writes the .am file and keeps the expansion in memory.
+ * - Assembles the expansion with assemble_source(), or with --incremental with assemble_incremental().
+ * - Writes the output files.
+ * - Releases the file's arena, which holds the symbols, words, operands and macros.
+ * - With --cache-dir, keeps the outputs in the cache if the file reported no errors or warnings.
  */
 
-bool process_file(char *filename) {
+bool process_file(char *filename, assembler_options *options) {
 
-	int temp_c;
-	long ic = IC_INIT_VALUE, dc = 0, icf, dcf;
-	bool is_success = TRUE; 
+	bool is_success;
 	char *input_filename;
-	char *macro_filename;
-	FILE *file_des; 
-	long data_img[CODE_ARR_IMG_LENGTH]; 
-	machine_word *code_img[CODE_ARR_IMG_LENGTH];
+	source_buffer source;
+	assembly_image image;
+	arena file_arena;
+	arena *previous_arena;
+	cache_key key;
+	long warnings_before = warning_count(), errors_before = error_count();
 
-	table symbol_table = NULL;
-	line_info curr_line_info;
+	trace_event_begin("process_file", filename);
+	if (options->cache_directory != NULL && cache_restore(filename, options, &key)) {
+		trace_event_end("process_file");
+		return TRUE;
+	}
+	/* Everything that lives until this file is done is allocated from file_arena */
+	arena_init(&file_arena);
+	previous_arena = arena_select(&file_arena);
+	stats_phase_begin(PHASE_MACRO);
+	is_success = macro(filename, &source);
+	stats_phase_end(PHASE_MACRO);
 	
-	printf("Before macro call\n");
-	macro(filename);
-	printf("After macro call\n");
-	printf("Before strallocat for input_filename\n");
+	if (!is_success) {
+		printf("Error: file \"%s.am\" could not be produced. skipping it.\n", filename);
+		arena_select(previous_arena);
+		arena_release(&file_arena);
+		trace_event_end("process_file");
+		return FALSE;
+	}
+
 	input_filename = strallocat(filename, ".as");
-	printf("After strallocat for input_filename: %s\n", input_filename);
+	if (options->incremental) {
+		is_success = assemble_incremental(&source, input_filename, filename, options, &image);
+	} else {
+		is_success = assemble_source(&source, input_filename, options, &image);
+	}
+	if (is_success) {
+		stats_phase_begin(PHASE_OUTPUT);
+		is_success = write_output_files(image.code_img, image.data_img, image.icf, image.dcf, filename,
+		                                image.symbol_table, options);
+		stats_phase_end(PHASE_OUTPUT);
+		STATS_ADD(COUNTER_WORDS, image.icf - IC_INIT_VALUE + image.dcf);
+	}
+	/* A hit replays no diagnostics, so only a file that reported none is stored; an error that does not fail the
+	 * assembly (an undefined symbol) must be printed again on every run */
+	if (is_success && options->cache_directory != NULL && warning_count() == warnings_before &&
+	    error_count() == errors_before) {
+		cache_store(filename, options, &key);
+	}
 
-	printf("Before strallocat for macro_filename\n");
-	macro_filename = strallocat(filename, ".am");
-	printf("After strallocat for macro_filename: %s\n", macro_filename);
+	source_close(&source);
+	free_with_check(input_filename);
+	arena_select(previous_arena);
+	arena_release(&file_arena);
+	trace_event_end("process_file");
+	return is_success;
+}
 
-	printf("Allocated macro filename: %s\n", macro_filename);
 
-	printf("Trying to open file: %s\n", macro_filename);
-	
-	file_des = fopen(macro_filename, "r");
+/**
+ * @brief Processes a source read from a file descriptor (stdin for "-"), writing the outputs with
+ *        write_output_stream instead of to files. No .am file is written.
+ *
+ * @param input_fd The file descriptor to read the source from.
+ * @param options The command line options, including the file descriptors chosen for the outputs.
+ * @return TRUE if the source assembled and its outputs were written, FALSE otherwise.
+ */
 
-	if (file_des == NULL) {
-		printf("Error: file \"%s.am\" is inaccessible for reading. skipping it.\n", macro_filename);
-		free(input_filename);
-		free(macro_filename);
+bool process_stream(int input_fd, assembler_options *options) {
+	bool is_success;
+	source_buffer input, expanded;
+	assembly_image image;
+	arena stream_arena;
+	arena *previous_arena;
+	static char stream_name[] = "<stdin>";
+
+	if (!source_read_fd(input_fd, &input)) {
+		fprintf(stderr, "Error: can't read the source from file descriptor %d.\n", input_fd);
 		return FALSE;
 	}
-	
 
-	curr_line_info.file_name = input_filename;
-	curr_line_info.content = temp_line; 
-	for (curr_line_info.line_number = 1;
-	     fgets(temp_line, MAX_LINE_LENGTH + 2, file_des) != NULL; curr_line_info.line_number++) {
+	trace_event_begin("process_stream", stream_name);
+	arena_init(&stream_arena);
+	previous_arena = arena_select(&stream_arena);
+
+	stats_phase_begin(PHASE_MACRO);
+	is_success = expand_macros(&input, stream_name, &expanded);
+	stats_phase_end(PHASE_MACRO);
+	source_close(&input);
+
+	is_success = is_success && assemble_source(&expanded, stream_name, options, &image);
+
+	stats_phase_begin(PHASE_OUTPUT);
+	if (is_success) {
+		is_success = write_output_stream(image.code_img, image.data_img, image.icf, image.dcf, image.symbol_table,
+		                                 TRUE, options);
+		STATS_ADD(COUNTER_WORDS, image.icf - IC_INIT_VALUE + image.dcf);
+	} else {
+		write_output_stream(NULL, NULL, 0, 0, NULL, FALSE, options);
+	}
+	stats_phase_end(PHASE_OUTPUT);
+
+	source_close(&expanded);
+	arena_select(previous_arena);
+	arena_release(&stream_arena);
+	trace_event_end("process_stream");
+	return is_success;
+}
+
+
+/**
+ * @brief Runs the first pass, relocation of data symbols and the second pass over a macro-expanded source.
+ *
+ * @param source The expanded source. Its lines are NUL-terminated in place.
+ * @param file_name The name reported in error messages.
+ * @param options The options; only the line limit applies here.
+ * @param image Receives the code and data images and the symbol table, allocated from the current arena.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise.
+ *
+ * This function:
+ * - Walks the source line by line, each line being a span into the buffer.
+ * - Checks line lengths against MAX_LINE_LENGTH as the options ask (error, warning or no limit).
+ * - Performs the first pass to parse and validate instructions.
+ * - Performs the second pass over the same buffer to resolve symbols.
+ */
+
+bool assemble_source(source_buffer *source, char *file_name, assembler_options *options, assembly_image *image) {
+	long offset;
+	long ic = IC_INIT_VALUE, dc = 0;
+	bool is_success = TRUE;
+	line_info curr_line_info;
+	machine_word **code_img = assembly_alloc(CODE_ARR_IMG_LENGTH * sizeof(machine_word *));
+
+	memset(code_img, 0, CODE_ARR_IMG_LENGTH * sizeof(machine_word *));
+	image->code_img = code_img;
+	image->data_img = assembly_alloc(CODE_ARR_IMG_LENGTH * sizeof(long));
+	image->symbol_table = NULL;
+
+	stats_phase_begin(PHASE_PASS1);
+	curr_line_info.file_name = file_name;
+	for (offset = 0, curr_line_info.line_number = 1;
+	     source_next_line(source, &offset, &curr_line_info); curr_line_info.line_number++) {
+		STATS_ADD(COUNTER_LINES, 1);
 		
-		if (strchr(temp_line, '\n') == NULL && !feof(file_des)) {
+		if (curr_line_info.length > MAX_LINE_LENGTH && options->line_limit == LINE_LIMIT_ERROR) {
 			
 			printf_line_error(curr_line_info, "Line too long to process. Maximum line length should be %d.",
 			                  MAX_LINE_LENGTH);
 			is_success = FALSE;
-
-			do {
-				temp_c = fgetc(file_des);
-			} while (temp_c != '\n' && temp_c != EOF);
 		} else {
-			if (!process_line_fpass(curr_line_info, &ic, &dc, code_img, data_img, &symbol_table)) {
-				if (is_success) {
-	
-					icf = -1;
-					is_success = FALSE;
-				}
+			if (curr_line_info.length > MAX_LINE_LENGTH && options->line_limit == LINE_LIMIT_WARN) {
+				printf_line_warning(curr_line_info, "Line is longer than %d characters.", MAX_LINE_LENGTH);
+			}
+			if (!process_line_fpass(curr_line_info, &ic, &dc, code_img, image->data_img, &image->symbol_table)) {
+				is_success = FALSE;
 			}
 		}
 	}
-	
+	stats_phase_end(PHASE_PASS1);
 
-	icf = ic;
-	dcf = dc;
-	printf("ic: %d\n dc: %d\n",ic ,dc);
+	image->icf = ic;
+	image->dcf = dc;
+	TRACE(TRACE_PASS1, "%s: first pass done, ic: %ld dc: %ld", file_name, ic, dc);
 
-	if (is_success) {
-	
-		ic = IC_INIT_VALUE;
+	if (!is_success) return FALSE;
 
-		add_value_to_type(symbol_table, icf, DATA_SYMBOL);
+	ic = IC_INIT_VALUE;
 
-		rewind(file_des); 
-
-		for (curr_line_info.line_number = 1; !feof(file_des); curr_line_info.line_number++) {
-			int i = 0;
-			fgets(temp_line, MAX_LINE_LENGTH, file_des);
-			MOVE_TO_NOT_WHITE(temp_line, i)
-			if (code_img[ic - IC_INIT_VALUE] != NULL || temp_line[i] == '.'){
-		                		printf("Trying to open file: %s\n",temp_line);
-				is_success &= process_line_spass(curr_line_info, &ic, code_img, &symbol_table);
-		        }
-		}
-		
-		if (is_success) {
-			
-			is_success = write_output_files(code_img, data_img, icf, dcf, filename, symbol_table);
+	stats_phase_begin(PHASE_RELOCATE);
+	add_value_to_type(image->symbol_table, image->icf, DATA_SYMBOL);
+	stats_phase_end(PHASE_RELOCATE);
 
+	stats_phase_begin(PHASE_PASS2);
+	for (offset = 0, curr_line_info.line_number = 1;
+	     source_next_line(source, &offset, &curr_line_info); curr_line_info.line_number++) {
+		int i = 0;
+		MOVE_TO_NOT_WHITE(curr_line_info.content, i)
+		if (code_img[ic - IC_INIT_VALUE] != NULL || curr_line_info.content[i] == '.'){
+			is_success &= process_line_spass(curr_line_info, &ic, code_img, &image->symbol_table);
 		}
 	}
-
-	fclose(file_des);
-
-	free(input_filename);
-	free_table(symbol_table);
-	free_code_image(code_img, icf);
-
-	free(macro_filename);
+	stats_phase_end(PHASE_PASS2);
 	return is_success;
 }
-
@@ -5,17 +5,46 @@
 #include "first_pass.h"
 #include "second_pass.h"
 #include "macr.h"
+#include "source.h"
+
+/**
+ * @struct assembly_image
+ * @brief The result of the first and second pass over a source: the code and data images and the symbol table.
+ *        Everything in it is allocated from the current arena (see arena.h).
+ */
+typedef struct assembly_image {
+	/** CODE_ARR_IMG_LENGTH words, code_img[0] being the word at IC_INIT_VALUE */
+	machine_word **code_img;
+	/** CODE_ARR_IMG_LENGTH data words */
+	long *data_img;
+	/** Instruction counter final value */
+	long icf;
+	/** Data counter final value */
+	long dcf;
+	table symbol_table;
+} assembly_image;
 
 
 
 
 
 
+/**
+ * @brief Sets options to those of a plain assembler run: lines limited to MAX_LINE_LENGTH, only the text outputs,
+ *        no stats, no file descriptors chosen for the outputs, no macro library, cache, incremental state or link.
+ *
+ * @param options The options to set.
+ */
+
+void init_assembler_options(assembler_options *options);
+
+
 /**
  * @brief Processes the specified assembly file by performing macro expansion, first pass and second pass processing,
  *        and writing output files.
  * 
  * @param filename The name of the assembly file to be processed.
+ * @param options The command line options.
  * @return true if the processing is successful, false otherwise.
  */
 
@@ -23,7 +52,33 @@
 
 
 
- bool process_file(char *filename);
+ bool process_file(char *filename, assembler_options *options);
+
+
+/**
+ * @brief Processes a source read from a file descriptor (stdin for "-"), writing the outputs with
+ *        write_output_stream instead of to files. No .am file is written.
+ *
+ * @param input_fd The file descriptor to read the source from.
+ * @param options The command line options, including the file descriptors chosen for the outputs.
+ * @return TRUE if the source assembled and its outputs were written, FALSE otherwise.
+ */
+
+bool process_stream(int input_fd, assembler_options *options);
+
+
+/**
+ * @brief Runs the first pass, relocation of data symbols and the second pass over a macro-expanded source.
+ *
+ * @param source The expanded source. Its lines are NUL-terminated in place.
+ * @param file_name The name reported in error messages.
+ * @param options The options; only the line limit applies here.
+ * @param image Receives the code and data images and the symbol table, allocated from the current arena.
+ *
+ * @return TRUE if the source assembled without errors, FALSE otherwise.
+ */
+
+bool assemble_source(source_buffer *source, char *file_name, assembler_options *options, assembly_image *image);
 
 
 
@@ -0,0 +1,303 @@
+/**
+ * File: program.c
+ *
+ * Description:
+ *  This file contains whole-program assembly, declared in program.h. It runs in three rounds, each spread over a
+ *  pool of threads that take the files in turn: every file is assembled in its own arena and kept as a linker
+ *  module; then, once the modules are laid out, every module publishes its entries into the global index; then
+ *  every module copies its words into the image and resolves its externals against the index. The layout between
+ *  the first two rounds, and the gathering of the relocation records at the end, are the only serial steps. The
+ *  stats each thread of the pool collects are added to the calling thread's once the round is over, and the
+ *  diagnostics of each file are gathered as text while it is assembled and printed in file order after the first
+ *  round, so that the files' messages never interleave.
+ *
+ * Functions:
+ *  assemble_program(): Assembles files as one program and writes the linked image.
+ *  run_round(): Runs one round over all the files on the pool of threads.
+ *  round_worker(): Takes the files of a round in turn.
+ *  pool_worker(): Runs round_worker on a thread of the pool and hands over the thread's stats.
+ *  assemble_unit(): Assembles one file into a module.
+ *  collect_module(): Fills a linker module from an assembled image.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "program.h"
+#include "process_file.h"
+#include "linker.h"
+#include "arena.h"
+#include "stats.h"
+#include "traceevents.h"
+
+#define KEEP_ONLY_15_LSB(value) ((value) & 0x7FFF)
+
+/* The rounds of assemble_program */
+typedef enum program_round {
+	ROUND_ASSEMBLE,
+	ROUND_PUBLISH,
+	ROUND_RESOLVE
+} program_round;
+
+/* What the threads of a round share */
+typedef struct program_context {
+	char **filenames;
+	int count;
+	assembler_options *options;
+	/** One arena per file, holding its module until the image is written */
+	arena *arenas;
+	link_module *modules;
+	/** Whether each file's step of the current round succeeded */
+	bool *succeeded;
+	/** The errors and warnings each file reported while it was assembled */
+	diagnostic_text *diagnostics;
+	link_image image;
+	program_round round;
+	/** The next file to take in the current round */
+	int next;
+	/** The stats of the threads of the pool that ended, taken under stats_lock */
+	stats_totals pool_stats;
+	pthread_mutex_t stats_lock;
+} program_context;
+
+
+/**
+ * Fills a linker module from an assembled image, as the module would be read back from its output files. Its
+ * memory is allocated from the current arena.
+ *
+ * @param image The assembled image.
+ * @param name The module's name.
+ * @param module Receives the module.
+ */
+
+static void collect_module(assembly_image *image, char *name, link_module *module) {
+	table entries = filter_table_by_type(image->symbol_table, ENTRY_SYMBOL);
+	table externals = filter_table_by_type(image->symbol_table, EXTERNAL_REFERENCE), curr_entry;
+	long i, val = 0;
+
+	memset(module, 0, sizeof(link_module));
+	module->name = name;
+	module->code_length = image->icf - IC_INIT_VALUE;
+	module->data_length = image->dcf;
+	module->words = assembly_alloc((module->code_length + module->data_length + 1) * sizeof(unsigned long));
+	module->relocations = assembly_alloc((module->code_length + 1) * sizeof(long));
+	for (i = 0; i < module->code_length; i++) {
+		if (image->code_img[i] != NULL) val = get_word_value(image->code_img[i]);
+		module->words[i] = val;
+		if (is_relocatable_word(image->code_img[i])) {
+			module->relocations[module->relocation_count++] = IC_INIT_VALUE + i;
+		}
+	}
+	for (i = 0; i < module->data_length; i++) {
+		module->words[module->code_length + i] = KEEP_ONLY_15_LSB(image->data_img[i]);
+	}
+
+	for (curr_entry = entries; curr_entry != NULL; curr_entry = curr_entry->next) module->entry_count++;
+	module->entries = assembly_alloc((module->entry_count + 1) * sizeof(link_symbol));
+	for (i = 0, curr_entry = entries; curr_entry != NULL; curr_entry = curr_entry->next, i++) {
+		module->entries[i].name = curr_entry->key;
+		module->entries[i].address = curr_entry->value;
+	}
+	for (curr_entry = externals; curr_entry != NULL; curr_entry = curr_entry->next) module->extern_count++;
+	module->externs = assembly_alloc((module->extern_count + 1) * sizeof(link_symbol));
+	for (i = 0, curr_entry = externals; curr_entry != NULL; curr_entry = curr_entry->next, i++) {
+		module->externs[i].name = curr_entry->key;
+		module->externs[i].address = curr_entry->value;
+	}
+}
+
+
+/**
+ * Assembles one file into a module, in the file's own arena, which is left holding the module.
+ *
+ * @param context The program.
+ * @param unit The index of the file.
+ *
+ * @return TRUE if the file assembled.
+ */
+
+static bool assemble_unit(program_context *context, int unit) {
+	char *filename = context->filenames[unit], *input_filename;
+	source_buffer source;
+	assembly_image image;
+	arena *previous_arena;
+	diagnostic_sink *previous_sink;
+	bool is_success;
+
+	trace_event_begin("assemble_unit", filename);
+	diagnostic_text_init(&context->diagnostics[unit]);
+	previous_sink = set_diagnostic_sink(&context->diagnostics[unit].sink);
+	arena_init(&context->arenas[unit]);
+	previous_arena = arena_select(&context->arenas[unit]);
+	stats_phase_begin(PHASE_MACRO);
+	is_success = macro(filename, &source);
+	stats_phase_end(PHASE_MACRO);
+	if (!is_success) {
+		printf("Error: file \"%s.am\" could not be produced. skipping it.\n", filename);
+		arena_select(previous_arena);
+		set_diagnostic_sink(previous_sink);
+		trace_event_end("assemble_unit");
+		return FALSE;
+	}
+
+	input_filename = strallocat(filename, ".as");
+	is_success = assemble_source(&source, input_filename, context->options, &image);
+	if (is_success) {
+		collect_module(&image, filename, &context->modules[unit]);
+		STATS_ADD(COUNTER_WORDS, image.icf - IC_INIT_VALUE + image.dcf);
+	}
+	source_close(&source);
+	free_with_check(input_filename);
+	arena_select(previous_arena);
+	set_diagnostic_sink(previous_sink);
+	trace_event_end("assemble_unit");
+	return is_success;
+}
+
+
+/**
+ * Takes the files of the current round in turn until none is left.
+ *
+ * @param argument The program context.
+ *
+ * @return NULL.
+ */
+
+static void *round_worker(void *argument) {
+	program_context *context = argument;
+	int unit;
+
+	while ((unit = __atomic_fetch_add(&context->next, 1, __ATOMIC_RELAXED)) < context->count) {
+		switch (context->round) {
+			case ROUND_ASSEMBLE:
+				context->succeeded[unit] = assemble_unit(context, unit);
+				break;
+			case ROUND_PUBLISH:
+				context->succeeded[unit] = link_publish_entries(context->modules, unit, &context->image);
+				break;
+			case ROUND_RESOLVE:
+				context->succeeded[unit] = link_resolve_module(context->modules, unit, &context->image);
+				break;
+		}
+	}
+	return NULL;
+}
+
+
+/**
+ * Runs round_worker on a thread of the pool, then hands the thread's stats over to the program before it ends.
+ *
+ * @param argument The program context.
+ *
+ * @return NULL.
+ */
+
+static void *pool_worker(void *argument) {
+	program_context *context = argument;
+
+	round_worker(context);
+	pthread_mutex_lock(&context->stats_lock);
+	stats_take_thread(&context->pool_stats);
+	pthread_mutex_unlock(&context->stats_lock);
+	return NULL;
+}
+
+
+/**
+ * Runs one round over all the files, on as many threads as there are processors (the calling thread being one).
+ *
+ * @param context The program.
+ * @param round The round to run.
+ *
+ * @return TRUE if every file's step succeeded.
+ */
+
+static bool run_round(program_context *context, program_round round) {
+	long processors = sysconf(_SC_NPROCESSORS_ONLN);
+	int i, started = 0, thread_count = context->count;
+	pthread_t *threads;
+	bool result = TRUE;
+
+	if (processors >= 1 && processors < thread_count) thread_count = (int) processors;
+	threads = malloc_with_check(thread_count * sizeof(pthread_t));
+
+	context->round = round;
+	context->next = 0;
+	memset(&context->pool_stats, 0, sizeof(context->pool_stats));
+	pthread_mutex_init(&context->stats_lock, NULL);
+	for (i = 1; i < thread_count; i++) {
+		if (pthread_create(&threads[started], NULL, pool_worker, context) == 0) started++;
+	}
+	round_worker(context);
+	for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&context->stats_lock);
+	stats_add_thread(&context->pool_stats);
+	free_with_check(threads);
+
+	for (i = 0; i < context->count; i++) result &= context->succeeded[i];
+	return result;
+}
+
+
+/**
+ * Assembles files as one program and writes the linked image as <output_name>.ob, .ent and .rel (and .obb with
+ * --obb). Each file's .am file is still written. The errors and warnings of each file's lines are printed together,
+ * in file order, as when the files are assembled one by one, followed by the link errors; the image is only
+ * written when there are none.
+ *
+ * @param filenames The files, without the .as extension, in the order their code and data are laid out.
+ * @param count The number of files.
+ * @param output_name The image's name, without extension.
+ * @param options The command line options; the line limit and --obb apply.
+ *
+ * @return TRUE if every file assembled and the image was linked and written, FALSE otherwise.
+ */
+
+bool assemble_program(char **filenames, int count, char *output_name, assembler_options *options) {
+	program_context context;
+	arena link_arena;
+	arena *previous_arena;
+	bool is_success;
+	int i;
+
+	context.filenames = filenames;
+	context.count = count;
+	context.options = options;
+	context.arenas = malloc_with_check((count + 1) * sizeof(arena));
+	context.modules = malloc_with_check((count + 1) * sizeof(link_module));
+	context.succeeded = malloc_with_check((count + 1) * sizeof(bool));
+	context.diagnostics = malloc_with_check((count + 1) * sizeof(diagnostic_text));
+	arena_init(&link_arena);
+	previous_arena = arena_select(&link_arena);
+
+	is_success = run_round(&context, ROUND_ASSEMBLE);
+	for (i = 0; i < count; i++) {
+		fputs(context.diagnostics[i].text, stderr);
+		free_with_check(context.diagnostics[i].text);
+	}
+	/* The image, its index and its records come from link_arena, the modules from their own arenas */
+	if (is_success) {
+		stats_phase_begin(PHASE_OUTPUT);
+		is_success = link_layout(context.modules, count, &context.image) && run_round(&context, ROUND_PUBLISH);
+		is_success = is_success && link_check_entries(context.modules, count, &context.image) &&
+		             run_round(&context, ROUND_RESOLVE);
+		if (is_success) {
+			link_finish_image(context.modules, count, &context.image);
+			is_success = link_write_image(output_name, &context.image, options->write_binary_object);
+		}
+		stats_phase_end(PHASE_OUTPUT);
+	}
+
+	for (i = 0; i < count; i++) arena_release(&context.arenas[i]);
+	arena_select(previous_arena);
+	arena_release(&link_arena);
+	free_with_check(context.arenas);
+	free_with_check(context.modules);
+	free_with_check(context.succeeded);
+	free_with_check(context.diagnostics);
+	return is_success;
+}
@@ -0,0 +1,35 @@
+/**
+ * File: program.h
+ *
+ * Description:
+ *  This header file declares whole-program assembly (--link): the files of a program are assembled in one process,
+ *  one file per thread, and linked into one image without writing their .ob, .ent, .ext and .rel files and reading
+ *  them back. Every thread publishes the entries of its file into the concurrent global index of the linker (see
+ *  linker.h) and then resolves its file's externals against that index directly.
+ *
+ * Functions:
+ *  assemble_program(): Assembles files as one program and writes the linked image.
+ */
+
+#ifndef _PROGRAM_H
+#define _PROGRAM_H
+#include "globals.h"
+
+
+/**
+ * Assembles files as one program and writes the linked image as <output_name>.ob, .ent and .rel (and .obb with
+ * --obb). Each file's .am file is still written. The errors and warnings of each file's lines are printed together,
+ * in file order, as when the files are assembled one by one, followed by the link errors; the image is only
+ * written when there are none.
+ *
+ * @param filenames The files, without the .as extension, in the order their code and data are laid out.
+ * @param count The number of files.
+ * @param output_name The image's name, without extension.
+ * @param options The command line options; the line limit and --obb apply.
+ *
+ * @return TRUE if every file assembled and the image was linked and written, FALSE otherwise.
+ */
+
+bool assemble_program(char **filenames, int count, char *output_name, assembler_options *options);
+
+#endif
@@ -20,6 +20,9 @@
 #include "second_pass.h"
 #include "code.h"
 #include "utils.h"
+#include "arena.h"
+#include "trace.h"
+#include "stats.h"
 #include "string.h"
 
 
@@ -45,15 +48,15 @@ bool process_direct_operand(line_info line, long curr_ic, char *operand, machine
 
 bool process_line_spass(line_info line, long *ic, machine_word **code_img, table *symbol_table) {
 	char *indexOfColon;
-	char *token;
+	char *token, *rest;
 	long i = 0;
-	printf("process_line_spass - code image %d :\n", code_img[(*ic) - IC_INIT_VALUE]);
+	TRACE(TRACE_PASS2, "%s:%ld: ic %ld: %s", line.file_name, line.line_number, *ic, line.content);
 
 
 	/* Move the pointer to the beginning of the line content */
 	MOVE_TO_NOT_WHITE(line.content, i)
 
-	if (line.content[i] == ';' || line.content[i] == '\n') return TRUE;
+	if (line.content[i] == ';' || line.content[i] == '\n' || !line.content[i]) return TRUE;
 	indexOfColon = strchr(line.content, ':');
 
 	if (indexOfColon != NULL) {
@@ -68,14 +71,14 @@ bool process_line_spass(line_info line, long *ic, machine_word **code_img, table
 		if (strncmp(".entry", line.content, 6) == 0) {
 			i += 6;
 			MOVE_TO_NOT_WHITE(line.content, i)
-			token = strtok(line.content + i, " \n\t");
+			token = strtok_r(line.content + i, " \n\t", &rest);
 			if (token == NULL) {
 				printf_line_error(line, "You have to specify a label name for .entry instruction.");
 				return FALSE;
 			}
 			if (find_by_types(*symbol_table, token, 1, ENTRY_SYMBOL) == NULL) {
 				table_entry *entry;
-				token = strtok(line.content + i, "\n");
+				token = strtok_r(line.content + i, "\n", &rest);
 				if (token[0] == '&') token++;
 
 				if ((entry = find_by_types(*symbol_table, token, 2, DATA_SYMBOL, CODE_SYMBOL)) == NULL) {
@@ -92,7 +95,6 @@ bool process_line_spass(line_info line, long *ic, machine_word **code_img, table
 				add_table_item(symbol_table, token, entry->value, ENTRY_SYMBOL);
 			}
 		}
-		printf("is_success \n");
 		return TRUE;
 	}
 	return add_symbols_to_code(line, ic, code_img, symbol_table);
@@ -119,7 +121,6 @@ bool add_symbols_to_code(line_info line, long *ic, machine_word **code_img, tabl
 	long curr_ic = *ic; 
 	int length = code_img[(*ic) - IC_INIT_VALUE]->length;
 
-	printf("add_symbols_to_code code_img %d length %d\n",  *code_img[(*ic) - IC_INIT_VALUE], length);
         if (length > 0) {
 		
 		MOVE_TO_NOT_WHITE(line.content, i)
@@ -129,31 +130,25 @@ bool add_symbols_to_code(line_info line, long *ic, machine_word **code_img, tabl
 			for (; line.content[i] && line.content[i] != '\n' && line.content[i] != EOF && line.content[i] != ' ' &&
 			       line.content[i] != '\t'; i++);
 			i++;
-                        printf("Label: %s i=%d\n, ",temp, i);
 		}
 
 		MOVE_TO_NOT_WHITE(line.content, i)
 
                 char command[80];
 		for (t=0; line.content[i] && line.content[i] != ' ' && line.content[i] != '\t' && line.content[i] != '\n' &&
-		       line.content[i] != EOF; i++, t++){
+		       line.content[i] != EOF && t < (int) sizeof(command) - 1; i++, t++){
                               command[t]=line.content[i] ;
                 }
                 command[t] = '\0';
 		MOVE_TO_NOT_WHITE(line.content, i)
-                printf("command %s, i=%d, ",command , i);
+                TRACE(TRACE_PASS2, "command %s, instruction length %d", command, length);
 		
-		analyze_operands(line, i, operands, &operand_count, NULL);
+		if (!analyze_operands(line, i, operands, &operand_count, NULL)) return FALSE;
 		
-		printf("process_spass_operand for  code img at %d to: %d \n" , ic, code_img[(*ic) - IC_INIT_VALUE]);
 		if(operand_count > 0){
                         char *operand2  = NULL;
                         if (operand_count >1){ operand2 = operands[1];}
 			isvalid = process_spass_operand(line, ic, ic, operands[0], operand2 , code_img, symbol_table);
-			free(operands[0]);
-                	if(operand2 != NULL){
-				free(operands[1]);
-			}
 		}
 		if (!isvalid) return FALSE;
 			
@@ -186,9 +181,8 @@ int process_spass_operand(line_info line, long *curr_ic, long *ic, char *operand
 	addressing_type addr1 = get_addressing_type(operand1);
 	addressing_type addr2 = NONE_ADDR;
 
-        printf("process_spass_operand  1 ic %d addr1 %d \n", *curr_ic, addr1);
-
-         printf("process_spass_operand op2 = %s\n", operand2);
+        TRACE(TRACE_PASS2, "operands at ic %ld: %s (addressing %d), %s", *curr_ic, operand1, addr1,
+              operand2 != NULL ? operand2 : "-");
 	
         if(operand2 != NULL){
 		addr2 = get_addressing_type(operand2);
@@ -198,21 +192,17 @@ int process_spass_operand(line_info line, long *curr_ic, long *ic, char *operand
 	if (addr1 == REGISTER_INDIRECT_ADDR || addr1 == REGISTER_ADDR){
             (*curr_ic)++;
             if (addr2 != NONE_ADDR && (addr2 == REGISTER_INDIRECT_ADDR || addr2 == REGISTER_ADDR)) { 
-                 printf("process_spass_operand 2 (2 registers) ic %d addr2 %d \n", *ic, addr2);
-
-		  printf("process_spass_operand ic at end = %d\n", *curr_ic); 
                  return TRUE;
             } 
            
         }
-	printf("process_spass_operand addr2 = %d\n", addr2);
         if (addr1 == IMMEDIATE_ADDR ) (*curr_ic)++;
         if (addr1 == DIRECT_ADDR  ) {
               (*curr_ic)++;
              process_direct_operand(line, *curr_ic, operand1, code_img, symbol_table);
         }
 
-        if (operand2 == NULL){ printf("process_spass_operand ic at end = %d\n", *curr_ic); return TRUE;}
+        if (operand2 == NULL) return TRUE;
 
        if (addr2 == REGISTER_INDIRECT_ADDR || addr2 == REGISTER_ADDR || addr2 == IMMEDIATE_ADDR){
             (*curr_ic)++;
@@ -223,7 +213,6 @@ int process_spass_operand(line_info line, long *curr_ic, long *ic, char *operand
               (*curr_ic)++;
              process_direct_operand(line, *curr_ic ,  operand2, code_img, symbol_table);
         }
-        printf("process_spass_operand ic at end = %d\n", *curr_ic);
         return TRUE;
 }
 
@@ -242,7 +231,6 @@ int process_spass_operand(line_info line, long *curr_ic, long *ic, char *operand
  */
 
 bool process_direct_operand(line_info line, long curr_ic, char *operand, machine_word **code_img, table *symbol_table) {        
-        printf("process_direct_operand started for ic %d\n", curr_ic);
 
 	machine_word *word_to_write;
 
@@ -254,25 +242,23 @@ bool process_direct_operand(line_info line, long curr_ic, char *operand, machine
 			printf_line_error(line, "The symbol %s not found", operand);
 			return FALSE;
 		} 
-                printf("process_direct_operand found entry\n");
 
 		data_to_add = entry->value;
 
 		if (entry->type == EXTERNAL_SYMBOL) {
-			add_table_item(symbol_table, operand, (curr_ic)+1 , EXTERNAL_REFERENCE);
+			add_table_item(symbol_table, operand, curr_ic, EXTERNAL_REFERENCE);
+			STATS_ADD(COUNTER_EXTERN_REFERENCES, 1);
 		}
-                printf("process_direct_operand added table item \n");
 
-		word_to_write = (machine_word *) malloc_with_check(sizeof(machine_word));
+		word_to_write = (machine_word *) assembly_alloc(sizeof(machine_word));
 		word_to_write->length = 0;
 		word_to_write->word.data = build_data_word_direct(data_to_add, entry->type == EXTERNAL_SYMBOL);
                 
-		printf("process_direct_operand saved word data\n");
+		TRACE(TRACE_PASS2, "direct operand %s resolved to %ld at ic %ld", operand, data_to_add, curr_ic);
 		code_img[curr_ic - IC_INIT_VALUE] = word_to_write;
 
                 		
 	}
-	printf("process_spass_operand ic at end = %d\n", curr_ic);
 	return TRUE;
 }
 
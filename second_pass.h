@@ -24,6 +24,17 @@ bool process_line_spass(line_info line, long *ic, machine_word **code_img, table
  */
 bool add_symbols_to_code(line_info line, long *ic, machine_word **code_img, table *symbol_table);
 
+/**
+ * Writes the word of a direct operand, and records the reference if the symbol is external.
+ * @param line The source code line
+ * @param curr_ic The address of the operand word
+ * @param operand The symbol name
+ * @param code_img The code image
+ * @param symbol_table The symbol table
+ * @return Whether the symbol was found
+ */
+bool process_direct_operand(line_info line, long curr_ic, char *operand, machine_word **code_img, table *symbol_table);
+
 #endif
 
 
@@ -0,0 +1,422 @@
+/**
+ * File: server.c
+ *
+ * Description:
+ *  This file contains the assembler daemon declared in server.h. The listening thread accepts connections and hands
+ *  each to a detached thread, which reads requests through a small buffer, assembles them with their own arena
+ *  and a diagnostic sink that gathers the messages as text, and writes back one frame per request. Everything
+ *  shared between the threads (the options, the macro library, the output tables, the pool of arena blocks) is
+ *  either read-only once serving starts or locked, so nothing is set up again per request.
+ *
+ * Functions:
+ *  serve(): Runs the daemon.
+ *  handle_connection(): Answers the requests of one connection.
+ *  read_request(): Reads one request.
+ *  answer_request(): Assembles one request and writes the frame back.
+ *  apply_request_options(): Applies the options of a request.
+ *  fill_reader() / read_request_line() / read_request_bytes(): Buffered reading from a connection.
+ *  remove_socket(): Removes the socket when the daemon is interrupted or terminated.
+ *  clear_socket_path(): Removes a stale socket left at the path of the daemon's socket.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "utils.h"
+#include "arena.h"
+#include "macr.h"
+#include "process_file.h"
+#include "writefiles.h"
+
+#define READ_BUFFER_SIZE 65536
+
+/* Longest header line of a request, and longest name or options section */
+#define MAX_REQUEST_LINE 64
+#define MAX_REQUEST_FIELD 4096
+
+/* The name used in diagnostics when a request does not give one */
+#define DEFAULT_REQUEST_NAME "<request>"
+
+/* How long to wait before accepting again when the process is out of descriptors or memory */
+#define ACCEPT_BACKOFF_US 100000
+
+/* A connection, and the buffer its requests are read through */
+typedef struct connection {
+	int fd;
+	assembler_options *options;
+	char buffer[READ_BUFFER_SIZE];
+	long start, end;
+} connection;
+
+/* One request as read from a connection */
+typedef struct request {
+	char name[MAX_REQUEST_FIELD + 1];
+	char options[MAX_REQUEST_FIELD + 1];
+	source_buffer source;
+} request;
+
+/* The path removed by remove_socket */
+static char *served_path = NULL;
+
+
+/**
+ * Reads more bytes from a connection into its buffer, which must be empty.
+ *
+ * @param conn The connection.
+ *
+ * @return TRUE if bytes were read, FALSE at the end of the connection or on an error.
+ */
+
+static bool fill_reader(connection *conn) {
+	long count = read(conn->fd, conn->buffer, READ_BUFFER_SIZE);
+
+	if (count <= 0) return FALSE;
+	conn->start = 0;
+	conn->end = count;
+	return TRUE;
+}
+
+
+/**
+ * Reads one line from a connection, without its newline.
+ *
+ * @param conn The connection.
+ * @param line Receives the line, NUL-terminated.
+ * @param size The size of line.
+ *
+ * @return TRUE if a line was read, FALSE at the end of the connection, on an error or if the line is too long.
+ */
+
+static bool read_request_line(connection *conn, char *line, int size) {
+	int length = 0;
+	char c;
+
+	while (TRUE) {
+		if (conn->start == conn->end && !fill_reader(conn)) return FALSE;
+		c = conn->buffer[conn->start++];
+		if (c == '\n') break;
+		if (length == size - 1) return FALSE;
+		line[length++] = c;
+	}
+	line[length] = '\0';
+	return TRUE;
+}
+
+
+/**
+ * Reads an exact number of bytes from a connection.
+ *
+ * @param conn The connection.
+ * @param dest Receives the bytes.
+ * @param length The number of bytes to read.
+ *
+ * @return TRUE if all bytes were read, FALSE at the end of the connection or on an error.
+ */
+
+static bool read_request_bytes(connection *conn, char *dest, long length) {
+	long count;
+
+	while (length > 0) {
+		if (conn->start == conn->end && !fill_reader(conn)) return FALSE;
+		count = conn->end - conn->start < length ? conn->end - conn->start : length;
+		memcpy(dest, conn->buffer + conn->start, count);
+		conn->start += count;
+		dest += count;
+		length -= count;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Reads one request from a connection. The source is read into the heap.
+ *
+ * @param conn The connection.
+ * @param req Receives the request; release its source with source_close when TRUE is returned.
+ *
+ * @return TRUE if a well-formed request was read, FALSE at the end of the connection or on a malformed request.
+ */
+
+static bool read_request(connection *conn, request *req) {
+	char line[MAX_REQUEST_LINE], section[MAX_REQUEST_LINE], newline;
+	char *dest;
+	long length;
+
+	strcpy(req->name, DEFAULT_REQUEST_NAME);
+	req->options[0] = '\0';
+	req->source.data = NULL;
+	req->source.length = 0;
+	req->source.mapped_length = 0;
+
+	if (!read_request_line(conn, line, sizeof(line)) || strcmp(line, "ASM-REQUEST 1") != 0) return FALSE;
+
+	while (read_request_line(conn, line, sizeof(line))) {
+		if (strcmp(line, "end") == 0) {
+			if (req->source.data != NULL) return TRUE;
+			break;
+		}
+		if (sscanf(line, "%63s %ld", section, &length) != 2 || length < 0) break;
+
+		if (strcmp(section, "name") == 0 && length <= MAX_REQUEST_FIELD) {
+			dest = req->name;
+		} else if (strcmp(section, "options") == 0 && length <= MAX_REQUEST_FIELD) {
+			dest = req->options;
+		} else if (strcmp(section, "source") == 0 && length <= MAX_REQUEST_SOURCE && req->source.data == NULL) {
+			dest = req->source.data = malloc_with_check(length + 1);
+		} else {
+			break;
+		}
+
+		if (!read_request_bytes(conn, dest, length) ||
+		    !read_request_bytes(conn, &newline, 1) || newline != '\n') {
+			break;
+		}
+		dest[length] = '\0';
+		if (dest == req->source.data) req->source.length = length;
+	}
+
+	source_close(&req->source);
+	return FALSE;
+}
+
+
+/**
+ * Applies the options of a request on top of the daemon's options.
+ *
+ * @param text The options, separated by spaces.
+ * @param options The options to update.
+ *
+ * @return TRUE if every option was recognized, FALSE otherwise.
+ */
+
+static bool apply_request_options(char *text, assembler_options *options) {
+	char *option, *rest;
+
+	for (option = strtok_r(text, " ", &rest); option != NULL; option = strtok_r(NULL, " ", &rest)) {
+		if (strcmp(option, "line-limit=error") == 0) {
+			options->line_limit = LINE_LIMIT_ERROR;
+		} else if (strcmp(option, "line-limit=warn") == 0) {
+			options->line_limit = LINE_LIMIT_WARN;
+		} else if (strcmp(option, "line-limit=off") == 0) {
+			options->line_limit = LINE_LIMIT_OFF;
+		} else if (strcmp(option, "obb") == 0) {
+			options->write_binary_object = TRUE;
+		} else {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+
+/**
+ * Assembles one request and writes the frame back, with the request's arena selected as the current arena.
+ *
+ * @param conn The connection.
+ * @param req The request; its source is released.
+ *
+ * @return TRUE if the frame was written, FALSE otherwise.
+ */
+
+static bool answer_request(connection *conn, request *req) {
+	assembler_options options = *conn->options;
+	source_buffer expanded;
+	assembly_image image;
+	diagnostic_text diagnostics;
+	diagnostic_sink *previous_sink;
+	arena request_arena;
+	arena *previous_arena;
+	bool is_success;
+	char *frame;
+	long length;
+
+	arena_init(&request_arena);
+	previous_arena = arena_select(&request_arena);
+	diagnostic_text_init(&diagnostics);
+	previous_sink = set_diagnostic_sink(&diagnostics.sink);
+
+	if (apply_request_options(req->options, &options)) {
+		is_success = expand_macros(&req->source, req->name, &expanded);
+		is_success = is_success && assemble_source(&expanded, req->name, &options, &image);
+		source_close(&expanded);
+	} else {
+		length = snprintf(NULL, 0, "Error: unknown option in request %s\n", req->name);
+		diagnostics.text = realloc_with_check(diagnostics.text, length + 1);
+		diagnostics.length = sprintf(diagnostics.text, "Error: unknown option in request %s\n", req->name);
+		is_success = FALSE;
+	}
+	source_close(&req->source);
+
+	if (is_success) {
+		frame = format_output_frame(image.code_img, image.data_img, image.icf, image.dcf, image.symbol_table, TRUE,
+		                            &options, diagnostics.text, diagnostics.length, &length);
+	} else {
+		frame = format_output_frame(NULL, NULL, 0, 0, NULL, FALSE, &options, diagnostics.text, diagnostics.length,
+		                            &length);
+	}
+	is_success = write_all(conn->fd, frame, length);
+
+	free_with_check(frame);
+	free_with_check(diagnostics.text);
+	set_diagnostic_sink(previous_sink);
+	arena_select(previous_arena);
+	arena_release(&request_arena);
+	return is_success;
+}
+
+
+/**
+ * Answers the requests of one connection until it is closed or a request is malformed, then closes it.
+ *
+ * @param arg The connection, from malloc_with_check; released here.
+ *
+ * @return NULL.
+ */
+
+static void *handle_connection(void *arg) {
+	connection *conn = arg;
+	request *req = malloc_with_check(sizeof(request));
+
+	while (read_request(conn, req) && answer_request(conn, req));
+
+	free_with_check(req);
+	close(conn->fd);
+	free_with_check(conn);
+	return NULL;
+}
+
+
+/**
+ * Removes the socket and exits; installed for SIGINT and SIGTERM.
+ *
+ * @param signal_number The signal received.
+ */
+
+static void remove_socket(int signal_number) {
+	(void) signal_number;
+	if (served_path != NULL) unlink(served_path);
+	_exit(0);
+}
+
+
+/**
+ * Makes the path of the daemon's socket free to bind: a socket left there by a daemon that is gone, which refuses
+ * connections, is removed. Anything else at the path, a file or a daemon still serving, is left alone.
+ *
+ * @param address The address of the socket.
+ *
+ * @return TRUE if nothing is at the path any more, FALSE if the path is in use (the error is printed).
+ */
+
+static bool clear_socket_path(struct sockaddr_un *address) {
+	struct stat status;
+	int probe_fd;
+	bool is_stale;
+
+	if (lstat(address->sun_path, &status) < 0) {
+		if (errno == ENOENT) return TRUE;
+		fprintf(stderr, "Error: can't check %s\n", address->sun_path);
+		return FALSE;
+	}
+	is_stale = FALSE;
+	if (S_ISSOCK(status.st_mode)) {
+		probe_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe_fd >= 0) {
+			is_stale = connect(probe_fd, (struct sockaddr *) address, sizeof(*address)) < 0 && errno == ECONNREFUSED;
+			close(probe_fd);
+		}
+	}
+	if (!is_stale) {
+		fprintf(stderr, "Error: %s is in use.\n", address->sun_path);
+		return FALSE;
+	}
+	unlink(address->sun_path);
+	return TRUE;
+}
+
+
+/**
+ * Listens on a Unix socket and assembles the sources sent to it until the process is interrupted or terminated,
+ * when the socket is removed. A stale socket left at the path is replaced; any other file, or a socket another
+ * daemon still serves, is not.
+ *
+ * @param socket_path The path of the socket.
+ * @param options The default options of every request; a request's options are applied on top of them.
+ *
+ * @return 1 if the socket could not be set up or stopped accepting connections; otherwise it does not return.
+ */
+
+int serve(char *socket_path, assembler_options *options) {
+	int listen_fd, fd;
+	struct sockaddr_un address;
+	connection *conn;
+	pthread_t thread;
+	pthread_attr_t attributes;
+
+	if (strlen(socket_path) >= sizeof(address.sun_path)) {
+		fprintf(stderr, "Error: socket path too long: %s\n", socket_path);
+		return 1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socket_path);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0) {
+		fprintf(stderr, "Error: can't create a socket.\n");
+		return 1;
+	}
+	if (!clear_socket_path(&address)) {
+		close(listen_fd);
+		return 1;
+	}
+	if (bind(listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listen_fd, SOMAXCONN) < 0) {
+		fprintf(stderr, "Error: can't listen on %s\n", socket_path);
+		close(listen_fd);
+		return 1;
+	}
+
+	served_path = socket_path;
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, remove_socket);
+	signal(SIGTERM, remove_socket);
+	prepare_output_tables();
+
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	while (TRUE) {
+		fd = accept(listen_fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR || errno == ECONNABORTED) continue;
+			/* Out of descriptors or memory: wait for connections to close rather than spin */
+			if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+				usleep(ACCEPT_BACKOFF_US);
+				continue;
+			}
+			fprintf(stderr, "Error: can't accept connections on %s\n", socket_path);
+			close(listen_fd);
+			unlink(socket_path);
+			return 1;
+		}
+
+		conn = malloc_with_check(sizeof(connection));
+		conn->fd = fd;
+		conn->options = options;
+		conn->start = conn->end = 0;
+		if (pthread_create(&thread, &attributes, handle_connection, conn) != 0) {
+			fprintf(stderr, "Error: can't start a thread for a connection.\n");
+			close(fd);
+			free_with_check(conn);
+		}
+	}
+}
@@ -0,0 +1,47 @@
+/**
+ * File: server.h
+ *
+ * Description:
+ *  This header file declares the assembler daemon started by --serve. It listens on a Unix socket and assembles the
+ *  sources sent to it, so that build systems and editors pay for process start-up, the macro library and the
+ *  output tables once rather than for every file. Each connection is handled by a thread of its own and may send
+ *  any number of requests, one after the other:
+ *
+ *   ASM-REQUEST 1
+ *   name <length>          then the name used in diagnostics and a newline (optional)
+ *   options <length>       then options separated by spaces and a newline (optional): line-limit=error|warn|off, obb
+ *   source <length>        then the source and a newline
+ *   end
+ *
+ *  Each request is answered by one frame, as written by format_output_frame, whose diag section holds the errors
+ *  and warnings in the usual "Error In <name>:<line>: <message>" form. A malformed request closes the connection.
+ *
+ * Functions:
+ *  serve(): Runs the daemon.
+ */
+
+#ifndef _SERVER_H
+#define _SERVER_H
+#include "globals.h"
+
+/** Header line of a request */
+#define REQUEST_HEADER "ASM-REQUEST 1\n"
+
+/** Largest source a request may carry */
+#define MAX_REQUEST_SOURCE (64L * 1024 * 1024)
+
+
+/**
+ * Listens on a Unix socket and assembles the sources sent to it until the process is interrupted or terminated,
+ * when the socket is removed. A stale socket left at the path is replaced; any other file, or a socket another
+ * daemon still serves, is not.
+ *
+ * @param socket_path The path of the socket.
+ * @param options The default options of every request; a request's options are applied on top of them.
+ *
+ * @return 1 if the socket could not be set up or stopped accepting connections; otherwise it does not return.
+ */
+
+int serve(char *socket_path, assembler_options *options);
+
+#endif
@@ -0,0 +1,158 @@
+/**
+ * File: source.c
+ *
+ * Description:
+ *  This file contains the functions that bring an assembly input file into memory and split it into lines.
+ *  Regular files are mapped with mmap (a private, copy-on-write mapping, so lines can be terminated in place
+ *  without touching the file on disk). Pipes, empty files and files whose size is an exact multiple of the
+ *  page size (where there is no room for a terminating NUL inside the mapping) are read into the heap instead.
+ *
+ * Functions:
+ *  source_open(): Loads a file by name into a source buffer.
+ *  source_read_fd(): Loads everything readable from an open file descriptor into a source buffer.
+ *  source_next_line(): Returns the next line of a source buffer as a span.
+ *  source_close(): Releases a source buffer.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "source.h"
+#include "stats.h"
+
+#define READ_CHUNK_SIZE 65536
+
+
+/**
+ * Loads a file into a source buffer. Regular files are memory mapped, anything else is read in one go.
+ *
+ * @param filename The name of the file to load.
+ * @param src The source buffer to fill.
+ *
+ * @return TRUE if the file was loaded, FALSE if it could not be opened or read.
+ */
+
+bool source_open(char *filename, source_buffer *src) {
+	int fd;
+	bool result;
+	struct stat file_stat;
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) return FALSE;
+
+	if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size > 0 &&
+	    file_stat.st_size % page_size != 0) {
+		/* The tail of the last page is zero filled, which gives us the terminating NUL for free */
+		void *mapping = mmap(NULL, file_stat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if (mapping != MAP_FAILED) {
+			src->data = mapping;
+			src->length = file_stat.st_size;
+			src->mapped_length = file_stat.st_size;
+			close(fd);
+			return TRUE;
+		}
+	}
+
+	result = source_read_fd(fd, src);
+	close(fd);
+	return result;
+}
+
+
+/**
+ * Loads everything readable from an open file descriptor (e.g. a pipe) into a source buffer.
+ * The descriptor is not closed.
+ *
+ * @param fd The file descriptor to read from.
+ * @param src The source buffer to fill.
+ *
+ * @return TRUE if the input was read, FALSE on a read error.
+ */
+
+bool source_read_fd(int fd, source_buffer *src) {
+	long capacity = READ_CHUNK_SIZE, length = 0, count;
+	struct stat file_stat;
+	char *data;
+
+	if (fstat(fd, &file_stat) == 0 && S_ISREG(file_stat.st_mode) && file_stat.st_size >= capacity) {
+		capacity = file_stat.st_size + 1;
+	}
+	data = malloc_with_check(capacity);
+
+	while ((count = read(fd, data + length, capacity - length - 1)) != 0) {
+		if (count < 0) {
+			free_with_check(data);
+			return FALSE;
+		}
+		length += count;
+		if (capacity - length - 1 == 0) {
+			capacity *= 2;
+			data = realloc_with_check(data, capacity);
+		}
+	}
+	data[length] = '\0';
+
+	src->data = data;
+	src->length = length;
+	src->mapped_length = 0;
+	return TRUE;
+}
+
+
+/**
+ * Returns the next line of a source buffer as a span into the buffer.
+ * The line is NUL-terminated in place (its newline is overwritten), so the span can be used as a string.
+ * Walking the same buffer again from offset 0 yields the same lines.
+ *
+ * @param src The source buffer.
+ * @param offset Position of the next line in the buffer; start at 0. Updated to the line after the returned one.
+ * @param line Receives the line content and length. Other fields are left untouched.
+ *
+ * @return TRUE if a line was returned, FALSE at the end of the buffer.
+ */
+
+bool source_next_line(source_buffer *src, long *offset, line_info *line) {
+	char *start;
+	long length;
+
+	if (*offset >= src->length) return FALSE;
+
+	start = src->data + *offset;
+	/* Stops at the newline on the first walk and at the NUL we left there on later walks */
+	length = strcspn(start, "\n");
+	start[length] = '\0';
+
+	line->content = start;
+	line->length = length;
+	*offset += length + 1;
+	STATS_ADD(COUNTER_BYTES_SCANNED, length + 1);
+	return TRUE;
+}
+
+
+/**
+ * Releases the memory held by a source buffer. Spans into the buffer are invalid afterwards.
+ *
+ * @param src The source buffer to release.
+ */
+
+void source_close(source_buffer *src) {
+	if (src->data == NULL) return;
+
+	if (src->mapped_length > 0) {
+		munmap(src->data, src->mapped_length);
+	} else {
+		free_with_check(src->data);
+	}
+	src->data = NULL;
+	src->length = 0;
+	src->mapped_length = 0;
+}
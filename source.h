@@ -0,0 +1,80 @@
+/**
+ * File: source.h
+ *
+ * Description:
+ *  This header file declares the source buffer used to read assembly input files. A whole file is brought into
+ *  memory at once - as a private memory mapping for regular files, or with large read() calls for pipes - and is
+ *  then walked line by line. Each line is handed out as a span (pointer and length) into the buffer, so no line is
+ *  ever copied.
+ *
+ * Functions:
+ *  source_open(): Loads a file by name into a source buffer.
+ *  source_read_fd(): Loads everything readable from an open file descriptor into a source buffer.
+ *  source_next_line(): Returns the next line of a source buffer as a span.
+ *  source_close(): Releases a source buffer.
+ */
+
+#ifndef _SOURCE_H
+#define _SOURCE_H
+#include "globals.h"
+
+/** A whole input file held in memory */
+typedef struct source_buffer {
+	/** The file contents, always followed by a NUL byte */
+	char *data;
+	/** Number of bytes in data, not counting the trailing NUL */
+	long length;
+	/** Size of the memory mapping, or 0 when data was read into the heap */
+	long mapped_length;
+} source_buffer;
+
+
+/**
+ * Loads a file into a source buffer. Regular files are memory mapped, anything else is read in one go.
+ *
+ * @param filename The name of the file to load.
+ * @param src The source buffer to fill.
+ *
+ * @return TRUE if the file was loaded, FALSE if it could not be opened or read.
+ */
+
+bool source_open(char *filename, source_buffer *src);
+
+
+/**
+ * Loads everything readable from an open file descriptor (e.g. a pipe) into a source buffer.
+ * The descriptor is not closed.
+ *
+ * @param fd The file descriptor to read from.
+ * @param src The source buffer to fill.
+ *
+ * @return TRUE if the input was read, FALSE on a read error.
+ */
+
+bool source_read_fd(int fd, source_buffer *src);
+
+
+/**
+ * Returns the next line of a source buffer as a span into the buffer.
+ * The line is NUL-terminated in place (its newline is overwritten), so the span can be used as a string.
+ * Walking the same buffer again from offset 0 yields the same lines.
+ *
+ * @param src The source buffer.
+ * @param offset Position of the next line in the buffer; start at 0. Updated to the line after the returned one.
+ * @param line Receives the line content and length. Other fields are left untouched.
+ *
+ * @return TRUE if a line was returned, FALSE at the end of the buffer.
+ */
+
+bool source_next_line(source_buffer *src, long *offset, line_info *line);
+
+
+/**
+ * Releases the memory held by a source buffer. Spans into the buffer are invalid afterwards.
+ *
+ * @param src The source buffer to release.
+ */
+
+void source_close(source_buffer *src);
+
+#endif
@@ -0,0 +1,338 @@
+/**
+ * File: srcgen.c
+ *
+ * Description:
+ *  This file contains the generator of synthetic assembly sources described in srcgen.h. A module is written top
+ *  to bottom: a comment, the .extern declarations, the macro definitions, the statement lines (instructions, data,
+ *  macro invocations, comments and blank lines, in the configured shares) and the .entry declarations. The words
+ *  of each statement are counted as it is written, so that the module ends before its images overflow.
+ *
+ * Functions:
+ *  srcgen_defaults(): Fills a configuration with the default shape.
+ *  srcgen_write_module(): Writes one module.
+ *  next_random(), random_unit(), random_below(): The generator's own random numbers (xorshift64*).
+ *  choose_addressing(): Picks an addressing mode an operand accepts, by the configured weights.
+ *  write_operand(): Writes an operand in a given addressing mode.
+ *  write_instruction(): Writes an instruction and counts its words.
+ *  write_data(): Writes a .data or .string line and counts its words.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "srcgen.h"
+#include "utils.h"
+
+#define MODE(mode) (1u << (mode))
+#define ALL_MODES (MODE(SRCGEN_IMMEDIATE) | MODE(SRCGEN_DIRECT) | MODE(SRCGEN_REGISTER_INDIRECT) | \
+                   MODE(SRCGEN_REGISTER))
+#define WRITABLE_MODES (MODE(SRCGEN_DIRECT) | MODE(SRCGEN_REGISTER_INDIRECT) | MODE(SRCGEN_REGISTER))
+#define JUMP_MODES (MODE(SRCGEN_DIRECT) | MODE(SRCGEN_REGISTER_INDIRECT))
+
+/** The most words a statement line takes: a .string of MAX_STRING_LENGTH characters */
+#define MAX_STRING_LENGTH 12
+#define MAX_STATEMENT_WORDS (MAX_STRING_LENGTH + 1)
+#define MAX_DATA_VALUES 6
+#define MAX_MACRO_INSTRUCTIONS 3
+
+/** An instruction the generator writes, with the addressing modes of its operands */
+typedef struct generated_instruction {
+	char *name;
+	int operand_count;
+	/** Masks of MODE() bits; a single operand is the first one */
+	unsigned int first_modes;
+	unsigned int second_modes;
+} generated_instruction;
+
+static generated_instruction instructions[] = {
+		{"mov",  2, ALL_MODES,      WRITABLE_MODES},
+		{"cmp",  2, ALL_MODES,      ALL_MODES},
+		{"add",  2, ALL_MODES,      WRITABLE_MODES},
+		{"sub",  2, ALL_MODES,      WRITABLE_MODES},
+		{"lea",  2, MODE(SRCGEN_DIRECT), WRITABLE_MODES},
+		{"clr",  1, WRITABLE_MODES, 0},
+		{"not",  1, WRITABLE_MODES, 0},
+		{"inc",  1, WRITABLE_MODES, 0},
+		{"dec",  1, WRITABLE_MODES, 0},
+		{"jmp",  1, JUMP_MODES,     0},
+		{"bne",  1, JUMP_MODES,     0},
+		{"jsr",  1, JUMP_MODES,     0},
+		{"red",  1, WRITABLE_MODES, 0},
+		{"prn",  1, ALL_MODES,      0},
+		{"rts",  0, 0,              0},
+		{"stop", 0, 0,              0}
+};
+
+#define INSTRUCTION_COUNT ((long) (sizeof(instructions) / sizeof(instructions[0])))
+
+
+/**
+ * Fills a configuration with the default shape.
+ *
+ * @param config The configuration.
+ */
+
+void srcgen_defaults(srcgen_config *config) {
+	config->module_lines = 100000;
+	config->label_density = 0.3;
+	config->extern_count = 8;
+	config->entry_count = 8;
+	config->macro_count = 4;
+	config->macro_rate = 0.05;
+	config->data_ratio = 0.2;
+	config->string_ratio = 0.3;
+	config->comment_ratio = 0.1;
+	config->addressing_weights[SRCGEN_IMMEDIATE] = 1;
+	config->addressing_weights[SRCGEN_DIRECT] = 1;
+	config->addressing_weights[SRCGEN_REGISTER_INDIRECT] = 1;
+	config->addressing_weights[SRCGEN_REGISTER] = 1;
+	config->seed = 1;
+}
+
+
+/**
+ * Advances the generator's random state (xorshift64*).
+ *
+ * @param config The configuration holding the state.
+ *
+ * @return 64 random bits.
+ */
+
+static uint64_t next_random(srcgen_config *config) {
+	if (config->seed == 0) config->seed = 0x9E3779B97F4A7C15ULL;
+	config->seed ^= config->seed >> 12;
+	config->seed ^= config->seed << 25;
+	config->seed ^= config->seed >> 27;
+	return config->seed * 2685821657736338717ULL;
+}
+
+
+/**
+ * @param config The configuration holding the random state.
+ *
+ * @return A random number in [0, 1).
+ */
+
+static double random_unit(srcgen_config *config) {
+	return (next_random(config) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+/**
+ * @param config The configuration holding the random state.
+ * @param bound The number of possible results; must be positive.
+ *
+ * @return A random number in [0, bound).
+ */
+
+static long random_below(srcgen_config *config, long bound) {
+	return (long) (next_random(config) % (uint64_t) bound);
+}
+
+
+/**
+ * Picks an addressing mode an operand accepts, in proportion to the configured weights. When the weights of all
+ * the accepted modes are zero, the first accepted mode is used.
+ *
+ * @param config The configuration.
+ * @param modes The accepted modes, as MODE() bits.
+ *
+ * @return The mode, one of SRCGEN_IMMEDIATE and friends.
+ */
+
+static int choose_addressing(srcgen_config *config, unsigned int modes) {
+	double total = 0, pick;
+	int mode, first = -1;
+
+	for (mode = 0; mode < 4; mode++) {
+		if (!(modes & MODE(mode))) continue;
+		if (first < 0) first = mode;
+		total += config->addressing_weights[mode];
+	}
+	if (total <= 0) return first;
+
+	pick = random_unit(config) * total;
+	for (mode = 0; mode < 4; mode++) {
+		if (!(modes & MODE(mode))) continue;
+		if (pick < config->addressing_weights[mode]) return mode;
+		pick -= config->addressing_weights[mode];
+	}
+	return first;
+}
+
+
+/**
+ * Writes an operand. A direct operand names one of the labels defined so far or one of the externals.
+ *
+ * @param out The stream.
+ * @param config The configuration.
+ * @param mode The addressing mode.
+ * @param label_count The labels defined so far, L0 to L<label_count - 1>.
+ */
+
+static void write_operand(FILE *out, srcgen_config *config, int mode, long label_count) {
+	long target;
+
+	switch (mode) {
+		case SRCGEN_IMMEDIATE:
+			fprintf(out, "#%ld", random_below(config, 1001) - 500);
+			break;
+		case SRCGEN_DIRECT:
+			target = random_below(config, label_count + config->extern_count);
+			if (target < label_count) fprintf(out, "L%ld", target);
+			else fprintf(out, "X%ld", target - label_count);
+			break;
+		case SRCGEN_REGISTER_INDIRECT:
+			fprintf(out, "*r%ld", random_below(config, 8));
+			break;
+		default:
+			fprintf(out, "r%ld", random_below(config, 8));
+	}
+}
+
+
+/**
+ * Writes an instruction (without a label) and a newline.
+ *
+ * @param out The stream.
+ * @param config The configuration.
+ * @param label_count The labels defined so far, for direct operands.
+ * @param allow_direct FALSE if no operand may be direct (e.g. in macro bodies, which are expanded anywhere).
+ *
+ * @return The number of words the instruction takes.
+ */
+
+static long write_instruction(FILE *out, srcgen_config *config, long label_count, bool allow_direct) {
+	generated_instruction *instruction;
+	unsigned int first_modes, second_modes;
+	int first, second;
+	bool has_targets = allow_direct && label_count + config->extern_count > 0;
+
+	do {
+		instruction = &instructions[random_below(config, INSTRUCTION_COUNT)];
+		first_modes = instruction->first_modes & (has_targets ? ALL_MODES : ~MODE(SRCGEN_DIRECT));
+		second_modes = instruction->second_modes & (has_targets ? ALL_MODES : ~MODE(SRCGEN_DIRECT));
+	} while ((instruction->operand_count >= 1 && first_modes == 0) ||
+	         (instruction->operand_count == 2 && second_modes == 0));
+
+	fprintf(out, " %s", instruction->name);
+	if (instruction->operand_count == 0) {
+		fputc('\n', out);
+		return 1;
+	}
+
+	first = choose_addressing(config, first_modes);
+	fputc(' ', out);
+	write_operand(out, config, first, label_count);
+	if (instruction->operand_count == 1) {
+		fputc('\n', out);
+		return 2;
+	}
+
+	second = choose_addressing(config, second_modes);
+	fputs(", ", out);
+	write_operand(out, config, second, label_count);
+	fputc('\n', out);
+	/* Two register operands share a word */
+	return (first == SRCGEN_REGISTER || first == SRCGEN_REGISTER_INDIRECT) &&
+	       (second == SRCGEN_REGISTER || second == SRCGEN_REGISTER_INDIRECT) ? 2 : 3;
+}
+
+
+/**
+ * Writes a .data or .string directive (without a label) and a newline.
+ *
+ * @param out The stream.
+ * @param config The configuration.
+ *
+ * @return The number of data words the directive takes.
+ */
+
+static long write_data(FILE *out, srcgen_config *config) {
+	long i, count;
+
+	if (random_unit(config) < config->string_ratio) {
+		count = random_below(config, MAX_STRING_LENGTH + 1);
+		fputs(" .string \"", out);
+		for (i = 0; i < count; i++) fputc('a' + (int) random_below(config, 26), out);
+		fputs("\"\n", out);
+		return count + 1;
+	}
+
+	count = 1 + random_below(config, MAX_DATA_VALUES);
+	fputs(" .data ", out);
+	for (i = 0; i < count; i++) fprintf(out, i == 0 ? "%ld" : ", %ld", random_below(config, 2001) - 1000);
+	fputc('\n', out);
+	return count;
+}
+
+
+/**
+ * Writes one module.
+ *
+ * @param out The stream to write the source to.
+ * @param config The shape of the source; its seed advances.
+ * @param max_lines Lines to write at most (the module may end sooner, see module_lines and the word budget).
+ * @param words Receives the number of words the module assembles to.
+ *
+ * @return The number of lines written.
+ */
+
+long srcgen_write_module(FILE *out, srcgen_config *config, long max_lines, long *words) {
+	long lines = 0, code_words = 0, data_words = 0, label_count = 0, statement_lines, i, j, body_length, macro;
+	long *macro_words = malloc_with_check((config->macro_count + 1) * sizeof(long));
+	double pick;
+
+	if (max_lines > config->module_lines) max_lines = config->module_lines;
+
+	fputs("; generated by srcgen\n", out);
+	lines++;
+	for (i = 0; i < config->extern_count; i++, lines++) fprintf(out, ".extern X%ld\n", i);
+
+	for (i = 0; i < config->macro_count; i++) {
+		fprintf(out, "macr mac%ld\n", i);
+		body_length = 1 + random_below(config, MAX_MACRO_INSTRUCTIONS);
+		macro_words[i] = 0;
+		for (j = 0; j < body_length; j++) {
+			macro_words[i] += write_instruction(out, config, 0, FALSE);
+		}
+		fputs("endmacr\n", out);
+		lines += body_length + 2;
+	}
+
+	statement_lines = max_lines - lines - config->entry_count;
+	for (i = 0; i < statement_lines || label_count == 0; i++, lines++) {
+		pick = random_unit(config);
+		if (pick < config->comment_ratio) {
+			fputs(random_below(config, 2) ? "; comment\n" : "\n", out);
+			continue;
+		}
+		if (code_words + MAX_STATEMENT_WORDS > SRCGEN_WORD_BUDGET ||
+		    data_words + MAX_STATEMENT_WORDS > SRCGEN_WORD_BUDGET) {
+			break;
+		}
+
+		pick = random_unit(config);
+		if (config->macro_count > 0 && pick < config->macro_rate) {
+			macro = random_below(config, config->macro_count);
+			fprintf(out, " mac%ld\n", macro);
+			code_words += macro_words[macro];
+			continue;
+		}
+
+		/* The first statement always defines a label, so that direct operands have a target */
+		if (label_count == 0 || random_unit(config) < config->label_density) fprintf(out, "L%ld:", label_count++);
+		if (pick < config->macro_rate + config->data_ratio) data_words += write_data(out, config);
+		else code_words += write_instruction(out, config, label_count, TRUE);
+	}
+
+	for (i = 0; i < config->entry_count && i < label_count; i++, lines++) {
+		fprintf(out, ".entry L%ld\n", i * label_count / (config->entry_count < label_count ? config->entry_count :
+		                                                  label_count));
+	}
+
+	free_with_check(macro_words);
+	*words = code_words + data_words;
+	return lines;
+}
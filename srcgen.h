@@ -0,0 +1,83 @@
+/**
+ * File: srcgen.h
+ *
+ * Description:
+ *  This header file declares the generator of synthetic assembly sources used by the benchmark driver (asmbench).
+ *  A generated source is valid: every label is defined once, every direct operand names a label of the same source
+ *  or one of its externals, every .entry names a label, and every operand uses an addressing mode its instruction
+ *  accepts. Its shape is tunable: label density, external and entry counts, macro definitions and how often they
+ *  are invoked, the share of .data and .string lines and the mix of addressing modes.
+ *
+ *  The code and data images of a source are limited to CODE_ARR_IMG_LENGTH words, so a large program is generated
+ *  as several modules (files), each stopping short of the limit. The .extern and .entry declarations and the macro
+ *  definitions use no words, so their counts per module are not limited; raising them is how the symbol table and
+ *  the macro table are made to grow within a file.
+ *
+ * Functions:
+ *  srcgen_defaults(): Fills a configuration with the default shape.
+ *  srcgen_write_module(): Writes one module.
+ */
+
+#ifndef _SRCGEN_H
+#define _SRCGEN_H
+#include <stdio.h>
+#include <stdint.h>
+#include "globals.h"
+
+/** Words a module's code or data image may use; the rest of the image is left as a margin */
+#define SRCGEN_WORD_BUDGET (CODE_ARR_IMG_LENGTH - 100)
+
+/** Indexes of srcgen_config.addressing_weights */
+#define SRCGEN_IMMEDIATE 0
+#define SRCGEN_DIRECT 1
+#define SRCGEN_REGISTER_INDIRECT 2
+#define SRCGEN_REGISTER 3
+
+/** The shape of the generated sources */
+typedef struct srcgen_config {
+	/** Lines of a module at most; a module also ends when its images are nearly full */
+	long module_lines;
+	/** Share of instruction and data lines that define a label */
+	double label_density;
+	/** .extern and .entry declarations per module (the entries are capped by the labels defined) */
+	long extern_count;
+	long entry_count;
+	/** Macros defined per module, and the share of statement lines that invoke one */
+	long macro_count;
+	double macro_rate;
+	/** Share of statement lines that are .data or .string, and the share of those that are .string */
+	double data_ratio;
+	double string_ratio;
+	/** Share of lines that are comments or blank */
+	double comment_ratio;
+	/** Relative weights of the addressing modes, indexed by SRCGEN_IMMEDIATE and friends */
+	double addressing_weights[4];
+	/** State of the random generator; the same seed gives the same sources */
+	uint64_t seed;
+} srcgen_config;
+
+
+/**
+ * Fills a configuration with the default shape: labels on 30% of the lines, 8 externals and entries, 4 macros
+ * invoked by 5% of the lines, 20% data lines of which 30% strings, 10% comments, and an even addressing mix.
+ *
+ * @param config The configuration.
+ */
+
+void srcgen_defaults(srcgen_config *config);
+
+
+/**
+ * Writes one module.
+ *
+ * @param out The stream to write the source to.
+ * @param config The shape of the source; its seed advances.
+ * @param max_lines Lines to write at most (the module may end sooner, see module_lines and the word budget).
+ * @param words Receives the number of words the module assembles to.
+ *
+ * @return The number of lines written.
+ */
+
+long srcgen_write_module(FILE *out, srcgen_config *config, long max_lines, long *words);
+
+#endif
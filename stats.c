@@ -0,0 +1,204 @@
+/**
+ * File: stats.c
+ *
+ * Description:
+ *  This file contains the phase timers and counters behind the --stats report. Wall time is measured with the
+ *  monotonic clock and CPU time with the calling thread's CPU clock, so a phase is charged only for the work of the
+ *  thread that ran it. Every figure is thread-local, so a phase is begun and ended on one thread and a counter is
+ *  never incremented by two at once. The phase marks double as span marks for --trace-out.
+ *
+ * Functions:
+ *  stats_phase_begin() / stats_phase_end(): Time one run of a phase.
+ *  stats_print(): Prints the statistics as a human-readable table.
+ *  stats_print_json(): Prints the statistics as a JSON object.
+ *  stats_phase_name() / stats_phase_wall_ms(): The name and accumulated wall time of a phase.
+ *  stats_take_thread() / stats_add_thread(): Move the figures of one thread to another.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+#include "traceevents.h"
+#include "allocstats.h"
+
+bool stats_enabled = FALSE;
+
+__thread long stats_counters[COUNTER_COUNT];
+
+/* Accumulated time per phase, in nanoseconds, and the start of the current run of each phase, on this thread */
+static __thread long long phase_wall_ns[PHASE_COUNT];
+static __thread long long phase_cpu_ns[PHASE_COUNT];
+static __thread long long phase_wall_start[PHASE_COUNT];
+static __thread long long phase_cpu_start[PHASE_COUNT];
+
+static char *phase_names[PHASE_COUNT] = {"macro", "pass1", "relocate", "pass2", "output"};
+
+static char *counter_names[COUNTER_COUNT] = {
+		"lines", "instructions", "words", "symbols", "extern_references",
+		"macro_definitions", "macro_expansions", "symbol_probes", "arena_bytes",
+		"lines_reused", "fixups_reused", "table_steps", "macro_probes", "bytes_scanned"
+};
+
+
+/**
+ * Reads a clock in nanoseconds.
+ *
+ * @param clock_id The clock to read.
+ *
+ * @return The clock value in nanoseconds.
+ */
+
+static long long read_clock_ns(clockid_t clock_id) {
+	struct timespec now;
+	clock_gettime(clock_id, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/**
+ * Marks the start of a phase on the calling thread, which must also be the one to end it. Records a trace event span if --trace-out is on; the timing does nothing
+ * unless stats_enabled is set.
+ *
+ * @param which The phase that starts.
+ */
+
+void stats_phase_begin(phase which) {
+	trace_event_begin(phase_names[which], NULL);
+	if (!stats_enabled) return;
+
+	phase_wall_start[which] = read_clock_ns(CLOCK_MONOTONIC);
+	phase_cpu_start[which] = read_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+
+/**
+ * Marks the end of a phase and adds the time since stats_phase_begin to its totals.
+ * Ends the trace event span if --trace-out is on; the timing does nothing unless stats_enabled is set.
+ *
+ * @param which The phase that ends.
+ */
+
+void stats_phase_end(phase which) {
+	if (stats_enabled) {
+		phase_wall_ns[which] += read_clock_ns(CLOCK_MONOTONIC) - phase_wall_start[which];
+		phase_cpu_ns[which] += read_clock_ns(CLOCK_THREAD_CPUTIME_ID) - phase_cpu_start[which];
+	}
+	trace_event_end(phase_names[which]);
+}
+
+
+/**
+ * Prints the phase times and counters as a human-readable table.
+ *
+ * @param out The stream to print to.
+ */
+
+void stats_print(FILE *out) {
+	int i;
+	long long total_wall = 0, total_cpu = 0;
+
+	fprintf(out, "%-20s %12s %12s\n", "phase", "wall ms", "cpu ms");
+	for (i = 0; i < PHASE_COUNT; i++) {
+		fprintf(out, "%-20s %12.3f %12.3f\n", phase_names[i], phase_wall_ns[i] / 1e6, phase_cpu_ns[i] / 1e6);
+		total_wall += phase_wall_ns[i];
+		total_cpu += phase_cpu_ns[i];
+	}
+	fprintf(out, "%-20s %12.3f %12.3f\n\n", "total", total_wall / 1e6, total_cpu / 1e6);
+
+	fprintf(out, "%-20s %12s\n", "counter", "value");
+	for (i = 0; i < COUNTER_COUNT; i++) {
+		fprintf(out, "%-20s %12ld\n", counter_names[i], stats_counters[i]);
+	}
+	alloc_stats_print(out);
+}
+
+
+/**
+ * Prints the phase times and counters as a single JSON object.
+ *
+ * @param out The stream to print to.
+ */
+
+void stats_print_json(FILE *out) {
+	int i;
+
+	fprintf(out, "{\"phases\": {");
+	for (i = 0; i < PHASE_COUNT; i++) {
+		fprintf(out, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", i ? ", " : "", phase_names[i],
+		        phase_wall_ns[i] / 1e6, phase_cpu_ns[i] / 1e6);
+	}
+	fprintf(out, "}, \"counters\": {");
+	for (i = 0; i < COUNTER_COUNT; i++) {
+		fprintf(out, "%s\"%s\": %ld", i ? ", " : "", counter_names[i], stats_counters[i]);
+	}
+	fprintf(out, "}, \"memory\": ");
+	alloc_stats_print_json(out);
+	fprintf(out, "}\n");
+}
+
+
+/**
+ * Returns the name of a phase, as used in the reports.
+ *
+ * @param which The phase.
+ *
+ * @return The name.
+ */
+
+char *stats_phase_name(phase which) {
+	return phase_names[which];
+}
+
+
+/**
+ * Returns the wall time accumulated by a phase so far; callers timing a run take the difference.
+ *
+ * @param which The phase.
+ *
+ * @return The wall time in milliseconds.
+ */
+
+double stats_phase_wall_ms(phase which) {
+	return phase_wall_ns[which] / 1e6;
+}
+
+
+/**
+ * Adds the counters and phase totals of the calling thread to totals and clears them, for a thread that is about
+ * to end. Calls into the same totals from different threads must be serialized by the caller.
+ *
+ * @param totals The figures to add to.
+ */
+
+void stats_take_thread(stats_totals *totals) {
+	int i;
+
+	for (i = 0; i < COUNTER_COUNT; i++) totals->counters[i] += stats_counters[i];
+	for (i = 0; i < PHASE_COUNT; i++) {
+		totals->wall_ns[i] += phase_wall_ns[i];
+		totals->cpu_ns[i] += phase_cpu_ns[i];
+	}
+	memset(stats_counters, 0, sizeof(stats_counters));
+	memset(phase_wall_ns, 0, sizeof(phase_wall_ns));
+	memset(phase_cpu_ns, 0, sizeof(phase_cpu_ns));
+}
+
+
+/**
+ * Adds figures taken from other threads to the counters and phase totals of the calling thread.
+ *
+ * @param totals The figures.
+ */
+
+void stats_add_thread(const stats_totals *totals) {
+	int i;
+
+	for (i = 0; i < COUNTER_COUNT; i++) stats_counters[i] += totals->counters[i];
+	for (i = 0; i < PHASE_COUNT; i++) {
+		phase_wall_ns[i] += totals->wall_ns[i];
+		phase_cpu_ns[i] += totals->cpu_ns[i];
+	}
+}
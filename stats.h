@@ -0,0 +1,152 @@
+/**
+ * File: stats.h
+ *
+ * Description:
+ *  This header file declares the statistics collected for the --stats report: wall and CPU time spent in each
+ *  phase of the assembler, summed over all processed files, and a set of work counters. Counting is a plain
+ *  increment, so the counters are always collected; timing is only taken when stats_enabled is set.
+ *
+ *  The counters and the phase totals belong to the thread that collects them, so threads never share them. A
+ *  thread whose figures belong in the report hands them over with stats_take_thread, and the reporting thread adds
+ *  them to its own with stats_add_thread.
+ *
+ * Functions:
+ *  stats_phase_begin() / stats_phase_end(): Time one run of a phase.
+ *  stats_print(): Prints the statistics as a human-readable table.
+ *  stats_print_json(): Prints the statistics as a JSON object.
+ *  stats_phase_name() / stats_phase_wall_ms(): The name and accumulated wall time of a phase.
+ *  stats_take_thread() / stats_add_thread(): Move the figures of one thread to another.
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+#include <stdio.h>
+#include "globals.h"
+
+/** The timed phases of assembling a file */
+typedef enum phases {
+	PHASE_MACRO,
+	PHASE_PASS1,
+	PHASE_RELOCATE,
+	PHASE_PASS2,
+	PHASE_OUTPUT,
+	PHASE_COUNT
+} phase;
+
+/** The work counters */
+typedef enum counters {
+	COUNTER_LINES,
+	COUNTER_INSTRUCTIONS,
+	COUNTER_WORDS,
+	COUNTER_SYMBOLS,
+	COUNTER_EXTERN_REFERENCES,
+	COUNTER_MACRO_DEFINITIONS,
+	COUNTER_MACRO_EXPANSIONS,
+	COUNTER_SYMBOL_PROBES,
+	COUNTER_ARENA_BYTES,
+	COUNTER_LINES_REUSED,
+	COUNTER_FIXUPS_REUSED,
+	/** Entries walked past by the sorted insertion of add_table_item */
+	COUNTER_TABLE_STEPS,
+	/** Nodes visited in the macro table's chains, by add_macro and find_macro */
+	COUNTER_MACRO_PROBES,
+	/** Bytes of source lines handed out by source_next_line */
+	COUNTER_BYTES_SCANNED,
+	COUNTER_COUNT
+} counter;
+
+/** The figures of a thread, as handed from one thread to another */
+typedef struct stats_totals {
+	long counters[COUNTER_COUNT];
+	long long wall_ns[PHASE_COUNT];
+	long long cpu_ns[PHASE_COUNT];
+} stats_totals;
+
+/** Whether phases are being timed */
+extern bool stats_enabled;
+
+/** The counter values of the calling thread */
+extern __thread long stats_counters[COUNTER_COUNT];
+
+/** Adds to a counter */
+#define STATS_ADD(which, amount) (stats_counters[(which)] += (amount))
+
+
+/**
+ * Marks the start of a phase on the calling thread, which must also be the one to end it. Records a trace event span if --trace-out is on; the timing does nothing
+ * unless stats_enabled is set.
+ *
+ * @param which The phase that starts.
+ */
+
+void stats_phase_begin(phase which);
+
+
+/**
+ * Marks the end of a phase and adds the time since stats_phase_begin to its totals.
+ * Ends the trace event span if --trace-out is on; the timing does nothing unless stats_enabled is set.
+ *
+ * @param which The phase that ends.
+ */
+
+void stats_phase_end(phase which);
+
+
+/**
+ * Prints the phase times and counters as a human-readable table.
+ *
+ * @param out The stream to print to.
+ */
+
+void stats_print(FILE *out);
+
+
+/**
+ * Prints the phase times and counters as a single JSON object.
+ *
+ * @param out The stream to print to.
+ */
+
+void stats_print_json(FILE *out);
+
+
+/**
+ * Returns the name of a phase, as used in the reports.
+ *
+ * @param which The phase.
+ *
+ * @return The name.
+ */
+
+char *stats_phase_name(phase which);
+
+
+/**
+ * Returns the wall time accumulated by a phase so far; callers timing a run take the difference.
+ *
+ * @param which The phase.
+ *
+ * @return The wall time in milliseconds.
+ */
+
+double stats_phase_wall_ms(phase which);
+
+/**
+ * Adds the counters and phase totals of the calling thread to totals and clears them, for a thread that is about
+ * to end. Calls into the same totals from different threads must be serialized by the caller.
+ *
+ * @param totals The figures to add to.
+ */
+
+void stats_take_thread(stats_totals *totals);
+
+
+/**
+ * Adds figures taken from other threads to the counters and phase totals of the calling thread.
+ *
+ * @param totals The figures.
+ */
+
+void stats_add_thread(const stats_totals *totals);
+
+#endif
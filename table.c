@@ -3,12 +3,11 @@
  * 
  * Description:
  *  This file contains functions for managing and handling a linked list based table.
- *  * It includes functions to add items to the table, free the table, update values based on type,
+ *  * It includes functions to add items to the table, update values based on type,
  * filter the table by type, and find entries based on types and keys.
  *
  * Functions:
  *  add_table_item(): Adds a new item to the table while maintaining sorted order by value.
- *  free_table(): Frees all memory allocated for the table, including the keys and table entries.
  *  add_value_to_type(): Adds a specified value to all entries of a given type in the table.
  *  filter_table_by_type(): Creates and returns a new table containing only entries of a specific type.
  *  find_by_types(): Searches for a table entry that matches a specified key and is of one of the provided types.
@@ -23,9 +22,13 @@
 #include <stdarg.h>
 #include "table.h"
 #include "utils.h"
+#include "arena.h"
+#include "trace.h"
+#include "stats.h"
 
 /**
  * Adds a new item to the table, maintaining sorted order by value.
+ * The entry and a copy of its key are allocated from the current arena (see arena.h) and are released with it.
  *
  * @param tab Pointer to the head of the table.
  * @param key The key associated with the new item.
@@ -35,15 +38,13 @@
  */
 
 void add_table_item(table *tab, char *key, long value, symbol_type type) {
-	char *temp_key;
 	table prev_entry, curr_entry, new_entry;
-	new_entry = (table) malloc_with_check(sizeof(table_entry));
+	new_entry = (table) assembly_alloc(sizeof(table_entry));
 	
-	temp_key = (char *) malloc_with_check(strlen(key) + 1);
-	strcpy(temp_key, key);
-	new_entry->key = temp_key;
+	new_entry->key = assembly_strdup(key);
 	new_entry->value = value;
 	new_entry->type = type;
+	TRACE(TRACE_SYMTAB, "add %s = %ld (type %d)", key, value, type);
 
 	if ((*tab) == NULL || (*tab)->value > value) {
 		new_entry->next = (*tab);
@@ -54,6 +55,7 @@ void add_table_item(table *tab, char *key, long value, symbol_type type) {
 	curr_entry = (*tab)->next;
 	prev_entry = *tab;
 	while (curr_entry != NULL && curr_entry->value < value) {
+		STATS_ADD(COUNTER_TABLE_STEPS, 1);
 		prev_entry = curr_entry;
 		curr_entry = curr_entry->next;
 	}
@@ -63,23 +65,6 @@ void add_table_item(table *tab, char *key, long value, symbol_type type) {
 }
 
 
-/**
- * Frees all memory allocated for the table, including the keys and table entries.
- *
- * @param tab Pointer to the table to be freed.
- */
-
-void free_table(table tab) {
-	table prev_entry, curr_entry = tab;
-	while (curr_entry != NULL) {
-		prev_entry = curr_entry;
-		curr_entry = curr_entry->next;
-		free(prev_entry->key); 
-		free(prev_entry);
-	}
-}
-
-
 /**
  * Adds a specified value to all entries of a given type in the table.
  *
@@ -94,6 +79,7 @@ void add_value_to_type(table tab, long to_add, symbol_type type) {
 	for (curr_entry = tab; curr_entry != NULL; curr_entry = curr_entry->next) {
 		if (curr_entry->type == type) {
 			curr_entry->value += to_add;
+			TRACE(TRACE_SYMTAB, "relocate %s to %ld", curr_entry->key, curr_entry->value);
 		}
 	}
 }
@@ -110,11 +96,11 @@ void add_value_to_type(table tab, long to_add, symbol_type type) {
 table filter_table_by_type(table tab, symbol_type type) {
 	table new_table = NULL;
 
-	do {
+	for (; tab != NULL; tab = tab->next) {
 		if (tab->type == type) {
 			add_table_item(&new_table, tab->key, tab->value, tab->type);
 		}
-	} while ((tab = tab->next) != NULL);
+	}
 	return new_table; 
 }
 
@@ -141,21 +127,22 @@ table_entry *find_by_types(table tab, char *key, int symbol_count, ...) {
 	va_end(arglist);
 
 	if (tab == NULL) {
-		free(valid_symbol_types);
+		free_with_check(valid_symbol_types);
 		return NULL;
 	}
 	
 	do {
+		STATS_ADD(COUNTER_SYMBOL_PROBES, 1);
 		for (i = 0; i < symbol_count; i++) {
 			if (valid_symbol_types[i] == tab->type && strcmp(key, tab->key) == 0) {
-				free(valid_symbol_types);
+				free_with_check(valid_symbol_types);
 				return tab;
 			}
 		}
 	} while ((tab = tab->next) != NULL);
 
 
-	free(valid_symbol_types);
+	free_with_check(valid_symbol_types);
 	return NULL;
 }
 
@@ -38,6 +38,7 @@ typedef struct entry {
 
 /**
  * Adds a new item to the table, maintaining sorted order by value.
+ * The entry and a copy of its key are allocated from the current arena (see arena.h) and are released with it.
  *
  * @param tab Pointer to the head of the table.
  * @param key The key associated with the new item.
@@ -48,14 +49,6 @@ typedef struct entry {
 
 void add_table_item(table *tab, char *key, long value, symbol_type type);
 
-/**
- * Frees all memory allocated for the table, including the keys and table entries.
- *
- * @param tab Pointer to the table to be freed.
- */
-
-void free_table(table tab);
-
 
 /**
  * Adds a specified value to all entries of a given type in the table.
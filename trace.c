@@ -0,0 +1,88 @@
+/**
+ * File: trace.c
+ *
+ * Description:
+ *  This file contains the runtime side of the trace facility declared in trace.h: the mask of enabled
+ *  categories, parsing of the --trace category list and printing of trace messages.
+ *
+ * Functions:
+ *  trace_enable(): Enables the categories named in a comma separated list.
+ *  trace_printf(): Prints a single trace message.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "trace.h"
+
+#define TRACE_OUTPUT_FILE stderr
+
+unsigned int trace_mask = 0;
+
+struct trace_lookup_item {
+	char *name;
+	trace_category category;
+};
+
+static struct trace_lookup_item trace_lookup_table[] = {
+		{"macro",  TRACE_MACRO},
+		{"pass1",  TRACE_PASS1},
+		{"pass2",  TRACE_PASS2},
+		{"symtab", TRACE_SYMTAB},
+		{"output", TRACE_OUTPUT},
+		{"all",    TRACE_ALL},
+		{NULL, 0}
+};
+
+
+/**
+ * Enables the trace categories named in a comma separated list.
+ *
+ * @param list Category names: macro, pass1, pass2, symtab, output or all.
+ *
+ * @return TRUE if every name was recognized, FALSE otherwise.
+ */
+
+bool trace_enable(char *list) {
+	struct trace_lookup_item *curr_item;
+	long length;
+
+	while (*list) {
+		length = strcspn(list, ",");
+		for (curr_item = trace_lookup_table; curr_item->name != NULL; curr_item++) {
+			if ((long) strlen(curr_item->name) == length && strncmp(curr_item->name, list, length) == 0) break;
+		}
+		if (curr_item->name == NULL) return FALSE;
+
+		trace_mask |= curr_item->category;
+		list += length;
+		if (*list == ',') list++;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Prints a single trace message to stderr, prefixed with its category name.
+ *
+ * @param category The category of the message.
+ * @param format The message format string.
+ * @param ... Additional arguments for the format string.
+ */
+
+void trace_printf(trace_category category, char *format, ...) {
+	struct trace_lookup_item *curr_item;
+	va_list args;
+
+	for (curr_item = trace_lookup_table; curr_item->name != NULL && curr_item->category != category; curr_item++)
+		;
+	fprintf(TRACE_OUTPUT_FILE, "[%s] ", curr_item->name != NULL ? curr_item->name : "trace");
+
+	va_start(args, format);
+	vfprintf(TRACE_OUTPUT_FILE, format, args);
+	va_end(args);
+
+	fprintf(TRACE_OUTPUT_FILE, "\n");
+}
@@ -0,0 +1,64 @@
+/**
+ * File: trace.h
+ *
+ * Description:
+ *  This header file declares the trace facility used for debugging output from the assembler's hot paths.
+ *  Trace messages are grouped into categories (subsystems) which are enabled at runtime with -v (all) or
+ *  --trace=<category>[,<category>...]. Tracing is compiled in only when ASM_TRACE is defined; otherwise TRACE()
+ *  expands to nothing and its arguments are never evaluated, so the default build pays nothing for it.
+ *
+ * Functions:
+ *  trace_enable(): Enables the categories named in a comma separated list.
+ *  trace_printf(): Prints a single trace message (use the TRACE macro instead of calling it directly).
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+#include "globals.h"
+
+/** Trace categories, one bit each */
+typedef enum trace_categories {
+	TRACE_MACRO = 1 << 0,
+	TRACE_PASS1 = 1 << 1,
+	TRACE_PASS2 = 1 << 2,
+	TRACE_SYMTAB = 1 << 3,
+	TRACE_OUTPUT = 1 << 4,
+	TRACE_ALL = (1 << 5) - 1
+} trace_category;
+
+/** The categories currently enabled */
+extern unsigned int trace_mask;
+
+#ifdef ASM_TRACE
+#define TRACE(category, ...) \
+        do { if (trace_mask & (category)) trace_printf((category), __VA_ARGS__); } while (0)
+#define TRACE_COMPILED_IN TRUE
+#else
+#define TRACE(category, ...) \
+        do { } while (0)
+#define TRACE_COMPILED_IN FALSE
+#endif
+
+
+/**
+ * Enables the trace categories named in a comma separated list.
+ *
+ * @param list Category names: macro, pass1, pass2, symtab, output or all.
+ *
+ * @return TRUE if every name was recognized, FALSE otherwise.
+ */
+
+bool trace_enable(char *list);
+
+
+/**
+ * Prints a single trace message to stderr, prefixed with its category name.
+ *
+ * @param category The category of the message.
+ * @param format The message format string.
+ * @param ... Additional arguments for the format string.
+ */
+
+void trace_printf(trace_category category, char *format, ...);
+
+#endif
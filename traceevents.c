@@ -0,0 +1,247 @@
+/**
+ * File: traceevents.c
+ *
+ * Description:
+ *  This file contains the Chrome trace event recorder behind --trace-out. Each thread appends events to a chain of
+ *  fixed size blocks it owns; the first event of a thread registers its buffer on a global list with a
+ *  compare-and-swap, which is the only shared write. Timestamps come from the monotonic clock.
+ *
+ * Functions:
+ *  trace_events_start(): Enables recording and sets time zero.
+ *  trace_event_begin() / trace_event_end(): Record the start and end of a span on the calling thread.
+ *  trace_events_write(): Writes all recorded events to a JSON file.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "utils.h"
+#include "traceevents.h"
+
+#define EVENTS_PER_BLOCK 1024
+
+/* A single begin ('B') or end ('E') event */
+typedef struct trace_event {
+	char type;
+	char *name;
+	char *file_name;
+	/* TRUE on the event that made the copy of file_name, which frees it */
+	bool owns_file_name;
+	long long timestamp_ns;
+} trace_event;
+
+typedef struct event_block {
+	trace_event events[EVENTS_PER_BLOCK];
+	int count;
+	struct event_block *next;
+} event_block;
+
+/* The events of one thread */
+typedef struct thread_events {
+	long thread_id;
+	char *current_file;
+	event_block *first, *last;
+	struct thread_events *next;
+} thread_events;
+
+bool trace_events_enabled = FALSE;
+
+static long long start_ns;
+
+/* All registered thread buffers; only ever pushed to */
+static thread_events *all_threads = NULL;
+
+static __thread thread_events *my_events = NULL;
+
+
+/**
+ * Reads the monotonic clock in nanoseconds.
+ *
+ * @return The clock value in nanoseconds.
+ */
+
+static long long now_ns(void) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+/**
+ * Enables recording and makes the current time the zero of all timestamps.
+ */
+
+void trace_events_start(void) {
+	start_ns = now_ns();
+	trace_events_enabled = TRUE;
+}
+
+
+/**
+ * Returns the calling thread's buffer, creating and registering it on first use.
+ *
+ * @return The calling thread's buffer.
+ */
+
+static thread_events *get_thread_events(void) {
+	thread_events *events = my_events;
+
+	if (events != NULL) return events;
+
+	events = malloc_with_check(sizeof(thread_events));
+	events->thread_id = syscall(SYS_gettid);
+	events->current_file = NULL;
+	events->first = events->last = NULL;
+	events->next = __atomic_load_n(&all_threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&all_threads, &events->next, events, TRUE,
+	                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	my_events = events;
+	return events;
+}
+
+
+/**
+ * Appends an event to the calling thread's buffer.
+ *
+ * @param type 'B' for the start of a span, 'E' for its end.
+ * @param name The name of the span.
+ * @param file_name The file the span works on, or NULL to use the thread's current file.
+ */
+
+static void record_event(char type, char *name, char *file_name) {
+	thread_events *events = get_thread_events();
+	event_block *block = events->last;
+	trace_event *event;
+
+	if (block == NULL || block->count == EVENTS_PER_BLOCK) {
+		block = malloc_with_check(sizeof(event_block));
+		block->count = 0;
+		block->next = NULL;
+		if (events->last == NULL) events->first = block;
+		else events->last->next = block;
+		events->last = block;
+	}
+
+	if (file_name != NULL) {
+		events->current_file = malloc_with_check(strlen(file_name) + 1);
+		strcpy(events->current_file, file_name);
+	}
+
+	event = &block->events[block->count++];
+	event->type = type;
+	event->name = name;
+	event->file_name = events->current_file;
+	event->owns_file_name = file_name != NULL;
+	event->timestamp_ns = now_ns();
+}
+
+
+/**
+ * Records the start of a span on the calling thread. Does nothing unless recording is enabled.
+ *
+ * @param name The name of the span; must stay valid until the events are written.
+ * @param file_name The file the span works on, or NULL to use the file of the enclosing span.
+ */
+
+void trace_event_begin(char *name, char *file_name) {
+	if (trace_events_enabled) record_event('B', name, file_name);
+}
+
+
+/**
+ * Records the end of the innermost open span on the calling thread. Does nothing unless recording is enabled.
+ *
+ * @param name The name of the span, as given to trace_event_begin.
+ */
+
+void trace_event_end(char *name) {
+	if (trace_events_enabled) record_event('E', name, NULL);
+}
+
+
+/**
+ * Writes a string as a JSON string literal, escaping what JSON requires.
+ *
+ * @param file_desc The stream to write to.
+ * @param string The string to write.
+ */
+
+static void write_json_string(FILE *file_desc, char *string) {
+	fputc('"', file_desc);
+	for (; *string; string++) {
+		if (*string == '"' || *string == '\\') fprintf(file_desc, "\\%c", *string);
+		else if ((unsigned char) *string < 0x20) fprintf(file_desc, "\\u%04x", *string);
+		else fputc(*string, file_desc);
+	}
+	fputc('"', file_desc);
+}
+
+
+/**
+ * Writes every recorded event of every thread to a file in the Chrome trace event JSON format and releases them.
+ * Must be called after all recording threads have finished; recording stops.
+ *
+ * @param filename The file to write.
+ *
+ * @return TRUE if the file was written, FALSE otherwise.
+ */
+
+bool trace_events_write(char *filename) {
+	FILE *file_desc;
+	thread_events *events, *next_events;
+	event_block *block, *next_block;
+	trace_event *event;
+	long pid = getpid();
+	bool first = TRUE;
+	int i;
+
+	file_desc = fopen(filename, "w");
+	if (file_desc == NULL) {
+		fprintf(stderr, "Error: can't write trace events to %s\n", filename);
+		return FALSE;
+	}
+
+	fprintf(file_desc, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+	for (events = __atomic_load_n(&all_threads, __ATOMIC_ACQUIRE); events != NULL; events = events->next) {
+		for (block = events->first; block != NULL; block = block->next) {
+			for (i = 0; i < block->count; i++) {
+				event = &block->events[i];
+				fprintf(file_desc, "%s\n{\"name\": ", first ? "" : ",");
+				write_json_string(file_desc, event->name);
+				fprintf(file_desc, ", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %ld, \"tid\": %ld", event->type,
+				        (event->timestamp_ns - start_ns) / 1e3, pid, events->thread_id);
+				if (event->file_name != NULL) {
+					fprintf(file_desc, ", \"args\": {\"file\": ");
+					write_json_string(file_desc, event->file_name);
+					fprintf(file_desc, "}");
+				}
+				fprintf(file_desc, "}");
+				first = FALSE;
+			}
+		}
+	}
+	fprintf(file_desc, "\n]}\n");
+	fclose(file_desc);
+
+	trace_events_enabled = FALSE;
+	for (events = all_threads; events != NULL; events = next_events) {
+		for (block = events->first; block != NULL; block = next_block) {
+			for (i = 0; i < block->count; i++) {
+				if (block->events[i].owns_file_name) free_with_check(block->events[i].file_name);
+			}
+			next_block = block->next;
+			free_with_check(block);
+		}
+		next_events = events->next;
+		free_with_check(events);
+	}
+	all_threads = NULL;
+	my_events = NULL;
+	return TRUE;
+}
@@ -0,0 +1,61 @@
+/**
+ * File: traceevents.h
+ *
+ * Description:
+ *  This header file declares the recorder behind --trace-out, which writes the assembler's phases as Chrome
+ *  trace events (viewable in chrome://tracing or Perfetto). Every thread records into its own buffer, registered
+ *  once with a lock-free push, so recording an event takes no locks and makes no system calls; all buffers are
+ *  written out together when the assembler is done.
+ *
+ * Functions:
+ *  trace_events_start(): Enables recording and sets time zero.
+ *  trace_event_begin() / trace_event_end(): Record the start and end of a span on the calling thread.
+ *  trace_events_write(): Writes all recorded events to a JSON file.
+ */
+
+#ifndef _TRACEEVENTS_H
+#define _TRACEEVENTS_H
+#include "globals.h"
+
+/** Whether events are being recorded */
+extern bool trace_events_enabled;
+
+
+/**
+ * Enables recording and makes the current time the zero of all timestamps.
+ */
+
+void trace_events_start(void);
+
+
+/**
+ * Records the start of a span on the calling thread. Does nothing unless recording is enabled.
+ *
+ * @param name The name of the span; must stay valid until the events are written.
+ * @param file_name The file the span works on, or NULL to use the file of the enclosing span.
+ */
+
+void trace_event_begin(char *name, char *file_name);
+
+
+/**
+ * Records the end of the innermost open span on the calling thread. Does nothing unless recording is enabled.
+ *
+ * @param name The name of the span, as given to trace_event_begin.
+ */
+
+void trace_event_end(char *name);
+
+
+/**
+ * Writes every recorded event of every thread to a file in the Chrome trace event JSON format.
+ * Must be called after all recording threads have finished.
+ *
+ * @param filename The file to write.
+ *
+ * @return TRUE if the file was written, FALSE otherwise.
+ */
+
+bool trace_events_write(char *filename);
+
+#endif
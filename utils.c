@@ -8,13 +8,18 @@
  * - find_label: Extracts a label from a line of code.
  * - find_instruction_by_name: Finds the instruction corresponding to a given name.
  * - is_int: Checks if a string represents an integer.
- * - malloc_with_check: Allocates memory and checks for allocation failure.
+ * - malloc_with_check_at: Allocates memory and checks for allocation failure (accounted with ASM_ALLOC_STATS).
+ * - realloc_with_check_at: Resizes memory from malloc_with_check_at.
+ * - free_with_check: Frees memory from malloc_with_check_at.
  * - is_label: Determines if a line contains a label.
  * - is_valid_label_name: Validates a label name based on specific rules.
  * - is_alphanumeric_str: Checks if a string contains only alphanumeric characters.
  * - is_reserved_word: Determines if a name is a reserved word.
  * - printf_line_error: Prints an error message with file and line information.
- * - free_code_image: Frees allocated memory for a code image.
+ * - printf_line_warning: Prints a warning message with file and line information.
+ * - set_diagnostic_sink: Routes errors and warnings to a sink instead of stderr.
+ * - diagnostic_text_init / gather_diagnostic: A sink that gathers the messages as text.
+ * - warning_count / error_count: Return how many warnings or errors the calling thread has reported.
  * No direct parameters or return values, as this file operates as part of the larger assembler system.
  */
 
@@ -27,9 +32,17 @@
 #include <stdarg.h>
 #include "utils.h"
 #include "code.h" 
+#include "allocstats.h"
 
 #define ERR_OUTPUT_FILE stderr
 
+/* Where printf_line_error and printf_line_warning report to; NULL for ERR_OUTPUT_FILE */
+static __thread diagnostic_sink *current_sink = NULL;
+
+/* Errors and warnings reported on this thread so far, see error_count and warning_count */
+static __thread long errors_reported = 0;
+static __thread long warnings_reported = 0;
+
 
 /**
  * Concatenates two strings and returns the result.
@@ -56,7 +69,7 @@ char *strallocat(char *s0, char* s1) {
  * Extracts a label from a line of code.
  *
  * @param line The line of code containing the label.
- * @param symbol_dest Buffer to store the extracted label.
+ * @param symbol_dest Buffer of at least MAX_LINE_LENGTH characters to store the extracted label.
  *
  * @return TRUE if a label was found, FALSE otherwise.
  */
@@ -68,10 +81,12 @@ bool find_label(line_info line, char *symbol_dest) {
 
 	MOVE_TO_NOT_WHITE(line.content, i)
 
-	for (; line.content[i] && line.content[i] != ':' && line.content[i] != EOF && i <= MAX_LINE_LENGTH; i++, j++) {
+	for (; line.content[i] && line.content[i] != ':' && line.content[i] != EOF && j < MAX_LINE_LENGTH - 1; i++, j++) {
 		symbol_dest[j] = line.content[i];
 	}
 	symbol_dest[j] = '\0'; 
+	/* With --line-limit=off the label may not fit; it is too long anyway, but still has to be found */
+	while (line.content[i] && line.content[i] != ':' && line.content[i] != EOF) i++;
 
 	if (line.content[i] == ':') {
 		if (!is_valid_label_name(symbol_dest)) {
@@ -140,21 +155,104 @@ bool is_int(char *string) {
 }
 
 
+#ifdef ASM_ALLOC_STATS
+/* Put in front of every block when allocations are accounted, keeping the block maximally aligned */
+typedef union alloc_header {
+	struct {
+		long size;
+		int site;
+	} info;
+	long double align;
+} alloc_header;
+#endif
+
+
 /**
- * Allocates memory and checks for allocation failure.
+ * Allocates memory and checks for allocation failure. Use the malloc_with_check macro.
+ * When built with -DASM_ALLOC_STATS the allocation is accounted to the given call site.
  *
  * @param size The size of memory to allocate.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
  *
  * @return Pointer to the allocated memory.
  */
 
-void *malloc_with_check(long size) {
+void *malloc_with_check_at(long size, char *file, int line) {
+#ifdef ASM_ALLOC_STATS
+	alloc_header *header = malloc(sizeof(alloc_header) + size);
+	if (header == NULL) {
+		printf("Error: Fatal: Memory allocation failed.");
+		exit(1);
+	}
+	header->info.size = size;
+	header->info.site = alloc_stats_record_alloc(size, file, line);
+	return header + 1;
+#else
 	void *ptr = malloc(size);
+	(void) file;
+	(void) line;
+	if (ptr == NULL) {
+		printf("Error: Fatal: Memory allocation failed.");
+		exit(1);
+	}
+	return ptr;
+#endif
+}
+
+
+/**
+ * Resizes memory from malloc_with_check and checks for allocation failure. Use the realloc_with_check macro.
+ *
+ * @param ptr The memory to resize (may be NULL).
+ * @param size The new size.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
+ *
+ * @return Pointer to the resized memory.
+ */
+
+void *realloc_with_check_at(void *ptr, long size, char *file, int line) {
+#ifdef ASM_ALLOC_STATS
+	alloc_header *header = ptr == NULL ? NULL : (alloc_header *) ptr - 1;
+	if (header != NULL) alloc_stats_record_free(header->info.size, header->info.site);
+	header = realloc(header, sizeof(alloc_header) + size);
+	if (header == NULL) {
+		printf("Error: Fatal: Memory allocation failed.");
+		exit(1);
+	}
+	header->info.size = size;
+	header->info.site = alloc_stats_record_alloc(size, file, line);
+	return header + 1;
+#else
+	(void) file;
+	(void) line;
+	ptr = realloc(ptr, size);
 	if (ptr == NULL) {
 		printf("Error: Fatal: Memory allocation failed.");
 		exit(1);
 	}
 	return ptr;
+#endif
+}
+
+
+/**
+ * Frees memory from malloc_with_check. All such memory must be released through here.
+ *
+ * @param ptr The memory to free (may be NULL).
+ */
+
+void free_with_check(void *ptr) {
+#ifdef ASM_ALLOC_STATS
+	alloc_header *header;
+	if (ptr == NULL) return;
+	header = (alloc_header *) ptr - 1;
+	alloc_stats_record_free(header->info.size, header->info.site);
+	free(header);
+#else
+	free(ptr);
+#endif
 }
 
 
@@ -191,7 +289,7 @@ bool is_label(const char *line, char *label) {
 
 bool is_valid_label_name(char *name) {
 	
-	return name[0] && strlen(name) <= 31 && isalpha(name[0]) && is_alphanumeric_str(name + 1) &&
+	return name[0] && strlen(name) <= MAX_LABEL_LENGTH && isalpha(name[0]) && is_alphanumeric_str(name + 1) &&
 	       !is_reserved_word(name);
 }
 
@@ -232,6 +330,116 @@ bool is_reserved_word(char *name) {
 }
 
 
+/**
+ * Routes the errors and warnings of the calling thread to a sink.
+ *
+ * @param sink The sink to use, or NULL to print to stderr again.
+ *
+ * @return The previous sink, so that it can be restored.
+ */
+
+diagnostic_sink *set_diagnostic_sink(diagnostic_sink *sink) {
+	diagnostic_sink *previous = current_sink;
+	current_sink = sink;
+	return previous;
+}
+
+
+/**
+ * Appends a reported diagnostic to a diagnostic text.
+ *
+ * @param sink The text's sink.
+ * @param line The line the message is about.
+ * @param is_warning TRUE for a warning, FALSE for an error.
+ * @param message The formatted message.
+ */
+
+static void gather_diagnostic(diagnostic_sink *sink, line_info line, bool is_warning, char *message) {
+	diagnostic_text *diagnostics = (diagnostic_text *) sink;
+	char *kind = is_warning ? "Warning" : "Error";
+	long length = snprintf(NULL, 0, "%s In %s:%ld: %s\n", kind, line.file_name, line.line_number, message);
+
+	if (diagnostics->length + length + 1 > diagnostics->capacity) {
+		while (diagnostics->length + length + 1 > diagnostics->capacity) diagnostics->capacity *= 2;
+		diagnostics->text = realloc_with_check(diagnostics->text, diagnostics->capacity);
+	}
+	sprintf(diagnostics->text + diagnostics->length, "%s In %s:%ld: %s\n", kind, line.file_name, line.line_number,
+	        message);
+	diagnostics->length += length;
+}
+
+
+/**
+ * Prepares an empty diagnostic text, to be passed to set_diagnostic_sink as &diagnostics->sink.
+ *
+ * @param diagnostics The text to prepare.
+ */
+
+void diagnostic_text_init(diagnostic_text *diagnostics) {
+	diagnostics->sink.report = gather_diagnostic;
+	diagnostics->capacity = 256;
+	diagnostics->length = 0;
+	diagnostics->text = malloc_with_check(diagnostics->capacity);
+	diagnostics->text[0] = '\0';
+}
+
+
+/**
+ * Returns how many warnings the calling thread has reported so far.
+ *
+ * @return The number of warnings.
+ */
+
+long warning_count(void) {
+	return warnings_reported;
+}
+
+
+/**
+ * Returns how many errors the calling thread has reported so far.
+ *
+ * @return The number of errors.
+ */
+
+long error_count(void) {
+	return errors_reported;
+}
+
+
+/**
+ * Reports an error or warning with file and line information, to the current sink or to stderr.
+ *
+ * @param line The line info for reporting.
+ * @param is_warning TRUE for a warning, FALSE for an error.
+ * @param message The message format string.
+ * @param args Arguments for the format string.
+ *
+ * @return The number of characters in the message.
+ */
+
+static int report_line(line_info line, bool is_warning, char *message, va_list args) {
+	int result;
+	char *text;
+	va_list args_copy;
+
+	if (current_sink == NULL) {
+		fprintf(ERR_OUTPUT_FILE, "%s In %s:%ld: ", is_warning ? "Warning" : "Error", line.file_name, line.line_number);
+		result = vfprintf(ERR_OUTPUT_FILE, message, args);
+		fprintf(ERR_OUTPUT_FILE, "\n");
+		return result;
+	}
+
+	va_copy(args_copy, args);
+	result = vsnprintf(NULL, 0, message, args_copy);
+	va_end(args_copy);
+	text = malloc_with_check(result + 1);
+	vsnprintf(text, result + 1, message, args);
+	current_sink->report(current_sink, line, is_warning, text);
+	free_with_check(text);
+	return result;
+}
+
+
 /**
  * Prints an error message with file and line information.
  *
@@ -245,40 +453,36 @@ bool is_reserved_word(char *name) {
 int printf_line_error(line_info line, char *message, ...) { 
 	int result;
 	va_list args; 
-	fprintf(ERR_OUTPUT_FILE,"Error In %s:%ld: ", line.file_name, line.line_number);
 
+	errors_reported++;
 	va_start(args, message);
-	result = vfprintf(ERR_OUTPUT_FILE, message, args);
+	result = report_line(line, FALSE, message, args);
 	va_end(args);
-
-	fprintf(ERR_OUTPUT_FILE, "\n");
 	return result;
 }
 
 
 /**
- * @brief Frees allocated memory for a code image.
+ * Prints a warning message with file and line information. Warnings do not fail the assembly.
  *
- * @param code_image Array of pointers to machine_word structures.
- * @param fic Number of elements in the code_image array.
+ * @param line The line info for warning reporting.
+ * @param message The warning message format string.
+ * @param ... Additional arguments for the format string.
+ *
+ * @return The number of characters printed.
  */
 
-void free_code_image(machine_word **code_image, long fic) {
-	long i;
-	
-	for (i = 0; i < fic; i++) {
-		machine_word *curr_word = code_image[i];
-		if (curr_word != NULL) {
-
-			if (curr_word->length > 0) {
-				free(curr_word->word.code);
-			} else {
-				free(curr_word->word.data);
-			}
-
-			free(curr_word);
-			code_image[i] = NULL;
-		}
-	}
+int printf_line_warning(line_info line, char *message, ...) {
+	int result;
+	va_list args;
+
+	warnings_reported++;
+	va_start(args, message);
+	result = report_line(line, TRUE, message, args);
+	va_end(args);
+	return result;
 }
 
+
+
+
@@ -33,7 +33,7 @@ char *strallocat(char *s0, char* s1);
  * @brief Extracts a label from a line of code.
  *
  * @param line The line of code containing the label.
- * @param symbol_dest Buffer to store the extracted label.
+ * @param symbol_dest Buffer of at least MAX_LINE_LENGTH characters to store the extracted label.
  *
  * @return TRUE if a label was found, FALSE otherwise.
  */
@@ -58,13 +58,52 @@ instruction find_instruction_by_name(char *name);
 bool is_int(char* string);
 
 /**
- * @brief Allocates memory and checks for allocation failure.
+ * @macro malloc_with_check
+ * @brief Allocates memory and checks for allocation failure, passing the call site on for allocation accounting.
  *
  * @param size The size of memory to allocate.
+ */
+#define malloc_with_check(size) malloc_with_check_at((size), __FILE__, __LINE__)
+
+/**
+ * @macro realloc_with_check
+ * @brief Resizes memory from malloc_with_check and checks for allocation failure.
+ *
+ * @param ptr The memory to resize.
+ * @param size The new size.
+ */
+#define realloc_with_check(ptr, size) realloc_with_check_at((ptr), (size), __FILE__, __LINE__)
+
+/**
+ * @brief Allocates memory and checks for allocation failure. Use the malloc_with_check macro.
+ * When built with -DASM_ALLOC_STATS the allocation is accounted to the given call site.
+ *
+ * @param size The size of memory to allocate.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
  *
  * @return Pointer to the allocated memory.
  */
-void *malloc_with_check(long size);
+void *malloc_with_check_at(long size, char *file, int line);
+
+/**
+ * @brief Resizes memory from malloc_with_check and checks for allocation failure. Use the realloc_with_check macro.
+ *
+ * @param ptr The memory to resize (may be NULL).
+ * @param size The new size.
+ * @param file The source file of the call site.
+ * @param line The source line of the call site.
+ *
+ * @return Pointer to the resized memory.
+ */
+void *realloc_with_check_at(void *ptr, long size, char *file, int line);
+
+/**
+ * @brief Frees memory from malloc_with_check. All such memory must be released through here.
+ *
+ * @param ptr The memory to free (may be NULL).
+ */
+void free_with_check(void *ptr);
 
 /**
  * @brief Validates a label name based on specific rules.
@@ -80,5 +119,90 @@ bool is_valid_label_name(char* name);
  *
  * @param string The string to check.
  *
- * @return TRUE if the string is alphanumeric, FALSE 
+ * @return TRUE if the string is alphanumeric, FALSE otherwise.
+ */
+bool is_alphanumeric_str(char *string);
+
+/**
+ * @brief Determines if a name is a reserved word (operation, register or instruction name).
+ *
+ * @param name The name to check.
+ *
+ * @return TRUE if the name is a reserved word, FALSE otherwise.
+ */
+bool is_reserved_word(char *name);
+
+/**
+ * @struct diagnostic_sink
+ * @brief Receives the errors and warnings of the calling thread instead of stderr, see set_diagnostic_sink.
+ *        Embed it as the first member of a structure that collects the diagnostics.
+ */
+typedef struct diagnostic_sink {
+	/** Called with the formatted message, without the "Error In file:line: " prefix */
+	void (*report)(struct diagnostic_sink *sink, line_info line, bool is_warning, char *message);
+} diagnostic_sink;
+
+/**
+ * @brief Routes the errors and warnings of the calling thread to a sink.
+ *
+ * @param sink The sink to use, or NULL to print to stderr again.
+ *
+ * @return The previous sink, so that it can be restored.
+ */
+diagnostic_sink *set_diagnostic_sink(diagnostic_sink *sink);
+
+/**
+ * @struct diagnostic_text
+ * @brief A diagnostic sink that appends every message to a text, as printf_line_error would print it.
+ */
+typedef struct diagnostic_text {
+	diagnostic_sink sink;
+	/** The messages, each on a line of its own; owned by the sink, free it with free_with_check */
+	char *text;
+	long length, capacity;
+} diagnostic_text;
+
+/**
+ * @brief Prepares an empty diagnostic text, to be passed to set_diagnostic_sink as &diagnostics->sink.
+ *
+ * @param diagnostics The text to prepare.
+ */
+void diagnostic_text_init(diagnostic_text *diagnostics);
+
+/**
+ * @brief Returns how many warnings the calling thread has reported so far, e.g. to tell whether a file had any.
+ *
+ * @return The number of warnings.
+ */
+long warning_count(void);
+
+/**
+ * @brief Returns how many errors the calling thread has reported so far, including those that do not fail the file.
+ *
+ * @return The number of errors.
+ */
+long error_count(void);
+
+/**
+ * @brief Prints an error message with file and line information.
+ *
+ * @param line The line info for error reporting.
+ * @param message The error message format string.
+ * @param ... Additional arguments for the format string.
+ *
+ * @return The number of characters printed.
+ */
+int printf_line_error(line_info line, char *message, ...);
+
+/**
+ * @brief Prints a warning message with file and line information. Warnings do not fail the assembly.
+ *
+ * @param line The line info for warning reporting.
+ * @param message The warning message format string.
+ * @param ... Additional arguments for the format string.
+ *
+ * @return The number of characters printed.
+ */
+int printf_line_warning(line_info line, char *message, ...);
 
+#endif
@@ -0,0 +1,244 @@
+/**
+ * File: watch.c
+ *
+ * Description:
+ *  This file contains the watch mode started by --watch, described in watch.h. Every directory holding a watched
+ *  file gets an inotify watch for files closed after writing and files renamed into it; the events are matched to
+ *  the watched files by name. After the first event of a burst, events are gathered until none arrives for
+ *  WATCH_DEBOUNCE_MS, then the files that changed are assembled again with process_file.
+ *
+ * Functions:
+ *  watch_files(): Rebuilds the files as they change, until interrupted.
+ *  split_path(): Splits a path into its directory and its name within it.
+ *  read_events(): Marks the watched files named by pending inotify events as changed.
+ *  rebuild(): Assembles the changed files again and prints how long it took.
+ *  request_stop(): Signal handler that ends the watch.
+ *
+ * No direct parameters or return values for the whole file, as it operates as part of the larger assembler system.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "watch.h"
+#include "process_file.h"
+#include "macr.h"
+#include "cache.h"
+#include "utils.h"
+
+/** The events that mean a file has new contents */
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+/** A watched file */
+typedef struct watched_file {
+	/** The base name given on the command line, or the macro library's file name */
+	char *name;
+	/** The directory holding the file, and the file's name within it */
+	char *directory;
+	char *entry_name;
+	int watch_descriptor;
+	bool is_library;
+	bool changed;
+} watched_file;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+
+/**
+ * Signal handler that ends the watch after the current rebuild.
+ *
+ * @param signal_number The signal received.
+ */
+
+static void request_stop(int signal_number) {
+	(void) signal_number;
+	stop_requested = 1;
+}
+
+
+/**
+ * Splits a path into its directory and its name within it.
+ *
+ * @param path The path.
+ * @param file Receives the directory and the name, both from malloc_with_check.
+ */
+
+static void split_path(char *path, watched_file *file) {
+	char *slash = strrchr(path, '/');
+	long length;
+
+	if (slash == NULL) {
+		file->directory = strallocat(".", "");
+		file->entry_name = strallocat(path, "");
+		return;
+	}
+	length = slash == path ? 1 : slash - path;
+	file->directory = malloc_with_check(length + 1);
+	memcpy(file->directory, path, length);
+	file->directory[length] = '\0';
+	file->entry_name = strallocat(slash + 1, "");
+}
+
+
+/**
+ * Reads the pending inotify events and marks the watched files they name as changed.
+ *
+ * @param fd The inotify descriptor, non-blocking.
+ * @param files The watched files.
+ * @param count The number of watched files.
+ *
+ * @return The number of events naming a watched file.
+ */
+
+static int read_events(int fd, watched_file *files, int count) {
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	long length, offset;
+	int i, found = 0;
+
+	while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+		for (offset = 0; offset < length; offset += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *) (buffer + offset);
+			if (event->len == 0) continue;
+			for (i = 0; i < count; i++) {
+				if (files[i].watch_descriptor == event->wd && strcmp(files[i].entry_name, event->name) == 0) {
+					files[i].changed = TRUE;
+					found++;
+				}
+			}
+		}
+	}
+	return found;
+}
+
+
+/**
+ * Assembles again the files that changed, or every file if the macro library changed, and prints how long the
+ * rebuild took.
+ *
+ * @param files The watched files; the macro library, if any, is the last one.
+ * @param count The number of watched files.
+ * @param options The options of every rebuild.
+ */
+
+static void rebuild(watched_file *files, int count, assembler_options *options) {
+	struct timespec start, end;
+	bool rebuild_all = files[count - 1].is_library && files[count - 1].changed;
+	int i, rebuilt = 0, failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (rebuild_all) {
+		unload_macro_library();
+		if (!load_macro_library(options->macro_library_filename) ||
+		    (options->cache_directory != NULL && !cache_open(options))) {
+			printf("Rebuild skipped: the macro library could not be loaded.\n");
+			fflush(stdout);
+			for (i = 0; i < count; i++) files[i].changed = FALSE;
+			return;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		if (!files[i].is_library && (files[i].changed || rebuild_all)) {
+			rebuilt++;
+			if (!process_file(files[i].name, options)) failed++;
+		}
+		files[i].changed = FALSE;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Rebuilt %d file(s) in %.2f ms", rebuilt,
+	       (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6);
+	if (failed > 0) printf(", %d with errors", failed);
+	printf(".\n");
+	fflush(stdout);
+}
+
+
+/**
+ * Watches the .as files of the given base names, and the macro library if any, and assembles a file again when
+ * it changes, until the process is interrupted or terminated.
+ *
+ * @param filenames The base names of the files (without extension), as given on the command line.
+ * @param count The number of files.
+ * @param options The options of every rebuild.
+ *
+ * @return 0 when interrupted, 1 if the watches could not be set up.
+ */
+
+int watch_files(char **filenames, int count, assembler_options *options) {
+	watched_file *files = malloc_with_check((count + 1) * sizeof(watched_file));
+	struct sigaction action;
+	struct pollfd poll_fd;
+	char *source_name;
+	int fd, i, total = count, pending, result = 0;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0) {
+		fprintf(stderr, "Error: can't start watching files: %s\n", strerror(errno));
+		free_with_check(files);
+		return 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		source_name = strallocat(filenames[i], ".as");
+		files[i].name = filenames[i];
+		files[i].is_library = FALSE;
+		split_path(source_name, &files[i]);
+		free_with_check(source_name);
+	}
+	if (options->macro_library_filename != NULL) {
+		files[total].name = options->macro_library_filename;
+		files[total].is_library = TRUE;
+		split_path(options->macro_library_filename, &files[total]);
+		total++;
+	}
+	for (i = 0; i < total; i++) {
+		files[i].changed = FALSE;
+		files[i].watch_descriptor = inotify_add_watch(fd, files[i].directory, WATCH_EVENTS);
+		if (files[i].watch_descriptor < 0) {
+			fprintf(stderr, "Error: can't watch %s: %s\n", files[i].directory, strerror(errno));
+			result = 1;
+		}
+	}
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = request_stop;
+	sigemptyset(&action.sa_mask);
+	/* No SA_RESTART, so that poll returns when interrupted */
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	if (result == 0) {
+		printf("Watching %d file(s) for changes. Press Ctrl-C to stop.\n", count);
+		fflush(stdout);
+	}
+	poll_fd.fd = fd;
+	poll_fd.events = POLLIN;
+	while (result == 0 && !stop_requested) {
+		if (poll(&poll_fd, 1, -1) < 0) {
+			if (errno == EINTR) continue;
+			fprintf(stderr, "Error: watching files failed: %s\n", strerror(errno));
+			result = 1;
+			break;
+		}
+		pending = read_events(fd, files, total);
+		/* Gather the rest of the burst */
+		while (!stop_requested && poll(&poll_fd, 1, WATCH_DEBOUNCE_MS) > 0) pending += read_events(fd, files, total);
+		if (pending > 0 && !stop_requested) rebuild(files, total, options);
+	}
+
+	close(fd);
+	for (i = 0; i < total; i++) {
+		free_with_check(files[i].directory);
+		free_with_check(files[i].entry_name);
+	}
+	free_with_check(files);
+	return result;
+}
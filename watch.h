@@ -0,0 +1,40 @@
+/**
+ * File: watch.h
+ *
+ * Description:
+ *  This header file declares the watch mode started by --watch. After the files named on the command line are
+ *  assembled, the assembler stays running and assembles a file again whenever its .as file is written, and every
+ *  file when the macro library (--macro-lib) is. The process stays warm between rebuilds: the macro library, the
+ *  arena blocks and the cache settings are kept, and --incremental is implied, so that a rebuild only assembles
+ *  again the lines that changed.
+ *
+ *  Changes are noticed with inotify on the directories holding the files, so that editors which save by writing
+ *  a new file and renaming it over the old one are seen too. A burst of events (an editor saving several files,
+ *  or writing one in several steps) is gathered into a single rebuild, which prints the time it took.
+ *
+ * Functions:
+ *  watch_files(): Rebuilds the files as they change, until interrupted.
+ */
+
+#ifndef _WATCH_H
+#define _WATCH_H
+#include "globals.h"
+
+/** How long events must stop before a rebuild starts, in milliseconds */
+#define WATCH_DEBOUNCE_MS 50
+
+
+/**
+ * Watches the .as files of the given base names, and the macro library if any, and assembles a file again when
+ * it changes, until the process is interrupted or terminated.
+ *
+ * @param filenames The base names of the files (without extension), as given on the command line.
+ * @param count The number of files.
+ * @param options The options of every rebuild.
+ *
+ * @return 0 when interrupted, 1 if the watches could not be set up.
+ */
+
+int watch_files(char **filenames, int count, assembler_options *options);
+
+#endif
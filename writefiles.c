@@ -4,9 +4,18 @@
  *  Contains functions for writing output files related to the assembler.
  *
  * Functions:
-*   write_output_files: Writes output files including the object file (.ob), external symbols (.ext), and entry symbols (.ent).
- *  write_ob: Writes the object file (.ob) with the code and data images.
- *  write_table_to_file: Writes a table of symbols to a file with a specified extension.
+*   write_output_files: Writes output files including the object file (.ob), external symbols (.ext), entry symbols (.ent) and relocations (.rel).
+ *  write_output_stream: Writes the same outputs to chosen file descriptors, or as one framed stream to stdout.
+ *  format_output_frame: Formats the outputs and diagnostics of a source as one frame.
+ *  prepare_output_tables: Fills the lookup tables used by the output formatting.
+ *  format_ob: Formats the object file (.ob) with the code and data images.
+ *  format_table: Formats a table of symbols as written to the .ext and .ent files.
+ *  format_relocations: Formats the relocation records (.rel), the addresses of the relocatable words.
+ *  format_obb: Formats the binary object file (.obb), see objfile.h.
+ *  get_word_value: Computes the value written for a single code image word.
+ *  is_relocatable_word: Tells whether a code image word is listed in the relocation records.
+ *  format_octal_word / format_decimal_address: Hand-rolled replacements for the "%.6lo" and "%.7ld" formats.
+ *  write_all / write_buffer_to_file: Write a fully formatted output buffer with a single write().
  *
  * No direct parameters or return values, as this file operates as part of the larger assembler system.
  */
@@ -15,18 +24,67 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include "utils.h"
 #include "table.h"
+#include "objfile.h"
+#include "trace.h"
+#include "writefiles.h"
+#include "cache.h"
 
 #define KEEP_ONLY_15_LSB(value) ((value) & 0x7FFF)
 
-static bool write_ob(machine_word **code_img, long *data_img, long icf, long dcf, char *filename);
+/* Digits in a decimal address, and bytes in one "\naddress value" record of the .ob file */
+#define ADDRESS_DIGITS 7
+#define OB_RECORD_LENGTH (1 + ADDRESS_DIGITS + 1 + 6)
 
-static bool write_table_to_file(table tab, char *filename, char *file_extension);
+/* The first line of a framed output, see format_output_frame */
+#define FRAME_HEADER "ASM-FRAME 1\n"
+
+/* Five octal digits for every 15-bit value, filled on first use */
+static char octal_digits[0x8000][5];
+static bool octal_digits_ready = FALSE;
+
+static void init_octal_digits(void);
+
+static char *format_ob(machine_word **code_img, long *data_img, long icf, long dcf, long *length);
+
+static char *format_table(table tab, long *length);
+
+static char *format_relocations(machine_word **code_img, long icf, long *length);
+
+static char *format_obb(machine_word **code_img, long *data_img, long icf, long dcf, table externals, table entries,
+                        long *length);
+
+static bool write_buffer_to_file(char *filename, char *buffer, long length);
 
 
 /**
- * Writes output files including the object file (.ob), external symbols (.ext), and entry symbols (.ent).
+ * Writes a formatted output buffer to the file named by a base name and an extension, and releases the buffer.
+ *
+ * @param filename Base name for the file.
+ * @param file_extension Extension for the file (e.g., ".ob").
+ * @param buffer The formatted contents, from malloc_with_check.
+ * @param length The number of bytes in the buffer.
+ *
+ * @return TRUE if the file is written successfully, FALSE otherwise.
+ */
+
+static bool write_formatted_file(char *filename, char *file_extension, char *buffer, long length) {
+	bool result;
+	char *full_filename = strallocat(filename, file_extension);
+
+	result = write_buffer_to_file(full_filename, buffer, length);
+	free_with_check(full_filename);
+	free_with_check(buffer);
+	return result;
+}
+
+
+/**
+ * Writes output files including the object file (.ob), external symbols (.ext), entry symbols (.ent) and
+ * relocations (.rel), and the binary object file (.obb) when the options ask for it.
  *
  * @param code_img Array of pointers to machine_word structures representing code image.
  * @param data_img Array of long integers representing data image.
@@ -34,113 +92,430 @@ static bool write_table_to_file(table tab, char *filename, char *file_extension)
  * @param dcf Data counter final value.
  * @param filename Base name for output files.
  * @param symbol_table Table of symbols to be written to .ext and .ent files.
+ * @param options The command line options.
  *
  * @return TRUE if all files are written successfully, FALSE otherwise.
  */
 
 int write_output_files(machine_word **code_img, long *data_img, long icf, long dcf, char *filename,
-                       table symbol_table) {
+                       table symbol_table, assembler_options *options) {
 	int i;
-	printf("Inside write_output_files\n");
-	printf("ICF: %ld, DCF: %ld\n", icf, dcf);
+	bool result, result2;
+	table externals, entries;
+	char *buffer;
+	long length;
+	TRACE(TRACE_OUTPUT, "writing %s: ICF: %ld, DCF: %ld", filename, icf, dcf);
+
+	externals = filter_table_by_type(symbol_table, EXTERNAL_REFERENCE);
+	entries = filter_table_by_type(symbol_table, ENTRY_SYMBOL);
+
+	for (i = 0; i < icf - IC_INIT_VALUE; i++) {
+		if (code_img[i] == NULL) {
+			TRACE(TRACE_OUTPUT, "code_img[%d] is NULL", i);
+		}
+	}
 
-	if (code_img == NULL) {
-		printf("Error: code_img is NULL\n");
+	/* Write .ob file */
+	buffer = format_ob(code_img, data_img, icf, dcf, &length);
+	result = write_formatted_file(filename, ".ob", buffer, length);
+	if (!result) return FALSE;
+
+	buffer = format_table(externals, &length);
+	result2 = write_formatted_file(filename, ".ext", buffer, length);
+	if (result2) {
+		buffer = format_table(entries, &length);
+		result2 = write_formatted_file(filename, ".ent", buffer, length);
 	}
-	if (data_img == NULL) {
-		printf("Error: data_img is NULL\n");
+	if (result2) {
+		buffer = format_relocations(code_img, icf, &length);
+		result2 = write_formatted_file(filename, ".rel", buffer, length);
 	}
-	if (symbol_table == NULL) {
-		printf("Error: symbol_table is NULL\n");
+	if (result2 && options->write_binary_object) {
+		buffer = format_obb(code_img, data_img, icf, dcf, externals, entries, &length);
+		result2 = write_formatted_file(filename, ".obb", buffer, length);
 	}
 
+	return result2;
+}
 
 
-        printf("Inside write_output_files , p2\n");
-	bool result, result2;
-	table externals = filter_table_by_type(symbol_table, EXTERNAL_REFERENCE);
-        printf("Inside write_output_files , p3\n");
-	table entries = filter_table_by_type(symbol_table, ENTRY_SYMBOL);
-        printf("Inside write_output_files , p4\n");
-	/* Write .ob file */
+/**
+ * Adds one section to a framed output: a "name length" line, the bytes, and a newline.
+ * Releases the section buffer.
+ *
+ * @param frame The frame being built; grown as needed.
+ * @param frame_length The number of bytes in the frame; updated.
+ * @param name The section name.
+ * @param section The section contents, from malloc_with_check.
+ * @param length The number of bytes in the section.
+ *
+ * @return The frame, which may have moved.
+ */
 
-	for (i = 0; i < icf - IC_INIT_VALUE; i++) {
-            if (code_img[i] == NULL) {
-                printf("Error: code_img[%d] is NULL\n", i);
-                    
-            }
-	    else{
-                printf("Processing code_img[%d] %d\n", i,code_img[i]);
-	    }
-            printf("BBB");
-	}
-	result = write_ob(code_img, data_img, icf, dcf, filename);
-        printf("Inside write_output_files , p5\n");
-        result2 = result &&
-	         
-	         write_table_to_file(externals, filename, ".ext") &&
-	         write_table_to_file(entries, filename, ".ent");
-
-	free_table(externals);
-	free_table(entries);
-	return result2;
+static char *add_frame_section(char *frame, long *frame_length, char *name, char *section, long length) {
+	int header_length = snprintf(NULL, 0, "%s %ld\n", name, length);
+
+	frame = realloc_with_check(frame, *frame_length + header_length + length + 2);
+	sprintf(frame + *frame_length, "%s %ld\n", name, length);
+	memcpy(frame + *frame_length + header_length, section, length);
+	*frame_length += header_length + length;
+	frame[(*frame_length)++] = '\n';
+	free_with_check(section);
+	return frame;
 }
 
 
 /**
- * Writes the object file (.ob) with the code and data images.
+ * Writes one output raw to the file descriptor chosen for it, if any, and releases the output buffer.
+ *
+ * @param fd The chosen file descriptor, or -1 to drop the output.
+ * @param name The output name, for error messages.
+ * @param buffer The output contents, from malloc_with_check.
+ * @param length The number of bytes in the output.
+ *
+ * @return TRUE if the output was written or dropped, FALSE if writing failed.
+ */
+
+static bool write_output_to_fd(int fd, char *name, char *buffer, long length) {
+	bool result = TRUE;
+
+	if (fd >= 0 && !write_all(fd, buffer, length)) {
+		fprintf(stderr, "Error: can't write the %s output to file descriptor %d.\n", name, fd);
+		result = FALSE;
+	}
+	free_with_check(buffer);
+	return result;
+}
+
+
+/**
+ * Formats the outputs of an assembled source as one frame:
+ *
+ *   ASM-FRAME 1
+ *   diag <length>          then the diagnostics and a newline, when there are any
+ *   ob <length>            then the .ob contents and a newline; likewise for ent, ext, rel and (with --obb) obb
+ *   end ok                 or "end failed", with no output sections before it, when assembly failed
  *
  * @param code_img Array of pointers to machine_word structures representing code image.
  * @param data_img Array of long integers representing data image.
  * @param icf Instruction counter final value.
  * @param dcf Data counter final value.
- * @param filename Base name for the object file.
+ * @param symbol_table Table of symbols to be written as the ext and ent outputs.
+ * @param succeeded Whether the source assembled; if not, only diagnostics and the end line are formatted.
+ * @param options The options; write_binary_object adds the obb section.
+ * @param diagnostics The diagnostics text, or NULL.
+ * @param diagnostics_length The number of bytes of diagnostics.
+ * @param length Receives the number of bytes formatted.
+ *
+ * @return The frame, from malloc_with_check.
+ */
+
+char *format_output_frame(machine_word **code_img, long *data_img, long icf, long dcf, table symbol_table,
+                          bool succeeded, assembler_options *options, char *diagnostics, long diagnostics_length,
+                          long *length) {
+	table externals, entries;
+	char *frame, *buffer, *end_line = succeeded ? "end ok\n" : "end failed\n";
+	long frame_length = sizeof(FRAME_HEADER) - 1, buffer_length;
+
+	frame = malloc_with_check(sizeof(FRAME_HEADER));
+	memcpy(frame, FRAME_HEADER, frame_length);
+
+	if (diagnostics != NULL && diagnostics_length > 0) {
+		buffer = malloc_with_check(diagnostics_length);
+		memcpy(buffer, diagnostics, diagnostics_length);
+		frame = add_frame_section(frame, &frame_length, "diag", buffer, diagnostics_length);
+	}
+
+	if (succeeded) {
+		externals = filter_table_by_type(symbol_table, EXTERNAL_REFERENCE);
+		entries = filter_table_by_type(symbol_table, ENTRY_SYMBOL);
+
+		buffer = format_ob(code_img, data_img, icf, dcf, &buffer_length);
+		frame = add_frame_section(frame, &frame_length, "ob", buffer, buffer_length);
+		buffer = format_table(entries, &buffer_length);
+		frame = add_frame_section(frame, &frame_length, "ent", buffer, buffer_length);
+		buffer = format_table(externals, &buffer_length);
+		frame = add_frame_section(frame, &frame_length, "ext", buffer, buffer_length);
+		buffer = format_relocations(code_img, icf, &buffer_length);
+		frame = add_frame_section(frame, &frame_length, "rel", buffer, buffer_length);
+		if (options->write_binary_object) {
+			buffer = format_obb(code_img, data_img, icf, dcf, externals, entries, &buffer_length);
+			frame = add_frame_section(frame, &frame_length, "obb", buffer, buffer_length);
+		}
+	}
+
+	frame = realloc_with_check(frame, frame_length + strlen(end_line));
+	memcpy(frame + frame_length, end_line, strlen(end_line));
+	*length = frame_length + strlen(end_line);
+	return frame;
+}
+
+
+/**
+ * Writes the outputs of an assembled source without touching the filesystem. When the options choose file
+ * descriptors for the outputs, each chosen output is written there as-is (outputs without a descriptor are
+ * dropped). Otherwise a single frame (see format_output_frame) is written to stdout.
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param data_img Array of long integers representing data image.
+ * @param icf Instruction counter final value.
+ * @param dcf Data counter final value.
+ * @param symbol_table Table of symbols to be written as the ext and ent outputs.
+ * @param succeeded Whether the source assembled; if not, only the frame's end line is written.
+ * @param options The command line options.
+ *
+ * @return TRUE if the source assembled and all outputs are written successfully, FALSE otherwise.
+ */
+
+int write_output_stream(machine_word **code_img, long *data_img, long icf, long dcf, table symbol_table,
+                        bool succeeded, assembler_options *options) {
+	bool result = TRUE;
+	table externals, entries;
+	char *buffer;
+	long length;
+
+	TRACE(TRACE_OUTPUT, "streaming output: ICF: %ld, DCF: %ld", icf, dcf);
+	if (options->object_fd < 0 && options->entries_fd < 0 && options->externals_fd < 0 &&
+	    options->relocations_fd < 0 && options->binary_object_fd < 0) {
+		buffer = format_output_frame(code_img, data_img, icf, dcf, symbol_table, succeeded, options, NULL, 0,
+		                             &length);
+		if (!write_all(STDOUT_FILENO, buffer, length)) {
+			fprintf(stderr, "Error: can't write the output frame to stdout.\n");
+			result = FALSE;
+		}
+		free_with_check(buffer);
+		return result && succeeded;
+	}
+
+	if (!succeeded) return FALSE;
+
+	externals = filter_table_by_type(symbol_table, EXTERNAL_REFERENCE);
+	entries = filter_table_by_type(symbol_table, ENTRY_SYMBOL);
+
+	buffer = format_ob(code_img, data_img, icf, dcf, &length);
+	result &= write_output_to_fd(options->object_fd, "ob", buffer, length);
+	buffer = format_table(entries, &length);
+	result &= write_output_to_fd(options->entries_fd, "ent", buffer, length);
+	buffer = format_table(externals, &length);
+	result &= write_output_to_fd(options->externals_fd, "ext", buffer, length);
+	buffer = format_relocations(code_img, icf, &length);
+	result &= write_output_to_fd(options->relocations_fd, "rel", buffer, length);
+	if (options->write_binary_object) {
+		buffer = format_obb(code_img, data_img, icf, dcf, externals, entries, &length);
+		result &= write_output_to_fd(options->binary_object_fd, "obb", buffer, length);
+	}
+	return result;
+}
+
+
+/**
+ * Fills the tables the output formatting uses. They are filled on first use anyway; calling this first lets
+ * several threads format output without racing to fill them.
+ */
+
+void prepare_output_tables(void) {
+	init_octal_digits();
+}
+
+
+/**
+ * Fills the lookup table from a 15-bit value to its five octal digits, once.
+ */
+
+static void init_octal_digits(void) {
+	long value;
+	int digit;
+
+	if (octal_digits_ready) return;
+
+	for (value = 0; value <= 0x7FFF; value++) {
+		for (digit = 0; digit < 5; digit++) {
+			octal_digits[value][4 - digit] = (char) ('0' + ((value >> (3 * digit)) & 7));
+		}
+	}
+	octal_digits_ready = TRUE;
+}
+
+
+/**
+ * Writes a word as six octal digits, like printf's "%.6lo" does for values of up to 18 bits.
+ *
+ * @param dest Where to write the six digits (no terminating NUL is written).
+ * @param value The value to format.
+ */
+
+static void format_octal_word(char *dest, long value) {
+	dest[0] = (char) ('0' + ((value >> 15) & 7));
+	memcpy(dest + 1, octal_digits[value & 0x7FFF], 5);
+}
+
+
+/**
+ * Writes a number as seven decimal digits, like printf's "%.7ld" does for values below 10^7.
+ *
+ * @param dest Where to write the seven digits (no terminating NUL is written).
+ * @param value The value to format.
+ */
+
+static void format_decimal_address(char *dest, long value) {
+	int i;
+
+	for (i = ADDRESS_DIGITS - 1; i >= 0; i--) {
+		dest[i] = (char) ('0' + value % 10);
+		value /= 10;
+	}
+}
+
+
+/**
+ * Advances a decimal address written by format_decimal_address to the next address, in place.
+ *
+ * @param address The seven address digits to increment.
+ */
+
+static void increment_decimal_address(char *address) {
+	int i;
+
+	for (i = ADDRESS_DIGITS - 1; i >= 0 && address[i] == '9'; i--) {
+		address[i] = '0';
+	}
+	if (i >= 0) address[i]++;
+}
+
+
+/**
+ * Writes a whole buffer to a file descriptor, normally with a single write().
+ *
+ * @param fd The file descriptor to write to.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
+ *
+ * @return TRUE if everything was written, FALSE otherwise.
+ */
+
+bool write_all(int fd, char *buffer, long length) {
+	long written = 0, count;
+
+	while (written < length) {
+		count = write(fd, buffer + written, length - written);
+		if (count < 0) return FALSE;
+		written += count;
+	}
+	return TRUE;
+}
+
+
+/**
+ * Creates (or truncates) a file and writes a whole buffer into it, normally with a single write().
+ *
+ * @param filename The name of the file to write.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
  *
  * @return TRUE if the file is written successfully, FALSE otherwise.
  */
 
-static bool write_ob(machine_word **code_img, long *data_img, long icf, long dcf, char *filename) {
-	printf("write_ob start");
-        int i;
-	long val;
-	FILE *file_desc;
-        code_word *codeword;
+static bool write_buffer_to_file(char *filename, char *buffer, long length) {
+	int fd;
 
-	char *output_filename = strallocat(filename, ".ob");
+	cache_unshare_output(filename);
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
 
-	file_desc = fopen(output_filename, "w");
-	if (file_desc == NULL) {
-		printf("Can't create or rewrite to file %s.", output_filename);
-		free(output_filename);
+	if (fd < 0) {
+		printf("Can't create or rewrite to file %s.", filename);
 		return FALSE;
 	}
-	free(output_filename);
 
+	if (!write_all(fd, buffer, length)) {
+		printf("Can't write to file %s.", filename);
+		close(fd);
+		return FALSE;
+	}
 
-	fprintf(file_desc, "%ld %ld", icf - IC_INIT_VALUE, dcf);
+	close(fd);
+	return TRUE;
+}
+
+
+/**
+ * Computes the value written for a single code image word: the encoded first word of an instruction,
+ * or an extra operand word with its ARE bits. A first word holds the opcode in bits 10-13, the addressing type of
+ * the first operand in bits 8-9 and of the second in bits 6-7, the funct in bits 3-5 and the ARE bits; the
+ * register numbers are only in the operands' extra words, so that no field overlaps another.
+ *
+ * @param word The code image word.
+ *
+ * @return The word value (up to 18 bits, of which the machine keeps the lower 15).
+ */
+
+long get_word_value(machine_word *word) {
+	code_word *codeword = word->word.code;
+
+	if (word->length > 0) {
+		TRACE(TRACE_OUTPUT, "Opcode: %d, Funct: %d, Src Addressing: %d, Dest Addressing: %d", codeword->opcode, codeword->funct, codeword->src_addressing, codeword->dest_addressing);
+		return (codeword->opcode << 10) |
+		       (codeword->src_addressing << 8) |
+		       (codeword->dest_addressing << 6) |
+		       ((codeword->funct & 7) << 3) |
+		       (codeword->ARE);
+	}
+	return (KEEP_ONLY_15_LSB(word->word.data->data) << 3) | (word->word.data->ARE);
+}
+
+
+/**
+ * Tells whether a code image word holds the address of an internal symbol (ARE_RELOCATABLE), which a linker
+ * moves with the module and which is therefore listed in the relocation records.
+ *
+ * @param word The code image word, or NULL.
+ *
+ * @return TRUE if the word is relocatable.
+ */
+
+bool is_relocatable_word(machine_word *word) {
+	return word != NULL && word->length == 0 && word->word.data->ARE == ARE_RELOCATABLE;
+}
+
+
+/**
+ * Formats the object file (.ob) with the code and data images.
+ * The whole file is formatted into one buffer, sized exactly from icf and dcf, to be written at once.
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param data_img Array of long integers representing data image.
+ * @param icf Instruction counter final value.
+ * @param dcf Data counter final value.
+ * @param length Receives the number of bytes formatted.
+ *
+ * @return The formatted file, from malloc_with_check.
+ */
+
+static char *format_ob(machine_word **code_img, long *data_img, long icf, long dcf, long *length) {
+        int i, header_length;
+	long val = 0;
+	char *buffer, *curr, address[ADDRESS_DIGITS];
+
+	init_octal_digits();
+
+	/* The header line, then one "\naddress value" record per word */
+	header_length = snprintf(NULL, 0, "%ld %ld", icf - IC_INIT_VALUE, dcf);
+	buffer = (char *) malloc_with_check(header_length + 1 + (icf - IC_INIT_VALUE + dcf) * OB_RECORD_LENGTH);
+	sprintf(buffer, "%ld %ld", icf - IC_INIT_VALUE, dcf);
+	curr = buffer + header_length;
+	format_decimal_address(address, IC_INIT_VALUE);
 
 	for (i = 0; i < icf - IC_INIT_VALUE; i++) {
 		
                 if (code_img[i] != NULL){
-			codeword = code_img[i]->word.code;
-			printf("Opcode: %d, Funct: %d, Src Addressing: %d, Dest Addressing: %d, lien %d\n", codeword->opcode, codeword->funct, codeword->src_addressing, codeword->dest_addressing, i);
-			
-		        if (code_img[i]->length > 0) {
-				 val = (codeword->opcode << 10) |
-		          		(codeword->src_addressing << 8) |
-		          		(codeword->src_register << 6) |
-		         		(codeword->dest_addressing << 3) |
-		         		(codeword->dest_register << 0) |
-					(codeword->funct << 3) |
-		         		(codeword->ARE);
-			} else {	
-			
-				 val = (KEEP_ONLY_15_LSB(code_img[i]->word.data->data) << 3) | (code_img[i]->word.data->ARE);
-				printf("Writing to file: Address: %07d, Value: %06lo\n", i + 100, val);
-			}
+			val = get_word_value(code_img[i]);
                 }
 
-		fprintf(file_desc, "\n%.7d %.6lo", i + 100, val);
+		*curr++ = '\n';
+		memcpy(curr, address, ADDRESS_DIGITS);
+		curr[ADDRESS_DIGITS] = ' ';
+		format_octal_word(curr + ADDRESS_DIGITS + 1, val);
+		curr += OB_RECORD_LENGTH - 1;
+		increment_decimal_address(address);
 	}
 
 
@@ -148,44 +523,126 @@ static bool write_ob(machine_word **code_img, long *data_img, long icf, long dcf
 
 		val = KEEP_ONLY_15_LSB(data_img[i]);
 
-		fprintf(file_desc, "\n%.7ld %.6lo", icf + i, val);
+		*curr++ = '\n';
+		memcpy(curr, address, ADDRESS_DIGITS);
+		curr[ADDRESS_DIGITS] = ' ';
+		format_octal_word(curr + ADDRESS_DIGITS + 1, val);
+		curr += OB_RECORD_LENGTH - 1;
+		increment_decimal_address(address);
 	}
 
-	/* Close the file */
-	fclose(file_desc);
-	return TRUE;
+	*length = curr - buffer;
+	return buffer;
 }
 
 
 /**
- * Writes a table of symbols to a file with a specified extension.
+ * Formats a table of symbols as written to the .ext and .ent files.
+ * Every line is "name address"; the lines are formatted into one buffer to be written at once.
  *
- * @param tab Table of symbols to be written.
- * @param filename Base name for the file.
- * @param file_extension Extension for the file (e.g., ".ext" or ".ent").
+ * @param tab Table of symbols to be formatted.
+ * @param length Receives the number of bytes formatted.
  *
- * @return TRUE if the file is written successfully, FALSE otherwise.
+ * @return The formatted file, from malloc_with_check.
  */
 
-static bool write_table_to_file(table tab, char *filename, char *file_extension) {
-	FILE *file_desc;
-	char *full_filename = strallocat(filename, file_extension);
-	file_desc = fopen(full_filename, "w");
-	free(full_filename);
+static char *format_table(table tab, long *length) {
+	long key_length, size = 0;
+	table curr_entry;
+	char *buffer, *curr;
 
-	if (file_desc == NULL) {
-		printf("Can't create or rewrite to file %s.", full_filename);
-		return FALSE;
+	for (curr_entry = tab; curr_entry != NULL; curr_entry = curr_entry->next) {
+		size += strlen(curr_entry->key) + 1 + ADDRESS_DIGITS + 1;
+	}
+	buffer = (char *) malloc_with_check(size + 1);
+
+	for (curr = buffer, curr_entry = tab; curr_entry != NULL; curr_entry = curr_entry->next) {
+		if (curr_entry != tab) *curr++ = '\n';
+		key_length = strlen(curr_entry->key);
+		memcpy(curr, curr_entry->key, key_length);
+		curr[key_length] = ' ';
+		format_decimal_address(curr + key_length + 1, curr_entry->value);
+		curr += key_length + 1 + ADDRESS_DIGITS;
 	}
 
-	if (tab == NULL) return TRUE;
+	*length = curr - buffer;
+	return buffer;
+}
 
 
-	fprintf(file_desc, "%s %.7ld", tab->key, tab->value);
-	while ((tab = tab->next) != NULL) {
-		fprintf(file_desc, "\n%s %.7ld", tab->key, tab->value);
+/**
+ * Formats the relocation records (.rel): the address of every relocatable word, one per line in the .ext
+ * format's seven digits, in address order. A linker patches exactly these words when it moves the module.
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param icf Instruction counter final value.
+ * @param length Receives the number of bytes formatted.
+ *
+ * @return The formatted file, from malloc_with_check.
+ */
+
+static char *format_relocations(machine_word **code_img, long icf, long *length) {
+	long i, count = 0;
+	char *buffer, *curr;
+
+	for (i = 0; i < icf - IC_INIT_VALUE; i++) {
+		if (is_relocatable_word(code_img[i])) count++;
 	}
-	fclose(file_desc);
-	return TRUE;
+	buffer = (char *) malloc_with_check(count * (ADDRESS_DIGITS + 1) + 1);
+
+	for (curr = buffer, i = 0; i < icf - IC_INIT_VALUE; i++) {
+		if (!is_relocatable_word(code_img[i])) continue;
+		if (curr != buffer) *curr++ = '\n';
+		format_decimal_address(curr, IC_INIT_VALUE + i);
+		curr += ADDRESS_DIGITS;
+	}
+
+	*length = curr - buffer;
+	return buffer;
 }
 
+
+/**
+ * Formats the binary object file (.obb), laid out as described in objfile.h, to be written at once.
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param data_img Array of long integers representing data image.
+ * @param icf Instruction counter final value.
+ * @param dcf Data counter final value.
+ * @param externals The external references, as written to the .ext file.
+ * @param entries The entry symbols, as written to the .ent file.
+ * @param length Receives the number of bytes formatted.
+ *
+ * @return The formatted file, from malloc_with_check.
+ */
+
+static char *format_obb(machine_word **code_img, long *data_img, long icf, long dcf, table externals, table entries,
+                        long *length) {
+	long i, code_length = icf - IC_INIT_VALUE, val = 0;
+	long entry_count = 0, extern_count = 0, relocation_count = 0, strings_size = 0;
+	obb_writer writer;
+	table curr_entry;
+
+	for (curr_entry = entries; curr_entry != NULL; curr_entry = curr_entry->next, entry_count++)
+		strings_size += strlen(curr_entry->key) + 1;
+	for (curr_entry = externals; curr_entry != NULL; curr_entry = curr_entry->next, extern_count++)
+		strings_size += strlen(curr_entry->key) + 1;
+	for (i = 0; i < code_length; i++) {
+		if (is_relocatable_word(code_img[i])) relocation_count++;
+	}
+
+	obb_format_begin(&writer, code_length, dcf, entry_count, extern_count, relocation_count, strings_size);
+	for (i = 0; i < code_length; i++) {
+		if (code_img[i] != NULL) val = get_word_value(code_img[i]);
+		obb_put_word(&writer, i, val);
+		if (is_relocatable_word(code_img[i])) obb_put_relocation(&writer, IC_INIT_VALUE + i);
+	}
+	for (i = 0; i < dcf; i++) obb_put_word(&writer, code_length + i, data_img[i]);
+	for (curr_entry = entries; curr_entry != NULL; curr_entry = curr_entry->next)
+		obb_put_entry(&writer, curr_entry->key, curr_entry->value);
+	for (curr_entry = externals; curr_entry != NULL; curr_entry = curr_entry->next)
+		obb_put_extern(&writer, curr_entry->key, curr_entry->value);
+
+	*length = writer.length;
+	return (char *) writer.buffer;
+}
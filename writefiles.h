@@ -7,7 +7,8 @@
 
 
 /**
- * Writes output files including the object file (.ob), external symbols (.ext), and entry symbols (.ent).
+ * Writes output files including the object file (.ob), external symbols (.ext), entry symbols (.ent) and
+ * relocations (.rel), and the binary object file (.obb) when the options ask for it.
  *
  * @param code_img Array of pointers to machine_word structures representing code image.
  * @param data_img Array of long integers representing data image.
@@ -15,12 +16,105 @@
  * @param dcf Data counter final value.
  * @param filename Base name for output files.
  * @param symbol_table Table of symbols to be written to .ext and .ent files.
+ * @param options The command line options.
  *
  * @return TRUE if all files are written successfully, FALSE otherwise.
  */
 
 int write_output_files(machine_word **code_img, long *data_img, long icf, long dcf, char *filename,
-                       table symbol_table);
+                       table symbol_table, assembler_options *options);
+
+
+/**
+ * Writes the outputs of an assembled source without touching the filesystem. When the options choose file
+ * descriptors for the outputs, each chosen output is written there as-is (outputs without a descriptor are
+ * dropped). Otherwise a single frame (see format_output_frame) is written to stdout.
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param data_img Array of long integers representing data image.
+ * @param icf Instruction counter final value.
+ * @param dcf Data counter final value.
+ * @param symbol_table Table of symbols to be written as the ext and ent outputs.
+ * @param succeeded Whether the source assembled; if not, only the frame's end line is written.
+ * @param options The command line options.
+ *
+ * @return TRUE if the source assembled and all outputs are written successfully, FALSE otherwise.
+ */
+
+int write_output_stream(machine_word **code_img, long *data_img, long icf, long dcf, table symbol_table,
+                        bool succeeded, assembler_options *options);
+
+
+/**
+ * Formats the outputs of an assembled source as one frame:
+ *
+ *   ASM-FRAME 1
+ *   diag <length>          then the diagnostics and a newline, when there are any
+ *   ob <length>            then the .ob contents and a newline; likewise for ent, ext and (with --obb) obb
+ *   end ok                 or "end failed", with no output sections before it, when assembly failed
+ *
+ * @param code_img Array of pointers to machine_word structures representing code image.
+ * @param data_img Array of long integers representing data image.
+ * @param icf Instruction counter final value.
+ * @param dcf Data counter final value.
+ * @param symbol_table Table of symbols to be written as the ext and ent outputs.
+ * @param succeeded Whether the source assembled; if not, only diagnostics and the end line are formatted.
+ * @param options The options; write_binary_object adds the obb section.
+ * @param diagnostics The diagnostics text, or NULL.
+ * @param diagnostics_length The number of bytes of diagnostics.
+ * @param length Receives the number of bytes formatted.
+ *
+ * @return The frame, from malloc_with_check.
+ */
+
+char *format_output_frame(machine_word **code_img, long *data_img, long icf, long dcf, table symbol_table,
+                          bool succeeded, assembler_options *options, char *diagnostics, long diagnostics_length,
+                          long *length);
+
+
+/**
+ * Fills the tables the output formatting uses. They are filled on first use anyway; calling this first lets
+ * several threads format output without racing to fill them.
+ */
+
+void prepare_output_tables(void);
+
+
+/**
+ * Writes a whole buffer to a file descriptor, normally with a single write().
+ *
+ * @param fd The file descriptor to write to.
+ * @param buffer The bytes to write.
+ * @param length The number of bytes to write.
+ *
+ * @return TRUE if everything was written, FALSE otherwise.
+ */
+
+bool write_all(int fd, char *buffer, long length);
+
+
+/**
+ * Computes the value written for a single code image word: the encoded first word of an instruction,
+ * or an extra operand word with its ARE bits.
+ *
+ * @param word The code image word.
+ *
+ * @return The word value (up to 18 bits, of which the machine keeps the lower 15).
+ */
+
+long get_word_value(machine_word *word);
+
+
+/**
+ * Tells whether a code image word holds the address of an internal symbol (ARE_RELOCATABLE), which a linker
+ * moves with the module and which is therefore listed in the relocation records.
+ *
+ * @param word The code image word, or NULL.
+ *
+ * @return TRUE if the word is relocatable.
+ */
+
+bool is_relocatable_word(machine_word *word);
 
 #endif
 